@@ -0,0 +1,187 @@
+/*
+On-device broadcast manager: cyclic transmission and content filtering of CAN frames,
+modeled after the Linux SocketCAN BCM (TX_SETUP and RX_SETUP with throttling) as exposed by socketcand
+*/
+
+#include "bcm.h"
+
+#include <string.h>
+
+static bcm_txJob_t *findTx(bcm_t *bcm, uint32_t identifier, bool extd)
+{
+    for (int i = 0; i < APP_BCM_MAX_TX_JOBS; i++)
+        if (bcm->tx[i].used && bcm->tx[i].frame.identifier == identifier && bcm->tx[i].frame.extd == extd)
+            return &bcm->tx[i];
+    return NULL;
+}
+
+static bcm_rxFilter_t *findRx(bcm_t *bcm, uint32_t identifier, bool extd)
+{
+    for (int i = 0; i < APP_BCM_MAX_RX_FILTERS; i++)
+        if (bcm->rx[i].used && bcm->rx[i].identifier == identifier && bcm->rx[i].extd == extd)
+            return &bcm->rx[i];
+    return NULL;
+}
+
+/// @brief Check if a received frame differs from the previous one in the bits selected by the filter
+static bool isChanged(const bcm_rxFilter_t *filter, const twai_message_t *msg)
+{
+    if (filter->maskLen == 0 || !filter->received)
+        return true;
+    if (msg->data_length_code != filter->lastFrame.data_length_code)
+        return true;
+
+    for (int i = 0; i < filter->maskLen; i++)
+        if ((msg->data[i] ^ filter->lastFrame.data[i]) & filter->mask[i])
+            return true;
+    return false;
+}
+
+void bcm_init(bcm_t *bcm, const bcm_callbacks_t *callbacks, void *ctx)
+{
+    bcm->callbacks = callbacks;
+    bcm->ctx = ctx;
+    bcm_clear(bcm);
+}
+
+void bcm_clear(bcm_t *bcm)
+{
+    memset(bcm->tx, 0, sizeof(bcm->tx));
+    memset(bcm->rx, 0, sizeof(bcm->rx));
+}
+
+esp_err_t bcm_addTx(bcm_t *bcm, const twai_message_t *frame, int64_t intervalUs, int64_t nowUs)
+{
+    if (intervalUs <= 0)
+        return ESP_ERR_INVALID_ARG;
+
+    bcm_txJob_t *job = findTx(bcm, frame->identifier, frame->extd);
+    for (int i = 0; job == NULL && i < APP_BCM_MAX_TX_JOBS; i++)
+        if (!bcm->tx[i].used)
+            job = &bcm->tx[i];
+    if (job == NULL)
+        return ESP_ERR_NO_MEM;
+
+    job->used = true;
+    job->frame = *frame;
+    job->intervalUs = intervalUs;
+    job->nextUs = nowUs + intervalUs;
+    return ESP_OK;
+}
+
+esp_err_t bcm_updateTx(bcm_t *bcm, const twai_message_t *frame)
+{
+    bcm_txJob_t *job = findTx(bcm, frame->identifier, frame->extd);
+    if (job == NULL)
+        return ESP_ERR_NOT_FOUND;
+
+    job->frame = *frame;
+    return ESP_OK;
+}
+
+esp_err_t bcm_deleteTx(bcm_t *bcm, uint32_t identifier, bool extd)
+{
+    bcm_txJob_t *job = findTx(bcm, identifier, extd);
+    if (job == NULL)
+        return ESP_ERR_NOT_FOUND;
+
+    job->used = false;
+    return ESP_OK;
+}
+
+esp_err_t bcm_addRx(bcm_t *bcm, uint32_t identifier, bool extd, const uint8_t *mask, uint8_t maskLen, int64_t intervalUs)
+{
+    bcm_rxFilter_t *filter = findRx(bcm, identifier, extd);
+    for (int i = 0; filter == NULL && i < APP_BCM_MAX_RX_FILTERS; i++)
+        if (!bcm->rx[i].used)
+            filter = &bcm->rx[i];
+    if (filter == NULL)
+        return ESP_ERR_NO_MEM;
+
+    memset(filter, 0, sizeof(*filter));
+    filter->used = true;
+    filter->identifier = identifier;
+    filter->extd = extd;
+    filter->maskLen = (mask == NULL) ? 0 : (maskLen > 8 ? 8 : maskLen);
+    if (filter->maskLen > 0)
+        memcpy(filter->mask, mask, filter->maskLen);
+    filter->intervalUs = intervalUs > 0 ? intervalUs : 0;
+    filter->lastReportUs = INT64_MIN / 2; // First frame is never throttled
+    return ESP_OK;
+}
+
+esp_err_t bcm_deleteRx(bcm_t *bcm, uint32_t identifier, bool extd)
+{
+    bcm_rxFilter_t *filter = findRx(bcm, identifier, extd);
+    if (filter == NULL)
+        return ESP_ERR_NOT_FOUND;
+
+    filter->used = false;
+    return ESP_OK;
+}
+
+void bcm_processFrame(bcm_t *bcm, const twai_message_t *msg, int64_t timestampUs)
+{
+    bcm_rxFilter_t *filter = findRx(bcm, msg->identifier, msg->extd);
+    if (filter == NULL)
+        return;
+
+    bool changed = isChanged(filter, msg);
+    filter->received = true;
+    filter->lastFrame = *msg;
+    if (!changed)
+        return;
+
+    if (timestampUs - filter->lastReportUs < filter->intervalUs)
+    {
+        // Report the latest content when the interval expires
+        filter->pending = true;
+        filter->pendingUs = timestampUs;
+        return;
+    }
+
+    filter->pending = false;
+    filter->lastReportUs = timestampUs;
+    bcm->callbacks->report(bcm->ctx, msg, timestampUs);
+}
+
+int64_t bcm_poll(bcm_t *bcm, int64_t nowUs)
+{
+    int64_t next = INT64_MAX;
+
+    for (int i = 0; i < APP_BCM_MAX_TX_JOBS; i++)
+    {
+        bcm_txJob_t *job = &bcm->tx[i];
+        if (!job->used)
+            continue;
+
+        if (job->nextUs <= nowUs)
+        {
+            bcm->callbacks->transmit(bcm->ctx, &job->frame);
+            job->nextUs += job->intervalUs;
+            if (job->nextUs <= nowUs)
+                job->nextUs = nowUs + job->intervalUs; // Late, skip missed transmissions instead of bursting
+        }
+        if (job->nextUs < next)
+            next = job->nextUs;
+    }
+
+    for (int i = 0; i < APP_BCM_MAX_RX_FILTERS; i++)
+    {
+        bcm_rxFilter_t *filter = &bcm->rx[i];
+        if (!filter->used || !filter->pending)
+            continue;
+
+        int64_t dueUs = filter->lastReportUs + filter->intervalUs;
+        if (dueUs <= nowUs)
+        {
+            filter->pending = false;
+            filter->lastReportUs = nowUs;
+            bcm->callbacks->report(bcm->ctx, &filter->lastFrame, filter->pendingUs);
+        }
+        else if (dueUs < next)
+            next = dueUs;
+    }
+
+    return next;
+}
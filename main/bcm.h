@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "hal/twai_types.h"
+#include "config.h"
+
+/// @brief Actions requested by the broadcast manager, implemented by its owner
+typedef struct
+{
+    esp_err_t (*transmit)(void *ctx, twai_message_t *msg);                     // Send a frame on the CAN bus
+    void (*report)(void *ctx, const twai_message_t *msg, int64_t timestampUs); // Forward a received frame to the client
+} bcm_callbacks_t;
+
+/// @brief Cyclic transmission job
+typedef struct
+{
+    bool used;
+    twai_message_t frame;
+    int64_t intervalUs;
+    int64_t nextUs; // Time of the next transmission
+} bcm_txJob_t;
+
+/// @brief Receive filter, reports frames of one identifier when their (masked) content changes
+typedef struct
+{
+    bool used;
+    uint32_t identifier;
+    bool extd;
+    uint8_t mask[8];
+    uint8_t maskLen;          // 0: every frame is reported (subscription)
+    int64_t intervalUs;       // Minimum time between reports (throttling), 0 to disable
+    int64_t lastReportUs;
+    bool received;            // lastFrame is valid
+    twai_message_t lastFrame; // Last received frame, to detect content changes
+    bool pending;             // A change was throttled and is reported by @ref bcm_poll
+    int64_t pendingUs;        // Reception time of lastFrame while pending
+} bcm_rxFilter_t;
+
+/// @brief Broadcast manager state (SocketCAN BCM equivalent) of a client connection
+typedef struct
+{
+    const bcm_callbacks_t *callbacks;
+    void *ctx;
+    bcm_txJob_t tx[APP_BCM_MAX_TX_JOBS];
+    bcm_rxFilter_t rx[APP_BCM_MAX_RX_FILTERS];
+} bcm_t;
+
+/// @brief Initialize broadcast manager state, without jobs or filters
+/// @param ctx Passed to callbacks
+void bcm_init(bcm_t *bcm, const bcm_callbacks_t *callbacks, void *ctx);
+
+/// @brief Remove all jobs and filters
+void bcm_clear(bcm_t *bcm);
+
+/// @brief Add or replace the cyclic transmission of a frame, first sent after one interval
+/// @return ESP_ERR_INVALID_ARG if interval is not positive, ESP_ERR_NO_MEM if no job is free
+esp_err_t bcm_addTx(bcm_t *bcm, const twai_message_t *frame, int64_t intervalUs, int64_t nowUs);
+
+/// @brief Update the content of a cyclically transmitted frame, timing is unchanged
+/// @return ESP_ERR_NOT_FOUND if the frame is not being transmitted
+esp_err_t bcm_updateTx(bcm_t *bcm, const twai_message_t *frame);
+
+/// @brief Stop the cyclic transmission of a frame
+/// @return ESP_ERR_NOT_FOUND if the frame is not being transmitted
+esp_err_t bcm_deleteTx(bcm_t *bcm, uint32_t identifier, bool extd);
+
+/// @brief Add or replace the receive filter of an identifier
+/// @param mask Payload bits compared to detect changes, NULL to report every frame
+/// @param maskLen Mask length (0-8), a change in data length is always reported when not 0
+/// @param intervalUs Minimum time between reports, changes in between are merged
+/// @return ESP_ERR_NO_MEM if no filter is free
+esp_err_t bcm_addRx(bcm_t *bcm, uint32_t identifier, bool extd, const uint8_t *mask, uint8_t maskLen, int64_t intervalUs);
+
+/// @brief Remove the receive filter of an identifier
+/// @return ESP_ERR_NOT_FOUND if there is no filter
+esp_err_t bcm_deleteRx(bcm_t *bcm, uint32_t identifier, bool extd);
+
+/// @brief Check a received CAN frame against receive filters, matching changes are reported immediately or when throttling allows
+void bcm_processFrame(bcm_t *bcm, const twai_message_t *msg, int64_t timestampUs);
+
+/// @brief Send due cyclic frames and report due throttled changes
+/// @return Time of the next deadline, INT64_MAX if there is none
+int64_t bcm_poll(bcm_t *bcm, int64_t nowUs);
@@ -2,6 +2,9 @@
 
 #include "config.h"
 #include "message.h"
+#include "lzss.h"
+#include "rtos.h"
+#include "trace.h"
 
 #include <string.h>
 #include "freertos/FreeRTOS.h"
@@ -13,6 +16,7 @@
 #include "esp_bt_device.h"
 #include "esp_gap_bt_api.h"
 #include "esp_spp_api.h"
+#include "esp_timer.h"
 
 #define TAG "BT"
 
@@ -20,8 +24,16 @@ QueueHandle_t btRxQueue;
 QueueHandle_t btTxQueue;
 
 static uint32_t sppHandle = 0;
-static SemaphoreHandle_t sppWriteLock = NULL;
-static message_t sppMessage; // Current message being written to SPP
+static StaticSemaphore_t sppWriteLockBuffer;
+static SemaphoreHandle_t sppWriteLock = NULL; // Taken while a write is in progress, buffers below are not reused until then
+static uint8_t sppBuf[LZSS_MAX_BLOCK_SIZE];  // Messages gathered by txTask, written as is or compressed in blockBuf
+
+static volatile bool compressionRequested = false; // Set by bt_setCompression, applied by txTask between writes
+static bool compressionEnabled = false;
+static lzss_encoder_t encoder;
+static uint8_t blockBuf[BT_BLOCK_HEADER_LEN + LZSS_MAX_OUTPUT_SIZE(LZSS_MAX_BLOCK_SIZE)];
+static bt_compression_stats_t stats = {0};
+static portMUX_TYPE statsLock = portMUX_INITIALIZER_UNLOCKED;
 
 static char *bda2str(uint8_t *bda, char *str, size_t size)
 {
@@ -68,6 +80,7 @@ static void sppCallback(esp_spp_cb_event_t event, esp_spp_cb_param_t *param)
     case ESP_SPP_CLOSE_EVT:
         ESP_LOGI(TAG, "ESP_SPP_CLOSE_EVT");
         sppHandle = 0;
+        compressionRequested = false; // Next client starts uncompressed
         xSemaphoreGive(sppWriteLock);
         break;
     case ESP_SPP_START_EVT:
@@ -82,22 +95,24 @@ static void sppCallback(esp_spp_cb_event_t event, esp_spp_cb_param_t *param)
             ESP_LOGE(TAG, "ESP_SPP_START_EVT status:%d", param->start.status);
         break;
     case ESP_SPP_DATA_IND_EVT:
-        ESP_LOGI(TAG, "ESP_SPP_DATA_IND_EVT length:%d", param->data_ind.len);
+        TRACE(BT_DATA_IND, param->data_ind.len, 0, 0);
         message_t msg = message_new(param->data_ind.data, param->data_ind.len);
-        if (xQueueSend(btRxQueue, &msg, 0) == errQUEUE_FULL)
-            ESP_LOGE(TAG, "btRxQueue FULL");
+        if (msg.data == NULL || xQueueSend(btRxQueue, &msg, 0) == errQUEUE_FULL)
+        {
+            TRACE(BT_RX_QUEUE_FULL, param->data_ind.len, 0, 0);
+            message_free(&msg);
+        }
         break;
     case ESP_SPP_CONG_EVT:
-        ESP_LOGW(TAG, "ESP_SPP_CONG_EVT status:%d cong:%d", param->cong.status, param->cong.cong);
+        TRACE(BT_CONG, param->cong.status, param->cong.cong, 0);
         if (!param->cong.cong) // Congestion resolved, allow new writes
             xSemaphoreGive(sppWriteLock);
         break;
     case ESP_SPP_WRITE_EVT:
         if (param->write.status != ESP_SPP_SUCCESS || param->write.cong)
-            ESP_LOGW(TAG, "ESP_SPP_WRITE_EVT status:%d cong:%d len:%d", param->write.status, param->write.cong, param->write.len);
+            TRACE(BT_WRITE, param->write.status, param->write.cong, param->write.len);
 
         // TODO maybe it makes sense to resend if the write was not successful
-        message_free(&sppMessage);
 
         // Allow new writes only if there is no congestion (ESP_SPP_CONG_EVT event will arrive otherwise)
         if (!param->write.cong)
@@ -115,9 +130,43 @@ static void sppCallback(esp_spp_cb_event_t event, esp_spp_cb_param_t *param)
     }
 }
 
+/// @brief Wrap buf in a block, compressed if it gets smaller
+/// @return Block length, in blockBuf
+static size_t compressBlock(const uint8_t *buf, size_t len, bool reset)
+{
+    int64_t start = esp_timer_get_time();
+
+    uint8_t flags = reset ? BT_BLOCK_FLAG_RESET : 0;
+    size_t compLen = lzss_compressBlock(&encoder, buf, len, blockBuf + BT_BLOCK_HEADER_LEN);
+    if (compLen >= len)
+    {
+        // Incompressible, history was still updated so the decompressor must feed it too
+        flags |= BT_BLOCK_FLAG_STORED;
+        memcpy(blockBuf + BT_BLOCK_HEADER_LEN, buf, len);
+        compLen = len;
+    }
+
+    blockBuf[0] = BT_BLOCK_MARKER;
+    blockBuf[1] = flags;
+    blockBuf[2] = compLen >> 8;
+    blockBuf[3] = compLen;
+    blockBuf[4] = len >> 8;
+    blockBuf[5] = len;
+
+    int64_t elapsed = esp_timer_get_time() - start;
+    portENTER_CRITICAL(&statsLock);
+    stats.inBytes += len;
+    stats.outBytes += BT_BLOCK_HEADER_LEN + compLen;
+    stats.compressUs += elapsed;
+    portEXIT_CRITICAL(&statsLock);
+
+    return BT_BLOCK_HEADER_LEN + compLen;
+}
+
 static void txTask(void *arg)
 {
     message_t msgRemainder = {0}; // Message received during previous cycle that did not fit in the buffer
+    size_t remainderOffset = 0;   // Bytes of msgRemainder already written, messages larger than sppBuf take several writes
 
     while (1)
     {
@@ -125,23 +174,31 @@ static void txTask(void *arg)
         xSemaphoreTake(sppWriteLock, portMAX_DELAY);
 
         // Read multiple messages from queue and send them at once
-        uint8_t buf[1024];
+        uint8_t *buf = sppBuf;
         uint8_t *pBuf = buf;
         uint8_t received = 0;
 
         if (msgRemainder.data != NULL)
         {
-            memcpy(pBuf, msgRemainder.data, msgRemainder.length);
-            pBuf += msgRemainder.length;
+            size_t chunk = msgRemainder.length - remainderOffset;
+            if (chunk > sizeof(sppBuf))
+                chunk = sizeof(sppBuf);
+            memcpy(pBuf, msgRemainder.data + remainderOffset, chunk);
+            pBuf += chunk;
             received++;
-            message_free(&msgRemainder);
-            msgRemainder.data = NULL;
+            remainderOffset += chunk;
+            if (remainderOffset == msgRemainder.length)
+            {
+                message_free(&msgRemainder);
+                msgRemainder.data = NULL;
+                remainderOffset = 0;
+            }
         }
 
         message_t msg;
-        while (xQueueReceive(btTxQueue, &msg, pdMS_TO_TICKS(10)) == pdTRUE)
+        while (msgRemainder.data == NULL && xQueueReceive(btTxQueue, &msg, pdMS_TO_TICKS(10)) == pdTRUE)
         {
-            uint32_t free = buf + sizeof(buf) - pBuf;
+            uint32_t free = buf + sizeof(sppBuf) - pBuf;
             // ESP_LOGI(TAG, "free:%d", free);
             if (msg.length <= free)
             {
@@ -162,13 +219,27 @@ static void txTask(void *arg)
         {
             size_t len = pBuf - buf;
 
+            // Requested mode is applied on a write boundary, enabling restarts the history on both ends
+            bool reset = false;
+            if (compressionRequested != compressionEnabled)
+            {
+                compressionEnabled = compressionRequested;
+                if (compressionEnabled)
+                {
+                    lzss_init(&encoder);
+                    reset = true;
+                }
+                ESP_LOGI(TAG, "compression %s", compressionEnabled ? "enabled" : "disabled");
+            }
+
             if (sppHandle > 0)
             {
-                sppMessage = message_new(buf, len);
-                // ESP_LOGI(TAG, "write messages:%d bytes:%d", received, sppMessage.length);
-                // ESP_LOG_BUFFER_HEX(TAG, sppMessage.data, sppMessage.length);
-                esp_spp_write(sppHandle, sppMessage.length, sppMessage.data);
-                // sppMessage will be freed and sppWriteLock given in SPP callbacks
+                if (compressionEnabled)
+                    esp_spp_write(sppHandle, compressBlock(buf, len, reset), blockBuf);
+                else
+                    esp_spp_write(sppHandle, len, buf);
+                // ESP_LOGI(TAG, "write messages:%d bytes:%d", received, len);
+                // sppWriteLock will be given in SPP callbacks
             }
             else
             {
@@ -182,6 +253,19 @@ static void txTask(void *arg)
     }
 }
 
+void bt_setCompression(bool enable)
+{
+    compressionRequested = enable;
+}
+
+void bt_getCompressionStats(bt_compression_stats_t *out)
+{
+    portENTER_CRITICAL(&statsLock);
+    *out = stats;
+    portEXIT_CRITICAL(&statsLock);
+    out->enabled = compressionRequested;
+}
+
 void bt_init(void)
 {
     ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_BLE));
@@ -202,13 +286,13 @@ void bt_init(void)
     ESP_ERROR_CHECK(esp_spp_enhanced_init(&spp_cfg));
     ESP_ERROR_CHECK(esp_bt_gap_set_pin(ESP_BT_PIN_TYPE_FIXED, 4, (esp_bt_pin_code_t){'0', '0', '0', '0'}));
 
-    btRxQueue = xQueueCreate(APP_BT_RX_QUEUE_LEN, sizeof(message_t));
-    btTxQueue = xQueueCreate(APP_BT_TX_QUEUE_LEN, sizeof(message_t));
+    btRxQueue = rtos_createQueue(RTOS_QUEUE_BT_RX);
+    btTxQueue = rtos_createQueue(RTOS_QUEUE_BT_TX);
 
-    sppWriteLock = xSemaphoreCreateBinary();
+    sppWriteLock = xSemaphoreCreateBinaryStatic(&sppWriteLockBuffer);
     xSemaphoreGive(sppWriteLock);
 
-    xTaskCreate(txTask, "btTx", 3072, NULL, APP_BT_TX_TASK_PRIO, NULL);
+    rtos_createTask(RTOS_TASK_BT_TX, NULL, txTask, NULL);
 
     ESP_LOGI(TAG, "initialized");
 }
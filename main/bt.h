@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
 
@@ -8,7 +10,29 @@
 extern QueueHandle_t btRxQueue;
 extern QueueHandle_t btTxQueue;
 
+// Compressed stream framing: [marker][flags][compressed length:16][raw length:16][payload], big endian lengths
+#define BT_BLOCK_MARKER 0x1B      // ESC, never sent by the ASCII SLCAN protocol
+#define BT_BLOCK_HEADER_LEN 6
+#define BT_BLOCK_FLAG_RESET 0x01  // First block after enabling compression, decompressor history starts empty
+#define BT_BLOCK_FLAG_STORED 0x02 // Payload is the raw data (not compressible), still part of the history
+
+typedef struct
+{
+    bool enabled;
+    uint64_t inBytes;    // Raw bytes sent in compressed mode
+    uint64_t outBytes;   // Bytes written to SPP in compressed mode, including block headers
+    uint64_t compressUs; // Time spent compressing
+} bt_compression_stats_t;
+
 /**
  * @brief Initialize Bluetooth component
  */
 void bt_init(void);
+
+/// @brief Enable or disable LZSS compression of data sent to the SPP client
+/// @details Applied on the next write, so data already queued may still use the previous mode.
+/// Compression is disabled again when the client disconnects.
+void bt_setCompression(bool enable);
+
+/// @brief Get compression statistics since boot
+void bt_getCompressionStats(bt_compression_stats_t *stats);
@@ -1,19 +1,131 @@
-#include "can.h"
+/*
+CAN connection: backend independent layer (connection state, driver call serialization, bus occupancy counters)
+over the controller backend, the ESP32 TWAI driver or SocketCAN on Linux host builds
+*/
 
-#include "config.h"
+#include "can.h"
 
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "esp_log.h"
-#include "driver/twai.h"
 
 #define TAG "CAN"
 
-static twai_general_config_t *canGeneralConfig;
+// Alerts read by the bus monitor, frame alerts (RX_DATA, TX_SUCCESS, TX_IDLE) would wake it for every frame
+#define CAN_ALERTS (TWAI_ALERT_BELOW_ERR_WARN | TWAI_ALERT_ERR_ACTIVE | TWAI_ALERT_RECOVERY_IN_PROGRESS |   \
+                    TWAI_ALERT_BUS_RECOVERED | TWAI_ALERT_ARB_LOST | TWAI_ALERT_ABOVE_ERR_WARN |           \
+                    TWAI_ALERT_BUS_ERROR | TWAI_ALERT_TX_FAILED | TWAI_ALERT_RX_QUEUE_FULL |               \
+                    TWAI_ALERT_ERR_PASS | TWAI_ALERT_BUS_OFF | TWAI_ALERT_RX_FIFO_OVERRUN)
+
+#define CAN_CRC15_POLY 0x4599
+
+static const can_backend_t *backend = NULL;
+static twai_mode_t canMode;
+static bool configured = false;
 static bool isOpen = false;
 
+// Serializes driver install/uninstall with alert and status reads from other tasks
+static SemaphoreHandle_t driverLock = NULL;
+static StaticSemaphore_t driverLockBuffer;
+
+static can_counters_t counters = {0};
+static portMUX_TYPE countersLock = portMUX_INITIALIZER_UNLOCKED;
+
+/// @brief Append the low count bits of value to a bit array, most significant first
+static inline size_t pushBits(uint8_t *bits, size_t n, uint32_t value, int count)
+{
+    for (int i = count - 1; i >= 0; i--)
+        bits[n++] = (value >> i) & 1;
+    return n;
+}
+
+uint32_t can_frameBits(const twai_message_t *msg)
+{
+    uint8_t bits[128]; // Stuffed part of the longest frame: 39 bits header, 64 data, 15 CRC
+    size_t n = 0;
+    uint8_t dlc = msg->data_length_code;
+    size_t dataLen = (msg->rtr || dlc == 0) ? 0 : (dlc <= 8 ? dlc : 8);
+
+    bits[n++] = 0; // SOF
+    if (!msg->extd)
+    {
+        n = pushBits(bits, n, msg->identifier, 11);
+        bits[n++] = msg->rtr;
+        bits[n++] = 0; // IDE
+        bits[n++] = 0; // r0
+    }
+    else
+    {
+        n = pushBits(bits, n, msg->identifier >> 18, 11);
+        bits[n++] = 1; // SRR
+        bits[n++] = 1; // IDE
+        n = pushBits(bits, n, msg->identifier, 18);
+        bits[n++] = msg->rtr;
+        bits[n++] = 0; // r1
+        bits[n++] = 0; // r0
+    }
+    n = pushBits(bits, n, dlc, 4);
+    for (size_t i = 0; i < dataLen; i++)
+        n = pushBits(bits, n, msg->data[i], 8);
+
+    uint16_t crc = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        bool next = bits[i] ^ ((crc >> 14) & 1);
+        crc = (crc << 1) & 0x7FFF;
+        if (next)
+            crc ^= CAN_CRC15_POLY;
+    }
+    n = pushBits(bits, n, crc, 15);
+
+    // A complementary bit follows every 5 identical bits, and counts towards the next run
+    uint32_t stuffBits = 0;
+    uint8_t last = 2;
+    int run = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        if (bits[i] == last)
+            run++;
+        else
+        {
+            last = bits[i];
+            run = 1;
+        }
+        if (run == 5)
+        {
+            stuffBits++;
+            last = !last;
+            run = 1;
+        }
+    }
+
+    // CRC delimiter, ACK slot and delimiter, EOF and intermission are not stuffed
+    return n + stuffBits + 1 + 2 + 7 + 3;
+}
+
+/// @brief Account a frame on the bus, received or queued for transmission
+static inline void countFrame(const twai_message_t *msg)
+{
+    uint32_t bits = can_frameBits(msg);
+    portENTER_CRITICAL(&countersLock);
+    counters.busBits += bits;
+    counters.frames++;
+    portEXIT_CRITICAL(&countersLock);
+}
+
+esp_err_t can_setBackend(const can_backend_t *value)
+{
+    if (can_isOpen())
+        return ESP_ERR_INVALID_STATE;
+
+    backend = value;
+    ESP_LOGI(TAG, "backend:%s", backend->name);
+    return ESP_OK;
+}
+
 bool can_isOpen(void)
 {
     return isOpen;
@@ -21,28 +133,34 @@ bool can_isOpen(void)
 
 twai_mode_t can_getMode(void)
 {
-    return (canGeneralConfig != NULL) ? canGeneralConfig->mode : -1;
+    return configured ? canMode : (twai_mode_t)-1;
 }
 
 esp_err_t can_open(twai_mode_t mode, twai_timing_config_t *timingConfig)
 {
-    if (can_isOpen())
+    if (can_isOpen() || backend == NULL)
         return ESP_ERR_INVALID_STATE;
 
-    ESP_LOGI(TAG, "opening");
+    if (driverLock == NULL)
+        driverLock = xSemaphoreCreateMutexStatic(&driverLockBuffer);
 
-    twai_general_config_t generalConfig = TWAI_GENERAL_CONFIG_DEFAULT(APP_CAN_TX_GPIO_NUM, APP_CAN_RX_GPIO_NUM, mode);
-    canGeneralConfig = malloc(sizeof(generalConfig));
-    memcpy(canGeneralConfig, &generalConfig, sizeof(generalConfig));
-
-    const twai_filter_config_t filterConfig = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+    ESP_LOGI(TAG, "opening");
 
-    ESP_ERROR_CHECK(twai_driver_install(canGeneralConfig, timingConfig, &filterConfig));
-    ESP_ERROR_CHECK(twai_start());
+    xSemaphoreTake(driverLock, portMAX_DELAY);
+    esp_err_t res = backend->open(mode, timingConfig, CAN_ALERTS);
+    if (res == ESP_OK)
+    {
+        canMode = mode;
+        configured = true;
+        isOpen = true;
+    }
+    xSemaphoreGive(driverLock);
 
-    isOpen = true;
-    ESP_LOGI(TAG, "opened");
-    return ESP_OK;
+    if (res == ESP_OK)
+        ESP_LOGI(TAG, "opened");
+    else
+        ESP_LOGE(TAG, "open returned %s", esp_err_to_name(res));
+    return res;
 }
 
 esp_err_t can_close(void)
@@ -51,33 +169,111 @@ esp_err_t can_close(void)
         return ESP_ERR_INVALID_STATE;
 
     ESP_LOGI(TAG, "closing");
-    isOpen = false;
-    ESP_ERROR_CHECK(twai_stop());
-    ESP_ERROR_CHECK(twai_driver_uninstall());
-    ESP_LOGI(TAG, "closed");
-    return ESP_OK;
+
+    xSemaphoreTake(driverLock, portMAX_DELAY);
+    esp_err_t res = backend->close();
+    if (res == ESP_OK)
+        isOpen = false;
+    xSemaphoreGive(driverLock);
+
+    if (res == ESP_OK)
+        ESP_LOGI(TAG, "closed");
+    else
+        ESP_LOGE(TAG, "close returned %s", esp_err_to_name(res));
+    return res;
 }
 
-esp_err_t can_receive(twai_message_t *msg, TickType_t ticksToWait)
+esp_err_t can_receive(twai_message_t *msgs, size_t maxCount, size_t *count, TickType_t ticksToWait)
 {
+    *count = 0;
     if (!can_isOpen())
         return ESP_ERR_INVALID_STATE;
 
-    esp_err_t ret = twai_receive(msg, ticksToWait);
-    if (ret != ESP_OK)
-        ESP_LOGE(TAG, "can_receive: twai_receive returned %s", esp_err_to_name(ret));
+    esp_err_t ret = backend->receive(msgs, maxCount, count, ticksToWait);
+    if (ret == ESP_OK)
+    {
+        for (size_t i = 0; i < *count; i++)
+            countFrame(&msgs[i]);
+    }
+    else if (ret != ESP_ERR_TIMEOUT)
+        ESP_LOGE(TAG, "can_receive: receive returned %s", esp_err_to_name(ret));
 
     return ret;
 }
 
-esp_err_t can_transmit(twai_message_t *msg, TickType_t ticksToWait)
+esp_err_t can_transmit(const twai_message_t *msg, TickType_t ticksToWait)
 {
     if (!can_isOpen())
         return ESP_ERR_INVALID_STATE;
 
-    esp_err_t ret = twai_transmit(msg, ticksToWait);
-    if (ret != ESP_OK)
-        ESP_LOGE(TAG, "can_transmit: twai_transmit returned %s", esp_err_to_name(ret));
+    esp_err_t ret = backend->transmit(msg, ticksToWait);
+    if (ret == ESP_OK)
+        countFrame(msg);
+    else
+    {
+        ESP_LOGE(TAG, "can_transmit: transmit returned %s", esp_err_to_name(ret));
+        if (ret == ESP_ERR_TIMEOUT)
+        {
+            portENTER_CRITICAL(&countersLock);
+            counters.txQueueFull++;
+            portEXIT_CRITICAL(&countersLock);
+        }
+    }
 
     return ret;
 }
+
+esp_err_t can_getStatusInfo(twai_status_info_t *status)
+{
+    if (!can_isOpen())
+        return ESP_ERR_INVALID_STATE;
+
+    xSemaphoreTake(driverLock, portMAX_DELAY);
+    esp_err_t res = isOpen ? backend->getStatus(status) : ESP_ERR_INVALID_STATE;
+    xSemaphoreGive(driverLock);
+    return res;
+}
+
+esp_err_t can_readAlerts(uint32_t *alerts, TickType_t ticksToWait)
+{
+    if (!can_isOpen())
+        return ESP_ERR_INVALID_STATE;
+
+    xSemaphoreTake(driverLock, portMAX_DELAY);
+    esp_err_t res = isOpen ? backend->readAlerts(alerts, ticksToWait) : ESP_ERR_INVALID_STATE;
+    xSemaphoreGive(driverLock);
+    return res;
+}
+
+esp_err_t can_initiateRecovery(void)
+{
+    if (!can_isOpen())
+        return ESP_ERR_INVALID_STATE;
+
+    xSemaphoreTake(driverLock, portMAX_DELAY);
+    esp_err_t res = isOpen ? backend->initiateRecovery() : ESP_ERR_INVALID_STATE;
+    xSemaphoreGive(driverLock);
+    if (res != ESP_OK)
+        ESP_LOGE(TAG, "initiateRecovery returned %s", esp_err_to_name(res));
+    return res;
+}
+
+esp_err_t can_restart(void)
+{
+    if (!can_isOpen())
+        return ESP_ERR_INVALID_STATE;
+
+    xSemaphoreTake(driverLock, portMAX_DELAY);
+    esp_err_t res = isOpen ? backend->start() : ESP_ERR_INVALID_STATE;
+    xSemaphoreGive(driverLock);
+    if (res != ESP_OK)
+        ESP_LOGE(TAG, "start returned %s", esp_err_to_name(res));
+    return res;
+}
+
+void can_getCounters(can_counters_t *out)
+{
+    portENTER_CRITICAL(&countersLock);
+    *out = counters;
+    portEXIT_CRITICAL(&countersLock);
+}
@@ -1,13 +1,44 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
 #include "hal/twai_types.h"
+#include "driver/twai.h"
+
+/// @brief CAN controller backend, selected with can_setBackend while the connection is closed
+/// @details Calls are serialized by can.c, except receive and transmit which run concurrently with the others
+typedef struct
+{
+    const char *name;
+    /// @brief Start the controller, alerts is the set of TWAI_ALERT_* to report through readAlerts
+    esp_err_t (*open)(twai_mode_t mode, const twai_timing_config_t *timingConfig, uint32_t alerts);
+    esp_err_t (*close)(void);
+    /// @brief Wait up to ticksToWait for the first frame, then take the frames already queued, up to maxCount
+    esp_err_t (*receive)(twai_message_t *msgs, size_t maxCount, size_t *count, TickType_t ticksToWait);
+    esp_err_t (*transmit)(const twai_message_t *msg, TickType_t ticksToWait);
+    esp_err_t (*getStatus)(twai_status_info_t *status);
+    esp_err_t (*readAlerts)(uint32_t *alerts, TickType_t ticksToWait);
+    esp_err_t (*initiateRecovery)(void);
+    esp_err_t (*start)(void);
+} can_backend_t;
+
+extern const can_backend_t can_twaiBackend;      // ESP32 TWAI controller (can_twai.c)
+extern const can_backend_t can_socketcanBackend; // Linux SocketCAN interface, host builds only (can_socketcan.c)
+
+/// @brief Select the SocketCAN network interface (default APP_CAN_SOCKETCAN_IFNAME), before opening
+void can_socketcanSetInterface(const char *name);
+
+/// @brief Select the controller backend
+/// @return ESP_ERR_INVALID_STATE if the connection is open
+esp_err_t can_setBackend(const can_backend_t *backend);
 
 /// @brief Check if CAN connection is open
 bool can_isOpen(void);
 
-/// @brief Get current CAN controller mode
+/// @brief Get current CAN controller mode, (twai_mode_t)-1 when the bus was never configured
 twai_mode_t can_getMode(void);
 
 /// @brief Open CAN connection
@@ -16,8 +47,37 @@ esp_err_t can_open(twai_mode_t mode, twai_timing_config_t *timingConfig);
 /// @brief Close CAN connection
 esp_err_t can_close(void);
 
-/// @brief Read CAN message from RX queue
-esp_err_t can_receive(twai_message_t *msg, TickType_t ticksToWait);
+/// @brief Read CAN messages from RX queue: wait up to ticksToWait for the first one, then take those already received
+/// @param count number of messages stored in msgs, at most maxCount
+esp_err_t can_receive(twai_message_t *msgs, size_t maxCount, size_t *count, TickType_t ticksToWait);
 
 /// @brief Send CAN message
-esp_err_t can_transmit(twai_message_t *msg, TickType_t ticksToWait);
+esp_err_t can_transmit(const twai_message_t *msg, TickType_t ticksToWait);
+
+/// @brief Get CAN controller state, error counters and driver statistics
+esp_err_t can_getStatusInfo(twai_status_info_t *status);
+
+/// @brief Read TWAI alerts (alerts enabled by can_open are the error and bus state alerts)
+/// @details Only one task reads alerts (bus monitor)
+/// @return ESP_ERR_TIMEOUT if no alert was raised within ticksToWait
+esp_err_t can_readAlerts(uint32_t *alerts, TickType_t ticksToWait);
+
+/// @brief Start bus-off recovery (128 occurrences of 11 recessive bits), TWAI_ALERT_BUS_RECOVERED follows
+esp_err_t can_initiateRecovery(void);
+
+/// @brief Start the controller again after bus-off recovery, which leaves it stopped
+esp_err_t can_restart(void);
+
+/// @brief Bus occupancy counters, monotonic since boot (they wrap)
+typedef struct
+{
+    uint32_t busBits;     // Bits of received and transmitted frames, stuff bits and interframe space included
+    uint32_t frames;      // Received and transmitted frames
+    uint32_t txQueueFull; // Transmissions refused because the TX queue stayed full
+} can_counters_t;
+
+void can_getCounters(can_counters_t *counters);
+
+/// @brief Length of a frame on the bus in bits: stuff bits computed from the actual identifier, data and CRC,
+/// plus the 3 bit intermission (error frames and overload frames are not included)
+uint32_t can_frameBits(const twai_message_t *msg);
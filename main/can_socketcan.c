@@ -0,0 +1,313 @@
+/*
+CAN backend on a Linux SocketCAN interface, for host builds: frames are read from e.g. vcan0 fed by canplayer
+or cangen, so that the layers above can.c run off-device at rates well beyond a real bus.
+Controller error frames are translated into TWAI alerts and error counters.
+*/
+
+#define _GNU_SOURCE // recvmmsg
+
+#include "can.h"
+
+#include "config.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/can.h>
+#include <linux/can/error.h>
+#include <linux/can/raw.h>
+#include "esp_log.h"
+
+#define TAG "CAN_SOCKETCAN"
+
+#define CAN_SOCKETCAN_BATCH 64 // Frames read per recvmmsg call
+
+static char ifname[IF_NAMESIZE] = APP_CAN_SOCKETCAN_IFNAME;
+static int sock = -1;
+static twai_mode_t canMode;
+
+// Written by the receiving task (error frames), read by the monitor
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t alertsCond = PTHREAD_COND_INITIALIZER;
+static uint32_t alertsEnabled = 0;
+static uint32_t alerts = 0;
+static twai_status_info_t status = {0};
+
+static int timeoutMs(TickType_t ticks)
+{
+    return ticks == portMAX_DELAY ? -1 : (int)(ticks * portTICK_PERIOD_MS);
+}
+
+static void raiseAlerts(uint32_t raised)
+{
+    pthread_mutex_lock(&lock);
+    alerts |= raised & alertsEnabled;
+    if (alerts != 0)
+        pthread_cond_signal(&alertsCond);
+    pthread_mutex_unlock(&lock);
+}
+
+/// @brief Translate a controller error frame (linux/can/error.h) into TWAI alerts and status
+static void processErrorFrame(const struct can_frame *frame)
+{
+    uint32_t raised = 0;
+    canid_t errorClass = frame->can_id & CAN_ERR_MASK;
+
+    pthread_mutex_lock(&lock);
+    if (errorClass & CAN_ERR_TX_TIMEOUT)
+    {
+        raised |= TWAI_ALERT_TX_FAILED;
+        status.tx_failed_count++;
+    }
+    if (errorClass & CAN_ERR_LOSTARB)
+    {
+        raised |= TWAI_ALERT_ARB_LOST;
+        status.arb_lost_count++;
+    }
+    if (errorClass & CAN_ERR_CRTL)
+    {
+        uint8_t crtl = frame->data[1];
+        if (crtl & (CAN_ERR_CRTL_RX_OVERFLOW | CAN_ERR_CRTL_TX_OVERFLOW))
+        {
+            raised |= TWAI_ALERT_RX_FIFO_OVERRUN;
+            status.rx_overrun_count++;
+        }
+        if (crtl & (CAN_ERR_CRTL_RX_WARNING | CAN_ERR_CRTL_TX_WARNING))
+            raised |= TWAI_ALERT_ABOVE_ERR_WARN;
+        if (crtl & (CAN_ERR_CRTL_RX_PASSIVE | CAN_ERR_CRTL_TX_PASSIVE))
+            raised |= TWAI_ALERT_ERR_PASS;
+        if (crtl & CAN_ERR_CRTL_ACTIVE)
+            raised |= TWAI_ALERT_ERR_ACTIVE | TWAI_ALERT_BELOW_ERR_WARN;
+    }
+    if (errorClass & (CAN_ERR_PROT | CAN_ERR_TRX | CAN_ERR_ACK | CAN_ERR_BUSERROR))
+    {
+        raised |= TWAI_ALERT_BUS_ERROR;
+        status.bus_error_count++;
+    }
+    if (errorClass & CAN_ERR_BUSOFF)
+    {
+        raised |= TWAI_ALERT_BUS_OFF;
+        status.state = TWAI_STATE_BUS_OFF;
+    }
+    if (errorClass & CAN_ERR_RESTARTED)
+    {
+        // Same sequence as TWAI: the controller is stopped after recovery until started again
+        raised |= TWAI_ALERT_BUS_RECOVERED;
+        status.state = TWAI_STATE_STOPPED;
+    }
+    if (errorClass & CAN_ERR_CNT)
+    {
+        status.tx_error_counter = frame->data[6];
+        status.rx_error_counter = frame->data[7];
+    }
+    pthread_mutex_unlock(&lock);
+
+    raiseAlerts(raised);
+}
+
+static esp_err_t socketcanOpen(twai_mode_t mode, const twai_timing_config_t *timingConfig, uint32_t enabled)
+{
+    // The bitrate of a SocketCAN interface is set by the host (ip link set <if> type can bitrate <n>)
+    (void)timingConfig;
+
+    int fd = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+    if (fd < 0)
+    {
+        ESP_LOGE(TAG, "socket failed errno:%d", errno);
+        return ESP_FAIL;
+    }
+
+    struct ifreq ifr = {0};
+    snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
+    if (ioctl(fd, SIOCGIFINDEX, &ifr) < 0)
+    {
+        ESP_LOGE(TAG, "%s: interface not found errno:%d", ifname, errno);
+        close(fd);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    can_err_mask_t errorMask = enabled != 0 ? CAN_ERR_MASK : 0;
+    setsockopt(fd, SOL_CAN_RAW, CAN_RAW_ERR_FILTER, &errorMask, sizeof(errorMask));
+
+    struct sockaddr_can addr = {.can_family = AF_CAN, .can_ifindex = ifr.ifr_ifindex};
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        ESP_LOGE(TAG, "%s: bind failed errno:%d", ifname, errno);
+        close(fd);
+        return ESP_FAIL;
+    }
+
+    pthread_mutex_lock(&lock);
+    memset(&status, 0, sizeof(status));
+    status.state = TWAI_STATE_RUNNING;
+    alertsEnabled = enabled;
+    alerts = 0;
+    pthread_mutex_unlock(&lock);
+
+    canMode = mode;
+    sock = fd;
+    // Bitrate is a property of the interface (ip link set <if> type can bitrate <n>), timingConfig is not used
+    ESP_LOGI(TAG, "%s: opened", ifname);
+    return ESP_OK;
+}
+
+static esp_err_t socketcanClose(void)
+{
+    close(sock);
+    sock = -1;
+
+    pthread_mutex_lock(&lock);
+    status.state = TWAI_STATE_STOPPED;
+    pthread_cond_broadcast(&alertsCond);
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
+
+static esp_err_t socketcanReceive(twai_message_t *msgs, size_t maxCount, size_t *count, TickType_t ticksToWait)
+{
+    static struct can_frame frames[CAN_SOCKETCAN_BATCH];
+    static struct iovec iovs[CAN_SOCKETCAN_BATCH];
+    static struct mmsghdr hdrs[CAN_SOCKETCAN_BATCH];
+
+    struct pollfd pfd = {.fd = sock, .events = POLLIN};
+    int res = poll(&pfd, 1, timeoutMs(ticksToWait));
+    if (res == 0 || (res < 0 && errno == EINTR))
+        return ESP_ERR_TIMEOUT;
+    if (res < 0 || (pfd.revents & (POLLERR | POLLNVAL)))
+        return ESP_FAIL;
+
+    if (maxCount > CAN_SOCKETCAN_BATCH)
+        maxCount = CAN_SOCKETCAN_BATCH;
+    for (size_t i = 0; i < maxCount; i++)
+    {
+        iovs[i] = (struct iovec){.iov_base = &frames[i], .iov_len = sizeof(frames[i])};
+        hdrs[i] = (struct mmsghdr){.msg_hdr = {.msg_iov = &iovs[i], .msg_iovlen = 1}};
+    }
+
+    int received = recvmmsg(sock, hdrs, maxCount, MSG_DONTWAIT, NULL);
+    if (received < 0)
+        return (errno == EAGAIN || errno == EINTR) ? ESP_ERR_TIMEOUT : ESP_FAIL;
+
+    size_t n = 0;
+    for (int i = 0; i < received; i++)
+    {
+        const struct can_frame *frame = &frames[i];
+        if (frame->can_id & CAN_ERR_FLAG)
+        {
+            processErrorFrame(frame);
+            continue;
+        }
+
+        twai_message_t *msg = &msgs[n++];
+        memset(msg, 0, sizeof(*msg));
+        msg->extd = (frame->can_id & CAN_EFF_FLAG) != 0;
+        msg->rtr = (frame->can_id & CAN_RTR_FLAG) != 0;
+        msg->identifier = frame->can_id & (msg->extd ? CAN_EFF_MASK : CAN_SFF_MASK);
+        msg->data_length_code = frame->len;
+        memcpy(msg->data, frame->data, sizeof(msg->data));
+    }
+
+    *count = n;
+    return n > 0 ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+static esp_err_t socketcanTransmit(const twai_message_t *msg, TickType_t ticksToWait)
+{
+    if (canMode == TWAI_MODE_LISTEN_ONLY)
+        return ESP_ERR_NOT_SUPPORTED;
+
+    struct can_frame frame = {0};
+    frame.can_id = msg->identifier | (msg->extd ? CAN_EFF_FLAG : 0) | (msg->rtr ? CAN_RTR_FLAG : 0);
+    frame.len = msg->data_length_code <= 8 ? msg->data_length_code : 8;
+    memcpy(frame.data, msg->data, sizeof(frame.data));
+
+    // The interface queue is full when write fails with ENOBUFS, wait for room like twai_transmit
+    while (write(sock, &frame, sizeof(frame)) != sizeof(frame))
+    {
+        if (errno != ENOBUFS && errno != EAGAIN)
+            return ESP_FAIL;
+
+        struct pollfd pfd = {.fd = sock, .events = POLLOUT};
+        if (poll(&pfd, 1, timeoutMs(ticksToWait)) <= 0)
+            return ESP_ERR_TIMEOUT;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t socketcanGetStatus(twai_status_info_t *out)
+{
+    pthread_mutex_lock(&lock);
+    *out = status;
+    pthread_mutex_unlock(&lock);
+
+    int pending = 0;
+    if (ioctl(sock, FIONREAD, &pending) == 0)
+        out->msgs_to_rx = pending / sizeof(struct can_frame);
+    return ESP_OK;
+}
+
+static esp_err_t socketcanReadAlerts(uint32_t *out, TickType_t ticksToWait)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    uint64_t ns = deadline.tv_nsec + (uint64_t)timeoutMs(ticksToWait) * 1000000;
+    deadline.tv_sec += ns / 1000000000;
+    deadline.tv_nsec = ns % 1000000000;
+
+    pthread_mutex_lock(&lock);
+    int res = 0;
+    while (alerts == 0 && sock >= 0 && res == 0)
+    {
+        if (ticksToWait == portMAX_DELAY)
+            res = pthread_cond_wait(&alertsCond, &lock);
+        else
+            res = pthread_cond_timedwait(&alertsCond, &lock, &deadline);
+    }
+    *out = alerts;
+    alerts = 0;
+    pthread_mutex_unlock(&lock);
+
+    return *out != 0 ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+static esp_err_t socketcanInitiateRecovery(void)
+{
+    // The kernel restarts the controller by itself (ip link set <if> type can restart-ms <n>)
+    pthread_mutex_lock(&lock);
+    if (status.state == TWAI_STATE_BUS_OFF)
+        status.state = TWAI_STATE_RECOVERING;
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
+
+static esp_err_t socketcanStart(void)
+{
+    pthread_mutex_lock(&lock);
+    status.state = TWAI_STATE_RUNNING;
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
+
+void can_socketcanSetInterface(const char *name)
+{
+    snprintf(ifname, sizeof(ifname), "%s", name);
+}
+
+const can_backend_t can_socketcanBackend = {
+    .name = "socketcan",
+    .open = socketcanOpen,
+    .close = socketcanClose,
+    .receive = socketcanReceive,
+    .transmit = socketcanTransmit,
+    .getStatus = socketcanGetStatus,
+    .readAlerts = socketcanReadAlerts,
+    .initiateRecovery = socketcanInitiateRecovery,
+    .start = socketcanStart,
+};
@@ -0,0 +1,74 @@
+/*
+CAN backend on the ESP32 TWAI controller driver
+*/
+
+#include "can.h"
+
+#include "config.h"
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "driver/twai.h"
+
+#define TAG "CAN_TWAI"
+
+static esp_err_t twaiOpen(twai_mode_t mode, const twai_timing_config_t *timingConfig, uint32_t alerts)
+{
+    twai_general_config_t generalConfig = TWAI_GENERAL_CONFIG_DEFAULT(APP_CAN_TX_GPIO_NUM, APP_CAN_RX_GPIO_NUM, mode);
+    generalConfig.alerts_enabled = alerts;
+    const twai_filter_config_t filterConfig = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+
+    esp_err_t res = twai_driver_install(&generalConfig, timingConfig, &filterConfig);
+    if (res != ESP_OK)
+    {
+        ESP_LOGE(TAG, "twai_driver_install returned %s", esp_err_to_name(res));
+        return res;
+    }
+
+    res = twai_start();
+    if (res != ESP_OK)
+    {
+        ESP_LOGE(TAG, "twai_start returned %s", esp_err_to_name(res));
+        twai_driver_uninstall();
+    }
+    return res;
+}
+
+static esp_err_t twaiClose(void)
+{
+    // Stopping fails in bus-off, where the driver can be uninstalled directly
+    esp_err_t res = twai_stop();
+    if (res != ESP_OK)
+        ESP_LOGW(TAG, "twai_stop returned %s", esp_err_to_name(res));
+    return twai_driver_uninstall();
+}
+
+static esp_err_t twaiReceive(twai_message_t *msgs, size_t maxCount, size_t *count, TickType_t ticksToWait)
+{
+    esp_err_t res = twai_receive(&msgs[0], ticksToWait);
+    if (res != ESP_OK)
+        return res;
+
+    size_t n = 1;
+    while (n < maxCount && twai_receive(&msgs[n], 0) == ESP_OK)
+        n++;
+    *count = n;
+    return ESP_OK;
+}
+
+static esp_err_t twaiTransmit(const twai_message_t *msg, TickType_t ticksToWait)
+{
+    return twai_transmit(msg, ticksToWait);
+}
+
+const can_backend_t can_twaiBackend = {
+    .name = "twai",
+    .open = twaiOpen,
+    .close = twaiClose,
+    .receive = twaiReceive,
+    .transmit = twaiTransmit,
+    .getStatus = twai_get_status_info,
+    .readAlerts = twai_read_alerts,
+    .initiateRecovery = twai_initiate_recovery,
+    .start = twai_start,
+};
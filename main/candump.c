@@ -0,0 +1,83 @@
+/*
+Parser of candump log lines, as written by the SD log and the flight recorder, and by candump -l on Linux hosts
+*/
+
+#include "candump.h"
+
+#include <string.h>
+
+static int hexValue(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+/// @brief Parse decimal digits, at most maxDigits
+/// @return Digits parsed, 0 if there are none
+static int parseDecimal(const char **p, int maxDigits, int64_t *out)
+{
+    int n = 0;
+    *out = 0;
+    while (n < maxDigits && **p >= '0' && **p <= '9')
+    {
+        *out = *out * 10 + (**p - '0');
+        (*p)++;
+        n++;
+    }
+    return n;
+}
+
+esp_err_t candump_parseLine(const char *line, candump_frame_t *out)
+{
+    const char *p = line;
+    int64_t sec, usec;
+
+    // Timestamp, microseconds are always 6 digits
+    if (*p++ != '(' || parseDecimal(&p, 18, &sec) == 0 || *p++ != '.' || parseDecimal(&p, 6, &usec) != 6 || *p++ != ')')
+        return ESP_ERR_INVALID_ARG;
+    out->timeUs = sec * 1000000 + usec;
+
+    // Interface name
+    while (*p == ' ')
+        p++;
+    while (*p != ' ' && *p != '\0')
+        p++;
+    while (*p == ' ')
+        p++;
+
+    // Identifier
+    uint32_t id = 0;
+    int digits = 0;
+    for (int v; (v = hexValue(*p)) >= 0 && digits < 8; p++, digits++)
+        id = id << 4 | v;
+    if ((digits != 3 && digits != 8) || *p++ != '#' || id > (digits == 3 ? 0x7FFUL : 0x1FFFFFFFUL))
+        return ESP_ERR_INVALID_ARG;
+
+    memset(&out->msg, 0, sizeof(out->msg));
+    out->msg.identifier = id;
+    out->msg.extd = digits == 8;
+
+    if (*p == 'R')
+    {
+        // Remote frame, with the requested length when given
+        p++;
+        out->msg.rtr = 1;
+        if (*p >= '0' && *p <= '8')
+            out->msg.data_length_code = *p++ - '0';
+    }
+    else
+    {
+        int len = 0;
+        for (int hi, lo; len < 8 && (hi = hexValue(p[0])) >= 0 && (lo = hexValue(p[1])) >= 0; p += 2)
+            out->msg.data[len++] = hi << 4 | lo;
+        out->msg.data_length_code = len;
+    }
+
+    // Trailing data (CAN FD "##", more than 8 bytes) is not a classic CAN frame
+    return *p == '\0' || *p == '\n' || *p == '\r' || *p == ' ' ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "hal/twai_types.h"
+
+/// @brief Frame of a candump log line
+typedef struct
+{
+    int64_t timeUs; // Log timestamp
+    twai_message_t msg;
+} candump_frame_t;
+
+/// @brief Parse a candump -l log line: "(<sec>.<usec>) <interface> <id>#<data>", or "<id>#R[<dlc>]" for remote frames
+/// @details Identifiers of 8 hex digits are extended, like the SD log (sd.c) and recorder dumps write them
+/// @return ESP_ERR_INVALID_ARG if the line is not a classic CAN data or remote frame (comments, CAN FD, error frames)
+esp_err_t candump_parseLine(const char *line, candump_frame_t *out);
@@ -0,0 +1,380 @@
+/*
+Single CAN RX stage: frames are received once, handed to on-device consumers (ISO-TP, socketcand, census, rules,
+flight recorder) and published in a ring read independently by every registered sink (host links, SD log...)
+
+A bus opened at boot also fills a boot buffer, kept until a host attaches: the ring alone would have overwritten the
+first frames long before a host connects.
+*/
+
+#include "capture.h"
+
+#include "config.h"
+#include "can.h"
+#include "isotp.h"
+#include "recorder.h"
+#include "rules.h"
+#include "census.h"
+#include "socketcand.h"
+#include "rtos.h"
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#define TAG "CAPTURE"
+
+_Static_assert((APP_CAPTURE_RING_LEN & (APP_CAPTURE_RING_LEN - 1)) == 0, "APP_CAPTURE_RING_LEN must be a power of 2");
+
+static capture_frame_t ring[APP_CAPTURE_RING_LEN];
+static uint32_t head = 0; // Sequence number of the next published frame
+static portMUX_TYPE ringLock = portMUX_INITIALIZER_UNLOCKED;
+
+static capture_frame_t bootFrames[APP_CAPTURE_BOOT_LEN];
+static uint32_t bootCount = 0;
+static uint32_t bootOverflows = 0;
+static bool bootBuffering = false;
+static int64_t openUs = -1;
+static int64_t firstFrameUs = -1;
+
+static capture_sink_t *sinks[APP_CAPTURE_MAX_SINKS];
+static size_t sinkCount = 0;
+
+static TaskHandle_t _canRxTask = NULL;
+static volatile bool rxEnabled = false; // canRxTask receives frames, parked otherwise
+static StaticSemaphore_t rxParkedBuffer;
+static SemaphoreHandle_t rxParked = NULL; // Given by canRxTask each time it parks
+static twai_timing_config_t timingConfig = {0};
+static uint32_t bitrate = 0;
+static volatile bool detecting = false;
+
+/// @brief Bitrates tried by capture_detectBitrate, most common first (OBD-II HS-CAN, MS-CAN)
+static const uint32_t DETECT_BITRATES[] = {500000, 125000, 250000, 1000000, 100000, 50000, 800000};
+
+static void publish(const twai_message_t *msg, int64_t timestampUs)
+{
+    portENTER_CRITICAL(&ringLock);
+    capture_frame_t *slot = &ring[head & (APP_CAPTURE_RING_LEN - 1)];
+    slot->msg = *msg;
+    slot->timestampUs = timestampUs;
+    head++;
+
+    // Same lock as the ring: capture_attachSink splits frames between the boot buffer and the ring exactly
+    if (bootBuffering)
+    {
+        if (bootCount < APP_CAPTURE_BOOT_LEN)
+            bootFrames[bootCount++] = *slot;
+        else
+            bootOverflows++;
+    }
+    bool first = firstFrameUs < 0;
+    if (first)
+        firstFrameUs = timestampUs;
+    portEXIT_CRITICAL(&ringLock);
+
+    if (first)
+        ESP_LOGI(TAG, "first frame %lld us after boot", timestampUs);
+}
+
+static void notifySinks(void)
+{
+    for (size_t i = 0; i < sinkCount; i++)
+        if (sinks[i]->task != NULL)
+            xTaskNotifyGive(sinks[i]->task);
+}
+
+void capture_processFrames(const twai_message_t *msgs, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        const twai_message_t *msg = &msgs[i];
+        int64_t timeUs = esp_timer_get_time();
+        isotp_processFrame(msg);
+        socketcand_processFrame(msg, timeUs);
+        census_processFrame(msg, timeUs);
+        rules_processFrame(msg, timeUs);
+        recorder_append(msg, timeUs);
+        publish(msg, timeUs);
+    }
+    notifySinks();
+}
+
+/// @brief Receive CAN frames and publish them while the bus is open
+/// @details The task lives for the whole run (static stack): when the bus is closed it parks until capture_open
+static void canRxTask(void *arg)
+{
+    (void)arg;
+
+    static twai_message_t batch[APP_CAPTURE_RX_BATCH];
+
+    while (1)
+    {
+        if (!rxEnabled)
+        {
+            xSemaphoreGive(rxParked);
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        size_t count;
+        if (can_receive(batch, APP_CAPTURE_RX_BATCH, &count, pdMS_TO_TICKS(APP_CAPTURE_RX_WAIT_MS)) == ESP_OK)
+            capture_processFrames(batch, count);
+    }
+}
+
+void capture_init(void)
+{
+    rxParked = xSemaphoreCreateBinaryStatic(&rxParkedBuffer);
+    _canRxTask = rtos_createTask(RTOS_TASK_CAN_RX, NULL, canRxTask, NULL);
+    ESP_LOGI(TAG, "initialized ring:%d frames", APP_CAPTURE_RING_LEN);
+}
+
+esp_err_t capture_setBitrate(uint32_t value)
+{
+    switch (value)
+    {
+    case 50000:
+        timingConfig = (twai_timing_config_t)TWAI_TIMING_CONFIG_50KBITS();
+        break;
+    case 100000:
+        timingConfig = (twai_timing_config_t)TWAI_TIMING_CONFIG_100KBITS();
+        break;
+    case 125000:
+        timingConfig = (twai_timing_config_t)TWAI_TIMING_CONFIG_125KBITS();
+        break;
+    case 250000:
+        timingConfig = (twai_timing_config_t)TWAI_TIMING_CONFIG_250KBITS();
+        break;
+    case 500000:
+        timingConfig = (twai_timing_config_t)TWAI_TIMING_CONFIG_500KBITS();
+        break;
+    case 800000:
+        timingConfig = (twai_timing_config_t)TWAI_TIMING_CONFIG_800KBITS();
+        break;
+    case 1000000:
+        timingConfig = (twai_timing_config_t)TWAI_TIMING_CONFIG_1MBITS();
+        break;
+    default:
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    bitrate = value;
+    return ESP_OK;
+}
+
+uint32_t capture_getBitrate(void)
+{
+    return bitrate;
+}
+
+/// @brief Listen at the current bitrate, reading the driver directly (canRxTask is parked)
+/// @return true when enough valid frames were received
+static bool probeBitrate(void)
+{
+    static twai_message_t batch[APP_CAPTURE_RX_BATCH];
+
+    if (can_open(TWAI_MODE_LISTEN_ONLY, &timingConfig) != ESP_OK)
+        return false;
+
+    twai_status_info_t info;
+    uint32_t baseErrors = can_getStatusInfo(&info) == ESP_OK ? info.bus_error_count : 0;
+    uint32_t frames = 0, errors = 0;
+    int64_t endUs = esp_timer_get_time() + APP_CAPTURE_AUTOBAUD_DWELL_MS * 1000LL;
+    while (frames < APP_CAPTURE_AUTOBAUD_FRAMES && errors < APP_CAPTURE_AUTOBAUD_ERRORS && esp_timer_get_time() < endUs)
+    {
+        size_t count;
+        if (can_receive(batch, APP_CAPTURE_RX_BATCH, &count, 1) == ESP_OK && count > 0)
+        {
+            capture_processFrames(batch, count);
+            frames += count;
+        }
+        if (can_getStatusInfo(&info) == ESP_OK)
+            errors = info.bus_error_count - baseErrors;
+    }
+    can_close();
+
+    ESP_LOGI(TAG, "probed bitrate:%lu frames:%lu errors:%lu", bitrate, frames, errors);
+    return frames >= APP_CAPTURE_AUTOBAUD_FRAMES;
+}
+
+esp_err_t capture_detectBitrate(capture_detection_t *result)
+{
+    if (can_isOpen())
+        return ESP_ERR_INVALID_STATE;
+
+    int64_t startUs = esp_timer_get_time();
+    uint32_t previous = bitrate;
+    result->bitrate = 0;
+    result->candidates = 0;
+
+    detecting = true;
+    for (size_t i = 0; i < sizeof(DETECT_BITRATES) / sizeof(DETECT_BITRATES[0]) && result->bitrate == 0; i++)
+    {
+        result->candidates++;
+        if (capture_setBitrate(DETECT_BITRATES[i]) == ESP_OK && probeBitrate())
+            result->bitrate = DETECT_BITRATES[i];
+    }
+    detecting = false;
+    result->elapsedMs = (esp_timer_get_time() - startUs) / 1000;
+
+    if (result->bitrate == 0)
+    {
+        if (capture_setBitrate(previous) != ESP_OK)
+            bitrate = 0;
+        ESP_LOGW(TAG, "no bitrate detected in %lums", result->elapsedMs);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    ESP_LOGI(TAG, "detected bitrate:%lu in %lums", result->bitrate, result->elapsedMs);
+    return ESP_OK;
+}
+
+bool capture_isDetecting(void)
+{
+    return detecting;
+}
+
+esp_err_t capture_open(twai_mode_t mode)
+{
+    if (bitrate == 0)
+        return ESP_ERR_INVALID_STATE;
+
+    esp_err_t res = can_open(mode, &timingConfig);
+    if (res == ESP_OK)
+    {
+        int64_t nowUs = esp_timer_get_time();
+        portENTER_CRITICAL(&ringLock);
+        if (openUs < 0)
+            openUs = nowUs;
+        portEXIT_CRITICAL(&ringLock);
+
+        // canRxTask is parked (the bus was closed), consume its parked notice so that close waits for the next one
+        xSemaphoreTake(rxParked, 0);
+        rxEnabled = true;
+        if (_canRxTask != NULL)
+            xTaskNotifyGive(_canRxTask);
+    }
+    return res;
+}
+
+esp_err_t capture_close(void)
+{
+    if (!can_isOpen())
+        return ESP_ERR_INVALID_STATE;
+
+    // The driver must not be uninstalled while canRxTask is receiving from it
+    rxEnabled = false;
+    if (_canRxTask != NULL)
+        xSemaphoreTake(rxParked, portMAX_DELAY);
+
+    esp_err_t res = can_close();
+    if (res != ESP_OK)
+    {
+        rxEnabled = true;
+        if (_canRxTask != NULL)
+            xTaskNotifyGive(_canRxTask);
+    }
+    return res;
+}
+
+esp_err_t capture_addSink(capture_sink_t *sink)
+{
+    esp_err_t res = ESP_OK;
+
+    portENTER_CRITICAL(&ringLock);
+    if (sinkCount < APP_CAPTURE_MAX_SINKS)
+    {
+        sink->cursor = head;
+        sink->drops = 0;
+        sinks[sinkCount++] = sink;
+    }
+    else
+        res = ESP_ERR_NO_MEM;
+    portEXIT_CRITICAL(&ringLock);
+
+    if (res == ESP_OK)
+        ESP_LOGI(TAG, "sink added name:%s", sink->name);
+    return res;
+}
+
+void capture_setFilter(capture_sink_t *sink, uint32_t id, uint32_t mask)
+{
+    portENTER_CRITICAL(&ringLock);
+    sink->filterId = id & mask;
+    sink->filterMask = mask;
+    portEXIT_CRITICAL(&ringLock);
+}
+
+bool capture_read(capture_sink_t *sink, capture_frame_t *out)
+{
+    while (1)
+    {
+        portENTER_CRITICAL(&ringLock);
+        uint32_t available = head - sink->cursor;
+        if (available == 0)
+        {
+            portEXIT_CRITICAL(&ringLock);
+            return false;
+        }
+        if (available > APP_CAPTURE_RING_LEN)
+        {
+            // Overwritten by the writer, skip to the oldest frame still in the ring
+            sink->drops += available - APP_CAPTURE_RING_LEN;
+            sink->cursor = head - APP_CAPTURE_RING_LEN;
+        }
+        *out = ring[sink->cursor & (APP_CAPTURE_RING_LEN - 1)];
+        sink->cursor++;
+        bool accepted = (out->msg.identifier & sink->filterMask) == sink->filterId;
+        portEXIT_CRITICAL(&ringLock);
+
+        if (accepted)
+            return true;
+    }
+}
+
+void capture_startBootBuffer(void)
+{
+    portENTER_CRITICAL(&ringLock);
+    bootBuffering = true;
+    portEXIT_CRITICAL(&ringLock);
+}
+
+void capture_attachSink(capture_sink_t *sink)
+{
+    portENTER_CRITICAL(&ringLock);
+    bootBuffering = false;
+    sink->cursor = head;
+    portEXIT_CRITICAL(&ringLock);
+}
+
+bool capture_readBoot(capture_sink_t *sink, uint32_t *index, capture_frame_t *out)
+{
+    while (1)
+    {
+        portENTER_CRITICAL(&ringLock);
+        if (*index >= bootCount)
+        {
+            portEXIT_CRITICAL(&ringLock);
+            return false;
+        }
+        *out = bootFrames[(*index)++];
+        bool accepted = (out->msg.identifier & sink->filterMask) == sink->filterId;
+        portEXIT_CRITICAL(&ringLock);
+
+        if (accepted)
+            return true;
+    }
+}
+
+void capture_getBootStatus(capture_bootStatus_t *status)
+{
+    portENTER_CRITICAL(&ringLock);
+    status->frames = bootCount;
+    status->overflows = bootOverflows;
+    status->buffering = bootBuffering;
+    status->openUs = openUs;
+    status->firstFrameUs = firstFrameUs;
+    portEXIT_CRITICAL(&ringLock);
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+#include "hal/twai_types.h"
+
+/// @brief Received CAN frame, as published to sinks
+typedef struct
+{
+    twai_message_t msg;
+    int64_t timestampUs; // Reception time (esp_timer)
+} capture_frame_t;
+
+/// @brief Consumer of received frames, reading at its own pace
+/// @details Frames are published once in a ring shared by all sinks, each sink has its own read cursor.
+/// A sink falling more than APP_CAPTURE_RING_LEN frames behind loses the oldest frames (counted in drops),
+/// other sinks are not affected.
+typedef struct
+{
+    const char *name;
+    TaskHandle_t task;   // Notified (xTaskNotifyGive) when frames are published, can be NULL
+    uint32_t filterId;   // Accepted identifier bits...
+    uint32_t filterMask; // ...compared under this mask, 0 accepts every frame
+    uint32_t cursor;     // Sequence number of the next frame to read
+    uint32_t drops;      // Frames overwritten before being read
+} capture_sink_t;
+
+/// @brief Frames kept since boot for the hosts, and boot timing
+typedef struct
+{
+    uint32_t frames;      // Frames in the boot buffer
+    uint32_t overflows;   // Frames received while the boot buffer was full
+    bool buffering;       // Boot buffer still filling, no host attached yet
+    int64_t openUs;       // Time the bus was first opened (esp_timer, since boot), -1 if never
+    int64_t firstFrameUs; // Reception time of the first frame, -1 if none yet
+} capture_bootStatus_t;
+
+/// @brief Initialize CAN capture component
+void capture_init(void);
+
+/// @brief Set CAN bitrate used by the next @ref capture_open
+/// @return ESP_ERR_NOT_SUPPORTED if the bitrate has no timing configuration
+esp_err_t capture_setBitrate(uint32_t bitrate);
+
+/// @brief Get CAN bitrate set by @ref capture_setBitrate, 0 if not set
+uint32_t capture_getBitrate(void);
+
+/// @brief Bitrate detection result
+typedef struct
+{
+    uint32_t bitrate;    // Detected bitrate, 0 if none
+    uint32_t candidates; // Candidate bitrates tried
+    uint32_t elapsedMs;  // Detection time
+} capture_detection_t;
+
+/// @brief Detect the bus bitrate: listen to every supported bitrate in turn, most common first, until valid frames are
+/// received (APP_CAPTURE_AUTOBAUD_FRAMES) before bus errors (APP_CAPTURE_AUTOBAUD_ERRORS) or the dwell time
+/// @details The bus must be closed, it is left closed with the detected bitrate set (the previous one when detection
+/// fails); frames received meanwhile are published. Blocks up to APP_CAPTURE_AUTOBAUD_DWELL_MS per candidate.
+/// @return ESP_ERR_NOT_FOUND if no candidate received valid frames (silent bus)
+esp_err_t capture_detectBitrate(capture_detection_t *result);
+
+/// @brief Check if bitrate detection is running, bus errors are then expected
+bool capture_isDetecting(void);
+
+/// @brief Open CAN connection and start publishing received frames
+esp_err_t capture_open(twai_mode_t mode);
+
+/// @brief Stop publishing received frames and close CAN connection
+esp_err_t capture_close(void);
+
+/// @brief Hand received frames to the on-device consumers and publish them, sinks are woken once per call
+/// @details CAN RX path, called by the capture RX task (and by the host pipeline benchmark)
+void capture_processFrames(const twai_message_t *msgs, size_t count);
+
+/// @brief Register a sink, it receives frames published from now on
+/// @param sink Sink description (name, task, filter), must stay valid
+/// @return ESP_ERR_NO_MEM if APP_CAPTURE_MAX_SINKS are already registered
+esp_err_t capture_addSink(capture_sink_t *sink);
+
+/// @brief Set the identifier filter of a sink
+void capture_setFilter(capture_sink_t *sink, uint32_t id, uint32_t mask);
+
+/// @brief Read the next frame published to a sink, skipping frames rejected by its filter
+/// @return false if no frame is available
+bool capture_read(capture_sink_t *sink, capture_frame_t *out);
+
+/// @brief Keep received frames in the boot buffer until the first @ref capture_attachSink, or until it is full
+void capture_startBootBuffer(void);
+
+/// @brief Mark a sink as attached to a host: frames published so far are skipped and the boot buffer stops filling
+/// @details A frame is either in the boot buffer or read by the sink afterwards, never both
+void capture_attachSink(capture_sink_t *sink);
+
+/// @brief Read the boot buffer frame at *index, skipping frames rejected by the sink filter
+/// @param index Position in the boot buffer, start at 0, advanced past the returned frame
+/// @return false at the end of the buffer
+bool capture_readBoot(capture_sink_t *sink, uint32_t *index, capture_frame_t *out);
+
+void capture_getBootStatus(capture_bootStatus_t *status);
@@ -0,0 +1,143 @@
+/*
+Per-identifier traffic census: frame count, period, jitter, DLC and changed payload bits of every identifier,
+updated in the CAN RX path so that a bus map is available without streaming every frame to the host
+*/
+
+#include "census.h"
+
+#include "config.h"
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+
+#define CENSUS_HASH_MULTIPLIER 0x9E3779B1
+#define CENSUS_EMPTY 0xFFFFFFFF // Free slot identifier, not a valid identifier
+
+_Static_assert((APP_CENSUS_MAX_IDS & (APP_CENSUS_MAX_IDS - 1)) == 0, "APP_CENSUS_MAX_IDS must be a power of 2");
+
+static census_entry_t table[APP_CENSUS_MAX_IDS];
+static census_status_t status = {.capacity = APP_CENSUS_MAX_IDS};
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+static inline uint32_t slotOf(uint32_t id)
+{
+    return (uint32_t)(id * CENSUS_HASH_MULTIPLIER) >> (32 - __builtin_ctz(APP_CENSUS_MAX_IDS));
+}
+
+/// @brief Empty the table, called with lock held
+static void clearLocked(void)
+{
+    memset(table, 0, sizeof(table));
+    for (size_t i = 0; i < APP_CENSUS_MAX_IDS; i++)
+        table[i].id = CENSUS_EMPTY;
+    status.ids = 0;
+    status.overflow = 0;
+}
+
+void census_init(void)
+{
+    census_clear();
+}
+
+void census_processFrame(const twai_message_t *msg, int64_t timestampUs)
+{
+    uint32_t id = msg->extd ? (msg->identifier | CENSUS_ID_EXTD) : msg->identifier;
+    uint32_t nowUs = timestampUs;
+    uint8_t dlc = msg->data_length_code <= 8 ? msg->data_length_code : 8;
+
+    portENTER_CRITICAL(&lock);
+    census_entry_t *entry = NULL;
+    uint32_t slot = slotOf(id);
+    for (int probe = 0; probe < APP_CENSUS_MAX_PROBE; probe++)
+    {
+        census_entry_t *candidate = &table[slot];
+        if (candidate->id == id)
+        {
+            entry = candidate;
+            break;
+        }
+        if (candidate->id == CENSUS_EMPTY)
+        {
+            entry = candidate;
+            entry->id = id;
+            status.ids++;
+            break;
+        }
+        slot = (slot + 1) & (APP_CENSUS_MAX_IDS - 1);
+    }
+
+    if (entry == NULL)
+        status.overflow++;
+    else
+    {
+        if (entry->count > 0)
+        {
+            uint32_t delta = nowUs - entry->lastUs;
+            if (entry->count == 1)
+            {
+                entry->periodUs = delta;
+                entry->minUs = delta;
+                entry->maxUs = delta;
+            }
+            else
+            {
+                int32_t error = (int32_t)(delta - entry->periodUs);
+                entry->periodUs += error / (1 << CENSUS_EWMA_SHIFT);
+                int32_t deviation = (error < 0 ? -error : error) - (int32_t)entry->jitterUs;
+                entry->jitterUs += deviation / (1 << CENSUS_EWMA_SHIFT);
+                if (delta < entry->minUs)
+                    entry->minUs = delta;
+                if (delta > entry->maxUs)
+                    entry->maxUs = delta;
+            }
+
+            uint64_t previous, current;
+            memcpy(&previous, entry->lastData, sizeof(previous));
+            memcpy(&current, msg->data, sizeof(current));
+            uint64_t valid = dlc < 8 ? (1ULL << (dlc * 8)) - 1 : ~0ULL;
+            entry->changedBits |= (previous ^ current) & valid;
+        }
+
+        entry->count++;
+        entry->lastUs = nowUs;
+        entry->dlcMask |= 1 << dlc;
+        entry->updated = true;
+        memcpy(entry->lastData, msg->data, sizeof(entry->lastData));
+    }
+    portEXIT_CRITICAL(&lock);
+}
+
+void census_clear(void)
+{
+    portENTER_CRITICAL(&lock);
+    clearLocked();
+    portEXIT_CRITICAL(&lock);
+}
+
+bool census_next(size_t *pos, bool onlyUpdated, census_entry_t *entry)
+{
+    bool found = false;
+
+    portENTER_CRITICAL(&lock);
+    while (*pos < APP_CENSUS_MAX_IDS && !found)
+    {
+        census_entry_t *candidate = &table[(*pos)++];
+        if (candidate->id == CENSUS_EMPTY || (onlyUpdated && !candidate->updated))
+            continue;
+
+        *entry = *candidate;
+        if (onlyUpdated)
+            candidate->updated = false;
+        found = true;
+    }
+    portEXIT_CRITICAL(&lock);
+
+    return found;
+}
+
+void census_getStatus(census_status_t *out)
+{
+    portENTER_CRITICAL(&lock);
+    *out = status;
+    portEXIT_CRITICAL(&lock);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "hal/twai_types.h"
+
+#define CENSUS_ID_EXTD 0x80000000 // Entry identifier flag
+#define CENSUS_EWMA_SHIFT 3       // Period and jitter averages weight new samples by 1/8
+
+/// @brief Traffic statistics of one identifier
+typedef struct
+{
+    uint32_t id;          // Identifier | CENSUS_ID_EXTD
+    uint32_t count;       // Frames received
+    uint32_t lastUs;      // Last reception time (low bits of esp_timer)
+    uint32_t periodUs;    // Inter-arrival time average (EWMA)
+    uint32_t jitterUs;    // Inter-arrival time mean deviation from periodUs (EWMA)
+    uint32_t minUs;       // Shortest inter-arrival time
+    uint32_t maxUs;       // Longest inter-arrival time
+    uint16_t dlcMask;     // Bit n set when DLC n was seen
+    bool updated;         // Received since the last dump with onlyUpdated
+    uint8_t lastData[8];
+    uint64_t changedBits; // Payload bits that changed at least once (loaded little endian)
+} census_entry_t;
+
+typedef struct
+{
+    uint32_t ids;      // Identifiers in the table
+    uint32_t capacity; // APP_CENSUS_MAX_IDS
+    uint32_t overflow; // Frames of identifiers that did not fit in the table
+} census_status_t;
+
+/// @brief Initialize census, with an empty table
+void census_init(void);
+
+/// @brief Update the statistics of a received frame, called from the CAN RX path
+/// @details Constant time: fixed table, at most APP_CENSUS_MAX_PROBE slots compared
+void census_processFrame(const twai_message_t *msg, int64_t timestampUs);
+
+/// @brief Empty the table
+void census_clear(void);
+
+/// @brief Copy the entry following position *pos, for iteration starting from *pos = 0
+/// @param onlyUpdated Skip identifiers not received since their last copy with onlyUpdated
+/// @return false when there are no more entries
+bool census_next(size_t *pos, bool onlyUpdated, census_entry_t *entry);
+
+void census_getStatus(census_status_t *status);
@@ -1,18 +1,151 @@
 #pragma once
 
-#define APP_BT_TX_QUEUE_LEN 32          // Bluetooth message queue size
-#define APP_BT_RX_QUEUE_LEN 128         // Bluetooth message queue size
-#define APP_BT_TX_TASK_PRIO 1           // Bluetooth TX task priority
-#define APP_CAN_TX_GPIO_NUM 21          // CAN TX GPIO number
-#define APP_CAN_RX_GPIO_NUM 22          // CAN RX GPIO number
-#define APP_SLCAN_SERIAL_RX_TASK_PRIO 1 // SLCAN serial RX task priority
-#define APP_SLCAN_CAN_RX_TASK_PRIO 1    // SLCAN CAN RX task priority
+#define APP_BT_TX_QUEUE_LEN 32         // Bluetooth message queue size
+#define APP_BT_RX_QUEUE_LEN 128        // Bluetooth message queue size
+#define APP_BT_TX_TASK_PRIO 1          // Bluetooth TX task priority
+#define APP_CAN_TX_GPIO_NUM 21         // CAN TX GPIO number
+#define APP_CAN_RX_GPIO_NUM 22         // CAN RX GPIO number
+#define APP_SLCAN_DISPATCH_TASK_PRIO 1 // SLCAN command dispatcher task priority
+#define APP_SLCAN_LINK_TX_TASK_PRIO 1  // SLCAN link frame forwarding tasks priority
+#define APP_SLCAN_MAX_LINKS 4          // Maximum number of SLCAN links (transports)
+#define APP_SLCAN_RX_QUEUE_SET_LEN 192 // Must be at least the sum of link rxQueue lengths
+#define APP_SLCAN_TX_BATCH_SIZE 256    // Frames forwarded in one pass are sent in messages up to this size
+#define APP_SLCAN_TX_WAIT_MS 100       // Maximum wait for space in a link transmit queue before frames are dropped
+
+#define APP_MESSAGE_SMALL_SIZE 128       // Message pool block size: replies, single frames, recorder lines
+#define APP_MESSAGE_SMALL_COUNT 64       // Message pool blocks of APP_MESSAGE_SMALL_SIZE bytes
+#define APP_MESSAGE_MEDIUM_SIZE 512      // Message pool block size: frame batches (APP_SLCAN_TX_BATCH_SIZE, APP_GVRET_BATCH_SIZE), TCP reads
+#define APP_MESSAGE_MEDIUM_COUNT 48      // Message pool blocks of APP_MESSAGE_MEDIUM_SIZE bytes
+#define APP_MESSAGE_LARGE_SIZE 2060      // Message pool block size: ISO-TP PDUs in hex (12 + 2 * APP_ISOTP_RX_BUF_SIZE), UART and SPP reads
+#define APP_MESSAGE_LARGE_COUNT 8        // Message pool blocks of APP_MESSAGE_LARGE_SIZE bytes
+#define APP_MESSAGE_LINK_SMALL_BLOCKS 8  // Small blocks held at most by the transmit queue of one link (SLCAN links, socketcand)
+#define APP_MESSAGE_LINK_MEDIUM_BLOCKS 8 // Medium blocks held at most by the transmit queue of one link
+#define APP_MESSAGE_LINK_LARGE_BLOCKS 1  // Large blocks held at most by the transmit queue of one link
+
+#define APP_TRACE_RING_LEN 256  // Trace records (16 bytes) kept per core (power of 2)
+#define APP_TRACE_DRAIN_MS 100  // Console drain task polling interval, 0: no drain task (rings only read by the "ld" command)
+#define APP_TRACE_TASK_PRIO 0   // Trace drain task priority (idle, formatting only runs when nothing else does)
+#define APP_TRACE_LEVEL_SLCAN 3 // SLCAN trace events above this level are compiled out (0 none ... 5 verbose)
+#define APP_TRACE_LEVEL_BT 3    // Bluetooth trace events above this level are compiled out
+#define APP_TRACE_LEVEL_TCP 3   // TCP trace events above this level are compiled out
+
+#define APP_CAN_SOCKETCAN_IFNAME "vcan0" // SocketCAN interface of Linux host builds (can_socketcan.c)
+
+#define APP_CAPTURE_RING_LEN 256          // Received frames kept for sinks (power of 2), a sink further behind loses frames
+#define APP_CAPTURE_MAX_SINKS 6           // Maximum number of frame sinks (SLCAN links, SD log, WebSocket streaming)
+#define APP_CAPTURE_TASK_PRIO 2           // CAN RX task priority (above sinks)
+#define APP_CAPTURE_RX_BATCH 16           // Frames taken from the CAN driver per receive call, sinks are woken once per batch
+#define APP_CAPTURE_RX_WAIT_MS 50         // Maximum CAN driver receive wait, bounds the time a bus close waits for the RX task
+#define APP_CAPTURE_BOOT_LEN 512          // Frames (32 bytes) kept from an auto started bus until the first host attaches
+#define APP_CAPTURE_AUTOBAUD_DWELL_MS 100 // Bitrate detection: maximum listening time per candidate bitrate
+#define APP_CAPTURE_AUTOBAUD_FRAMES 2     // Bitrate detection: valid frames locking onto a candidate
+#define APP_CAPTURE_AUTOBAUD_ERRORS 4     // Bitrate detection: bus errors rejecting a candidate early
+
+#define APP_SETTINGS_NVS_NAMESPACE "settings" // NVS namespace of the persisted adapter configuration (Q, Z commands)
+
+#define APP_RECORDER_RING_LEN 2048        // Flight recorder records (16 bytes) in internal RAM (power of 2)
+#define APP_RECORDER_PSRAM_RING_LEN 65536 // Flight recorder records when PSRAM is available (power of 2)
+#define APP_RECORDER_PRE_TRIGGER_MS 10000 // Flight recorder default window before a trigger
+#define APP_RECORDER_POST_TRIGGER_MS 2000 // Flight recorder default window after a trigger
+#define APP_RECORDER_ERROR_BURST 100      // Flight recorder default bus errors per second firing a trigger
+#define APP_RECORDER_POLL_MS 100          // Flight recorder bus state polling interval
+#define APP_RECORDER_TASK_PRIO 1          // Flight recorder task priority
+
+#define APP_MONITOR_LOAD_WINDOW_MS 1000 // Bus load averaging window
+#define APP_MONITOR_ALERT_WAIT_MS 50    // Bus monitor maximum wait for TWAI alerts, error counters sampling interval
+#define APP_MONITOR_AUTO_RECOVERY 1     // Recover from bus-off automatically by default
+#define APP_MONITOR_TASK_PRIO 2         // Bus monitor task priority (bus-off recovery latency)
+
+#define APP_CENSUS_MAX_IDS 256 // Identifiers tracked by the traffic census (power of 2, 48 bytes each)
+#define APP_CENSUS_MAX_PROBE 8 // Census table slots compared per frame, bounds the RX path cost
+
+#define APP_RULES_MAX_RULES 256 // Maximum number of frame match rules (at most 256)
+
+#define APP_ISOTP_MAX_SESSIONS 8       // Maximum number of concurrent ISO-TP sessions
+#define APP_ISOTP_RX_BUF_SIZE 1024     // ISO-TP reassembly buffer size, per session (max 4095)
+#define APP_ISOTP_TX_BUF_SIZE 256      // ISO-TP segmentation buffer size, per session (max 4095)
+#define APP_ISOTP_TIMEOUT_MS 1000      // ISO-TP N_Bs and N_Cr timeouts
+#define APP_ISOTP_MAX_WFT 10           // ISO-TP maximum consecutive FC.WAIT frames accepted (N_WFTmax)
+#define APP_ISOTP_PADDING 0xCC         // ISO-TP frame padding byte
+#define APP_ISOTP_DEFAULT_BS 0         // ISO-TP block size advertised when not specified by the host
+#define APP_ISOTP_DEFAULT_STMIN 0      // ISO-TP STmin advertised when not specified by the host
+#define APP_ISOTP_CAN_TX_TIMEOUT_MS 10 // ISO-TP maximum wait for space in the CAN TX queue
+#define APP_ISOTP_TASK_PRIO 2          // ISO-TP task priority (above SLCAN tasks, to keep CF pacing)
+
+#define APP_OBD_MAX_PIDS 32             // Maximum number of polled OBD-II PIDs
+#define APP_OBD_RESPONSE_TIMEOUT_MS 100 // OBD-II response timeout (P2 max is 50ms)
+#define APP_OBD_MAX_MISSES 3            // Missing responses before a PID is considered unsupported
+#define APP_OBD_POLL_INTERVAL_MS 5      // OBD-II poller scheduling interval
+#define APP_OBD_POLL_TASK_PRIO 1        // OBD-II poller task priority
+
+#define APP_UDS_MAX_JOBS 16            // Maximum number of queued UDS jobs (running jobs are limited by free ISO-TP sessions)
+#define APP_UDS_P2_MS 150              // UDS response timeout
+#define APP_UDS_P2_EXT_MS 5000         // UDS response timeout after a responsePending (0x78) negative response
+#define APP_UDS_MAX_TIMEOUTS 5         // Consecutive timeouts before a UDS job is aborted
+#define APP_UDS_TESTER_PRESENT_MS 2000 // UDS TesterPresent period for idle non-default sessions
+#define APP_UDS_POLL_INTERVAL_MS 5     // UDS task scheduling interval
+#define APP_UDS_TASK_PRIO 1            // UDS task priority
+
+#define APP_GVRET_BATCH_SIZE 512 // GVRET received frames batch size in bytes
+#define APP_GVRET_BATCH_MS 5     // GVRET maximum time a received frame waits in the batch
+
+#define APP_TCP_PORT 23         // TCP server port (SavvyCAN GVRET network default)
+#define APP_TCP_RX_QUEUE_LEN 32 // TCP message queue size
+#define APP_TCP_TX_QUEUE_LEN 64 // TCP message queue size
+#define APP_TCP_TASK_PRIO 1     // TCP server and TX tasks priority
+
+#define APP_BCM_MAX_TX_JOBS 16    // Maximum number of cyclic transmissions per socketcand client
+#define APP_BCM_MAX_RX_FILTERS 32 // Maximum number of receive filters/subscriptions per socketcand client
+
+#define APP_SOCKETCAND_PORT 29536           // socketcand server port (socketcand default)
+#define APP_SOCKETCAND_RX_QUEUE_LEN 16      // socketcand message queue size
+#define APP_SOCKETCAND_TX_QUEUE_LEN 128     // socketcand message queue size
+#define APP_SOCKETCAND_MAX_CMD_LEN 128      // socketcand maximum command length
+#define APP_SOCKETCAND_CAN_TX_TIMEOUT_MS 10 // socketcand maximum wait for space in the CAN TX queue
+#define APP_SOCKETCAND_POLL_INTERVAL_MS 5   // socketcand maximum scheduling interval of throttled reports
+#define APP_SOCKETCAND_TASK_PRIO 1          // socketcand session task priority
+
+#define APP_WS_PORT 80                     // WebSocket streaming server port (HTTP, endpoint /ws)
+#define APP_WS_TASK_PRIO 1                 // WebSocket streaming task priority
+#define APP_STREAM_MAX_CLIENTS 4           // Maximum number of streaming clients (HTTP server sockets are this plus 1)
+#define APP_STREAM_MAX_SUBS 24             // Maximum number of subscriptions per streaming client, bounds batch size
+#define APP_STREAM_MAX_ITEMS 64            // Maximum number of distinct identifiers and signals subscribed by all clients
+#define APP_STREAM_DEFAULT_INTERVAL_MS 100 // Streaming batch interval until the client chooses one ("rate")
+#define APP_STREAM_MIN_INTERVAL_MS 10      // Minimum streaming batch interval accepted from clients
+#define APP_STREAM_RETRY_MS 10             // Streaming batch retry delay when the client socket is not writable
+#define APP_STREAM_MAX_CMD_LEN 256         // Streaming client command maximum length
+
+#define APP_SD_MOUNT_POINT "/sdcard" // SD card FAT mount point
+#define APP_SD_MAX_FILES 4           // Maximum number of files open at once on the SD card
+#define APP_SD_LOG_BUF_SIZE 4096     // SD log write buffer size
+#define APP_SD_LOG_FLUSH_MS 1000     // SD log maximum time before buffered frames are written to the card
+#define APP_SD_TASK_PRIO 1           // SD log task priority
+
+#define APP_REPLAY_BUF_LEN 256            // Log replay read-ahead: frames parsed ahead of their transmission time (power of 2)
+#define APP_REPLAY_READ_BUF_SIZE 4096     // Log replay file read buffer size
+#define APP_REPLAY_MAX_LINE_LEN 96        // Log replay longest candump line, longer lines are skipped
+#define APP_REPLAY_WAKE_LEAD_US 50        // Log replay timer alarm lead, the transmit task spins the rest of the way to the frame time
+#define APP_REPLAY_LATE_US 100            // Log replay transmissions later than this after their frame time are counted as late
+#define APP_REPLAY_LOOP_GAP_MS 100        // Log replay pause between two passes of a looped log
+#define APP_REPLAY_MAX_SPEED_PERCENT 1000 // Log replay maximum speed scale
+#define APP_REPLAY_CAN_TX_TIMEOUT_MS 10   // Log replay maximum wait for space in the CAN TX queue
+#define APP_REPLAY_TX_TASK_PRIO 5         // Log replay transmit task priority (above every other application task, for timing)
+#define APP_REPLAY_READER_TASK_PRIO 1     // Log replay file reader task priority
 
 #define UART_PORT_NUM UART_NUM_0 // ESP console moved from UART0 to UART1 via menuconfig (sdkconfig)
 #define UART_TXD_GPIO_NUM GPIO_NUM_1
 #define UART_RXD_GPIO_NUM GPIO_NUM_3
-#define UART_BAUDRATE 921600 // Default CP2102 config also supports 1200000 and 1500000
-#define UART_BUF_SIZE 128    // Must be at least 128 (ESP32 driver requirement)
-#define UART_QUEUES_LEN 8
-#define UART_EVENT_TASK_PRIO 1
+#define UART_RTS_GPIO_NUM GPIO_NUM_18 // Used when UART_FLOW_CONTROL is enabled
+#define UART_CTS_GPIO_NUM GPIO_NUM_19 // Used when UART_FLOW_CONTROL is enabled
+#define UART_FLOW_CONTROL 0           // RTS/CTS hardware flow control, requires RTS/CTS wired to the USB bridge
+#define UART_BAUDRATE 921600          // Default CP2102 config also supports 1200000 and 1500000, CP2102N and FT232H up to 3000000
+#define UART_RX_BUF_SIZE 8192         // Driver RX ring size, holds ~27ms of data at 3Mbaud
+#define UART_TX_BUF_SIZE 8192         // Driver TX ring size, writes only block when it is full
+#define UART_RX_FLOW_THRESHOLD 100    // RTS is deasserted when the RX FIFO (128 bytes) holds this many bytes
+#define UART_EVENT_QUEUE_LEN 32
+#define UART_PATTERN_QUEUE_LEN 32 // Command terminators (CR) positions tracked by the driver
+#define UART_QUEUES_LEN 16
+#define UART_EVENT_TASK_PRIO 2 // Above SLCAN tasks, to empty the RX ring before it overflows
 #define UART_TX_TASK_PRIO 1
+#define UART_LOOPBACK_BENCHMARK 0        // 1 to measure throughput at startup with internal loopback (host link unavailable meanwhile)
+#define UART_BENCHMARK_SIZE (256 * 1024) // Bytes sent by the loopback benchmark
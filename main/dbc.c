@@ -0,0 +1,175 @@
+/*
+DBC signal decoder, using tables generated at build time by tools/dbc2c.py (set DBC_FILE when configuring the project)
+*/
+
+#include "dbc.h"
+
+#include "dbc_tables.h"
+
+#include <string.h>
+
+#define DBC_HASH_MULTIPLIER 0x9E3779B1 // Must match tools/dbc2c.py
+
+extern const uint16_t DBC_STD_INDEX[2048];
+extern const uint16_t DBC_EXT_INDEX[];
+
+#define SIGNAL_WORDS ((DBC_SIGNAL_COUNT + 31) / 32 > 0 ? (DBC_SIGNAL_COUNT + 31) / 32 : 1)
+
+// Table sizes as variables, so that bounds checks against empty tables (no DBC file) are not constant comparisons
+static const size_t signalCount = DBC_SIGNAL_COUNT;
+static const size_t messageCount = DBC_MESSAGE_COUNT;
+
+static uint32_t enabledSignals[SIGNAL_WORDS];
+static int64_t lastRaw[DBC_SIGNAL_COUNT > 0 ? DBC_SIGNAL_COUNT : 1];
+static uint32_t reportedSignals[SIGNAL_WORDS]; // Signals reported at least once, for on-change mode
+static bool onChange = false;
+
+size_t dbc_getSignalCount(void)
+{
+    return signalCount;
+}
+
+const dbc_message_t *dbc_findMessage(uint32_t identifier, bool extd)
+{
+    if (!extd)
+    {
+        uint16_t index = DBC_STD_INDEX[identifier & 0x7FF];
+        return index != 0 ? &DBC_MESSAGES[index - 1] : NULL;
+    }
+
+#if DBC_EXT_HASH_BITS > 0
+    uint32_t slot = (uint32_t)(identifier * DBC_HASH_MULTIPLIER) >> (32 - DBC_EXT_HASH_BITS);
+    for (int probe = 0; probe < DBC_EXT_MAX_PROBE; probe++)
+    {
+        uint16_t index = DBC_EXT_INDEX[slot];
+        if (index == 0)
+            break;
+        if (DBC_MESSAGES[index - 1].identifier == identifier)
+            return &DBC_MESSAGES[index - 1];
+        slot = (slot + 1) & ((1 << DBC_EXT_HASH_BITS) - 1);
+    }
+#endif
+    return NULL;
+}
+
+esp_err_t dbc_setEnabled(uint16_t signal, bool enabled)
+{
+    if (signal >= signalCount)
+        return ESP_ERR_INVALID_ARG;
+
+    if (enabled)
+        enabledSignals[signal / 32] |= 1UL << (signal % 32);
+    else
+        enabledSignals[signal / 32] &= ~(1UL << (signal % 32));
+    reportedSignals[signal / 32] &= ~(1UL << (signal % 32));
+    return ESP_OK;
+}
+
+void dbc_disableAll(void)
+{
+    memset(enabledSignals, 0, sizeof(enabledSignals));
+    memset(reportedSignals, 0, sizeof(reportedSignals));
+}
+
+void dbc_setOnChange(bool value)
+{
+    onChange = value;
+    memset(reportedSignals, 0, sizeof(reportedSignals));
+}
+
+static inline int64_t extractSignal(const dbc_signal_t *sig, uint64_t le, uint64_t be)
+{
+    uint64_t raw = (sig->littleEndian ? le : be) >> sig->shift;
+    if (sig->length < 64)
+    {
+        raw &= (1ULL << sig->length) - 1;
+        if (sig->isSigned && (raw >> (sig->length - 1)) & 1)
+            raw |= ~0ULL << sig->length; // Sign extension
+    }
+    return (int64_t)raw;
+}
+
+/// @brief Load the payload as 64bit integer in both byte orders, missing bytes are zero
+static inline void loadPayload(const twai_message_t *msg, uint64_t *le, uint64_t *be)
+{
+    *le = 0;
+    *be = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        uint64_t byte = i < msg->data_length_code ? msg->data[i] : 0;
+        *le |= byte << (8 * i);
+        *be |= byte << (8 * (7 - i));
+    }
+}
+
+int dbc_findSignal(const char *name)
+{
+    for (size_t i = 0; i < signalCount; i++)
+        if (strcmp(DBC_SIGNALS[i].name, name) == 0)
+            return i;
+    return -1;
+}
+
+const dbc_message_t *dbc_getSignalMessage(uint16_t signal)
+{
+    for (size_t i = 0; i < messageCount; i++)
+    {
+        const dbc_message_t *m = &DBC_MESSAGES[i];
+        if (signal >= m->firstSignal && signal < m->firstSignal + m->signalCount)
+            return m;
+    }
+    return NULL;
+}
+
+esp_err_t dbc_decodeSignal(const twai_message_t *msg, uint16_t signal, dbc_value_t *out)
+{
+    if (signal >= signalCount || msg->rtr)
+        return ESP_ERR_INVALID_ARG;
+
+    uint64_t le, be;
+    loadPayload(msg, &le, &be);
+
+    const dbc_signal_t *sig = &DBC_SIGNALS[signal];
+    out->signal = signal;
+    out->raw = extractSignal(sig, le, be);
+    out->value = out->raw * sig->scale + sig->offset;
+    return ESP_OK;
+}
+
+size_t dbc_decodeFrame(const twai_message_t *msg, dbc_value_t *out, size_t max, uint16_t *next)
+{
+    const dbc_message_t *m = dbc_findMessage(msg->identifier, msg->extd);
+    if (m == NULL || msg->rtr)
+        return 0;
+
+    uint64_t le, be;
+    loadPayload(msg, &le, &be);
+
+    size_t count = 0;
+    uint16_t i = *next > m->firstSignal ? *next : m->firstSignal;
+    for (; i < m->firstSignal + m->signalCount && count < max; i++)
+    {
+        uint32_t bit = 1UL << (i % 32);
+        if (!(enabledSignals[i / 32] & bit))
+            continue;
+
+        const dbc_signal_t *sig = &DBC_SIGNALS[i];
+        int64_t raw = extractSignal(sig, le, be);
+
+        if (onChange)
+        {
+            if ((reportedSignals[i / 32] & bit) && lastRaw[i] == raw)
+                continue;
+            reportedSignals[i / 32] |= bit;
+            lastRaw[i] = raw;
+        }
+
+        out[count].signal = i;
+        out[count].raw = raw;
+        out[count].value = raw * sig->scale + sig->offset;
+        count++;
+    }
+
+    *next = i;
+    return count;
+}
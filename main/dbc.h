@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "hal/twai_types.h"
+
+/// @brief Signal layout, generated from a DBC file by tools/dbc2c.py
+typedef struct
+{
+    const char *name; // "<message>.<signal>"
+    const char *unit;
+    uint8_t shift;        // Position of the LSB in the payload loaded as a 64bit integer (in the signal byte order)
+    uint8_t length;       // Length in bits
+    uint8_t littleEndian; // Intel (1) or Motorola (0) byte order
+    uint8_t isSigned;
+    float scale;
+    float offset;
+} dbc_signal_t;
+
+/// @brief Message layout, generated from a DBC file by tools/dbc2c.py
+typedef struct
+{
+    uint32_t identifier;
+    uint8_t extd;
+    uint16_t firstSignal; // Index of the first signal in @ref DBC_SIGNALS
+    uint16_t signalCount;
+} dbc_message_t;
+
+/// @brief Decoded signal value
+typedef struct
+{
+    uint16_t signal; // Index in @ref DBC_SIGNALS
+    int64_t raw;     // Raw value, sign extended for signed signals
+    float value;     // Physical value (raw * scale + offset)
+} dbc_value_t;
+
+extern const dbc_signal_t DBC_SIGNALS[];
+extern const dbc_message_t DBC_MESSAGES[];
+
+/// @brief Get the number of signals in the generated tables
+size_t dbc_getSignalCount(void);
+
+/// @brief Find the message layout of a CAN identifier
+/// @return Message layout, or NULL if the identifier is not in the DBC
+const dbc_message_t *dbc_findMessage(uint32_t identifier, bool extd);
+
+/// @brief Find a signal by name
+/// @param name "<message>.<signal>"
+/// @return Signal index, -1 if there is no such signal
+int dbc_findSignal(const char *name);
+
+/// @brief Get the message layout of a signal
+/// @return NULL if signal is not a signal index
+const dbc_message_t *dbc_getSignalMessage(uint16_t signal);
+
+/// @brief Decode one signal of a received frame of its message, whether the signal is enabled or not
+/// @return ESP_ERR_INVALID_ARG if signal is not a signal index or msg is a remote frame
+esp_err_t dbc_decodeSignal(const twai_message_t *msg, uint16_t signal, dbc_value_t *out);
+
+/// @brief Enable or disable decoding of a signal
+esp_err_t dbc_setEnabled(uint16_t signal, bool enabled);
+
+/// @brief Disable decoding of all signals
+void dbc_disableAll(void);
+
+/// @brief Only report signals whose raw value changed since they were last reported
+void dbc_setOnChange(bool onChange);
+
+/// @brief Decode the enabled signals of a received frame, in chunks of up to max values
+/// @param msg Received frame
+/// @param out Decoded values
+/// @param max Maximum number of values
+/// @param next Signal to resume from, 0 to start with the first signal of the frame; set past the last signal decoded
+/// @return Number of values written, 0 once every enabled signal of the frame was decoded
+size_t dbc_decodeFrame(const twai_message_t *msg, dbc_value_t *out, size_t max, uint16_t *next);
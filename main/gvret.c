@@ -0,0 +1,313 @@
+/*
+Implementation of the GVRET binary protocol, as spoken natively by SavvyCAN
+Reference implementation: https://github.com/collin80/GVRET (gvret_comm.cpp)
+*/
+
+#include "gvret.h"
+
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#define TAG "GVRET"
+
+#define GVRET_BINARY_MODE 0xE7 // Sent twice by the host to enter binary mode
+#define GVRET_COMMAND 0xF1     // Command/frame prefix
+
+#define GVRET_EXTENDED_FLAG 0x80000000UL
+#define GVRET_BUS_CONFIGURED 0x80000000UL // SETUP_CANBUS: enabled/listen-only flags are valid
+#define GVRET_BUS_ENABLED 0x40000000UL
+#define GVRET_BUS_LISTEN_ONLY 0x20000000UL
+#define GVRET_BUS_SPEED_MASK 0xFFFFFUL
+
+#define GVRET_BUILD_NUMBER 343 // Reported build number, SavvyCAN only checks it is present
+#define GVRET_NUM_BUSES 1
+
+typedef enum
+{
+    CMD_BUILD_CAN_FRAME = 0x00,
+    CMD_TIME_SYNC = 0x01,
+    CMD_GET_DIG_INPUTS = 0x02,
+    CMD_GET_ANALOG_INPUTS = 0x03,
+    CMD_SET_DIG_OUTPUTS = 0x04,
+    CMD_SETUP_CANBUS = 0x05,
+    CMD_GET_CANBUS_PARAMS = 0x06,
+    CMD_GET_DEVICE_INFO = 0x07,
+    CMD_SET_SINGLEWIRE_MODE = 0x08,
+    CMD_KEEPALIVE = 0x09,
+    CMD_SET_SYSTYPE = 0x0A,
+    CMD_ECHO_CAN_FRAME = 0x0B,
+    CMD_GET_NUMBUSES = 0x0C,
+    CMD_GET_EXT_BUSES = 0x0D,
+    CMD_SET_EXT_BUSES = 0x0E,
+} command_t;
+
+typedef enum
+{
+    STATE_IDLE = 0xFF,    // Waiting for GVRET_COMMAND
+    STATE_COMMAND = 0xFE, // Waiting for command byte
+    // Other values: command_t being parsed
+} state_t;
+
+static void put32(uint8_t *buf, uint32_t value)
+{
+    buf[0] = value & 0xFF;
+    buf[1] = value >> 8 & 0xFF;
+    buf[2] = value >> 16 & 0xFF;
+    buf[3] = value >> 24 & 0xFF;
+}
+
+/// @brief Format a frame in GVRET binary format
+/// @param out output buffer, at least GVRET_MAX_FRAME_LEN bytes
+/// @return formatted length
+static size_t formatFrame(const twai_message_t *msg, uint32_t timestampUs, uint8_t *out)
+{
+    uint8_t *p = out;
+    *p++ = GVRET_COMMAND;
+    *p++ = CMD_BUILD_CAN_FRAME;
+    put32(p, timestampUs);
+    p += 4;
+    put32(p, msg->identifier | (msg->extd ? GVRET_EXTENDED_FLAG : 0));
+    p += 4;
+    *p++ = (msg->data_length_code & 0xF) | (0 << 4); // Bus 0
+    memcpy(p, msg->data, msg->data_length_code);
+    p += msg->data_length_code;
+    *p++ = 0; // Checksum, unused
+    return p - out;
+}
+
+static void sendBatch(gvret_t *g)
+{
+    if (g->batchLen > 0)
+    {
+        g->callbacks->send(g->ctx, g->batch, g->batchLen);
+        g->batchLen = 0;
+    }
+}
+
+static void reply(gvret_t *g, const uint8_t *data, size_t len)
+{
+    g->callbacks->send(g->ctx, data, len);
+}
+
+/// @brief Handle a command without arguments
+static void handleCommand(gvret_t *g, uint8_t cmd)
+{
+    switch (cmd)
+    {
+    case CMD_TIME_SYNC:
+    {
+        uint8_t out[6] = {GVRET_COMMAND, CMD_TIME_SYNC};
+        put32(out + 2, (uint32_t)esp_timer_get_time());
+        reply(g, out, sizeof(out));
+        break;
+    }
+    case CMD_GET_DIG_INPUTS:
+    {
+        uint8_t out[4] = {GVRET_COMMAND, CMD_GET_DIG_INPUTS, 0, 0};
+        reply(g, out, sizeof(out));
+        break;
+    }
+    case CMD_GET_ANALOG_INPUTS:
+    {
+        uint8_t out[2 + 14 + 1] = {GVRET_COMMAND, CMD_GET_ANALOG_INPUTS};
+        reply(g, out, sizeof(out));
+        break;
+    }
+    case CMD_GET_CANBUS_PARAMS:
+    {
+        bool enabled, listenOnly;
+        uint32_t bitrate;
+        g->callbacks->getBus(g->ctx, &enabled, &listenOnly, &bitrate);
+
+        uint8_t out[12] = {GVRET_COMMAND, CMD_GET_CANBUS_PARAMS};
+        out[2] = (enabled ? 1 : 0) | (listenOnly ? 1 : 0) << 4;
+        put32(out + 3, bitrate);
+        out[7] = 0; // CAN1 disabled
+        put32(out + 8, 0);
+        reply(g, out, sizeof(out));
+        break;
+    }
+    case CMD_GET_DEVICE_INFO:
+    {
+        uint8_t out[8] = {GVRET_COMMAND, CMD_GET_DEVICE_INFO, GVRET_BUILD_NUMBER & 0xFF, GVRET_BUILD_NUMBER >> 8, 0x20, 0, 0, 0};
+        reply(g, out, sizeof(out));
+        break;
+    }
+    case CMD_KEEPALIVE:
+    {
+        uint8_t out[4] = {GVRET_COMMAND, CMD_KEEPALIVE, 0xDE, 0xAD};
+        reply(g, out, sizeof(out));
+        break;
+    }
+    case CMD_GET_NUMBUSES:
+    {
+        uint8_t out[3] = {GVRET_COMMAND, CMD_GET_NUMBUSES, GVRET_NUM_BUSES};
+        reply(g, out, sizeof(out));
+        break;
+    }
+    case CMD_GET_EXT_BUSES:
+    {
+        uint8_t out[2 + 15 + 1] = {GVRET_COMMAND, CMD_GET_EXT_BUSES};
+        reply(g, out, sizeof(out));
+        break;
+    }
+    default:
+        ESP_LOGW(TAG, "unknown command %02X", cmd);
+    }
+}
+
+/// @brief Handle a byte of a command with arguments
+/// @return true when the command is complete
+static bool handleArgument(gvret_t *g, uint8_t b)
+{
+    uint8_t step = g->step++;
+
+    switch (g->state)
+    {
+    case CMD_BUILD_CAN_FRAME:
+    case CMD_ECHO_CAN_FRAME:
+        if (step < 4)
+        {
+            g->value |= (uint32_t)b << (8 * step);
+            if (step == 3)
+            {
+                g->frame.flags = 0;
+                g->frame.extd = (g->value & GVRET_EXTENDED_FLAG) ? 1 : 0;
+                g->frame.identifier = g->value & (g->frame.extd ? TWAI_EXTD_ID_MASK : TWAI_STD_ID_MASK);
+            }
+            return false;
+        }
+        if (step == 4) // Bus, only bus 0 exists
+            return false;
+        if (step == 5)
+        {
+            g->frame.data_length_code = (b & 0xF) > 8 ? 8 : (b & 0xF);
+            return false;
+        }
+        if (step < 6 + g->frame.data_length_code)
+        {
+            g->frame.data[step - 6] = b;
+            return false;
+        }
+
+        // Checksum byte, unused
+        if (g->state == CMD_ECHO_CAN_FRAME)
+        {
+            uint8_t out[GVRET_MAX_FRAME_LEN];
+            reply(g, out, formatFrame(&g->frame, esp_timer_get_time(), out));
+        }
+        else if (g->callbacks->transmit(g->ctx, &g->frame) != ESP_OK)
+            ESP_LOGW(TAG, "transmit failed id:%lX", g->frame.identifier);
+        return true;
+    case CMD_SETUP_CANBUS:
+    {
+        g->value |= (uint32_t)b << (8 * (step % 4));
+        if (step == 3)
+        {
+            g->bitrate = g->value;
+            g->value = 0;
+        }
+        if (step < 7)
+            return false;
+
+        // CAN1 settings (g->value) are ignored, only one bus exists
+        bool enabled = g->bitrate > 0, listenOnly = false;
+        if (g->bitrate & GVRET_BUS_CONFIGURED)
+        {
+            enabled = (g->bitrate & GVRET_BUS_ENABLED) != 0;
+            listenOnly = (g->bitrate & GVRET_BUS_LISTEN_ONLY) != 0;
+        }
+        uint32_t bitrate = g->bitrate & GVRET_BUS_SPEED_MASK;
+        if (bitrate > 1000000)
+            bitrate = 1000000;
+
+        if (g->callbacks->setBus(g->ctx, enabled, listenOnly, bitrate) != ESP_OK)
+            ESP_LOGW(TAG, "cannot set bus enabled:%d listen:%d bitrate:%lu", enabled, listenOnly, bitrate);
+        return true;
+    }
+    case CMD_SET_DIG_OUTPUTS:
+    case CMD_SET_SINGLEWIRE_MODE:
+    case CMD_SET_SYSTYPE:
+        return true; // One byte argument, not supported
+    case CMD_SET_EXT_BUSES:
+        return step >= 11; // 12 bytes of arguments, not supported
+    default:
+        return true;
+    }
+}
+
+void gvret_init(gvret_t *g, const gvret_callbacks_t *callbacks, void *ctx)
+{
+    memset(g, 0, sizeof(*g));
+    g->callbacks = callbacks;
+    g->ctx = ctx;
+    g->state = STATE_IDLE;
+}
+
+bool gvret_isHandshake(const uint8_t *data, size_t len)
+{
+    return len > 0 && data[0] == GVRET_BINARY_MODE;
+}
+
+void gvret_processInput(gvret_t *g, const uint8_t *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        uint8_t b = data[i];
+
+        switch (g->state)
+        {
+        case STATE_IDLE:
+            if (b == GVRET_COMMAND)
+                g->state = STATE_COMMAND;
+            // GVRET_BINARY_MODE and anything else is ignored
+            break;
+        case STATE_COMMAND:
+            switch (b)
+            {
+            case CMD_BUILD_CAN_FRAME:
+            case CMD_ECHO_CAN_FRAME:
+            case CMD_SETUP_CANBUS:
+            case CMD_SET_DIG_OUTPUTS:
+            case CMD_SET_SINGLEWIRE_MODE:
+            case CMD_SET_SYSTYPE:
+            case CMD_SET_EXT_BUSES:
+                g->state = b;
+                g->step = 0;
+                g->value = 0;
+                break;
+            default:
+                handleCommand(g, b);
+                g->state = STATE_IDLE;
+            }
+            break;
+        default:
+            if (handleArgument(g, b))
+                g->state = STATE_IDLE;
+        }
+    }
+}
+
+void gvret_queueFrame(gvret_t *g, const twai_message_t *msg, int64_t timestampUs)
+{
+    if (g->batchLen + GVRET_MAX_FRAME_LEN > sizeof(g->batch))
+        sendBatch(g);
+
+    if (g->batchLen == 0)
+        g->batchStart = timestampUs;
+    g->batchLen += formatFrame(msg, (uint32_t)timestampUs, g->batch + g->batchLen);
+
+    gvret_flush(g, timestampUs);
+}
+
+void gvret_flush(gvret_t *g, int64_t nowUs)
+{
+    if (g->batchLen > 0 && nowUs - g->batchStart >= APP_GVRET_BATCH_MS * 1000)
+        sendBatch(g);
+}
+
+bool gvret_hasPending(const gvret_t *g)
+{
+    return g->batchLen > 0;
+}
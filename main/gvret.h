@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "hal/twai_types.h"
+#include "config.h"
+
+#define GVRET_MAX_FRAME_LEN 20 // Header (2) + timestamp (4) + identifier (4) + length/bus (1) + data (8) + checksum (1)
+
+/// @brief Actions requested by the host, implemented by the protocol owner
+typedef struct
+{
+    void (*send)(void *ctx, const uint8_t *data, size_t len);                        // Send bytes to the host
+    esp_err_t (*setBus)(void *ctx, bool enabled, bool listenOnly, uint32_t bitrate); // Configure and open/close the CAN bus
+    void (*getBus)(void *ctx, bool *enabled, bool *listenOnly, uint32_t *bitrate);   // Get current CAN bus configuration
+    esp_err_t (*transmit)(void *ctx, twai_message_t *msg);                           // Send a frame on the CAN bus
+} gvret_callbacks_t;
+
+/// @brief GVRET protocol state of a host connection
+typedef struct
+{
+    const gvret_callbacks_t *callbacks;
+    void *ctx;
+    uint8_t state;                       // Command being parsed
+    uint8_t step;                        // Command byte index
+    uint32_t value;                      // Multi-byte argument being parsed
+    uint32_t bitrate;                    // CAN0 bitrate argument of SETUP_CANBUS
+    twai_message_t frame;                // Frame being parsed
+    uint8_t batch[APP_GVRET_BATCH_SIZE]; // Received frames, sent to the host in batches
+    size_t batchLen;
+    int64_t batchStart;                  // Time of the first frame in the batch (us)
+} gvret_t;
+
+/// @brief Initialize GVRET protocol state
+/// @param ctx Passed to callbacks
+void gvret_init(gvret_t *g, const gvret_callbacks_t *callbacks, void *ctx);
+
+/// @brief Check if data received from the host starts a GVRET session (binary mode request)
+bool gvret_isHandshake(const uint8_t *data, size_t len);
+
+/// @brief Parse data received from the host, commands may span multiple calls
+void gvret_processInput(gvret_t *g, const uint8_t *data, size_t len);
+
+/// @brief Add a received CAN frame to the output batch, the batch is sent when full or too old
+/// @param timestampUs Frame reception time
+void gvret_queueFrame(gvret_t *g, const twai_message_t *msg, int64_t timestampUs);
+
+/// @brief Send the output batch if it is older than APP_GVRET_BATCH_MS
+/// @param nowUs Current time
+void gvret_flush(gvret_t *g, int64_t nowUs);
+
+/// @brief Check if the output batch holds frames not sent yet
+bool gvret_hasPending(const gvret_t *g);
@@ -0,0 +1,532 @@
+/*
+Implementation of ISO-TP (ISO 15765-2) transport protocol over CAN
+Flow Control frames are generated on the device, so that N_Br/N_Cs timing requirements are met regardless of host latency
+*/
+
+#include "isotp.h"
+
+#include "config.h"
+#include "can.h"
+#include "rtos.h"
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#define TAG "ISOTP"
+
+#define ISOTP_PCI_SF 0x0 // Single Frame
+#define ISOTP_PCI_FF 0x1 // First Frame
+#define ISOTP_PCI_CF 0x2 // Consecutive Frame
+#define ISOTP_PCI_FC 0x3 // Flow Control
+
+#define ISOTP_FC_CTS 0x0   // Continue To Send
+#define ISOTP_FC_WAIT 0x1  // Wait
+#define ISOTP_FC_OVFLW 0x2 // Overflow
+#define ISOTP_FC_NONE 0xFF // No Flow Control frame pending
+
+#define ISOTP_SF_MAX_LEN 7
+#define ISOTP_FF_DATA_LEN 6
+#define ISOTP_CF_DATA_LEN 7
+#define ISOTP_MAX_PDU_LEN 4095
+
+typedef enum
+{
+    RX_IDLE,
+    RX_RECEIVING,
+} rxState_t;
+
+typedef enum
+{
+    TX_IDLE,
+    TX_WAIT_FC,
+    TX_SENDING,
+} txState_t;
+
+struct isotp_session
+{
+    bool inUse;
+    isotp_config_t config;
+
+    rxState_t rxState;
+    size_t rxLen;        // Expected PDU length
+    size_t rxPos;        // Bytes received so far
+    uint8_t rxSn;        // Next expected sequence number
+    uint8_t rxBlockCnt;  // CFs received since last FC
+    int64_t rxDeadline;  // N_Cr deadline (us)
+    uint8_t rxFcPending; // Flow status of the Flow Control frame the ISO-TP task must send, ISOTP_FC_NONE if none
+    uint8_t rxBuf[APP_ISOTP_RX_BUF_SIZE];
+
+    txState_t txState;
+    size_t txLen;
+    size_t txPos;
+    uint8_t txSn;
+    uint8_t txBlockSize; // BS received from peer
+    uint8_t txBlockCnt;  // CFs sent since last FC
+    uint32_t txStMinUs;  // STmin received from peer
+    uint8_t txWftCnt;    // FC.WAIT frames received in a row
+    int64_t txDeadline;  // N_Bs deadline while waiting for FC, time of next CF while sending (us)
+    uint8_t txBuf[APP_ISOTP_TX_BUF_SIZE];
+};
+
+/// @brief Callback invocation, deferred until the sessions lock is released
+typedef struct
+{
+    isotp_session_t *session;
+    isotp_callback_t callback;
+    void *ctx;
+    isotp_result_t result;
+    const uint8_t *data;
+    size_t len;
+} event_t;
+
+static isotp_session_t sessions[APP_ISOTP_MAX_SESSIONS];
+static StaticSemaphore_t sessionsLockBuffer;
+static SemaphoreHandle_t sessionsLock = NULL;
+static TaskHandle_t _isotpTask = NULL;
+
+/// @brief Convert STmin from its ISO 15765-2 encoding to microseconds
+static uint32_t stMinToUs(uint8_t stMin)
+{
+    if (stMin <= 0x7F)
+        return stMin * 1000;
+    if (stMin >= 0xF1 && stMin <= 0xF9)
+        return (stMin - 0xF0) * 100;
+    return 0x7F * 1000; // Reserved values must be interpreted as the longest STmin
+}
+
+/// @brief Build a padded frame of a session, transmitted with @ref transmitFrame once sessionsLock is released
+static void buildFrame(const isotp_session_t *s, const uint8_t *data, size_t len, twai_message_t *frame)
+{
+    *frame = (twai_message_t){
+        .extd = s->config.extd,
+        .identifier = s->config.txId,
+        .data_length_code = 8,
+    };
+    memcpy(frame->data, data, len);
+    memset(frame->data + len, APP_ISOTP_PADDING, 8 - len);
+}
+
+/// @brief Transmit a frame, must not be called with sessionsLock held (can_transmit waits for TX queue space)
+static esp_err_t transmitFrame(const twai_message_t *frame)
+{
+    esp_err_t ret = can_transmit(frame, pdMS_TO_TICKS(APP_ISOTP_CAN_TX_TIMEOUT_MS));
+    if (ret != ESP_OK)
+        ESP_LOGW(TAG, "%03lX: frame transmit failed", frame->identifier);
+    return ret;
+}
+
+/// @brief Have the ISO-TP task send a Flow Control frame, so that the CAN RX path never waits for the TX queue
+static void sendFlowControl(isotp_session_t *s, uint8_t flowStatus)
+{
+    s->rxFcPending = flowStatus;
+    xTaskNotifyGive(_isotpTask);
+}
+
+static void setEvent(event_t *event, isotp_session_t *s, isotp_result_t result, const uint8_t *data, size_t len)
+{
+    event->session = s;
+    event->callback = s->config.callback;
+    event->ctx = s->config.ctx;
+    event->result = result;
+    event->data = data;
+    event->len = len;
+}
+
+static void fireEvent(event_t *event)
+{
+    if (event->callback != NULL)
+        event->callback(event->session, event->result, event->data, event->len, event->ctx);
+}
+
+/// @brief Handle a frame addressed to a session, must be called with sessionsLock held
+/// @return true if an event has been set
+static bool handleFrame(isotp_session_t *s, const twai_message_t *msg, event_t *event)
+{
+    const uint8_t *d = msg->data;
+    uint8_t dlc = msg->data_length_code;
+    int64_t now = esp_timer_get_time();
+
+    if (dlc == 0)
+        return false;
+
+    switch (d[0] >> 4)
+    {
+    case ISOTP_PCI_SF:
+    {
+        size_t len = d[0] & 0xF;
+        if (len == 0 || len > ISOTP_SF_MAX_LEN || len + 1 > dlc)
+            return false;
+
+        // A new SF terminates any reception in progress
+        memcpy(s->rxBuf, d + 1, len);
+        s->rxState = RX_IDLE;
+        setEvent(event, s, ISOTP_RESULT_OK, s->rxBuf, len);
+        return true;
+    }
+    case ISOTP_PCI_FF:
+    {
+        if (dlc < 8)
+            return false;
+
+        size_t len = (d[0] & 0xF) << 8 | d[1];
+        if (len <= ISOTP_SF_MAX_LEN)
+            return false;
+        if (len > sizeof(s->rxBuf))
+        {
+            sendFlowControl(s, ISOTP_FC_OVFLW);
+            s->rxState = RX_IDLE;
+            setEvent(event, s, ISOTP_RESULT_OVERFLOW, NULL, 0);
+            return true;
+        }
+
+        memcpy(s->rxBuf, d + 2, ISOTP_FF_DATA_LEN);
+        s->rxLen = len;
+        s->rxPos = ISOTP_FF_DATA_LEN;
+        s->rxSn = 1;
+        s->rxBlockCnt = 0;
+        s->rxDeadline = now + APP_ISOTP_TIMEOUT_MS * 1000;
+        s->rxState = RX_RECEIVING;
+        sendFlowControl(s, ISOTP_FC_CTS); // Also reschedules the N_Cr deadline
+        return false;
+    }
+    case ISOTP_PCI_CF:
+    {
+        if (s->rxState != RX_RECEIVING)
+            return false;
+
+        if ((d[0] & 0xF) != s->rxSn)
+        {
+            s->rxState = RX_IDLE;
+            setEvent(event, s, ISOTP_RESULT_WRONG_SN, NULL, 0);
+            return true;
+        }
+
+        size_t len = s->rxLen - s->rxPos;
+        if (len > ISOTP_CF_DATA_LEN)
+            len = ISOTP_CF_DATA_LEN;
+        if (len + 1 > dlc)
+            return false;
+
+        memcpy(s->rxBuf + s->rxPos, d + 1, len);
+        s->rxPos += len;
+        s->rxSn = (s->rxSn + 1) & 0xF;
+
+        if (s->rxPos >= s->rxLen)
+        {
+            s->rxState = RX_IDLE;
+            setEvent(event, s, ISOTP_RESULT_OK, s->rxBuf, s->rxLen);
+            return true;
+        }
+
+        s->rxDeadline = now + APP_ISOTP_TIMEOUT_MS * 1000;
+        if (s->config.blockSize > 0 && ++s->rxBlockCnt >= s->config.blockSize)
+        {
+            s->rxBlockCnt = 0;
+            sendFlowControl(s, ISOTP_FC_CTS);
+        }
+        return false;
+    }
+    case ISOTP_PCI_FC:
+    {
+        if (s->txState != TX_WAIT_FC || dlc < 3)
+            return false;
+
+        switch (d[0] & 0xF)
+        {
+        case ISOTP_FC_CTS:
+            s->txBlockSize = d[1];
+            s->txBlockCnt = 0;
+            s->txStMinUs = stMinToUs(d[2]);
+            s->txWftCnt = 0;
+            s->txDeadline = now;
+            s->txState = TX_SENDING;
+            xTaskNotifyGive(_isotpTask);
+            return false;
+        case ISOTP_FC_WAIT:
+            if (++s->txWftCnt > APP_ISOTP_MAX_WFT)
+            {
+                s->txState = TX_IDLE;
+                setEvent(event, s, ISOTP_RESULT_WFT_OVERRUN, NULL, 0);
+                return true;
+            }
+            s->txDeadline = now + APP_ISOTP_TIMEOUT_MS * 1000;
+            return false;
+        case ISOTP_FC_OVFLW:
+            s->txState = TX_IDLE;
+            setEvent(event, s, ISOTP_RESULT_OVERFLOW, NULL, 0);
+            return true;
+        default:
+            return false;
+        }
+    }
+    default:
+        return false;
+    }
+}
+
+/// @brief Build the next Consecutive Frame of a session and advance it, must be called with sessionsLock held
+static void buildConsecutiveFrame(isotp_session_t *s, int64_t now, twai_message_t *frame)
+{
+    uint8_t cf[8];
+    size_t len = s->txLen - s->txPos;
+    if (len > ISOTP_CF_DATA_LEN)
+        len = ISOTP_CF_DATA_LEN;
+
+    cf[0] = ISOTP_PCI_CF << 4 | s->txSn;
+    memcpy(cf + 1, s->txBuf + s->txPos, len);
+    buildFrame(s, cf, len + 1, frame);
+
+    s->txPos += len;
+    s->txSn = (s->txSn + 1) & 0xF;
+
+    if (s->txPos >= s->txLen)
+        s->txState = TX_IDLE;
+    else if (s->txBlockSize > 0 && ++s->txBlockCnt >= s->txBlockSize)
+    {
+        s->txState = TX_WAIT_FC;
+        s->txDeadline = now + APP_ISOTP_TIMEOUT_MS * 1000;
+    }
+    else
+        s->txDeadline = now + s->txStMinUs;
+}
+
+/// @brief Send Flow Control frames, pace Consecutive Frames and handle N_Bs/N_Cr timeouts
+static void isotpTask(void *arg)
+{
+    (void)arg;
+
+    event_t events[APP_ISOTP_MAX_SESSIONS * 2];
+    twai_message_t frames[APP_ISOTP_MAX_SESSIONS * 2];
+
+    while (1)
+    {
+        size_t eventCnt = 0;
+        size_t frameCnt = 0;
+        int64_t now = esp_timer_get_time();
+        int64_t nextDeadline = INT64_MAX;
+
+        xSemaphoreTake(sessionsLock, portMAX_DELAY);
+        for (size_t i = 0; i < APP_ISOTP_MAX_SESSIONS; i++)
+        {
+            isotp_session_t *s = &sessions[i];
+            if (!s->inUse)
+                continue;
+
+            if (s->rxFcPending != ISOTP_FC_NONE)
+            {
+                uint8_t fc[3] = {ISOTP_PCI_FC << 4 | s->rxFcPending, s->config.blockSize, s->config.stMin};
+                buildFrame(s, fc, sizeof(fc), &frames[frameCnt++]);
+                s->rxFcPending = ISOTP_FC_NONE;
+            }
+
+            if (s->rxState == RX_RECEIVING)
+            {
+                if (now >= s->rxDeadline)
+                {
+                    s->rxState = RX_IDLE;
+                    setEvent(&events[eventCnt++], s, ISOTP_RESULT_TIMEOUT_CR, NULL, 0);
+                }
+                else if (s->rxDeadline < nextDeadline)
+                    nextDeadline = s->rxDeadline;
+            }
+
+            // At most one CF per session per iteration, so that the lock is not held for a whole block
+            if (s->txState == TX_SENDING && now >= s->txDeadline)
+                buildConsecutiveFrame(s, now, &frames[frameCnt++]);
+            else if (s->txState == TX_WAIT_FC && now >= s->txDeadline)
+            {
+                s->txState = TX_IDLE;
+                setEvent(&events[eventCnt++], s, ISOTP_RESULT_TIMEOUT_BS, NULL, 0);
+            }
+
+            if (s->txState != TX_IDLE && s->txDeadline < nextDeadline)
+                nextDeadline = s->txDeadline;
+        }
+        xSemaphoreGive(sessionsLock);
+
+        for (size_t i = 0; i < frameCnt; i++)
+            transmitFrame(&frames[i]);
+        for (size_t i = 0; i < eventCnt; i++)
+            fireEvent(&events[i]);
+
+        TickType_t ticksToWait = portMAX_DELAY;
+        if (nextDeadline != INT64_MAX)
+        {
+            int64_t waitUs = nextDeadline - esp_timer_get_time();
+            if (waitUs <= 0)
+                continue;
+            ticksToWait = pdMS_TO_TICKS((waitUs + 999) / 1000);
+            if (ticksToWait == 0)
+                ticksToWait = 1;
+        }
+        ulTaskNotifyTake(pdTRUE, ticksToWait);
+    }
+}
+
+void isotp_processFrame(const twai_message_t *msg)
+{
+    event_t event;
+    bool hasEvent = false;
+
+    xSemaphoreTake(sessionsLock, portMAX_DELAY);
+    for (size_t i = 0; i < APP_ISOTP_MAX_SESSIONS; i++)
+    {
+        isotp_session_t *s = &sessions[i];
+        if (s->inUse && s->config.rxId == msg->identifier && s->config.extd == msg->extd && !msg->rtr)
+        {
+            hasEvent = handleFrame(s, msg, &event);
+            break;
+        }
+    }
+    xSemaphoreGive(sessionsLock);
+
+    // Received data stays valid during the callback: only this task writes session RX buffers
+    if (hasEvent)
+        fireEvent(&event);
+}
+
+esp_err_t isotp_open(const isotp_config_t *config, isotp_session_t **session)
+{
+    esp_err_t ret = ESP_ERR_NO_MEM;
+
+    xSemaphoreTake(sessionsLock, portMAX_DELAY);
+    for (size_t i = 0; i < APP_ISOTP_MAX_SESSIONS; i++)
+    {
+        if (sessions[i].inUse && sessions[i].config.rxId == config->rxId && sessions[i].config.extd == config->extd)
+        {
+            ret = ESP_ERR_INVALID_STATE;
+            break;
+        }
+    }
+
+    if (ret != ESP_ERR_INVALID_STATE)
+    {
+        for (size_t i = 0; i < APP_ISOTP_MAX_SESSIONS; i++)
+        {
+            isotp_session_t *s = &sessions[i];
+            if (!s->inUse)
+            {
+                s->config = *config;
+                s->rxState = RX_IDLE;
+                s->rxFcPending = ISOTP_FC_NONE;
+                s->txState = TX_IDLE;
+                s->inUse = true;
+                *session = s;
+                ret = ESP_OK;
+                break;
+            }
+        }
+    }
+    xSemaphoreGive(sessionsLock);
+
+    if (ret == ESP_OK)
+        ESP_LOGI(TAG, "open tx:%03lX rx:%03lX bs:%u stmin:%u", config->txId, config->rxId, config->blockSize, config->stMin);
+    return ret;
+}
+
+esp_err_t isotp_close(isotp_session_t *session)
+{
+    if (session == NULL || !session->inUse)
+        return ESP_ERR_INVALID_ARG;
+
+    xSemaphoreTake(sessionsLock, portMAX_DELAY);
+    session->inUse = false;
+    session->rxState = RX_IDLE;
+    session->txState = TX_IDLE;
+    xSemaphoreGive(sessionsLock);
+
+    ESP_LOGI(TAG, "close tx:%03lX rx:%03lX", session->config.txId, session->config.rxId);
+    return ESP_OK;
+}
+
+isotp_session_t *isotp_find(uint32_t txId, uint32_t rxId)
+{
+    isotp_session_t *session = NULL;
+
+    xSemaphoreTake(sessionsLock, portMAX_DELAY);
+    for (size_t i = 0; i < APP_ISOTP_MAX_SESSIONS; i++)
+    {
+        if (sessions[i].inUse && sessions[i].config.txId == txId && sessions[i].config.rxId == rxId)
+        {
+            session = &sessions[i];
+            break;
+        }
+    }
+    xSemaphoreGive(sessionsLock);
+
+    return session;
+}
+
+const isotp_config_t *isotp_getConfig(isotp_session_t *session)
+{
+    return &session->config;
+}
+
+esp_err_t isotp_send(isotp_session_t *session, const uint8_t *data, size_t len)
+{
+    if (session == NULL || !session->inUse)
+        return ESP_ERR_INVALID_ARG;
+    if (len == 0 || len > sizeof(session->txBuf) || len > ISOTP_MAX_PDU_LEN)
+        return ESP_ERR_INVALID_SIZE;
+    if (!can_isOpen())
+        return ESP_ERR_INVALID_STATE;
+
+    esp_err_t ret = ESP_OK;
+    twai_message_t frame;
+
+    xSemaphoreTake(sessionsLock, portMAX_DELAY);
+    if (session->txState != TX_IDLE)
+        ret = ESP_ERR_INVALID_STATE;
+    else if (len <= ISOTP_SF_MAX_LEN)
+    {
+        uint8_t sf[8];
+        sf[0] = ISOTP_PCI_SF << 4 | len;
+        memcpy(sf + 1, data, len);
+        buildFrame(session, sf, len + 1, &frame);
+    }
+    else
+    {
+        memcpy(session->txBuf, data, len);
+        session->txLen = len;
+        session->txPos = ISOTP_FF_DATA_LEN;
+        session->txSn = 1;
+        session->txWftCnt = 0;
+
+        uint8_t ff[8];
+        ff[0] = ISOTP_PCI_FF << 4 | len >> 8;
+        ff[1] = len & 0xFF;
+        memcpy(ff + 2, data, ISOTP_FF_DATA_LEN);
+        buildFrame(session, ff, sizeof(ff), &frame);
+
+        session->txDeadline = esp_timer_get_time() + APP_ISOTP_TIMEOUT_MS * 1000;
+        session->txState = TX_WAIT_FC;
+        xTaskNotifyGive(_isotpTask);
+    }
+    xSemaphoreGive(sessionsLock);
+
+    if (ret != ESP_OK)
+        return ret;
+
+    // A lost Single Frame or First Frame ends the transfer at once, the caller sees the error instead of a timeout
+    ret = transmitFrame(&frame);
+    if (ret != ESP_OK)
+    {
+        xSemaphoreTake(sessionsLock, portMAX_DELAY);
+        session->txState = TX_IDLE;
+        xSemaphoreGive(sessionsLock);
+    }
+    return ret;
+}
+
+void isotp_init(void)
+{
+    sessionsLock = xSemaphoreCreateMutexStatic(&sessionsLockBuffer);
+
+    _isotpTask = rtos_createTask(RTOS_TASK_ISOTP, NULL, isotpTask, NULL);
+
+    ESP_LOGI(TAG, "initialized");
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "hal/twai_types.h"
+
+/// @brief ISO-TP (ISO 15765-2) session, identified by its TX/RX CAN identifier pair
+typedef struct isotp_session isotp_session_t;
+
+/// @brief Result reported to the session callback
+typedef enum
+{
+    ISOTP_RESULT_OK = 0,        // Complete PDU received
+    ISOTP_RESULT_TIMEOUT_BS,    // N_Bs expired: no Flow Control received while sending
+    ISOTP_RESULT_TIMEOUT_CR,    // N_Cr expired: no Consecutive Frame received while receiving
+    ISOTP_RESULT_WRONG_SN,      // Consecutive Frame with unexpected sequence number
+    ISOTP_RESULT_OVERFLOW,      // Peer answered with FC.OVFLW, or incoming PDU does not fit the buffer
+    ISOTP_RESULT_WFT_OVERRUN,   // Peer sent too many FC.WAIT frames
+} isotp_result_t;
+
+/// @brief Session callback, invoked for received PDUs and for errors
+/// @param session Session the event belongs to
+/// @param result @ref ISOTP_RESULT_OK for a received PDU, error code otherwise
+/// @param data Received PDU (only valid during the call, points into the session buffer), NULL on errors
+/// @param len Received PDU length in bytes, 0 on errors
+/// @param ctx User context given in @ref isotp_config_t
+typedef void (*isotp_callback_t)(isotp_session_t *session, isotp_result_t result, const uint8_t *data, size_t len, void *ctx);
+
+/// @brief Session configuration
+typedef struct
+{
+    uint32_t txId;             // Identifier for outgoing frames (SF, FF, CF and our FC)
+    uint32_t rxId;             // Identifier of incoming frames
+    bool extd;                 // Use 29bit identifiers
+    uint8_t blockSize;         // BS advertised in our Flow Control frames (0 = no further FC)
+    uint8_t stMin;             // STmin advertised in our Flow Control frames (ISO 15765-2 encoding)
+    isotp_callback_t callback; // Called from the CAN RX or ISO-TP task context, must not block
+    void *ctx;                 // Passed to callback
+} isotp_config_t;
+
+/// @brief Initialize ISO-TP component
+void isotp_init(void);
+
+/// @brief Open a new session
+/// @param config Session configuration
+/// @param session Output session handle
+/// @return ESP_ERR_INVALID_STATE if a session with the same RX identifier exists, ESP_ERR_NO_MEM if all sessions are in use
+esp_err_t isotp_open(const isotp_config_t *config, isotp_session_t **session);
+
+/// @brief Close a session, aborting any transfer in progress
+esp_err_t isotp_close(isotp_session_t *session);
+
+/// @brief Find an open session by identifier pair
+/// @return Session handle or NULL
+isotp_session_t *isotp_find(uint32_t txId, uint32_t rxId);
+
+/// @brief Get the configuration a session was opened with
+const isotp_config_t *isotp_getConfig(isotp_session_t *session);
+
+/// @brief Start sending a PDU, data is copied into the session buffer
+/// @return ESP_ERR_INVALID_STATE if a previous transfer is still in progress, ESP_ERR_INVALID_SIZE if too long, the
+/// can_transmit error if the Single Frame or First Frame was not transmitted (the transfer is then abandoned)
+esp_err_t isotp_send(isotp_session_t *session, const uint8_t *data, size_t len);
+
+/// @brief Feed a received CAN frame to the engine, must be called for every frame received from the bus
+void isotp_processFrame(const twai_message_t *msg);
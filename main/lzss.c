@@ -0,0 +1,121 @@
+/*
+LZSS compressor with a bounded window and hash chains, in the spirit of heatshrink:
+small static footprint (~7KB), history carried across blocks for repetitive streams
+*/
+
+#include "lzss.h"
+
+#include <string.h>
+
+typedef struct
+{
+    uint8_t *out;
+    size_t len;
+    uint32_t bits;   // Pending bits, right aligned
+    uint8_t bitCount;
+} bitWriter_t;
+
+static inline void writeBits(bitWriter_t *w, uint32_t value, uint8_t count)
+{
+    w->bits = w->bits << count | (value & ((1UL << count) - 1));
+    w->bitCount += count;
+    while (w->bitCount >= 8)
+    {
+        w->bitCount -= 8;
+        w->out[w->len++] = w->bits >> w->bitCount;
+    }
+}
+
+static inline void flushBits(bitWriter_t *w)
+{
+    if (w->bitCount > 0)
+        w->out[w->len++] = w->bits << (8 - w->bitCount);
+    w->bitCount = 0;
+}
+
+static inline uint32_t hash(const uint8_t *p)
+{
+    return (uint32_t)((p[0] | p[1] << 8 | p[2] << 16) * 2654435761U) >> (32 - LZSS_HASH_BITS);
+}
+
+static inline void insert(lzss_encoder_t *enc, size_t pos)
+{
+    uint32_t h = hash(enc->buf + pos);
+    enc->prev[pos] = enc->head[h];
+    enc->head[h] = pos;
+}
+
+void lzss_init(lzss_encoder_t *enc)
+{
+    enc->historyLen = 0;
+}
+
+size_t lzss_compressBlock(lzss_encoder_t *enc, const uint8_t *in, size_t len, uint8_t *out)
+{
+    if (len > LZSS_MAX_BLOCK_SIZE)
+        len = LZSS_MAX_BLOCK_SIZE;
+
+    uint8_t *buf = enc->buf;
+    memcpy(buf + enc->historyLen, in, len);
+    size_t total = enc->historyLen + len;
+
+    // Positions are relative to buf, chains are rebuilt for each block starting with the history
+    memset(enc->head, 0xFF, sizeof(enc->head));
+    for (size_t i = 0; i < enc->historyLen && i + LZSS_MIN_MATCH <= total; i++)
+        insert(enc, i);
+
+    bitWriter_t w = {.out = out};
+    size_t pos = enc->historyLen;
+    while (pos < total)
+    {
+        size_t bestLen = 0, bestDist = 0;
+        size_t maxLen = total - pos < LZSS_MAX_MATCH ? total - pos : LZSS_MAX_MATCH;
+
+        if (maxLen >= LZSS_MIN_MATCH)
+        {
+            int candidate = enc->head[hash(buf + pos)];
+            for (int depth = 0; candidate >= 0 && depth < LZSS_MAX_CHAIN; depth++)
+            {
+                size_t dist = pos - candidate;
+                if (dist > LZSS_WINDOW_SIZE)
+                    break; // Older candidates are further away
+
+                size_t matchLen = 0;
+                while (matchLen < maxLen && buf[candidate + matchLen] == buf[pos + matchLen])
+                    matchLen++;
+                if (matchLen > bestLen)
+                {
+                    bestLen = matchLen;
+                    bestDist = dist;
+                    if (matchLen == maxLen)
+                        break;
+                }
+                candidate = enc->prev[candidate];
+            }
+        }
+
+        if (bestLen >= LZSS_MIN_MATCH)
+        {
+            writeBits(&w, 0, 1);
+            writeBits(&w, bestDist - 1, LZSS_WINDOW_BITS);
+            writeBits(&w, bestLen - LZSS_MIN_MATCH, LZSS_LENGTH_BITS);
+        }
+        else
+        {
+            bestLen = 1;
+            writeBits(&w, 1, 1);
+            writeBits(&w, buf[pos], 8);
+        }
+
+        for (size_t end = pos + bestLen; pos < end; pos++)
+            if (pos + LZSS_MIN_MATCH <= total)
+                insert(enc, pos);
+    }
+    flushBits(&w);
+
+    // Keep the end of the stream as history for the next block
+    enc->historyLen = total < LZSS_WINDOW_SIZE ? total : LZSS_WINDOW_SIZE;
+    memmove(buf, buf + total - enc->historyLen, enc->historyLen);
+
+    return w.len;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Stream format, must match tools/btbridge.py
+#define LZSS_WINDOW_BITS 10                                                // Back-reference distance bits
+#define LZSS_LENGTH_BITS 5                                                 // Back-reference length bits
+#define LZSS_MIN_MATCH 3                                                   // Shorter matches are sent as literals
+#define LZSS_WINDOW_SIZE (1 << LZSS_WINDOW_BITS)                           // History shared by consecutive blocks
+#define LZSS_MAX_MATCH (LZSS_MIN_MATCH + (1 << LZSS_LENGTH_BITS) - 1)
+#define LZSS_MAX_BLOCK_SIZE 1024                                           // Maximum uncompressed block size
+#define LZSS_MAX_OUTPUT_SIZE(len) ((len) + ((len) + 7) / 8 + 1)            // Worst case, literals only (9 bits each)
+
+#define LZSS_HASH_BITS 10
+#define LZSS_MAX_CHAIN 16 // Match candidates compared per position, bounds CPU time
+
+/// @brief Compressor state, history is kept between blocks so that repeated content across blocks is matched
+typedef struct
+{
+    uint8_t buf[LZSS_WINDOW_SIZE + LZSS_MAX_BLOCK_SIZE]; // History followed by the block being compressed
+    size_t historyLen;
+    int16_t head[1 << LZSS_HASH_BITS];                    // Last position of each 3 byte prefix hash
+    int16_t prev[LZSS_WINDOW_SIZE + LZSS_MAX_BLOCK_SIZE]; // Previous position with the same hash
+} lzss_encoder_t;
+
+/// @brief Initialize compressor state, with empty history (the decompressor must start at the same point)
+void lzss_init(lzss_encoder_t *enc);
+
+/// @brief Compress a block, the output can be decompressed on its own given the previous blocks
+/// @details Bit stream, MSB first: "1" + 8 bit literal, or "0" + (distance-1) + (length-LZSS_MIN_MATCH);
+/// the last byte is padded with zeros
+/// @param len Block length, at most LZSS_MAX_BLOCK_SIZE
+/// @param out Output buffer, at least LZSS_MAX_OUTPUT_SIZE(len) bytes
+/// @return Compressed length
+size_t lzss_compressBlock(lzss_encoder_t *enc, const uint8_t *in, size_t len, uint8_t *out);
@@ -4,40 +4,26 @@
 #include "uart.h"
 #include "bt.h"
 #include "wifi.h"
+#include "tcp.h"
+#include "socketcand.h"
+#include "ws.h"
 #include "can.h"
+#include "capture.h"
+#include "recorder.h"
+#include "replay.h"
+#include "census.h"
+#include "monitor.h"
+#include "isotp.h"
+#include "obd.h"
+#include "uds.h"
 #include "slcan.h"
 #include "sd.h"
+#include "rtos.h"
+#include "trace.h"
 
-// TODO capture FreeRTOS statistics and optimize task stack sizes, etc...
-
-#include "message.h"
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
-#include "freertos/queue.h"
 #include "esp_log.h"
-#include "esp_heap_caps.h"
-#define TESTPATTERN "12345678987654321"
-
-static char taskList[1024];
-void testTask(void *arg)
-{
-    while (1)
-    {
-        // message_t msg = message_new((uint8_t *)TESTPATTERN, sizeof(TESTPATTERN));
-        // if (xQueueSend(btTxQueue, &msg, 0) == errQUEUE_FULL)
-        // {
-        //     ESP_LOGE("testTask", "queue full");
-        //     message_free(&msg);
-        // }
-
-        heap_caps_print_heap_info(MALLOC_CAP_DEFAULT);
 
-        vTaskList(taskList);
-        ESP_LOGW("task", "%s", taskList);
-
-        vTaskDelay(pdMS_TO_TICKS(5000));
-    }
-}
+#define TAG "MAIN"
 
 void app_main(void)
 {
@@ -50,11 +36,33 @@ void app_main(void)
     }
     ESP_ERROR_CHECK(ret);
 
-    // uartInit();
+    trace_init();
+
+    // CAN first: with auto start (Q command) the bus is opened by slcan_init(), before the slow radio initialization
+    can_setBackend(&can_twaiBackend);
+    capture_init();
+    recorder_init();
+    replay_init();
+    census_init();
+    monitor_init();
+    isotp_init();
+    obd_init();
+    uds_init();
+    slcan_init(); // Requires NVS, capture consumers
+
+    uartInit();
     bt_init();
-    // wifiInit();
-    slcan_init(&btRxQueue, &btTxQueue);
-    // sdInit();
+    wifiInit();
+    tcp_init();        // Requires wifiInit()
+    socketcand_init(); // Requires wifiInit()
+    ws_init();         // Requires wifiInit(), capture_init()
+    slcan_addLink("uart", &uartRxQueue, &uartTxQueue);
+    slcan_addLink("bt", &btRxQueue, &btTxQueue);
+    slcan_addLink("tcp", &tcpRxQueue, &tcpTxQueue);
+    sdInit(); // Requires capture_init()
 
-    // xTaskCreate(testTask, "testTask", 2048, NULL, 1, NULL);
+    // Tasks, queues and message buffers are static from here on, see "fm" SLCAN command for their usage
+    rtos_heapStats_t heap;
+    rtos_getHeapStats(&heap);
+    ESP_LOGI(TAG, "started heap free:%lu min:%lu internal:%lu", heap.freeBytes, heap.minFreeBytes, heap.internalFreeBytes);
 }
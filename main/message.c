@@ -1,24 +1,164 @@
+/*
+Message buffers are blocks of fixed pools allocated at build time, nothing is taken from the heap at runtime: a message
+takes a free block of the smallest size class that fits its length. Classes do not borrow from larger ones, so bursts of
+short messages cannot take the large blocks that UART and SPP reads need. Messages queued for a link are charged to its
+budget, which caps the blocks a slow host can hold. A sender that gets no block drops its message like it would on a
+full queue.
+*/
+
 #include "message.h"
 
-#include <stdlib.h>
+#include "config.h"
+
 #include <string.h>
+#include "freertos/FreeRTOS.h"
 #include "esp_log.h"
 
 #define TAG "message"
 
-message_t message_new(uint8_t *data, size_t length)
+typedef struct
+{
+    uint8_t *blocks;
+    uint32_t blockSize;
+    uint32_t blockCount;
+    uint16_t *freeList; // Indexes of released blocks, last released first
+    uint32_t freeCount;
+    uint32_t fresh; // Blocks never used start at this index
+    message_poolStats_t stats;
+} pool_t;
+
+_Static_assert(APP_MESSAGE_SMALL_SIZE < APP_MESSAGE_MEDIUM_SIZE && APP_MESSAGE_MEDIUM_SIZE < APP_MESSAGE_LARGE_SIZE,
+               "message pools must be ordered by block size");
+
+// Links transmit queues (SLCAN links and socketcand) must leave blocks of every class to received data
+#define MESSAGE_LINKS (APP_SLCAN_MAX_LINKS + 1)
+_Static_assert(MESSAGE_LINKS * APP_MESSAGE_LINK_SMALL_BLOCKS < APP_MESSAGE_SMALL_COUNT &&
+                   MESSAGE_LINKS * APP_MESSAGE_LINK_MEDIUM_BLOCKS < APP_MESSAGE_MEDIUM_COUNT &&
+                   MESSAGE_LINKS * APP_MESSAGE_LINK_LARGE_BLOCKS < APP_MESSAGE_LARGE_COUNT,
+               "link budgets exceed the message pools");
+
+static uint8_t smallBlocks[APP_MESSAGE_SMALL_COUNT][APP_MESSAGE_SMALL_SIZE] __attribute__((aligned(4)));
+static uint8_t mediumBlocks[APP_MESSAGE_MEDIUM_COUNT][APP_MESSAGE_MEDIUM_SIZE] __attribute__((aligned(4)));
+static uint8_t largeBlocks[APP_MESSAGE_LARGE_COUNT][APP_MESSAGE_LARGE_SIZE] __attribute__((aligned(4)));
+static uint16_t smallFree[APP_MESSAGE_SMALL_COUNT];
+static uint16_t mediumFree[APP_MESSAGE_MEDIUM_COUNT];
+static uint16_t largeFree[APP_MESSAGE_LARGE_COUNT];
+
+#define POOL(array, free)                               \
+    {                                                   \
+        .blocks = &array[0][0],                         \
+        .blockSize = sizeof(array[0]),                  \
+        .blockCount = sizeof(array) / sizeof(array[0]), \
+        .freeList = free,                               \
+    }
+
+static pool_t pools[MESSAGE_POOL_COUNT] = {
+    POOL(smallBlocks, smallFree),
+    POOL(mediumBlocks, mediumFree),
+    POOL(largeBlocks, largeFree),
+};
+
+static const uint16_t BUDGET_LIMITS[MESSAGE_POOL_COUNT] = {
+    APP_MESSAGE_LINK_SMALL_BLOCKS,
+    APP_MESSAGE_LINK_MEDIUM_BLOCKS,
+    APP_MESSAGE_LINK_LARGE_BLOCKS,
+};
+
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+message_t message_allocBudget(message_budget_t *budget, size_t length)
+{
+    message_t msg = {0};
+
+    // Smallest class that fits, larger than every block counts as a failure of the largest class
+    size_t i = 0;
+    while (i < MESSAGE_POOL_COUNT - 1 && length > pools[i].blockSize)
+        i++;
+    pool_t *pool = &pools[i];
+
+    portENTER_CRITICAL(&lock);
+    if (length > pool->blockSize)
+        pool->stats.failures++;
+    else if (budget != NULL && budget->used[i] >= BUDGET_LIMITS[i])
+        pool->stats.limited++;
+    else
+    {
+        if (pool->freeCount > 0)
+            msg.data = pool->blocks + pool->freeList[--pool->freeCount] * pool->blockSize;
+        else if (pool->fresh < pool->blockCount)
+            msg.data = pool->blocks + pool->fresh++ * pool->blockSize;
+
+        if (msg.data == NULL)
+            pool->stats.failures++;
+        else
+        {
+            msg.length = length;
+            if (++pool->stats.used > pool->stats.peakUsed)
+                pool->stats.peakUsed = pool->stats.used;
+            if (budget != NULL)
+            {
+                budget->used[i]++;
+                msg.budget = budget;
+            }
+        }
+    }
+    portEXIT_CRITICAL(&lock);
+
+    return msg;
+}
+
+message_t message_alloc(size_t length)
 {
-    message_t msg = {
-        .length = length,
-        .data = (uint8_t *)malloc(length),
-    };
-    // ESP_LOGI(TAG, "new %p %d", msg.data, msg.length);
-    memcpy(msg.data, data, length);
+    return message_allocBudget(NULL, length);
+}
+
+message_t message_newBudget(message_budget_t *budget, uint8_t *data, size_t length)
+{
+    message_t msg = message_allocBudget(budget, length);
+    if (msg.data != NULL)
+        memcpy(msg.data, data, length);
     return msg;
 }
 
+message_t message_new(uint8_t *data, size_t length)
+{
+    return message_newBudget(NULL, data, length);
+}
+
 void message_free(message_t *msg)
 {
-    // ESP_LOGI(TAG, "free %p %d", msg->data, msg->length);
-    free(msg->data);
+    if (msg->data == NULL)
+        return;
+
+    portENTER_CRITICAL(&lock);
+    for (size_t i = 0; i < MESSAGE_POOL_COUNT; i++)
+    {
+        pool_t *pool = &pools[i];
+        if (msg->data >= pool->blocks && msg->data < pool->blocks + pool->blockCount * pool->blockSize)
+        {
+            pool->freeList[pool->freeCount++] = (msg->data - pool->blocks) / pool->blockSize;
+            pool->stats.used--;
+            if (msg->budget != NULL)
+                msg->budget->used[i]--;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&lock);
+
+    msg->data = NULL;
+    msg->budget = NULL;
+}
+
+bool message_getPoolStats(size_t index, message_poolStats_t *stats)
+{
+    if (index >= MESSAGE_POOL_COUNT)
+        return false;
+
+    portENTER_CRITICAL(&lock);
+    *stats = pools[index].stats;
+    portEXIT_CRITICAL(&lock);
+
+    stats->blockSize = pools[index].blockSize;
+    stats->blocks = pools[index].blockCount;
+    return true;
 }
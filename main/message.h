@@ -1,20 +1,60 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
-/// @brief Dynamically allocated message buffer
+#define MESSAGE_POOL_COUNT 3 // Block size classes: small, medium, large (APP_MESSAGE_* in config.h)
+
+/// @brief Blocks held by the messages of one link transmit queue, at most APP_MESSAGE_LINK_<class>_BLOCKS per class so
+/// that a slow link cannot take the blocks of the other links and of received data
+typedef struct
+{
+    uint16_t used[MESSAGE_POOL_COUNT]; // Smallest blocks first
+} message_budget_t;
+
+/// @brief Message buffer taken from the static message pools, data is NULL when no block was free
 typedef struct
 {
     size_t length;
     uint8_t *data;
+    message_budget_t *budget; // Budget the block is charged to, NULL when not limited
 } message_t;
 
+/// @brief Usage of one message pool (block size class), since boot
+typedef struct
+{
+    uint32_t blockSize;
+    uint32_t blocks;
+    uint32_t used;     // Blocks currently held by messages
+    uint32_t peakUsed; // Highest number of blocks held at once
+    uint32_t failures; // Messages that found no free block in this class
+    uint32_t limited;  // Messages refused because their link held its budget of this class
+} message_poolStats_t;
+
 /// @brief Allocate and initialize a new @ref message_t instance with the given data
 /// @param data Message data
 /// @param length Data length in bytes
+/// @return Message with NULL data and zero length when the pools are exhausted (or length is too large)
 message_t message_new(uint8_t *data, size_t length);
 
 /// @brief Free an allocated message
-/// @param msg The message to free
+/// @param msg The message to free, may have NULL data
 void message_free(message_t *msg);
+
+/// @brief Allocate a new uninitialized @ref message_t instance, to be filled in by the caller
+/// @param length Data length in bytes
+/// @return Message with NULL data and zero length when the pools are exhausted (or length is too large)
+message_t message_alloc(size_t length);
+
+/// @brief Allocate and initialize a new @ref message_t instance charged to the budget of a link
+/// @return Message with NULL data and zero length when the budget or the pools are exhausted (or length is too large)
+message_t message_newBudget(message_budget_t *budget, uint8_t *data, size_t length);
+
+/// @brief Allocate a new uninitialized @ref message_t instance charged to the budget of a link
+/// @return Message with NULL data and zero length when the budget or the pools are exhausted (or length is too large)
+message_t message_allocBudget(message_budget_t *budget, size_t length);
+
+/// @brief Get the usage of pool index (smallest blocks first)
+/// @return false when index is not a pool
+bool message_getPoolStats(size_t index, message_poolStats_t *stats);
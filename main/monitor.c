@@ -0,0 +1,244 @@
+/*
+Bus monitor: bus load from bit-accurate frame lengths, error counters and state transitions from TWAI alerts,
+automatic bus-off recovery so that the adapter does not stay silent until it is power-cycled
+*/
+
+#include "monitor.h"
+
+#include "config.h"
+#include "can.h"
+#include "capture.h"
+#include "recorder.h"
+#include "rtos.h"
+
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "driver/twai.h"
+
+#define TAG "MONITOR"
+
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+static monitor_stats_t stats = {.autoRecovery = APP_MONITOR_AUTO_RECOVERY};
+static uint8_t flags = 0;
+
+// Monitor task only
+static int64_t busOffUs = 0; // Start of the current outage, 0 when the bus is on
+static int64_t windowStartUs = 0;
+static uint32_t windowStartBits = 0;
+static uint32_t lastTxQueueFull = 0;
+
+/// @brief Error state from the error counters, ISO 11898-1 limits
+static monitor_state_t stateOf(const twai_status_info_t *info)
+{
+    if (info->state == TWAI_STATE_BUS_OFF)
+        return MONITOR_BUS_OFF;
+    if (info->state == TWAI_STATE_RECOVERING)
+        return MONITOR_RECOVERING;
+    if (info->tx_error_counter >= 128 || info->rx_error_counter >= 128)
+        return MONITOR_ERROR_PASSIVE;
+    if (info->tx_error_counter >= 96 || info->rx_error_counter >= 96)
+        return MONITOR_ERROR_WARNING;
+    return MONITOR_ERROR_ACTIVE;
+}
+
+/// @brief Restart the window and the outage tracking when the connection opens
+static void startMonitoring(void)
+{
+    can_counters_t counters;
+    can_getCounters(&counters);
+    windowStartBits = counters.busBits;
+    lastTxQueueFull = counters.txQueueFull;
+    windowStartUs = esp_timer_get_time();
+    busOffUs = 0;
+
+    portENTER_CRITICAL(&lock);
+    stats.state = MONITOR_ERROR_ACTIVE;
+    stats.loadPermille = 0;
+    flags = 0;
+    portEXIT_CRITICAL(&lock);
+}
+
+static void handleAlerts(uint32_t alerts)
+{
+    uint8_t raised = 0;
+    if (alerts & TWAI_ALERT_RX_QUEUE_FULL)
+        raised |= MONITOR_FLAG_RX_QUEUE_FULL;
+    if (alerts & TWAI_ALERT_ABOVE_ERR_WARN)
+        raised |= MONITOR_FLAG_ERROR_WARNING;
+    if (alerts & TWAI_ALERT_RX_FIFO_OVERRUN)
+        raised |= MONITOR_FLAG_DATA_OVERRUN;
+    if (alerts & TWAI_ALERT_ERR_PASS)
+        raised |= MONITOR_FLAG_ERROR_PASSIVE;
+    if (alerts & TWAI_ALERT_ARB_LOST)
+        raised |= MONITOR_FLAG_ARB_LOST;
+    if (alerts & (TWAI_ALERT_BUS_ERROR | TWAI_ALERT_BUS_OFF))
+        raised |= MONITOR_FLAG_BUS_ERROR;
+
+    portENTER_CRITICAL(&lock);
+    flags |= raised;
+    if (alerts & TWAI_ALERT_ARB_LOST)
+        stats.arbLost++;
+    if (alerts & TWAI_ALERT_TX_FAILED)
+        stats.txFailed++;
+    if (alerts & (TWAI_ALERT_RX_QUEUE_FULL | TWAI_ALERT_RX_FIFO_OVERRUN))
+        stats.rxOverruns++;
+    if (alerts & TWAI_ALERT_ABOVE_ERR_WARN)
+        stats.warnings++;
+    if (alerts & TWAI_ALERT_ERR_PASS)
+        stats.errorPassives++;
+    if (alerts & TWAI_ALERT_BUS_OFF)
+        stats.busOffs++;
+    portEXIT_CRITICAL(&lock);
+
+    if (alerts & TWAI_ALERT_ERR_PASS)
+        ESP_LOGW(TAG, "error passive");
+
+    if (alerts & TWAI_ALERT_BUS_OFF)
+    {
+        busOffUs = esp_timer_get_time();
+        ESP_LOGE(TAG, "bus-off");
+        recorder_notifyBusOff();
+    }
+
+    // Recovery leaves the controller stopped, the outage ends when it is started again
+    if ((alerts & TWAI_ALERT_BUS_RECOVERED) && can_restart() == ESP_OK && busOffUs != 0)
+    {
+        uint32_t outageMs = (esp_timer_get_time() - busOffUs) / 1000;
+        busOffUs = 0;
+
+        portENTER_CRITICAL(&lock);
+        stats.lastOutageMs = outageMs;
+        stats.totalOutageMs += outageMs;
+        portEXIT_CRITICAL(&lock);
+
+        ESP_LOGW(TAG, "bus-off recovered after %" PRIu32 "ms", outageMs);
+    }
+}
+
+/// @brief Sample error counters, start bus-off recovery, and close the bus load window when it has elapsed
+static void sample(void)
+{
+    twai_status_info_t info;
+    if (can_getStatusInfo(&info) != ESP_OK)
+        return;
+
+    portENTER_CRITICAL(&lock);
+    bool autoRecovery = stats.autoRecovery;
+    portEXIT_CRITICAL(&lock);
+
+    // Also covers automatic recovery enabled while the bus is off
+    if (info.state == TWAI_STATE_BUS_OFF)
+    {
+        if (busOffUs == 0)
+            busOffUs = esp_timer_get_time();
+        if (autoRecovery && can_initiateRecovery() == ESP_OK)
+            ESP_LOGI(TAG, "recovery started");
+    }
+
+    can_counters_t counters;
+    can_getCounters(&counters);
+
+    int64_t nowUs = esp_timer_get_time();
+    int64_t elapsedUs = nowUs - windowStartUs;
+    uint32_t bitrate = capture_getBitrate();
+    int32_t load = -1;
+    if (elapsedUs >= APP_MONITOR_LOAD_WINDOW_MS * 1000LL)
+    {
+        uint64_t bits = counters.busBits - windowStartBits;
+        load = bitrate > 0 ? bits * 1000000000ULL / ((uint64_t)bitrate * elapsedUs) : 0;
+        if (load > 1000)
+            load = 1000; // Frames queued for transmission are counted before they are sent
+        windowStartBits = counters.busBits;
+        windowStartUs = nowUs;
+    }
+
+    portENTER_CRITICAL(&lock);
+    stats.state = stateOf(&info);
+    stats.tec = info.tx_error_counter;
+    stats.rec = info.rx_error_counter;
+    stats.busErrors = info.bus_error_count;
+    if (stats.tec > stats.peakTec)
+        stats.peakTec = stats.tec;
+    if (stats.rec > stats.peakRec)
+        stats.peakRec = stats.rec;
+    if (load >= 0)
+    {
+        stats.loadPermille = load;
+        if (load > stats.peakLoadPermille)
+            stats.peakLoadPermille = load;
+    }
+    if (counters.txQueueFull != lastTxQueueFull)
+        flags |= MONITOR_FLAG_TX_QUEUE_FULL;
+    portEXIT_CRITICAL(&lock);
+
+    lastTxQueueFull = counters.txQueueFull;
+}
+
+static void monitorTask(void *arg)
+{
+    bool monitoring = false;
+
+    while (1)
+    {
+        // Bus errors of bitrate detection are not reported, the connection is reopened afterwards
+        if (!can_isOpen() || capture_isDetecting())
+        {
+            if (monitoring)
+            {
+                portENTER_CRITICAL(&lock);
+                stats.state = MONITOR_CLOSED;
+                stats.loadPermille = 0;
+                portEXIT_CRITICAL(&lock);
+                monitoring = false;
+            }
+            vTaskDelay(pdMS_TO_TICKS(APP_MONITOR_ALERT_WAIT_MS));
+            continue;
+        }
+
+        if (!monitoring)
+        {
+            startMonitoring();
+            monitoring = true;
+        }
+
+        uint32_t alerts = 0;
+        esp_err_t res = can_readAlerts(&alerts, pdMS_TO_TICKS(APP_MONITOR_ALERT_WAIT_MS));
+        if (res == ESP_OK)
+            handleAlerts(alerts);
+        else if (res != ESP_ERR_TIMEOUT)
+            continue; // Closed meanwhile
+
+        sample();
+    }
+}
+
+void monitor_init(void)
+{
+    rtos_createTask(RTOS_TASK_MONITOR, NULL, monitorTask, NULL);
+}
+
+uint8_t monitor_takeFlags(void)
+{
+    portENTER_CRITICAL(&lock);
+    uint8_t value = flags;
+    flags = 0;
+    portEXIT_CRITICAL(&lock);
+    return value;
+}
+
+void monitor_getStats(monitor_stats_t *out)
+{
+    portENTER_CRITICAL(&lock);
+    *out = stats;
+    portEXIT_CRITICAL(&lock);
+}
+
+void monitor_setAutoRecovery(bool enable)
+{
+    portENTER_CRITICAL(&lock);
+    stats.autoRecovery = enable;
+    portEXIT_CRITICAL(&lock);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Status flags, bit layout of the LAWICEL "F" command reply
+#define MONITOR_FLAG_RX_QUEUE_FULL 0x01 // Frames lost, driver RX queue full
+#define MONITOR_FLAG_TX_QUEUE_FULL 0x02 // Transmission refused, driver TX queue full
+#define MONITOR_FLAG_ERROR_WARNING 0x04 // Error counter reached the warning limit (96)
+#define MONITOR_FLAG_DATA_OVERRUN 0x08  // Frames lost, controller RX FIFO overrun
+#define MONITOR_FLAG_ERROR_PASSIVE 0x20 // Error counter reached the error passive limit (128)
+#define MONITOR_FLAG_ARB_LOST 0x40      // Arbitration lost
+#define MONITOR_FLAG_BUS_ERROR 0x80     // Bus error or bus-off
+
+typedef enum
+{
+    MONITOR_CLOSED,        // CAN connection not open
+    MONITOR_ERROR_ACTIVE,  // TEC and REC below 96
+    MONITOR_ERROR_WARNING, // TEC or REC at least 96
+    MONITOR_ERROR_PASSIVE, // TEC or REC at least 128
+    MONITOR_BUS_OFF,       // TEC above 255, not transmitting nor receiving
+    MONITOR_RECOVERING,    // Bus-off recovery in progress
+} monitor_state_t;
+
+typedef struct
+{
+    monitor_state_t state;
+    uint16_t loadPermille;   // Bus load over the last APP_MONITOR_LOAD_WINDOW_MS
+    uint16_t peakLoadPermille;
+    uint32_t tec;            // Transmit error counter
+    uint32_t rec;            // Receive error counter
+    uint32_t peakTec;
+    uint32_t peakRec;
+    uint32_t busErrors;      // Error frames detected by the controller
+    uint32_t arbLost;
+    uint32_t txFailed;       // Single shot transmissions that failed
+    uint32_t rxOverruns;     // Frames lost to RX queue full or controller FIFO overrun
+    uint32_t warnings;       // Transitions to error warning
+    uint32_t errorPassives;  // Transitions to error passive
+    uint32_t busOffs;
+    uint32_t lastOutageMs;   // Duration of the last bus-off, from bus-off to restart
+    uint32_t totalOutageMs;
+    bool autoRecovery;       // Recover from bus-off without host intervention
+} monitor_stats_t;
+
+/// @brief Start the monitor task, it follows the CAN connection state
+void monitor_init(void);
+
+/// @brief Read and clear status flags raised since the last call (MONITOR_FLAG_*)
+uint8_t monitor_takeFlags(void);
+
+void monitor_getStats(monitor_stats_t *stats);
+
+/// @brief Enable/disable automatic bus-off recovery, when disabled the bus stays off until the connection is reopened
+void monitor_setAutoRecovery(bool enable);
@@ -0,0 +1,494 @@
+/*
+OBD-II mode 01 PID poller
+Requests are sent on-device over ISO-TP: up to 6 PIDs are packed in a single request when the ECU supports it,
+and every ECU has its own request in flight. Latest values are cached so that host queries cause no bus traffic.
+*/
+
+#include "obd.h"
+
+#include "config.h"
+#include "can.h"
+#include "isotp.h"
+#include "rtos.h"
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#define TAG "OBD"
+
+#define OBD_REQUEST_ID_BASE 0x7E0
+#define OBD_RESPONSE_ID_BASE 0x7E8
+#define OBD_MODE_CURRENT_DATA 0x01
+#define OBD_POSITIVE_RESPONSE 0x40
+#define OBD_NEGATIVE_RESPONSE 0x7F
+#define OBD_MAX_PIDS_PER_REQUEST 6 // ISO 15031-5 limit
+#define OBD_MAX_RESPONSE_LEN (1 + OBD_MAX_PIDS_PER_REQUEST * 5) // 41 and up to 6 PIDs with 4 data bytes, longer ones are cut
+
+/// @brief Number of data bytes returned for each mode 01 PID (0 = unknown, never packed with other PIDs)
+static const uint8_t PID_LEN[] = {
+    [0x00] = 4, 4, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 2, 1, 1, 1,
+    [0x10] = 2, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1, 2,
+    [0x20] = 4, 2, 2, 2, 4, 4, 4, 4, 4, 4, 4, 4, 1, 1, 1, 1,
+    [0x30] = 1, 2, 2, 1, 4, 4, 4, 4, 4, 4, 4, 4, 2, 2, 2, 2,
+    [0x40] = 4, 4, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 4,
+    [0x50] = 4, 1, 1, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1, 2, 2, 1,
+    [0x60] = 4,
+};
+
+typedef struct
+{
+    bool inUse;
+    bool supported;   // Cleared after repeated missing responses to single-PID requests
+    uint8_t misses;   // Consecutive requests without this PID in the response
+    uint16_t periodMs;
+    int64_t nextDue;  // Time of next request (us)
+    obd_value_t value;
+} entry_t;
+
+typedef struct
+{
+    isotp_session_t *session;
+    bool multiPid; // ECU accepts multiple PIDs per request
+    bool inFlight;
+    int64_t deadline;
+    uint8_t pidCnt;
+    entry_t *pending[OBD_MAX_PIDS_PER_REQUEST]; // Entries requested by the request in flight
+
+    // Response handed over by isotpCallback (CAN RX path) under responseLock, parsed by pollTask
+    bool responseReady;
+    isotp_result_t responseResult;
+    int64_t responseUs;
+    size_t responseLen;
+    uint8_t response[OBD_MAX_RESPONSE_LEN];
+} ecu_t;
+
+static entry_t entries[APP_OBD_MAX_PIDS];
+static ecu_t ecus[OBD_MAX_ECUS];
+static obd_stats_t stats;
+static int64_t statsStart;
+static StaticSemaphore_t obdLockBuffer;
+static SemaphoreHandle_t obdLock = NULL;
+static portMUX_TYPE responseLock = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t _pollTask = NULL;
+
+static uint8_t pidLen(uint8_t pid)
+{
+    return pid < sizeof(PID_LEN) ? PID_LEN[pid] : 0;
+}
+
+/// @brief Apply SAE J1979 scaling for common PIDs
+static float decodePid(uint8_t pid, const uint8_t *d, uint8_t len)
+{
+    uint8_t A = len > 0 ? d[0] : 0;
+    uint8_t B = len > 1 ? d[1] : 0;
+
+    switch (pid)
+    {
+    case 0x04: // Calculated engine load (%)
+    case 0x11: // Throttle position (%)
+    case 0x2F: // Fuel tank level (%)
+    case 0x45: // Relative throttle position (%)
+    case 0x47: // Absolute throttle position B (%)
+    case 0x49: // Accelerator pedal position D (%)
+    case 0x4A: // Accelerator pedal position E (%)
+    case 0x4C: // Commanded throttle actuator (%)
+    case 0x52: // Ethanol fuel (%)
+    case 0x5A: // Relative accelerator pedal position (%)
+    case 0x5B: // Hybrid battery pack remaining life (%)
+        return A * 100.0f / 255;
+    case 0x05: // Engine coolant temperature (°C)
+    case 0x0F: // Intake air temperature (°C)
+    case 0x46: // Ambient air temperature (°C)
+    case 0x5C: // Engine oil temperature (°C)
+        return A - 40.0f;
+    case 0x06: // Short term fuel trim bank 1 (%)
+    case 0x07: // Long term fuel trim bank 1 (%)
+    case 0x08: // Short term fuel trim bank 2 (%)
+    case 0x09: // Long term fuel trim bank 2 (%)
+        return A * 100.0f / 128 - 100;
+    case 0x0A: // Fuel pressure (kPa)
+        return A * 3.0f;
+    case 0x0C: // Engine speed (rpm)
+        return (A * 256 + B) / 4.0f;
+    case 0x0E: // Timing advance (° before TDC)
+        return A / 2.0f - 64;
+    case 0x10: // MAF air flow rate (g/s)
+        return (A * 256 + B) / 100.0f;
+    case 0x42: // Control module voltage (V)
+        return (A * 256 + B) / 1000.0f;
+    case 0x5E: // Engine fuel rate (L/h)
+        return (A * 256 + B) / 20.0f;
+    default: // Raw value
+    {
+        uint32_t raw = 0;
+        for (uint8_t i = 0; i < len; i++)
+            raw = raw << 8 | d[i];
+        return raw;
+    }
+    }
+}
+
+static entry_t *findEntry(uint8_t ecu, uint8_t pid)
+{
+    for (size_t i = 0; i < APP_OBD_MAX_PIDS; i++)
+        if (entries[i].inUse && entries[i].value.ecu == ecu && entries[i].value.pid == pid)
+            return &entries[i];
+    return NULL;
+}
+
+/// @brief Complete the request in flight for an ECU, must be called with obdLock held
+static void completeRequest(ecu_t *e, bool timeout)
+{
+    for (uint8_t i = 0; i < e->pidCnt; i++)
+    {
+        entry_t *entry = e->pending[i];
+        if (entry == NULL || !entry->inUse)
+            continue;
+
+        // PID missing from the response
+        if (++entry->misses >= APP_OBD_MAX_MISSES)
+        {
+            if (e->pidCnt > 1 && e->multiPid)
+            {
+                ESP_LOGW(TAG, "ecu:%d does not answer multi-PID requests", e - ecus);
+                e->multiPid = false;
+                entry->misses = 0;
+            }
+            else if (entry->supported)
+            {
+                ESP_LOGW(TAG, "ecu:%d pid:%02X not supported", e - ecus, entry->value.pid);
+                entry->supported = false;
+            }
+        }
+    }
+
+    if (timeout)
+        stats.timeouts++;
+    e->inFlight = false;
+    e->pidCnt = 0;
+}
+
+/// @brief Handle the response to the request in flight for an ECU, must be called with obdLock held
+static void handleResponse(ecu_t *e, isotp_result_t result, const uint8_t *data, size_t len, int64_t now)
+{
+    if (!e->inFlight)
+        return;
+
+    if (result == ISOTP_RESULT_OK && len >= 2 && data[0] == OBD_MODE_CURRENT_DATA + OBD_POSITIVE_RESPONSE)
+    {
+        // Response: 41 <pid> <data...> [<pid> <data...>]...
+        size_t pos = 1;
+        while (pos < len)
+        {
+            uint8_t pid = data[pos++];
+            uint8_t n = pidLen(pid);
+            if (n == 0 && e->pidCnt == 1)
+                n = len - pos > sizeof(entries[0].value.raw) ? sizeof(entries[0].value.raw) : len - pos;
+            if (n == 0 || pos + n > len)
+                break;
+
+            for (uint8_t i = 0; i < e->pidCnt; i++)
+            {
+                entry_t *entry = e->pending[i];
+                if (entry != NULL && entry->inUse && entry->value.pid == pid)
+                {
+                    memcpy(entry->value.raw, data + pos, n);
+                    entry->value.rawLen = n;
+                    entry->value.value = decodePid(pid, data + pos, n);
+                    entry->value.timestamp = now;
+                    entry->misses = 0;
+                    entry->supported = true;
+                    e->pending[i] = NULL;
+                    stats.samples++;
+                    break;
+                }
+            }
+            pos += n;
+        }
+        completeRequest(e, false);
+    }
+    else if (result == ISOTP_RESULT_OK && len >= 1 && data[0] == OBD_NEGATIVE_RESPONSE)
+        completeRequest(e, false);
+    else if (result != ISOTP_RESULT_OK)
+        completeRequest(e, true);
+}
+
+/// @brief Hand the response over to pollTask: CAN RX path, obdLock is held while requests are sent and must not be
+/// waited for here
+static void isotpCallback(isotp_session_t *session, isotp_result_t result, const uint8_t *data, size_t len, void *ctx)
+{
+    ecu_t *e = (ecu_t *)ctx;
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&responseLock);
+    e->responseResult = result;
+    e->responseUs = now;
+    e->responseLen = len < sizeof(e->response) ? len : sizeof(e->response);
+    if (e->responseLen > 0)
+        memcpy(e->response, data, e->responseLen);
+    e->responseReady = true;
+    portEXIT_CRITICAL(&responseLock);
+
+    // Issue the next request right away
+    xTaskNotifyGive(_pollTask);
+}
+
+/// @brief Handle the response handed over by isotpCallback, if any, must be called with obdLock held
+static void takeResponse(ecu_t *e)
+{
+    uint8_t data[OBD_MAX_RESPONSE_LEN];
+
+    portENTER_CRITICAL(&responseLock);
+    bool ready = e->responseReady;
+    isotp_result_t result = e->responseResult;
+    int64_t responseUs = e->responseUs;
+    size_t len = e->responseLen;
+    if (ready)
+        memcpy(data, e->response, len);
+    e->responseReady = false;
+    portEXIT_CRITICAL(&responseLock);
+
+    if (ready)
+        handleResponse(e, result, data, len, responseUs);
+}
+
+/// @brief Send the next request for an ECU, must be called with obdLock held
+static void pollEcu(ecu_t *e, uint8_t ecuIndex, int64_t now)
+{
+    if (e->session == NULL)
+    {
+        isotp_config_t config = {
+            .txId = OBD_REQUEST_ID_BASE + ecuIndex,
+            .rxId = OBD_RESPONSE_ID_BASE + ecuIndex,
+            .blockSize = APP_ISOTP_DEFAULT_BS,
+            .stMin = APP_ISOTP_DEFAULT_STMIN,
+            .callback = isotpCallback,
+            .ctx = e,
+        };
+        if (isotp_open(&config, &e->session) != ESP_OK)
+        {
+            ESP_LOGW(TAG, "ecu:%d cannot open ISO-TP session", ecuIndex);
+            e->session = NULL;
+            return;
+        }
+        e->multiPid = true;
+    }
+
+    uint8_t request[1 + OBD_MAX_PIDS_PER_REQUEST] = {OBD_MODE_CURRENT_DATA};
+    uint8_t maxPids = e->multiPid ? OBD_MAX_PIDS_PER_REQUEST : 1;
+    e->pidCnt = 0;
+
+    // Most overdue PIDs first, packing only PIDs with known response length
+    while (e->pidCnt < maxPids)
+    {
+        entry_t *next = NULL;
+        for (size_t i = 0; i < APP_OBD_MAX_PIDS; i++)
+        {
+            entry_t *entry = &entries[i];
+            if (!entry->inUse || !entry->supported || entry->value.ecu != ecuIndex || entry->nextDue > now)
+                continue;
+            if (e->pidCnt > 0 && pidLen(entry->value.pid) == 0)
+                continue;
+
+            bool alreadyPending = false;
+            for (uint8_t j = 0; j < e->pidCnt; j++)
+                alreadyPending |= e->pending[j] == entry;
+            if (!alreadyPending && (next == NULL || entry->nextDue < next->nextDue))
+                next = entry;
+        }
+        if (next == NULL)
+            break;
+
+        e->pending[e->pidCnt] = next;
+        request[1 + e->pidCnt] = next->value.pid;
+        e->pidCnt++;
+        if (pidLen(next->value.pid) == 0)
+            break;
+    }
+
+    if (e->pidCnt == 0)
+        return;
+
+    if (isotp_send(e->session, request, 1 + e->pidCnt) != ESP_OK)
+    {
+        e->pidCnt = 0;
+        return;
+    }
+
+    for (uint8_t i = 0; i < e->pidCnt; i++)
+    {
+        entry_t *entry = e->pending[i];
+        // Keep the schedule anchored, unless we fell behind by more than a period
+        entry->nextDue += entry->periodMs * 1000;
+        if (entry->nextDue < now)
+            entry->nextDue = now + entry->periodMs * 1000;
+    }
+
+    e->inFlight = true;
+    e->deadline = now + APP_OBD_RESPONSE_TIMEOUT_MS * 1000;
+    stats.requests++;
+}
+
+static void pollTask(void *arg)
+{
+    while (1)
+    {
+        int64_t now = esp_timer_get_time();
+
+        xSemaphoreTake(obdLock, portMAX_DELAY);
+        if (can_isOpen() && can_getMode() == TWAI_MODE_NORMAL)
+        {
+            for (uint8_t i = 0; i < OBD_MAX_ECUS; i++)
+            {
+                ecu_t *e = &ecus[i];
+                takeResponse(e);
+                if (e->inFlight && now >= e->deadline)
+                    completeRequest(e, true);
+                if (!e->inFlight)
+                    pollEcu(e, i, now);
+            }
+        }
+        xSemaphoreGive(obdLock);
+
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(APP_OBD_POLL_INTERVAL_MS));
+    }
+}
+
+/// @brief Close the ISO-TP session of ECUs without registered PIDs, must be called with obdLock held
+static void releaseUnusedEcus(void)
+{
+    for (uint8_t i = 0; i < OBD_MAX_ECUS; i++)
+    {
+        ecu_t *e = &ecus[i];
+        if (e->session == NULL)
+            continue;
+
+        bool used = false;
+        for (size_t j = 0; j < APP_OBD_MAX_PIDS; j++)
+            used |= entries[j].inUse && entries[j].value.ecu == i;
+
+        if (!used)
+        {
+            isotp_close(e->session);
+            e->session = NULL;
+            e->inFlight = false;
+            e->pidCnt = 0;
+        }
+    }
+}
+
+esp_err_t obd_addPid(uint8_t ecu, uint8_t pid, uint16_t periodMs)
+{
+    if (ecu >= OBD_MAX_ECUS || periodMs == 0)
+        return ESP_ERR_INVALID_ARG;
+
+    esp_err_t ret = ESP_ERR_NO_MEM;
+
+    xSemaphoreTake(obdLock, portMAX_DELAY);
+    entry_t *entry = findEntry(ecu, pid);
+    if (entry == NULL)
+    {
+        for (size_t i = 0; i < APP_OBD_MAX_PIDS; i++)
+        {
+            if (!entries[i].inUse)
+            {
+                entry = &entries[i];
+                memset(entry, 0, sizeof(*entry));
+                entry->value.ecu = ecu;
+                entry->value.pid = pid;
+                entry->supported = true;
+                entry->inUse = true;
+                break;
+            }
+        }
+    }
+    if (entry != NULL)
+    {
+        entry->periodMs = periodMs;
+        entry->nextDue = esp_timer_get_time();
+        ret = ESP_OK;
+    }
+    xSemaphoreGive(obdLock);
+
+    xTaskNotifyGive(_pollTask);
+    return ret;
+}
+
+esp_err_t obd_removePid(uint8_t ecu, uint8_t pid)
+{
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+
+    xSemaphoreTake(obdLock, portMAX_DELAY);
+    entry_t *entry = findEntry(ecu, pid);
+    if (entry != NULL)
+    {
+        entry->inUse = false;
+        releaseUnusedEcus();
+        ret = ESP_OK;
+    }
+    xSemaphoreGive(obdLock);
+
+    return ret;
+}
+
+void obd_clear(void)
+{
+    xSemaphoreTake(obdLock, portMAX_DELAY);
+    for (size_t i = 0; i < APP_OBD_MAX_PIDS; i++)
+        entries[i].inUse = false;
+    releaseUnusedEcus();
+    memset(&stats, 0, sizeof(stats));
+    statsStart = esp_timer_get_time();
+    xSemaphoreGive(obdLock);
+}
+
+esp_err_t obd_getValue(uint8_t ecu, uint8_t pid, obd_value_t *out)
+{
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+
+    xSemaphoreTake(obdLock, portMAX_DELAY);
+    entry_t *entry = findEntry(ecu, pid);
+    if (entry != NULL)
+    {
+        *out = entry->value;
+        ret = ESP_OK;
+    }
+    xSemaphoreGive(obdLock);
+
+    return ret;
+}
+
+size_t obd_getValues(obd_value_t *out, size_t max)
+{
+    size_t count = 0;
+
+    xSemaphoreTake(obdLock, portMAX_DELAY);
+    for (size_t i = 0; i < APP_OBD_MAX_PIDS && count < max; i++)
+        if (entries[i].inUse)
+            out[count++] = entries[i].value;
+    xSemaphoreGive(obdLock);
+
+    return count;
+}
+
+void obd_getStats(obd_stats_t *out)
+{
+    xSemaphoreTake(obdLock, portMAX_DELAY);
+    *out = stats;
+    out->elapsedUs = esp_timer_get_time() - statsStart;
+    xSemaphoreGive(obdLock);
+}
+
+void obd_init(void)
+{
+    obdLock = xSemaphoreCreateMutexStatic(&obdLockBuffer);
+    statsStart = esp_timer_get_time();
+
+    _pollTask = rtos_createTask(RTOS_TASK_OBD_POLL, NULL, pollTask, NULL);
+
+    ESP_LOGI(TAG, "initialized");
+}
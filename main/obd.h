@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define OBD_MAX_ECUS 8 // Physical addressing: requests 0x7E0-0x7E7, responses 0x7E8-0x7EF
+
+/// @brief Latest cached value of a polled PID
+typedef struct
+{
+    uint8_t ecu;       // ECU index (0-7)
+    uint8_t pid;       // Mode 01 PID
+    float value;       // Decoded value (raw big-endian integer for PIDs without a known formula)
+    uint8_t raw[4];    // Raw data bytes (A, B, C, D)
+    uint8_t rawLen;    // Number of valid raw bytes, 0 if no response has been received yet
+    int64_t timestamp; // Time of last update (us since boot)
+} obd_value_t;
+
+/// @brief Poller statistics since the last @ref obd_clear
+typedef struct
+{
+    uint32_t samples;  // PID values received
+    uint32_t requests; // Requests sent
+    uint32_t timeouts; // Requests without a response
+    int64_t elapsedUs; // Time since statistics were reset
+} obd_stats_t;
+
+/// @brief Initialize OBD-II poller component
+void obd_init(void);
+
+/// @brief Register a mode 01 PID to be polled periodically
+/// @param ecu ECU index (0-7)
+/// @param pid Mode 01 PID
+/// @param periodMs Target polling period
+esp_err_t obd_addPid(uint8_t ecu, uint8_t pid, uint16_t periodMs);
+
+/// @brief Stop polling a PID
+esp_err_t obd_removePid(uint8_t ecu, uint8_t pid);
+
+/// @brief Stop polling all PIDs and reset statistics
+void obd_clear(void);
+
+/// @brief Get the cached value of a polled PID, without any bus traffic
+/// @return ESP_ERR_NOT_FOUND if the PID is not registered
+esp_err_t obd_getValue(uint8_t ecu, uint8_t pid, obd_value_t *out);
+
+/// @brief Get cached values of all polled PIDs
+/// @return Number of values written
+size_t obd_getValues(obd_value_t *out, size_t max);
+
+/// @brief Get poller statistics
+void obd_getStats(obd_stats_t *out);
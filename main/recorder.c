@@ -0,0 +1,438 @@
+/*
+Flight recorder: received frames are kept in a ring covering the last seconds of traffic,
+when a trigger fires the window before and after it is written to the SD card or streamed to a host
+*/
+
+#include "recorder.h"
+
+#include "config.h"
+#include "can.h"
+#include "capture.h"
+#include "sd.h"
+#include "rtos.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "driver/twai.h"
+
+#define TAG "RECORDER"
+
+_Static_assert((APP_RECORDER_RING_LEN & (APP_RECORDER_RING_LEN - 1)) == 0, "APP_RECORDER_RING_LEN must be a power of 2");
+_Static_assert((APP_RECORDER_PSRAM_RING_LEN & (APP_RECORDER_PSRAM_RING_LEN - 1)) == 0, "APP_RECORDER_PSRAM_RING_LEN must be a power of 2");
+_Static_assert(sizeof(recorder_record_t) == 16, "recorder_record_t must stay compact");
+_Static_assert(RECORDER_MAX_WINDOW_MS * 1000ULL < (1UL << (RECORDER_TIME_BITS - 1)), "recorder window exceeds time range");
+
+static const char *TRIGGER_NAMES[] = {"command", "pattern", "error-burst", "bus-off", "rule"};
+
+static recorder_record_t *ring = NULL;
+static uint32_t ringLen = 0;
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t task = NULL;
+
+// Protected by lock
+static recorder_state_t state = RECORDER_DISARMED;
+static uint32_t head = 0;        // Sequence number of the next record
+static uint32_t startSeq = 0;    // Oldest record still in the ring, recorded since arming
+static uint32_t triggerSeq = 0;  // First record after the trigger
+static uint32_t windowSeq = 0;   // First record of the window, computed by the task after a trigger
+static uint32_t stopSeq = 0;     // Recording stops here so that the window start is not overwritten
+static bool windowPending = false;
+static int64_t triggerTimeUs = 0;
+static int64_t postEndUs = 0;
+static recorder_trigger_t triggerSource;
+static recorder_pattern_t pattern = {0};
+
+static recorder_status_t status = {
+    .preTriggerMs = APP_RECORDER_PRE_TRIGGER_MS,
+    .postTriggerMs = APP_RECORDER_POST_TRIGGER_MS,
+    .errorBurst = APP_RECORDER_ERROR_BURST,
+    .busOffTrigger = true,
+};
+
+static recorder_output_t output = NULL;
+static void *outputCtx = NULL;
+
+/// @brief Signed time of a record relative to a reference time, valid within half the time wrap
+static inline int32_t recordOffsetUs(const recorder_record_t *rec, int64_t refUs)
+{
+    uint32_t diff = (rec->time - (uint32_t)refUs) & RECORDER_TIME_MASK;
+    return diff & (1UL << (RECORDER_TIME_BITS - 1)) ? (int32_t)(diff - (1UL << RECORDER_TIME_BITS)) : (int32_t)diff;
+}
+
+/// @brief Fire a trigger, called with lock held
+static void triggerLocked(recorder_trigger_t source, int64_t timeUs, uint32_t seq)
+{
+    state = RECORDER_TRIGGERED;
+    triggerSource = source;
+    triggerTimeUs = timeUs;
+    triggerSeq = seq;
+    postEndUs = timeUs + status.postTriggerMs * 1000LL;
+    windowSeq = startSeq;
+    stopSeq = startSeq + ringLen; // Tightened by the task once the window start is known
+    windowPending = true;
+    status.triggers++;
+}
+
+void recorder_append(const twai_message_t *msg, int64_t timestampUs)
+{
+    bool notify = false;
+
+    portENTER_CRITICAL(&lock);
+    if (state == RECORDER_ARMED || state == RECORDER_TRIGGERED)
+    {
+        recorder_record_t *rec = &ring[head & (ringLen - 1)];
+        rec->time = ((uint32_t)timestampUs & RECORDER_TIME_MASK) | (uint32_t)msg->data_length_code << RECORDER_TIME_BITS;
+        rec->id = msg->identifier | (msg->extd ? RECORDER_ID_EXTD : 0) | (msg->rtr ? RECORDER_ID_RTR : 0);
+        memcpy(rec->data, msg->data, sizeof(rec->data));
+        head++;
+        if (head - startSeq > ringLen)
+            startSeq = head - ringLen;
+
+        if (state == RECORDER_ARMED)
+        {
+            if (pattern.enabled && (rec->id & pattern.idMask) == pattern.id)
+            {
+                uint64_t data;
+                memcpy(&data, rec->data, sizeof(data));
+                if (msg->data_length_code < 8)
+                    data &= (1ULL << (msg->data_length_code * 8)) - 1; // Bytes past DLC are not meaningful
+                if ((data & pattern.dataMask) == pattern.data)
+                {
+                    triggerLocked(RECORDER_TRIGGER_PATTERN, timestampUs, head - 1);
+                    notify = true;
+                }
+            }
+        }
+        else if (timestampUs >= postEndUs || head == stopSeq)
+        {
+            state = RECORDER_DUMPING;
+            notify = true;
+        }
+    }
+    portEXIT_CRITICAL(&lock);
+
+    if (notify)
+        xTaskNotifyGive(task);
+}
+
+/// @brief Find the first record of the pre-trigger window and limit post-trigger recording accordingly
+static void computeWindow(void)
+{
+    portENTER_CRITICAL(&lock);
+    uint32_t seq = triggerSeq;
+    uint32_t oldest = startSeq;
+    int64_t refUs = triggerTimeUs;
+    int32_t preUs = status.preTriggerMs * 1000;
+    uint32_t totalMs = status.preTriggerMs + status.postTriggerMs;
+    portEXIT_CRITICAL(&lock);
+
+    // When the ring is shorter than the window, it is shared between pre and post-trigger frames by duration
+    uint32_t maxPre = totalMs > 0 ? (uint64_t)ringLen * (preUs / 1000) / totalMs : ringLen;
+    if (seq - oldest > maxPre)
+        oldest = seq - maxPre;
+
+    // Walk back while records are inside the window, ages must keep increasing (older records may have wrapped)
+    int32_t lastOffset = 0;
+    while (seq != oldest)
+    {
+        int32_t offset = recordOffsetUs(&ring[(seq - 1) & (ringLen - 1)], refUs);
+        if (offset < -preUs || offset > lastOffset)
+            break;
+        lastOffset = offset;
+        seq--;
+    }
+
+    portENTER_CRITICAL(&lock);
+    if (state == RECORDER_TRIGGERED || state == RECORDER_DUMPING)
+    {
+        // Records overwritten during the walk are lost, the window is incomplete
+        windowSeq = (int32_t)(seq - startSeq) < 0 ? startSeq : seq;
+        stopSeq = windowSeq + ringLen;
+        if (state == RECORDER_TRIGGERED && (int32_t)(head - stopSeq) >= 0)
+            state = RECORDER_DUMPING;
+    }
+    windowPending = false;
+    portEXIT_CRITICAL(&lock);
+}
+
+/// @brief Format a record as a candump log line, without line terminator
+static int formatRecord(const recorder_record_t *rec, int64_t timeUs, char *line, size_t size)
+{
+    uint32_t id = rec->id & ~(RECORDER_ID_EXTD | RECORDER_ID_RTR);
+    int len = snprintf(line, size, rec->id & RECORDER_ID_EXTD ? "(%" PRId64 ".%06ld) can0 %08lX#"
+                                                              : "(%" PRId64 ".%06ld) can0 %03lX#",
+                       timeUs / 1000000, (long)(timeUs % 1000000), (unsigned long)id);
+    if (rec->id & RECORDER_ID_RTR)
+        line[len++] = 'R';
+    else
+    {
+        uint8_t dlc = rec->time >> RECORDER_TIME_BITS;
+        for (int i = 0; i < dlc && i < 8; i++)
+            len += snprintf(line + len, size - len, "%02X", rec->data[i]);
+    }
+    line[len] = '\0';
+    return len;
+}
+
+/// @brief Write the window to the selected output
+static void dump(void)
+{
+    portENTER_CRITICAL(&lock);
+    uint32_t first = windowSeq;
+    uint32_t end = head;
+    int64_t refUs = triggerTimeUs;
+    recorder_trigger_t source = triggerSource;
+    recorder_output_t out = output;
+    void *ctx = outputCtx;
+    portEXIT_CRITICAL(&lock);
+
+    uint32_t count = end - first;
+    int32_t firstOffset = count > 0 ? recordOffsetUs(&ring[first & (ringLen - 1)], refUs) : 0;
+    int32_t lastOffset = count > 0 ? recordOffsetUs(&ring[(end - 1) & (ringLen - 1)], refUs) : 0;
+
+    FILE *file = NULL;
+    if (out == NULL)
+    {
+        file = sd_createFile("record");
+        if (file == NULL)
+        {
+            ESP_LOGE(TAG, "no output, window discarded records:%" PRIu32, count);
+            return;
+        }
+    }
+
+    char line[80];
+    int len = snprintf(line, sizeof(line), "# trigger:%s time:%" PRId64 ".%06ld records:%" PRIu32,
+                       TRIGGER_NAMES[source], refUs / 1000000, (long)(refUs % 1000000), count);
+    if (file != NULL)
+        fprintf(file, "%s\n", line);
+    else
+        out(ctx, line, len);
+
+    for (uint32_t seq = first; seq != end; seq++)
+    {
+        const recorder_record_t *rec = &ring[seq & (ringLen - 1)];
+        len = formatRecord(rec, refUs + recordOffsetUs(rec, refUs), line, sizeof(line));
+        if (file != NULL)
+        {
+            line[len++] = '\n';
+            fwrite(line, 1, len, file);
+        }
+        else
+            out(ctx, line, len);
+    }
+
+    if (file != NULL)
+        fclose(file);
+    else
+        out(ctx, "# end", strlen("# end"));
+
+    portENTER_CRITICAL(&lock);
+    status.dumps++;
+    status.lastRecords = count;
+    status.lastPreTriggerMs = firstOffset < 0 ? -firstOffset / 1000 : 0;
+    status.lastPostTriggerMs = lastOffset > 0 ? lastOffset / 1000 : 0;
+    portEXIT_CRITICAL(&lock);
+
+    ESP_LOGI(TAG, "window written trigger:%s records:%" PRIu32 " pre:%" PRIu32 "ms post:%" PRIu32 "ms",
+             TRIGGER_NAMES[source], count, status.lastPreTriggerMs, status.lastPostTriggerMs);
+}
+
+/// @brief Check the bus error burst trigger, computed over the polling interval
+static void pollBusTriggers(void)
+{
+    static uint32_t lastBusErrors = 0;
+    static int64_t lastPollUs = 0;
+
+    // Bitrate detection causes bus errors on purpose
+    twai_status_info_t info;
+    if (capture_isDetecting() || can_getStatusInfo(&info) != ESP_OK)
+    {
+        lastPollUs = 0;
+        return;
+    }
+
+    int64_t nowUs = esp_timer_get_time();
+    if (lastPollUs != 0)
+    {
+        uint32_t errors = info.bus_error_count - lastBusErrors;
+        uint32_t rate = errors * 1000000ULL / (nowUs - lastPollUs);
+        if (status.errorBurst > 0 && rate >= status.errorBurst)
+            recorder_trigger(RECORDER_TRIGGER_ERROR_BURST);
+    }
+    lastBusErrors = info.bus_error_count;
+    lastPollUs = nowUs;
+}
+
+static void recorderTask(void *arg)
+{
+    (void)arg;
+
+    while (1)
+    {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(APP_RECORDER_POLL_MS));
+
+        pollBusTriggers();
+
+        if (windowPending)
+            computeWindow();
+
+        // Post-trigger window also ends without traffic
+        portENTER_CRITICAL(&lock);
+        if (state == RECORDER_TRIGGERED && esp_timer_get_time() >= postEndUs)
+            state = RECORDER_DUMPING;
+        bool dumping = state == RECORDER_DUMPING;
+        portEXIT_CRITICAL(&lock);
+
+        if (dumping)
+        {
+            dump();
+
+            // Rearm, the next window must not span the frames missed while dumping
+            portENTER_CRITICAL(&lock);
+            if (state == RECORDER_DUMPING)
+            {
+                state = RECORDER_ARMED;
+                startSeq = head;
+            }
+            portEXIT_CRITICAL(&lock);
+        }
+    }
+}
+
+void recorder_init(void)
+{
+    ring = heap_caps_malloc(APP_RECORDER_PSRAM_RING_LEN * sizeof(recorder_record_t), MALLOC_CAP_SPIRAM);
+    if (ring != NULL)
+    {
+        ringLen = APP_RECORDER_PSRAM_RING_LEN;
+        status.psram = true;
+    }
+    else
+    {
+        ring = heap_caps_malloc(APP_RECORDER_RING_LEN * sizeof(recorder_record_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        if (ring == NULL)
+        {
+            ESP_LOGE(TAG, "cannot allocate ring");
+            return;
+        }
+        ringLen = APP_RECORDER_RING_LEN;
+    }
+    status.capacity = ringLen;
+
+    task = rtos_createTask(RTOS_TASK_RECORDER, NULL, recorderTask, NULL);
+    recorder_arm();
+
+    ESP_LOGI(TAG, "initialized records:%" PRIu32 " psram:%d", ringLen, status.psram);
+}
+
+esp_err_t recorder_arm(void)
+{
+    esp_err_t res = ESP_OK;
+
+    portENTER_CRITICAL(&lock);
+    if (ring == NULL)
+        res = ESP_ERR_NO_MEM;
+    else if (state == RECORDER_DISARMED)
+    {
+        startSeq = head;
+        state = RECORDER_ARMED;
+    }
+    else if (state != RECORDER_ARMED)
+        res = ESP_ERR_INVALID_STATE;
+    portEXIT_CRITICAL(&lock);
+
+    return res;
+}
+
+void recorder_disarm(void)
+{
+    portENTER_CRITICAL(&lock);
+    state = RECORDER_DISARMED;
+    windowPending = false;
+    portEXIT_CRITICAL(&lock);
+}
+
+esp_err_t recorder_trigger(recorder_trigger_t source)
+{
+    esp_err_t res = ESP_ERR_INVALID_STATE;
+
+    portENTER_CRITICAL(&lock);
+    if (state == RECORDER_ARMED)
+    {
+        triggerLocked(source, esp_timer_get_time(), head);
+        res = ESP_OK;
+    }
+    portEXIT_CRITICAL(&lock);
+
+    if (res == ESP_OK)
+    {
+        ESP_LOGI(TAG, "triggered by %s", TRIGGER_NAMES[source]);
+        xTaskNotifyGive(task);
+    }
+    return res;
+}
+
+esp_err_t recorder_setWindow(uint32_t preTriggerMs, uint32_t postTriggerMs)
+{
+    if (preTriggerMs > RECORDER_MAX_WINDOW_MS || postTriggerMs > RECORDER_MAX_WINDOW_MS)
+        return ESP_ERR_INVALID_ARG;
+
+    portENTER_CRITICAL(&lock);
+    status.preTriggerMs = preTriggerMs;
+    status.postTriggerMs = postTriggerMs;
+    portEXIT_CRITICAL(&lock);
+    return ESP_OK;
+}
+
+void recorder_setPattern(const recorder_pattern_t *value)
+{
+    portENTER_CRITICAL(&lock);
+    if (value != NULL)
+    {
+        pattern = *value;
+        pattern.id &= pattern.idMask;
+        pattern.data &= pattern.dataMask;
+    }
+    else
+        pattern.enabled = false;
+    portEXIT_CRITICAL(&lock);
+}
+
+void recorder_setErrorBurst(uint32_t errorsPerSecond)
+{
+    status.errorBurst = errorsPerSecond;
+}
+
+void recorder_setBusOffTrigger(bool enable)
+{
+    status.busOffTrigger = enable;
+}
+
+void recorder_notifyBusOff(void)
+{
+    if (status.busOffTrigger)
+        recorder_trigger(RECORDER_TRIGGER_BUS_OFF);
+}
+
+void recorder_setOutput(recorder_output_t value, void *ctx)
+{
+    portENTER_CRITICAL(&lock);
+    output = value;
+    outputCtx = ctx;
+    portEXIT_CRITICAL(&lock);
+}
+
+void recorder_getStatus(recorder_status_t *out)
+{
+    portENTER_CRITICAL(&lock);
+    *out = status;
+    out->state = state;
+    portEXIT_CRITICAL(&lock);
+}
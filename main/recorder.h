@@ -0,0 +1,107 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "hal/twai_types.h"
+
+#define RECORDER_TIME_BITS 28                                // Reception time resolution is 1us, wraps every ~268s
+#define RECORDER_TIME_MASK ((1UL << RECORDER_TIME_BITS) - 1)
+#define RECORDER_MAX_WINDOW_MS 120000                        // Pre/post-trigger durations limit, within half the time wrap
+
+#define RECORDER_ID_EXTD 0x80000000 // Record identifier flags
+#define RECORDER_ID_RTR 0x40000000
+
+typedef enum
+{
+    RECORDER_DISARMED,  // Not recording
+    RECORDER_ARMED,     // Recording, waiting for a trigger
+    RECORDER_TRIGGERED, // Recording post-trigger frames
+    RECORDER_DUMPING,   // Not recording, window is being written out
+} recorder_state_t;
+
+typedef enum
+{
+    RECORDER_TRIGGER_COMMAND,
+    RECORDER_TRIGGER_PATTERN,
+    RECORDER_TRIGGER_ERROR_BURST,
+    RECORDER_TRIGGER_BUS_OFF,
+    RECORDER_TRIGGER_RULE, // External rule (e.g. rule engine)
+} recorder_trigger_t;
+
+/// @brief Received frame as stored in the ring (16 bytes)
+typedef struct
+{
+    uint32_t time; // Bits 0-27: reception time in us (low bits of esp_timer), bits 28-31: DLC
+    uint32_t id;   // Identifier | RECORDER_ID_*
+    uint8_t data[8];
+} recorder_record_t;
+
+/// @brief Frame pattern trigger, fires when (id & idMask) == id and (data & dataMask) == data
+typedef struct
+{
+    bool enabled;
+    uint32_t id; // Identifier | RECORDER_ID_EXTD, same layout as records
+    uint32_t idMask;
+    uint64_t data; // Payload bytes loaded little endian
+    uint64_t dataMask;
+} recorder_pattern_t;
+
+/// @brief Stream output, called from the recorder task with one candump line at a time
+typedef void (*recorder_output_t)(void *ctx, const char *line, size_t len);
+
+typedef struct
+{
+    recorder_state_t state;
+    uint32_t capacity;          // Ring length in records
+    bool psram;                 // Ring allocated in PSRAM
+    uint32_t preTriggerMs;      // Window recorded before a trigger
+    uint32_t postTriggerMs;     // Window recorded after a trigger
+    uint32_t errorBurst;        // Bus errors per second firing a trigger, 0 disabled
+    bool busOffTrigger;         // Bus-off fires a trigger
+    uint32_t triggers;          // Triggers fired since boot
+    uint32_t dumps;             // Windows written out since boot
+    uint32_t lastRecords;       // Records in the last window
+    uint32_t lastPreTriggerMs;  // Time covered before the trigger in the last window, below preTriggerMs if incomplete
+    uint32_t lastPostTriggerMs; // Time covered after the trigger in the last window
+} recorder_status_t;
+
+/// @brief Allocate the ring (PSRAM when available) and start the recorder task, armed
+void recorder_init(void);
+
+/// @brief Append a received frame, called from the CAN RX path
+/// @details Fixed cost: one 16 byte record copy and pattern trigger check
+void recorder_append(const twai_message_t *msg, int64_t timestampUs);
+
+/// @brief Start recording, waiting for a trigger
+esp_err_t recorder_arm(void);
+
+/// @brief Stop recording, a pending window is discarded
+void recorder_disarm(void);
+
+/// @brief Fire a trigger now
+/// @return ESP_ERR_INVALID_STATE if the recorder is not armed (disarmed or a window is already in progress)
+esp_err_t recorder_trigger(recorder_trigger_t source);
+
+/// @brief Set pre and post-trigger window durations
+/// @return ESP_ERR_INVALID_ARG if above RECORDER_MAX_WINDOW_MS
+esp_err_t recorder_setWindow(uint32_t preTriggerMs, uint32_t postTriggerMs);
+
+/// @brief Set the frame pattern trigger, NULL disables it
+void recorder_setPattern(const recorder_pattern_t *pattern);
+
+/// @brief Set the bus error rate (errors per second) firing a trigger, 0 disables it
+void recorder_setErrorBurst(uint32_t errorsPerSecond);
+
+/// @brief Enable or disable the bus-off trigger
+void recorder_setBusOffTrigger(bool enable);
+
+/// @brief Bus-off notification from the bus monitor, fires the bus-off trigger when enabled
+/// @details Bus-off is not polled: automatic recovery can end it within a few ms
+void recorder_notifyBusOff(void);
+
+/// @brief Write windows to output instead of the SD card, NULL selects the SD card
+void recorder_setOutput(recorder_output_t output, void *ctx);
+
+void recorder_getStatus(recorder_status_t *status);
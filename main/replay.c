@@ -0,0 +1,379 @@
+/*
+Replay of candump logs from the SD card on the CAN bus, with the timing of the log.
+
+A reader task parses the log into a ring of frames ahead of transmission (read-ahead), each frame stamped with its
+transmission time on a 1MHz hardware timer started with the replay. The timer alarm fires APP_REPLAY_WAKE_LEAD_US
+before the next frame time and wakes the transmit task (highest application priority), which spins on the timer the
+rest of the way: the wake-up latency of the task is hidden, and a frame is handed to the CAN driver within a few
+microseconds of its time. Timing error against the log is measured with tools/bench/replay_bench.
+*/
+
+#include "replay.h"
+
+#include "config.h"
+#include "can.h"
+#include "candump.h"
+#include "rtos.h"
+#include "sd.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/gptimer.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+
+#define TAG "REPLAY"
+
+_Static_assert((APP_REPLAY_BUF_LEN & (APP_REPLAY_BUF_LEN - 1)) == 0, "APP_REPLAY_BUF_LEN must be a power of 2");
+
+/// @brief Parsed frame waiting for its transmission time
+typedef struct
+{
+    twai_message_t msg;
+    uint64_t timeUs; // Transmission time on the replay timer
+} entry_t;
+
+static gptimer_handle_t timer = NULL;
+static TaskHandle_t readerTask = NULL;
+static TaskHandle_t txTask = NULL;
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+static FILE *file = NULL; // Owned by the reader task while a replay is running
+static char readBuf[APP_REPLAY_READ_BUF_SIZE];
+static replay_options_t options;
+
+// Ring written by the reader task, read by the transmit task, indexes protected by lock
+static entry_t ring[APP_REPLAY_BUF_LEN];
+static uint32_t head = 0; // Next entry written
+static uint32_t tail = 0; // Next entry sent
+
+static volatile replay_state_t state = REPLAY_IDLE;
+static volatile bool readerDone = false;    // Every frame of the log is in the ring
+static volatile bool readerWaiting = false; // Ring full, the reader waits for the transmit task
+static volatile bool timerStarted = false;  // Read-ahead filled, frames are being sent
+static volatile bool txDone = false;        // Transmit task finished with this replay
+
+// Protected by lock
+static replay_status_t status;
+static uint64_t errorSumUs = 0;
+
+static bool IRAM_ATTR onAlarm(gptimer_handle_t timer, const gptimer_alarm_event_data_t *edata, void *ctx)
+{
+    BaseType_t higherPriorityTaskWoken = pdFALSE;
+    vTaskNotifyGiveFromISR(txTask, &higherPriorityTaskWoken);
+    return higherPriorityTaskWoken == pdTRUE;
+}
+
+static uint64_t timerNow(void)
+{
+    uint64_t count;
+    gptimer_get_raw_count(timer, &count);
+    return count;
+}
+
+static uint32_t ringUsed(void)
+{
+    portENTER_CRITICAL(&lock);
+    uint32_t used = head - tail;
+    portEXIT_CRITICAL(&lock);
+    return used;
+}
+
+static void startTimer(void)
+{
+    gptimer_set_raw_count(timer, 0);
+    gptimer_start(timer);
+    timerStarted = true;
+    xTaskNotifyGive(txTask);
+}
+
+/// @brief Read the next line, lines longer than the buffer are consumed and reported as invalid
+/// @return false at the end of the file
+static bool readLine(char *line, size_t size)
+{
+    if (fgets(line, size, file) == NULL)
+        return false;
+
+    size_t len = strlen(line);
+    if (len == size - 1 && line[len - 1] != '\n')
+    {
+        int c;
+        while ((c = fgetc(file)) != EOF && c != '\n')
+            ;
+        line[0] = '\0';
+    }
+    return true;
+}
+
+/// @brief Fill the ring with the frames of the log until its end, or until the replay is stopped
+static void readLog(void)
+{
+    char line[APP_REPLAY_MAX_LINE_LEN];
+    bool firstOfPass = true;
+    uint32_t passFrames = 0;
+    int64_t firstLogUs = 0;
+    uint64_t passStartUs = 0;
+    uint64_t lastTimeUs = 0;
+
+    while (state == REPLAY_RUNNING)
+    {
+        if (ringUsed() == APP_REPLAY_BUF_LEN)
+        {
+            if (!timerStarted)
+                startTimer();
+            readerWaiting = true;
+            if (ringUsed() == APP_REPLAY_BUF_LEN) // Transmit task may have made room meanwhile
+                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            readerWaiting = false;
+            continue;
+        }
+
+        if (!readLine(line, sizeof(line)))
+        {
+            if (!options.loop || passFrames == 0)
+                break;
+            rewind(file);
+            passStartUs = lastTimeUs + APP_REPLAY_LOOP_GAP_MS * 1000ULL;
+            firstOfPass = true;
+            passFrames = 0;
+            portENTER_CRITICAL(&lock);
+            status.loops++;
+            portEXIT_CRITICAL(&lock);
+            continue;
+        }
+
+        candump_frame_t frame;
+        if (candump_parseLine(line, &frame) != ESP_OK)
+        {
+            // Comments (recorder dumps start with a "#" header) are not counted
+            if (line[0] != '#' && line[0] != '\n' && line[0] != '\r')
+            {
+                portENTER_CRITICAL(&lock);
+                status.invalid++;
+                portEXIT_CRITICAL(&lock);
+            }
+            continue;
+        }
+
+        // Filtered frames keep their place in time, the gaps of the others are unchanged
+        if (firstOfPass)
+        {
+            firstLogUs = frame.timeUs;
+            firstOfPass = false;
+        }
+        int64_t logOffsetUs = frame.timeUs - firstLogUs;
+        uint64_t timeUs = passStartUs + (logOffsetUs > 0 ? logOffsetUs * 100 / options.speedPercent : 0);
+        lastTimeUs = timeUs;
+
+        if ((frame.msg.identifier & options.filterMask) != options.filterId)
+        {
+            portENTER_CRITICAL(&lock);
+            status.filtered++;
+            portEXIT_CRITICAL(&lock);
+            continue;
+        }
+        passFrames++;
+
+        portENTER_CRITICAL(&lock);
+        ring[head % APP_REPLAY_BUF_LEN] = (entry_t){.msg = frame.msg, .timeUs = timeUs};
+        bool wasEmpty = head == tail;
+        head++;
+        portEXIT_CRITICAL(&lock);
+        if (wasEmpty && timerStarted)
+            xTaskNotifyGive(txTask);
+    }
+
+    readerDone = true;
+    if (!timerStarted)
+        startTimer();
+    xTaskNotifyGive(txTask);
+}
+
+/// @brief Open and read logs on request, close them once the transmit task is done
+static void readerTaskFn(void *arg)
+{
+    while (1)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (state != REPLAY_RUNNING)
+            continue;
+
+        readLog();
+        while (!txDone)
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        gptimer_stop(timer);
+        fclose(file);
+        file = NULL;
+
+        state = REPLAY_IDLE;
+        ESP_LOGI(TAG, "done frames:%lu late:%lu underruns:%lu max error:%luus", status.frames, status.late, status.underruns,
+                 status.maxErrorUs);
+    }
+}
+
+/// @brief Send each frame of the ring at its time: sleep until the alarm, then spin on the timer
+static void txTaskFn(void *arg)
+{
+    bool starved = false; // Ring ran empty before the frame being sent was read
+
+    while (1)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        while (timerStarted && !txDone)
+        {
+            if (state != REPLAY_RUNNING)
+            {
+                txDone = true;
+                xTaskNotifyGive(readerTask);
+                break;
+            }
+
+            portENTER_CRITICAL(&lock);
+            bool empty = head == tail;
+            entry_t entry = ring[tail % APP_REPLAY_BUF_LEN];
+            portEXIT_CRITICAL(&lock);
+            if (empty)
+            {
+                if (readerDone)
+                {
+                    txDone = true;
+                    xTaskNotifyGive(readerTask);
+                }
+                else
+                    starved = true; // Woken by the reader when it adds a frame
+                break;
+            }
+
+            uint64_t now = timerNow();
+            if (entry.timeUs > now + 2 * APP_REPLAY_WAKE_LEAD_US)
+            {
+                gptimer_alarm_config_t alarm = {.alarm_count = entry.timeUs - APP_REPLAY_WAKE_LEAD_US};
+                gptimer_set_alarm_action(timer, &alarm);
+                break;
+            }
+            while (now < entry.timeUs)
+                now = timerNow();
+
+            esp_err_t res = can_transmit(&entry.msg, pdMS_TO_TICKS(APP_REPLAY_CAN_TX_TIMEOUT_MS));
+            uint32_t errorUs = now - entry.timeUs;
+
+            portENTER_CRITICAL(&lock);
+            tail++;
+            bool wakeReader = readerWaiting && head - tail <= APP_REPLAY_BUF_LEN / 2;
+            if (res == ESP_OK)
+            {
+                status.frames++;
+                errorSumUs += errorUs;
+                if (errorUs > status.maxErrorUs)
+                    status.maxErrorUs = errorUs;
+                if (errorUs > APP_REPLAY_LATE_US)
+                {
+                    status.late++;
+                    if (starved)
+                        status.underruns++;
+                }
+            }
+            else
+                status.txErrors++;
+            portEXIT_CRITICAL(&lock);
+            starved = false;
+
+            if (wakeReader)
+                xTaskNotifyGive(readerTask);
+            if (res == ESP_ERR_INVALID_STATE)
+            {
+                ESP_LOGW(TAG, "bus closed, stopping");
+                state = REPLAY_STOPPING;
+            }
+        }
+    }
+}
+
+esp_err_t replay_start(const char *name, const replay_options_t *value)
+{
+    if (value->speedPercent == 0 || value->speedPercent > APP_REPLAY_MAX_SPEED_PERCENT)
+        return ESP_ERR_INVALID_ARG;
+    if (!can_isOpen() || can_getMode() == TWAI_MODE_LISTEN_ONLY || state != REPLAY_IDLE || timer == NULL)
+        return ESP_ERR_INVALID_STATE;
+    if (!sd_isMounted())
+        return ESP_ERR_NOT_FOUND;
+
+    char path[64];
+    snprintf(path, sizeof(path), APP_SD_MOUNT_POINT "/%s", name);
+    file = fopen(path, "r");
+    if (file == NULL)
+    {
+        ESP_LOGE(TAG, "cannot open %s", path);
+        return ESP_ERR_NOT_FOUND;
+    }
+    setvbuf(file, readBuf, _IOFBF, sizeof(readBuf));
+
+    options = *value;
+    head = 0;
+    tail = 0;
+    readerDone = false;
+    readerWaiting = false;
+    timerStarted = false;
+    txDone = false;
+
+    portENTER_CRITICAL(&lock);
+    memset(&status, 0, sizeof(status));
+    errorSumUs = 0;
+    state = REPLAY_RUNNING;
+    portEXIT_CRITICAL(&lock);
+
+    ESP_LOGI(TAG, "replaying %s speed:%u%% loop:%d filter:%08lX/%08lX", path, options.speedPercent, options.loop,
+             options.filterId, options.filterMask);
+    xTaskNotifyGive(readerTask);
+    return ESP_OK;
+}
+
+void replay_stop(void)
+{
+    portENTER_CRITICAL(&lock);
+    if (state == REPLAY_RUNNING)
+        state = REPLAY_STOPPING;
+    portEXIT_CRITICAL(&lock);
+
+    // Transmit task acknowledges the stop, then the reader closes the log
+    xTaskNotifyGive(txTask);
+    xTaskNotifyGive(readerTask);
+}
+
+void replay_getStatus(replay_status_t *out)
+{
+    portENTER_CRITICAL(&lock);
+    *out = status;
+    out->state = state;
+    out->meanErrorUs = status.frames > 0 ? errorSumUs / status.frames : 0;
+    portEXIT_CRITICAL(&lock);
+}
+
+void replay_init(void)
+{
+    gptimer_config_t timerConfig = {
+        .clk_src = GPTIMER_CLK_SRC_DEFAULT,
+        .direction = GPTIMER_COUNT_UP,
+        .resolution_hz = 1000000,
+    };
+    esp_err_t res = gptimer_new_timer(&timerConfig, &timer);
+    if (res != ESP_OK)
+    {
+        ESP_LOGE(TAG, "gptimer_new_timer: %s", esp_err_to_name(res));
+        timer = NULL;
+        return;
+    }
+    gptimer_event_callbacks_t callbacks = {.on_alarm = onAlarm};
+    gptimer_register_event_callbacks(timer, &callbacks, NULL);
+    gptimer_enable(timer);
+
+    txTask = rtos_createTask(RTOS_TASK_REPLAY_TX, NULL, txTaskFn, NULL);
+    readerTask = rtos_createTask(RTOS_TASK_REPLAY_READER, NULL, readerTaskFn, NULL);
+
+    ESP_LOGI(TAG, "initialized");
+}
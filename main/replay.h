@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#include "config.h"
+
+typedef enum
+{
+    REPLAY_IDLE,
+    REPLAY_RUNNING,
+    REPLAY_STOPPING, // Stop requested, the log is being closed
+} replay_state_t;
+
+typedef struct
+{
+    uint16_t speedPercent; // Time scale, 100 keeps the log timing, 200 replays twice as fast
+    bool loop;             // Start over after the last frame, APP_REPLAY_LOOP_GAP_MS later
+    uint32_t filterId;     // Only frames whose identifier matches filterId under filterMask are sent, mask 0 sends all
+    uint32_t filterMask;
+} replay_options_t;
+
+typedef struct
+{
+    replay_state_t state;
+    uint32_t frames;      // Frames transmitted
+    uint32_t filtered;    // Log frames not sent because of the identifier filter
+    uint32_t invalid;     // Log lines that are not classic CAN frames
+    uint32_t txErrors;    // Transmissions refused by the CAN driver (TX queue full, bus off)
+    uint32_t late;        // Transmissions started more than APP_REPLAY_LATE_US after their frame time
+    uint32_t underruns;   // Late transmissions caused by the read-ahead running empty (SD card too slow)
+    uint32_t loops;       // Completed passes of a looped log
+    uint32_t meanErrorUs; // Mean delay of transmissions after their frame time
+    uint32_t maxErrorUs;  // Largest delay of a transmission after its frame time
+} replay_status_t;
+
+/// @brief Create the replay hardware timer and tasks
+void replay_init(void);
+
+/// @brief Replay a candump log from the SD card on the CAN bus, with the inter-frame gaps of the log
+/// @details Frames are parsed ahead of time by a reader task, a hardware timer wakes the transmit task just before each
+/// frame time. The first frame is sent once the read-ahead buffer is full.
+/// @param name File name in the SD card root, e.g. "candump-0.log"
+/// @return ESP_ERR_INVALID_STATE if the bus is not open in normal mode or a replay is running, ESP_ERR_NOT_FOUND if the
+/// file cannot be opened
+esp_err_t replay_start(const char *name, const replay_options_t *options);
+
+/// @brief Stop the running replay, frames already in the CAN TX queue are still sent
+void replay_stop(void);
+
+void replay_getStatus(replay_status_t *status);
@@ -0,0 +1,128 @@
+/*
+Central layout of FreeRTOS objects: task stacks, TCBs and message queue storage are allocated at build time, so
+their RAM shows up in the image size and nothing is taken from the heap after app_main. Stack high-water marks and
+heap minimums are kept by the kernel and heap allocator, they are read on request (SLCAN "fm" command).
+*/
+
+#include "rtos.h"
+
+#include "message.h"
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+#define TAG "RTOS"
+
+typedef struct
+{
+    const char *name;
+    uint32_t stackSize; // Bytes
+    UBaseType_t priority;
+    size_t instances;
+    StackType_t *stacks; // instances stacks of stackSize bytes
+    StaticTask_t *tcbs;
+} taskEntry_t;
+
+typedef struct
+{
+    size_t length;
+    uint8_t *storage;
+} queueEntry_t;
+
+#define RTOS_TASK_STORAGE(id, name, stackSize, priority, instances)                 \
+    static StackType_t stack_##id[(instances) * (stackSize) / sizeof(StackType_t)]; \
+    static StaticTask_t tcb_##id[instances];
+RTOS_TASKS(RTOS_TASK_STORAGE)
+#undef RTOS_TASK_STORAGE
+
+#define RTOS_QUEUE_STORAGE(id, length) static uint8_t queueStorage_##id[(length) * sizeof(message_t)];
+RTOS_QUEUES(RTOS_QUEUE_STORAGE)
+#undef RTOS_QUEUE_STORAGE
+
+static const taskEntry_t taskLayout[RTOS_TASK_COUNT] = {
+#define RTOS_TASK_ENTRY(id, name, stackSize, priority, instances) {name, stackSize, priority, instances, stack_##id, tcb_##id},
+    RTOS_TASKS(RTOS_TASK_ENTRY)
+#undef RTOS_TASK_ENTRY
+};
+
+static const queueEntry_t queueLayout[RTOS_QUEUE_COUNT] = {
+#define RTOS_QUEUE_ENTRY(id, length) {length, queueStorage_##id},
+    RTOS_QUEUES(RTOS_QUEUE_ENTRY)
+#undef RTOS_QUEUE_ENTRY
+};
+
+#define RTOS_TASK_INSTANCES(id, name, stackSize, priority, instances) +(instances)
+#define TASK_INSTANCES (0 RTOS_TASKS(RTOS_TASK_INSTANCES))
+
+static size_t taskUsed[RTOS_TASK_COUNT];
+static TaskHandle_t tasks[TASK_INSTANCES]; // Created tasks, in creation order
+static uint32_t taskStackSizes[TASK_INSTANCES];
+static size_t taskCount = 0;
+
+static StaticQueue_t queueBuffers[RTOS_QUEUE_COUNT];
+static QueueHandle_t queues[RTOS_QUEUE_COUNT];
+
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+TaskHandle_t rtos_createTask(rtos_task_t task, const char *name, TaskFunction_t function, void *arg)
+{
+    const taskEntry_t *entry = &taskLayout[task];
+
+    portENTER_CRITICAL(&lock);
+    size_t instance = taskUsed[task];
+    if (instance < entry->instances)
+        taskUsed[task]++;
+    portEXIT_CRITICAL(&lock);
+
+    if (instance >= entry->instances)
+    {
+        ESP_LOGE(TAG, "no free instance of task %s", entry->name);
+        return NULL;
+    }
+
+    // ESP-IDF stack depth is in bytes
+    size_t stackDepth = entry->stackSize / sizeof(StackType_t);
+    TaskHandle_t handle = xTaskCreateStatic(function, name != NULL ? name : entry->name, entry->stackSize, arg, entry->priority,
+                                            entry->stacks + instance * stackDepth, &entry->tcbs[instance]);
+
+    portENTER_CRITICAL(&lock);
+    tasks[taskCount] = handle;
+    taskStackSizes[taskCount] = entry->stackSize;
+    taskCount++;
+    portEXIT_CRITICAL(&lock);
+
+    return handle;
+}
+
+QueueHandle_t rtos_createQueue(rtos_queue_t queue)
+{
+    if (queues[queue] == NULL)
+        queues[queue] = xQueueCreateStatic(queueLayout[queue].length, sizeof(message_t), queueLayout[queue].storage, &queueBuffers[queue]);
+    return queues[queue];
+}
+
+bool rtos_nextTask(size_t *pos, rtos_taskStats_t *stats)
+{
+    portENTER_CRITICAL(&lock);
+    size_t count = taskCount;
+    portEXIT_CRITICAL(&lock);
+
+    if (*pos >= count)
+        return false;
+
+    TaskHandle_t handle = tasks[*pos];
+    stats->name = pcTaskGetName(handle);
+    stats->stackSize = taskStackSizes[*pos];
+    stats->stackFree = uxTaskGetStackHighWaterMark(handle); // Bytes in ESP-IDF
+    (*pos)++;
+    return true;
+}
+
+void rtos_getHeapStats(rtos_heapStats_t *stats)
+{
+    stats->freeBytes = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    stats->minFreeBytes = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+    stats->largestBlock = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    stats->internalFreeBytes = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    stats->internalMinFreeBytes = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#include "config.h"
+
+/// @brief Statically allocated tasks: X(id, name, stack size in bytes, priority, instances)
+/// @details Stack sizes are tuned from the high-water marks reported by the "fm" SLCAN command
+#define RTOS_TASKS(X)                                                                      \
+    X(UART_EVENT, "uartEvent", 2048, UART_EVENT_TASK_PRIO, 1)                              \
+    X(UART_TX, "uartTx", 2048, UART_TX_TASK_PRIO, 1)                                       \
+    X(BT_TX, "btTx", 3072, APP_BT_TX_TASK_PRIO, 1)                                         \
+    X(TCP_SERVER, "tcp server", 3072, APP_TCP_TASK_PRIO, 1)                                \
+    X(TCP_TX, "tcp tx", 3072, APP_TCP_TASK_PRIO, 1)                                        \
+    X(SOCKETCAND_SERVER, "socketcand srv", 3072, APP_TCP_TASK_PRIO, 1)                     \
+    X(SOCKETCAND_TX, "socketcand tx", 3072, APP_TCP_TASK_PRIO, 1)                          \
+    X(SOCKETCAND, "socketcand", 3072, APP_SOCKETCAND_TASK_PRIO, 1)                         \
+    X(CAN_RX, "canRx", 3072, APP_CAPTURE_TASK_PRIO, 1)                                     \
+    X(RECORDER, "recorder", 3072, APP_RECORDER_TASK_PRIO, 1)                               \
+    X(MONITOR, "monitor", 3072, APP_MONITOR_TASK_PRIO, 1)                                  \
+    X(ISOTP, "isotp", 3072, APP_ISOTP_TASK_PRIO, 1)                                        \
+    X(OBD_POLL, "obdPoll", 3072, APP_OBD_POLL_TASK_PRIO, 1)                                \
+    X(UDS, "uds", 3072, APP_UDS_TASK_PRIO, 1)                                              \
+    X(SLCAN_DISPATCH, "slcan dispatch", 3072, APP_SLCAN_DISPATCH_TASK_PRIO, 1)             \
+    X(SLCAN_LINK_TX, "slcan link", 3072, APP_SLCAN_LINK_TX_TASK_PRIO, APP_SLCAN_MAX_LINKS) \
+    X(SD_LOG, "sdLog", 3072, APP_SD_TASK_PRIO, 1)                                          \
+    X(TRACE_DRAIN, "traceDrain", 3072, APP_TRACE_TASK_PRIO, 1)                             \
+    X(STREAM, "stream", 3072, APP_WS_TASK_PRIO, 1)                                         \
+    X(REPLAY_TX, "replayTx", 3072, APP_REPLAY_TX_TASK_PRIO, 1)                             \
+    X(REPLAY_READER, "replayReader", 3072, APP_REPLAY_READER_TASK_PRIO, 1)
+
+/// @brief Statically allocated @ref message_t queues: X(id, length)
+#define RTOS_QUEUES(X)                            \
+    X(UART_RX, UART_QUEUES_LEN)                   \
+    X(UART_TX, UART_QUEUES_LEN)                   \
+    X(BT_RX, APP_BT_RX_QUEUE_LEN)                 \
+    X(BT_TX, APP_BT_TX_QUEUE_LEN)                 \
+    X(TCP_RX, APP_TCP_RX_QUEUE_LEN)               \
+    X(TCP_TX, APP_TCP_TX_QUEUE_LEN)               \
+    X(SOCKETCAND_RX, APP_SOCKETCAND_RX_QUEUE_LEN) \
+    X(SOCKETCAND_TX, APP_SOCKETCAND_TX_QUEUE_LEN)
+
+typedef enum
+{
+#define RTOS_TASK_ID(id, name, stackSize, priority, instances) RTOS_TASK_##id,
+    RTOS_TASKS(RTOS_TASK_ID)
+#undef RTOS_TASK_ID
+    RTOS_TASK_COUNT
+} rtos_task_t;
+
+typedef enum
+{
+#define RTOS_QUEUE_ID(id, length) RTOS_QUEUE_##id,
+    RTOS_QUEUES(RTOS_QUEUE_ID)
+#undef RTOS_QUEUE_ID
+    RTOS_QUEUE_COUNT
+} rtos_queue_t;
+
+/// @brief Stack usage of one created task
+typedef struct
+{
+    const char *name;
+    uint32_t stackSize; // Bytes
+    uint32_t stackFree; // Bytes never used since the task started (high-water mark)
+} rtos_taskStats_t;
+
+/// @brief Heap usage, since boot
+typedef struct
+{
+    uint32_t freeBytes;
+    uint32_t minFreeBytes; // Lowest free heap since boot
+    uint32_t largestBlock; // Largest allocatable block
+    uint32_t internalFreeBytes;
+    uint32_t internalMinFreeBytes;
+} rtos_heapStats_t;
+
+/// @brief Create a task on the next free instance of its layout entry (stack and TCB allocated at build time)
+/// @param name Task name, NULL for the layout name
+/// @return NULL when all instances of the entry are already used
+TaskHandle_t rtos_createTask(rtos_task_t task, const char *name, TaskFunction_t function, void *arg);
+
+/// @brief Create a @ref message_t queue from its layout entry (storage allocated at build time), at most once
+QueueHandle_t rtos_createQueue(rtos_queue_t queue);
+
+/// @brief Copy the stack usage of the created task following position *pos, for iteration starting from *pos = 0
+/// @return false when there are no more tasks
+bool rtos_nextTask(size_t *pos, rtos_taskStats_t *stats);
+
+void rtos_getHeapStats(rtos_heapStats_t *stats);
@@ -0,0 +1,228 @@
+/*
+Frame match rules, compiled into a per-identifier dispatch table so that each received frame is only
+compared with the rules of its identifier (one 64bit mask compare per candidate rule)
+
+Changes compile a shadow table outside the critical section, the CAN RX path then switches to it together with the
+changed rule: interrupts are only disabled for a few stores.
+*/
+
+#include "rules.h"
+
+#include "config.h"
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#define RULES_HASH_MULTIPLIER 0x9E3779B1
+#define RULES_EXT_HASH_BITS 9 // Extended identifiers hash slots, at least twice APP_RULES_MAX_RULES
+#define RULES_ALL APP_RULES_MAX_RULES // Change index of every rule
+
+_Static_assert(APP_RULES_MAX_RULES <= (1 << (RULES_EXT_HASH_BITS - 1)), "RULES_EXT_HASH_BITS too small for APP_RULES_MAX_RULES");
+
+/// @brief Dispatch table: rule indexes sorted by identifier, identifiers map to their first rule (0: none, else 1 + position)
+typedef struct
+{
+    uint16_t order[APP_RULES_MAX_RULES];
+    uint32_t ids[APP_RULES_MAX_RULES]; // Identifier of the rule at each position
+    uint16_t len;
+    uint16_t stdIndex[2048];
+    uint16_t extIndex[1 << RULES_EXT_HASH_BITS];
+} table_t;
+
+static rules_rule_t rules[APP_RULES_MAX_RULES];
+static bool used[APP_RULES_MAX_RULES];
+static uint32_t hits[APP_RULES_MAX_RULES];
+
+static table_t tables[2];
+static table_t *active = &tables[0]; // Read by the CAN RX path, the other table is the shadow
+
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+static StaticSemaphore_t writeLockBuffer;
+static SemaphoreHandle_t writeLock = NULL; // Serializes changes: rules and used are only written by its holder
+static rules_callbacks_t callbacks = {0};
+static void *callbacksCtx = NULL;
+
+static inline uint32_t extSlot(uint32_t id)
+{
+    return (uint32_t)(id * RULES_HASH_MULTIPLIER) >> (32 - RULES_EXT_HASH_BITS);
+}
+
+/// @brief Build the dispatch table of the rules as they are once rule index (or RULES_ALL) is set to rule (NULL: deleted)
+/// @details Called with writeLock held, without lock: the table is not read by the CAN RX path
+static void compile(table_t *t, size_t index, const rules_rule_t *rule)
+{
+    // Insertion sort by identifier, stable so rules of the same identifier are evaluated in index order
+    t->len = 0;
+    for (uint16_t i = 0; i < APP_RULES_MAX_RULES; i++)
+    {
+        const rules_rule_t *r = index == RULES_ALL || i == index ? rule : used[i] ? &rules[i] : NULL;
+        if (r == NULL)
+            continue;
+        uint16_t pos = t->len++;
+        while (pos > 0 && t->ids[pos - 1] > r->id)
+        {
+            t->order[pos] = t->order[pos - 1];
+            t->ids[pos] = t->ids[pos - 1];
+            pos--;
+        }
+        t->order[pos] = i;
+        t->ids[pos] = r->id;
+    }
+
+    memset(t->stdIndex, 0, sizeof(t->stdIndex));
+    memset(t->extIndex, 0, sizeof(t->extIndex));
+    for (uint16_t pos = 0; pos < t->len; pos++)
+    {
+        uint32_t id = t->ids[pos];
+        if (pos > 0 && t->ids[pos - 1] == id)
+            continue; // Not the first rule of this identifier
+
+        if (!(id & RULES_ID_EXTD))
+            t->stdIndex[id & 0x7FF] = pos + 1;
+        else
+        {
+            uint32_t slot = extSlot(id);
+            while (t->extIndex[slot] != 0)
+                slot = (slot + 1) & ((1 << RULES_EXT_HASH_BITS) - 1);
+            t->extIndex[slot] = pos + 1;
+        }
+    }
+}
+
+/// @brief Find the position of the first rule of an identifier in a table, -1 if none
+static inline int findFirst(const table_t *t, uint32_t id)
+{
+    if (!(id & RULES_ID_EXTD))
+        return (int)t->stdIndex[id & 0x7FF] - 1;
+
+    uint32_t slot = extSlot(id);
+    while (t->extIndex[slot] != 0)
+    {
+        uint16_t pos = t->extIndex[slot] - 1;
+        if (t->ids[pos] == id)
+            return pos;
+        slot = (slot + 1) & ((1 << RULES_EXT_HASH_BITS) - 1);
+    }
+    return -1;
+}
+
+/// @brief Set or delete (rule NULL) a rule, RULES_ALL deletes every rule
+static void change(size_t index, const rules_rule_t *rule)
+{
+    xSemaphoreTake(writeLock, portMAX_DELAY);
+    table_t *shadow = active == &tables[0] ? &tables[1] : &tables[0];
+    compile(shadow, index, rule);
+
+    portENTER_CRITICAL(&lock);
+    if (index == RULES_ALL)
+        memset(used, 0, sizeof(used));
+    else
+    {
+        if (rule != NULL)
+            rules[index] = *rule;
+        used[index] = rule != NULL;
+        hits[index] = 0;
+    }
+    active = shadow;
+    portEXIT_CRITICAL(&lock);
+    xSemaphoreGive(writeLock);
+}
+
+void rules_init(const rules_callbacks_t *value, void *ctx)
+{
+    writeLock = xSemaphoreCreateMutexStatic(&writeLockBuffer);
+    callbacks = *value;
+    callbacksCtx = ctx;
+    rules_clear();
+}
+
+esp_err_t rules_set(size_t index, const rules_rule_t *rule)
+{
+    if (index >= APP_RULES_MAX_RULES || rule->action >= RULES_ACTION_MAX || (rule->dlc > 8 && rule->dlc != RULES_DLC_ANY))
+        return ESP_ERR_INVALID_ARG;
+
+    rules_rule_t value = *rule;
+    value.id &= (rule->id & RULES_ID_EXTD) ? (RULES_ID_EXTD | 0x1FFFFFFF) : 0x7FF;
+    value.value &= rule->mask;
+    change(index, &value);
+    return ESP_OK;
+}
+
+esp_err_t rules_delete(size_t index)
+{
+    if (index >= APP_RULES_MAX_RULES)
+        return ESP_ERR_INVALID_ARG;
+
+    change(index, NULL);
+    return ESP_OK;
+}
+
+void rules_clear(void)
+{
+    change(RULES_ALL, NULL);
+}
+
+bool rules_get(size_t index, rules_rule_t *rule, uint32_t *hitCount)
+{
+    if (index >= APP_RULES_MAX_RULES)
+        return false;
+
+    portENTER_CRITICAL(&lock);
+    bool found = used[index];
+    *rule = rules[index];
+    *hitCount = hits[index];
+    portEXIT_CRITICAL(&lock);
+    return found;
+}
+
+void rules_resetHits(void)
+{
+    portENTER_CRITICAL(&lock);
+    memset(hits, 0, sizeof(hits));
+    portEXIT_CRITICAL(&lock);
+}
+
+size_t rules_processFrame(const twai_message_t *msg, int64_t timestampUs)
+{
+    uint32_t id = msg->extd ? (msg->identifier | RULES_ID_EXTD) : msg->identifier;
+    uint64_t data;
+    memcpy(&data, msg->data, sizeof(data));
+    if (msg->data_length_code < 8)
+        data &= (1ULL << (msg->data_length_code * 8)) - 1; // Bytes past DLC are not meaningful
+
+    uint16_t actions[RULES_MAX_ACTIONS];
+    uint8_t actionTypes[RULES_MAX_ACTIONS];
+    size_t actionCount = 0;
+    size_t matches = 0;
+
+    portENTER_CRITICAL(&lock);
+    const table_t *t = active;
+    int pos = findFirst(t, id);
+    if (pos >= 0)
+    {
+        for (; pos < t->len && t->ids[pos] == id; pos++)
+        {
+            uint16_t index = t->order[pos];
+            const rules_rule_t *rule = &rules[index];
+            if ((data & rule->mask) != rule->value || (rule->dlc != RULES_DLC_ANY && rule->dlc != msg->data_length_code))
+                continue;
+
+            hits[index]++;
+            matches++;
+            if (rule->action != RULES_ACTION_COUNT && actionCount < RULES_MAX_ACTIONS)
+            {
+                actions[actionCount] = index;
+                actionTypes[actionCount++] = rule->action;
+            }
+        }
+    }
+    portEXIT_CRITICAL(&lock);
+
+    // Actions run outside the critical section, they use other locks and queues
+    if (callbacks.onMatch != NULL)
+        for (size_t i = 0; i < actionCount; i++)
+            callbacks.onMatch(callbacksCtx, actions[i], actionTypes[i], msg, timestampUs);
+
+    return matches;
+}
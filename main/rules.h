@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "hal/twai_types.h"
+
+#define RULES_ID_EXTD 0x80000000 // Rule identifier flag
+#define RULES_DLC_ANY 0xFF       // Rule matches any DLC
+#define RULES_MAX_ACTIONS 8      // Actions (other than counting) reported per frame
+
+typedef enum
+{
+    RULES_ACTION_COUNT,   // Only count hits
+    RULES_ACTION_MARKER,  // Report a marker to the host
+    RULES_ACTION_TRIGGER, // Fire a flight recorder trigger
+    RULES_ACTION_ARM,     // Start flight recorder
+    RULES_ACTION_DISARM,  // Stop flight recorder
+    RULES_ACTION_MAX,
+} rules_action_t;
+
+/// @brief Frame match rule: identifier == id, DLC == dlc (unless RULES_DLC_ANY) and (data & mask) == value
+typedef struct
+{
+    uint32_t id;    // Identifier | RULES_ID_EXTD
+    uint8_t dlc;    // Required DLC or RULES_DLC_ANY
+    uint8_t action; // rules_action_t
+    uint64_t mask;  // Payload bytes loaded little endian (byte 0 is the least significant)
+    uint64_t value;
+} rules_rule_t;
+
+typedef struct
+{
+    /// @brief Called from the CAN RX path for each matching rule whose action is not RULES_ACTION_COUNT
+    void (*onMatch)(void *ctx, size_t index, rules_action_t action, const twai_message_t *msg, int64_t timestampUs);
+} rules_callbacks_t;
+
+/// @brief Initialize rule engine, without rules
+void rules_init(const rules_callbacks_t *callbacks, void *ctx);
+
+/// @brief Set (or replace) the rule at an index, its hit counter is reset
+/// @return ESP_ERR_INVALID_ARG if index >= APP_RULES_MAX_RULES or the rule is invalid
+esp_err_t rules_set(size_t index, const rules_rule_t *rule);
+
+/// @brief Delete the rule at an index
+esp_err_t rules_delete(size_t index);
+
+/// @brief Delete all rules
+void rules_clear(void);
+
+/// @brief Get the rule at an index and its hit counter
+/// @return false if there is no rule at index
+bool rules_get(size_t index, rules_rule_t *rule, uint32_t *hits);
+
+/// @brief Reset all hit counters
+void rules_resetHits(void);
+
+/// @brief Match a received frame against the rules of its identifier, called from the CAN RX path
+/// @return Number of matching rules
+size_t rules_processFrame(const twai_message_t *msg, int64_t timestampUs);
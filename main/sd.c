@@ -1,5 +1,14 @@
 #include "sd.h"
 
+#include "config.h"
+#include "capture.h"
+#include "rtos.h"
+
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "driver/sdmmc_host.h"
 #include "esp_log.h"
 #include "esp_vfs_fat.h"
@@ -7,37 +16,107 @@
 
 static const char *TAG = "SD";
 
-void sdInit(void)
+static sdmmc_card_t *card = NULL;
+static FILE *logFile = NULL;
+static capture_sink_t logSink = {.name = "sd"};
+static char logBuf[APP_SD_LOG_BUF_SIZE];
+
+/// @brief Write a received frame as a candump log line: "(<sec>.<usec>) can0 <id>#<data>"
+static void writeFrame(const capture_frame_t *frame)
+{
+    const twai_message_t *msg = &frame->msg;
+    fprintf(logFile, msg->extd ? "(%lld.%06ld) can0 %08lX#" : "(%lld.%06ld) can0 %03lX#",
+            frame->timestampUs / 1000000, (long)(frame->timestampUs % 1000000), (unsigned long)msg->identifier);
+    if (msg->rtr)
+        fputc('R', logFile);
+    else
+        for (int i = 0; i < msg->data_length_code; i++)
+            fprintf(logFile, "%02X", msg->data[i]);
+    fputc('\n', logFile);
+}
+
+/// @brief Write captured frames to the log file, flushed at least every APP_SD_LOG_FLUSH_MS
+static void logTask(void *arg)
+{
+    uint32_t lastDrops = 0;
+
+    while (1)
+    {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(APP_SD_LOG_FLUSH_MS));
+
+        capture_frame_t frame;
+        while (capture_read(&logSink, &frame))
+            writeFrame(&frame);
+        fflush(logFile);
+        fsync(fileno(logFile));
+
+        if (logSink.drops != lastDrops)
+        {
+            ESP_LOGW(TAG, "log dropped frames:%lu", logSink.drops - lastDrops);
+            lastDrops = logSink.drops;
+        }
+    }
+}
+
+FILE *sd_createFile(const char *prefix)
+{
+    if (card == NULL)
+        return NULL;
+
+    char path[48];
+    struct stat st;
+    for (int i = 0; i < 10000; i++)
+    {
+        snprintf(path, sizeof(path), APP_SD_MOUNT_POINT "/%s-%d.log", prefix, i);
+        if (stat(path, &st) != 0)
+        {
+            ESP_LOGI(TAG, "creating %s", path);
+            return fopen(path, "w");
+        }
+    }
+    return NULL;
+}
+
+bool sd_isMounted(void)
 {
-    // esp_err_t ret;
+    return card != NULL;
+}
 
+void sdInit(void)
+{
     sdmmc_host_t host = SDMMC_HOST_DEFAULT();
     sdmmc_slot_config_t slot_config = SDMMC_SLOT_CONFIG_DEFAULT();
     slot_config.width = 1;
 
-    ESP_ERROR_CHECK(sdmmc_host_init());
-    ESP_ERROR_CHECK(sdmmc_host_init_slot(SDMMC_HOST_SLOT_1, &slot_config));
+    // SD card was formatted as FAT with 16kB sectors
+    esp_vfs_fat_sdmmc_mount_config_t mount_config = {
+        .format_if_mount_failed = false,
+        .max_files = APP_SD_MAX_FILES,
+        .allocation_unit_size = 16 * 1024,
+    };
 
-    sdmmc_card_t card;
-    ESP_ERROR_CHECK(sdmmc_card_init(&host, &card));
+    // A missing card is not fatal, other transports keep working
+    esp_err_t ret = esp_vfs_fat_sdmmc_mount(APP_SD_MOUNT_POINT, &host, &slot_config, &mount_config, &card);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "esp_vfs_fat_sdmmc_mount: %s", esp_err_to_name(ret));
+        card = NULL;
+        return;
+    }
 
-    ESP_LOG_BUFFER_HEXDUMP(TAG, &card, sizeof(sdmmc_card_t), ESP_LOG_INFO);
+    sdmmc_card_print_info(stdout, card);
 
-    // SD card was formatted as FAT with 16kB sectors
-    // esp_vfs_fat_sdmmc_mount_config_t mount_config = {
-    //     .format_if_mount_failed = false,
-    //     .max_files = 5,
-    //     .allocation_unit_size = 16 * 1024,
-    // };
-
-    // ret = esp_vfs_fat_sdmmc_mount("/sdcard", &host, &slot_config, &mount_config, &card);
-    // if (ret != ESP_OK)
-    // {
-    //     ESP_LOGE(TAG, "esp_vfs_fat_sdmmc_mount: %s", esp_err_to_name(ret));
-    //     return;
-    // }
-
-    // sdmmc_card_print_info(stdout, card);
+    logFile = sd_createFile("candump");
+    if (logFile == NULL)
+    {
+        ESP_LOGE(TAG, "cannot open log file");
+        return;
+    }
+    setvbuf(logFile, logBuf, _IOFBF, sizeof(logBuf));
+
+    logSink.task = rtos_createTask(RTOS_TASK_SD_LOG, NULL, logTask, NULL);
+    if (capture_addSink(&logSink) != ESP_OK)
+        ESP_LOGE(TAG, "cannot add log sink");
 
     ESP_LOGI(TAG, "initialized");
 }
@@ -1,3 +1,14 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdio.h>
+
+/// @brief Mount the SD card and start logging received CAN frames (candump format)
 void sdInit(void);
+
+/// @brief Check if the SD card is mounted
+bool sd_isMounted(void);
+
+/// @brief Create the first unused "<prefix>-<n>.log" file for writing
+/// @return NULL if the SD card is not mounted or the file cannot be created
+FILE *sd_createFile(const char *prefix);
@@ -0,0 +1,79 @@
+/*
+Adapter configuration record (bitrate, auto start, timestamps, link filters and forwarding), stored as a single NVS
+blob prefixed by a version: a record written by another firmware version is ignored rather than misread.
+*/
+
+#include "settings.h"
+
+#include <string.h>
+#include "nvs.h"
+#include "esp_log.h"
+
+#define TAG "SETTINGS"
+
+#define SETTINGS_VERSION 1
+#define SETTINGS_KEY "config"
+
+typedef struct
+{
+    uint16_t version;
+    uint16_t size; // sizeof(settings_t), changes with APP_SLCAN_MAX_LINKS
+    settings_t settings;
+} record_t;
+
+static void setDefaults(settings_t *settings)
+{
+    memset(settings, 0, sizeof(*settings));
+    settings->autoStart = SETTINGS_AUTO_START_OFF;
+    settings->sinks = (1 << APP_SLCAN_MAX_LINKS) - 1;
+}
+
+esp_err_t settings_load(settings_t *settings)
+{
+    setDefaults(settings);
+
+    nvs_handle_t handle;
+    esp_err_t res = nvs_open(APP_SETTINGS_NVS_NAMESPACE, NVS_READONLY, &handle);
+    if (res != ESP_OK)
+        return ESP_ERR_NOT_FOUND; // Namespace is created by the first save
+
+    record_t record;
+    size_t len = sizeof(record);
+    res = nvs_get_blob(handle, SETTINGS_KEY, &record, &len);
+    nvs_close(handle);
+
+    if (res != ESP_OK || len != sizeof(record) || record.version != SETTINGS_VERSION || record.size != sizeof(settings_t))
+    {
+        if (res != ESP_ERR_NVS_NOT_FOUND)
+            ESP_LOGW(TAG, "ignoring stored record res:%s len:%u", esp_err_to_name(res), len);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    *settings = record.settings;
+    ESP_LOGI(TAG, "loaded bitrate:%lu autoStart:%d timestamps:%d sinks:%02X", settings->bitrate, settings->autoStart,
+             settings->timestamps, settings->sinks);
+    return ESP_OK;
+}
+
+esp_err_t settings_save(const settings_t *settings)
+{
+    record_t record = {
+        .version = SETTINGS_VERSION,
+        .size = sizeof(settings_t),
+        .settings = *settings,
+    };
+
+    nvs_handle_t handle;
+    esp_err_t res = nvs_open(APP_SETTINGS_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (res != ESP_OK)
+        return res;
+
+    res = nvs_set_blob(handle, SETTINGS_KEY, &record, sizeof(record));
+    if (res == ESP_OK)
+        res = nvs_commit(handle);
+    nvs_close(handle);
+
+    if (res != ESP_OK)
+        ESP_LOGE(TAG, "save failed res:%s", esp_err_to_name(res));
+    return res;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#include "config.h"
+
+/// @brief Bus opened at boot (LAWICEL Qn)
+typedef enum
+{
+    SETTINGS_AUTO_START_OFF = 0,
+    SETTINGS_AUTO_START_NORMAL = 1,
+    SETTINGS_AUTO_START_LISTEN_ONLY = 2,
+} settings_autoStart_t;
+
+typedef struct
+{
+    uint32_t id;
+    uint32_t mask;
+} settings_filter_t;
+
+/// @brief Adapter configuration record, persisted in NVS
+typedef struct
+{
+    uint32_t bitrate;                               // CAN bitrate, 0 if not set
+    uint8_t autoStart;                              // settings_autoStart_t
+    bool timestamps;                                // SLCAN frames carry a ms timestamp (LAWICEL Zn)
+    uint8_t sinks;                                  // Links forwarding received frames, bit n for link n
+    settings_filter_t filters[APP_SLCAN_MAX_LINKS]; // Identifier filter of each link, in link order
+} settings_t;
+
+/// @brief Load the configuration record, requires NVS to be initialized
+/// @details Defaults (no auto start, every link forwarding every frame) are returned when no record of the current
+/// version is stored
+/// @return ESP_ERR_NOT_FOUND when defaults were returned
+esp_err_t settings_load(settings_t *settings);
+
+/// @brief Store the configuration record, applied at the next boot
+esp_err_t settings_save(const settings_t *settings);
@@ -8,19 +8,43 @@ Target is to be compatible with Linux SocketCAN slcan driver, to allow usage of
 #include "config.h"
 #include "message.h"
 #include "can.h"
+#include "capture.h"
+#include "isotp.h"
+#include "obd.h"
+#include "uds.h"
+#include "dbc.h"
+#include "gvret.h"
+#include "uart.h"
+#include "bt.h"
+#include "recorder.h"
+#include "replay.h"
+#include "rules.h"
+#include "census.h"
+#include "monitor.h"
+#include "rtos.h"
+#include "trace.h"
+#include "settings.h"
 
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 #include "esp_log.h"
 #include "esp_mac.h"
 #include "esp_timer.h"
+#include "esp_rom_sys.h"
 
 #define TAG "SLCAN"
 
 #define SLCAN_MIN_STD_CMD_LEN (strlen("t1FF0\r"))
 #define SLCAN_MIN_EXT_CMD_LEN (strlen("T1FFFFFFF0\r"))
 #define SLCAN_MAX_CMD_LEN (strlen("T1FFFFFFF81122334455667788FFFF\r")) // Including timestamp (2 bytes)
+#define SLCAN_MAX_SIGNAL_LEN (strlen("dr0000FFFFFFFFFFFFFFFF\r"))           // 64 bit raw value, longer than any text value
+#define SLCAN_MAX_EXT_CMD_LEN (sizeof("is1231FF\r") - 1 + APP_ISOTP_TX_BUF_SIZE * 2) // Longest extension command
+
+_Static_assert(12 + APP_ISOTP_RX_BUF_SIZE * 2 <= APP_MESSAGE_LARGE_SIZE, "ISO-TP PDUs must fit in a message pool block");
+_Static_assert(APP_SLCAN_TX_BATCH_SIZE <= APP_MESSAGE_MEDIUM_SIZE && APP_GVRET_BATCH_SIZE <= APP_MESSAGE_MEDIUM_SIZE,
+               "Frame batches must fit in a medium message pool block");
 
 /// @brief Hex to ASCII conversion function
 #define HEX2ASCII(x) HEX2ASCII_LUT[(x)]
@@ -37,22 +61,78 @@ static const uint8_t ASCII2HEX_LUT[] = {
 };
 // clang-format on
 
-static QueueHandle_t *_rxQueue;
-static QueueHandle_t *_txQueue;
-static TaskHandle_t _canRxTask = NULL;
-static bool timingConfigSet = false;
-static twai_timing_config_t timingConfig = {0};
+/// @brief Host connection over one transport
+typedef struct
+{
+    const char *name;
+    QueueHandle_t *rxQueue;
+    QueueHandle_t *txQueue;
+    bool gvretMode; // Host switched to GVRET binary protocol
+    gvret_t gvret;
+    capture_sink_t sink;
+    uint32_t txDrops;                            // Frames lost because txQueue was full
+    message_budget_t txBudget;                   // Message blocks held by txQueue
+    bool forwarding;                             // Received frames are sent to the host ("fe")
+    volatile bool attached;                      // Host opened the bus (or switched to GVRET), frames are forwarded
+    volatile bool bootPending;                   // Boot buffer frames still to be sent, before live frames
+    uint8_t bufRemainder[SLCAN_MAX_EXT_CMD_LEN]; // Partial command received
+    size_t bufRemainderLen;
+} link_t;
+
+static link_t links[APP_SLCAN_MAX_LINKS];
+static size_t linkCount = 0;
+static QueueSetHandle_t rxQueueSet; // Received data of all links, handled by a single dispatcher
+static link_t *cmdLink = NULL;      // Link of the command being handled, receives responses
+static link_t *dbcLink = NULL;      // Link receiving decoded signals, last one that configured the decoder
+static link_t *ruleLinks[APP_RULES_MAX_RULES]; // Link receiving markers of each rule, the one that set it
+static bool dbcRawFormat = false;   // Decoded signals output format: text value or raw hex
+static bool dbcSignalsOnly = false; // Frames of DBC messages are replaced by their decoded signals on dbcLink
+static trace_reader_t traceReader;  // Trace records not dumped yet by "ld"
+static settings_t settings;         // Configuration loaded at boot, updated and stored by Q and Z
+static bool timestamps = false;     // Frames carry a ms timestamp (Zn)
+static replay_options_t replayOptions = {.speedPercent = 100}; // Options of the next log replay (yo, yf)
+
+/// @brief Bitrates selected by S0-S8 commands
+static const uint32_t SLCAN_BITRATES[] = {10000, 20000, 50000, 100000, 125000, 250000, 500000, 800000, 1000000};
 
-static void sendSerialMessage(char *data, size_t len)
+/// @brief Allocate a message charged to the budget of a link, waiting for the link to release blocks
+/// @return Message with NULL data if the link still held its budget (or the pools were exhausted) after ticksToWait
+static message_t newLinkMessage(link_t *link, const char *data, size_t len, TickType_t ticksToWait)
 {
-    message_t msg = message_new((uint8_t *)data, len);
-    if (xQueueSend(*_txQueue, &msg, 0) == errQUEUE_FULL)
+    TickType_t start = xTaskGetTickCount();
+    message_t msg = message_newBudget(&link->txBudget, (uint8_t *)data, len);
+    while (msg.data == NULL && xTaskGetTickCount() - start < ticksToWait)
     {
-        ESP_LOGE(TAG, "transmit queue full");
-        message_free(&msg);
+        vTaskDelay(1);
+        msg = message_newBudget(&link->txBudget, (uint8_t *)data, len);
+    }
+    return msg;
+}
+
+/// @brief Queue an already allocated message for sending, ownership is transferred
+/// @return false if the link transmit queue stayed full (message is discarded)
+static bool queueMessage(link_t *link, message_t *msg, TickType_t ticksToWait)
+{
+    if (msg->data == NULL || xQueueSend(*link->txQueue, msg, ticksToWait) == errQUEUE_FULL)
+    {
+        message_free(msg);
+        return false;
     }
-    // else
-    //     ESP_LOGI(TAG, "serial transmit bytes:%d", len);
+    return true;
+}
+
+/// @brief Queue an already allocated message for sending without waiting, ownership is transferred
+static void sendMessage(link_t *link, message_t *msg)
+{
+    if (!queueMessage(link, msg, 0))
+        TRACE(SLCAN_TX_QUEUE_FULL, link - links, 0, 0);
+}
+
+static void sendSerialMessage(link_t *link, char *data, size_t len)
+{
+    message_t msg = newLinkMessage(link, data, len, 0);
+    sendMessage(link, &msg);
+    // ESP_LOGI(TAG, "serial transmit bytes:%d", len);
 }
 
 /// @brief Send an OK response (0x0D), with optional data
@@ -64,28 +144,83 @@ static void sendOkResponse(char *data)
         char buf[32];
         snprintf(buf, sizeof(buf), "%s\r", data);
 
-        ESP_LOGI(TAG, "respond ok data=\"%s\"", data);
-        sendSerialMessage(buf, strlen(buf));
+        TRACE(SLCAN_OK, strlen(data), 0, 0);
+        sendSerialMessage(cmdLink, buf, strlen(buf));
     }
     else
     {
-        ESP_LOGI(TAG, "respond ok");
-        sendSerialMessage("\r", 1);
+        TRACE(SLCAN_OK, 0, 0, 0);
+        sendSerialMessage(cmdLink, "\r", 1);
     }
 }
 
 /// @brief Send an error response (0x07)
 static void sendErrorResponse(void)
 {
-    ESP_LOGI(TAG, "respond error");
-    sendSerialMessage("\a", 1);
+    TRACE(SLCAN_ERROR, 0, 0, 0);
+    sendSerialMessage(cmdLink, "\a", 1);
+}
+
+/// @brief Parse a fixed number of hex digits
+/// @param buf input characters
+/// @param digits number of characters to parse
+/// @param out parsed value
+static esp_err_t parseHex(const uint8_t *buf, size_t digits, uint32_t *out)
+{
+    uint32_t value = 0;
+    for (size_t i = 0; i < digits; i++)
+    {
+        uint8_t c = buf[i];
+        if (!((c >= '0' && c <= '9') || (c >= 'A' && c <= 'F') || (c >= 'a' && c <= 'f')))
+            return ESP_FAIL;
+        value = value << 4 | ASCII2HEX(c);
+    }
+    *out = value;
+    return ESP_OK;
+}
+
+/// @brief Write bytes as hex characters
+/// @return pointer past the last written character
+static char *formatHex(char *str, const uint8_t *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        *str++ = HEX2ASCII(data[i] >> 4);
+        *str++ = HEX2ASCII(data[i] & 0xF);
+    }
+    return str;
+}
+
+/// @brief Parse 8 bytes (16 hex digits) in frame order into a 64bit integer loaded little endian
+static esp_err_t parseHexPayload(const uint8_t *buf, uint64_t *out)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        uint32_t byte;
+        if (parseHex(buf + i * 2, 2, &byte) != ESP_OK)
+            return ESP_FAIL;
+        value |= (uint64_t)byte << (i * 8);
+    }
+    *out = value;
+    return ESP_OK;
+}
+
+/// @brief Write a 64bit integer loaded little endian as 16 hex digits in frame order
+static char *formatHexPayload(char *str, uint64_t value)
+{
+    uint8_t bytes[8];
+    for (int i = 0; i < 8; i++)
+        bytes[i] = value >> (i * 8);
+    return formatHex(str, bytes, sizeof(bytes));
 }
 
 /// @brief Format received CAN frame for SLCAN output
 /// @param msg input frame
 /// @param str formatted output string, must be at least SLCAN_MAX_CMD_LEN+1 long
 /// @param outLen length of formatted output
-static void formatFrame(twai_message_t *msg, char *str, size_t *outLen, uint16_t timestamp)
+/// @param timestamp LAWICEL timestamp (ms, 0-59999), -1 for none
+static void formatFrame(twai_message_t *msg, char *str, size_t *outLen, int32_t timestamp)
 {
     char *pStr = str;
 
@@ -129,7 +264,7 @@ static void formatFrame(twai_message_t *msg, char *str, size_t *outLen, uint16_t
         *pStr++ = HEX2ASCII(msg->data[i] & 0xF);
     }
 
-    if (timestamp != 0)
+    if (timestamp >= 0)
     {
         *pStr++ = HEX2ASCII(timestamp >> 12 & 0xF);
         *pStr++ = HEX2ASCII(timestamp >> 8 & 0xF);
@@ -206,279 +341,1686 @@ static esp_err_t parseFrame(uint8_t *buf, size_t len, twai_message_t *msg)
     return ESP_OK;
 }
 
-/// @brief Handle received CAN frames
-static void canRxTask(void *arg)
+/// @brief Queue formatted frames for sending, waiting for the link to make room
+static void sendFrames(link_t *link, char *data, size_t len)
+{
+    if (len == 0)
+        return;
+
+    message_t msg = newLinkMessage(link, data, len, pdMS_TO_TICKS(APP_SLCAN_TX_WAIT_MS));
+    if (!queueMessage(link, &msg, pdMS_TO_TICKS(APP_SLCAN_TX_WAIT_MS)))
+        link->txDrops++;
+}
+
+/// @brief Append the enabled DBC signals of a received frame to the batch of a link, sending the batch when it is full
+/// @details Text format is "dv<signal>,<value>", raw format is "dr<signal><raw>" with raw as (length+3)/4 hex digits.
+/// Signals are decoded in chunks, messages can have more signals than fit on the stack.
+static void forwardDecodedSignals(link_t *link, const twai_message_t *msg, char *out, size_t size, size_t *outLen)
+{
+    dbc_value_t values[16];
+    uint16_t next = 0;
+    size_t count;
+
+    while ((count = dbc_decodeFrame(msg, values, sizeof(values) / sizeof(values[0]), &next)) > 0)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            if (*outLen + SLCAN_MAX_SIGNAL_LEN + 1 > size)
+            {
+                sendFrames(link, out, *outLen);
+                *outLen = 0;
+            }
+
+            char *pStr = out + *outLen;
+            uint16_t signal = values[i].signal;
+            *pStr++ = 'd';
+            *pStr++ = dbcRawFormat ? 'r' : 'v';
+            *pStr++ = HEX2ASCII(signal >> 12 & 0xF);
+            *pStr++ = HEX2ASCII(signal >> 8 & 0xF);
+            *pStr++ = HEX2ASCII(signal >> 4 & 0xF);
+            *pStr++ = HEX2ASCII(signal & 0xF);
+            if (dbcRawFormat)
+            {
+                uint64_t raw = values[i].raw;
+                for (int digit = (DBC_SIGNALS[signal].length + 3) / 4 - 1; digit >= 0; digit--)
+                    *pStr++ = HEX2ASCII(raw >> (digit * 4) & 0xF);
+            }
+            else
+                pStr += snprintf(pStr, out + size - pStr, ",%g", values[i].value);
+            *pStr++ = '\r';
+            *outLen = pStr - out;
+        }
+    }
+}
+
+/// @brief Append a received frame to the batch of a link, sending the batch when it is full
+static void forwardFrame(link_t *link, const capture_frame_t *frame, char *out, size_t size, size_t *outLen)
+{
+    if (link->gvretMode)
+    {
+        gvret_queueFrame(&link->gvret, &frame->msg, frame->timestampUs);
+        return;
+    }
+
+    if (link == dbcLink)
+    {
+        forwardDecodedSignals(link, &frame->msg, out, size, outLen);
+        if (dbcSignalsOnly && dbc_findMessage(frame->msg.identifier, frame->msg.extd) != NULL)
+            return;
+    }
+
+    if (*outLen + SLCAN_MAX_CMD_LEN + 1 > size)
+    {
+        sendFrames(link, out, *outLen);
+        *outLen = 0;
+    }
+
+    size_t len;
+    formatFrame((twai_message_t *)&frame->msg, out + *outLen, &len, timestamps ? (frame->timestampUs / 1000) % 60000 : -1);
+    *outLen += len;
+}
+
+/// @brief Forward captured CAN frames to the host, each link reads the capture ring at its own pace
+/// @details Nothing is read before the host attaches: the frames kept in the boot buffer are then sent first, followed
+/// by the frames published after the attach
+static void linkTxTask(void *arg)
 {
+    link_t *link = arg;
+
     while (1)
     {
-        twai_message_t msg;
-        if (can_receive(&msg, pdMS_TO_TICKS(100)) == ESP_OK)
+        TickType_t ticksToWait = link->gvretMode && gvret_hasPending(&link->gvret) ? pdMS_TO_TICKS(APP_GVRET_BATCH_MS) : portMAX_DELAY;
+        ulTaskNotifyTake(pdTRUE, ticksToWait);
+        if (!link->attached)
+            continue;
+
+        // Frames read in one pass are sent as a single message
+        char out[APP_SLCAN_TX_BATCH_SIZE];
+        size_t outLen = 0;
+        capture_frame_t frame;
+        if (link->bootPending)
         {
-            // TODO add timestamp (Zn) command
-            // int64_t timeUs = esp_timer_get_time();
-            // uint16_t timeMs = (timeUs / 1000) & 0xFFFF;
-            char out[32];
-            size_t len;
-            formatFrame(&msg, out, &len, /*timeMs*/ 0);
-            sendSerialMessage(out, len);
+            link->bootPending = false;
+            uint32_t index = 0;
+            while (link->forwarding && capture_readBoot(&link->sink, &index, &frame))
+                forwardFrame(link, &frame, out, sizeof(out), &outLen);
         }
+        while (capture_read(&link->sink, &frame))
+            if (link->forwarding)
+                forwardFrame(link, &frame, out, sizeof(out), &outLen);
+        sendFrames(link, out, outLen);
+
+        if (link->gvretMode)
+            gvret_flush(&link->gvret, esp_timer_get_time());
     }
 }
 
-/// @brief Parse received command and perform requested action
-static void parseCommand(uint8_t *buf, size_t len)
+/// @brief Start sending frames to a host that is ready for them, frames kept since boot first (once per link)
+static void attachLink(link_t *link)
 {
-    ESP_LOGI(TAG, "command \"%.*s\"", len - 1, buf);
+    if (link->attached)
+        return;
 
-    if (len == 0)
+    // Set last: linkTxTask starts reading once the cursor is past the boot buffer frames and these are pending
+    capture_attachSink(&link->sink);
+    link->bootPending = true;
+    link->attached = true;
+    xTaskNotifyGive(link->sink.task);
+}
+
+static void gvretSend(void *ctx, const uint8_t *data, size_t len)
+{
+    sendFrames(ctx, (char *)data, len);
+}
+
+static esp_err_t gvretSetBus(void *ctx, bool enabled, bool listenOnly, uint32_t value)
+{
+    if (can_isOpen())
+    {
+        esp_err_t res = capture_close();
+        if (res != ESP_OK)
+            return res;
+    }
+
+    if (!enabled)
+        return ESP_OK;
+
+    esp_err_t res = capture_setBitrate(value);
+    if (res != ESP_OK)
+        return res;
+
+    return capture_open(listenOnly ? TWAI_MODE_LISTEN_ONLY : TWAI_MODE_NORMAL);
+}
+
+static void gvretGetBus(void *ctx, bool *enabled, bool *listenOnly, uint32_t *value)
+{
+    *enabled = can_isOpen();
+    *listenOnly = can_getMode() == TWAI_MODE_LISTEN_ONLY;
+    *value = capture_getBitrate();
+}
+
+static esp_err_t gvretTransmit(void *ctx, twai_message_t *msg)
+{
+    if (!can_isOpen() || can_getMode() != TWAI_MODE_NORMAL)
+        return ESP_ERR_INVALID_STATE;
+
+    return can_transmit(msg, pdMS_TO_TICKS(100));
+}
+
+static const gvret_callbacks_t gvretCallbacks = {
+    .send = gvretSend,
+    .setBus = gvretSetBus,
+    .getBus = gvretGetBus,
+    .transmit = gvretTransmit,
+};
+
+/// @brief Forward ISO-TP session events to the host
+/// @details Received PDUs are sent as a single "ip<txid><rxid><len><data>" message, errors as "ie<txid><rxid><code>"
+static void isotpCallback(isotp_session_t *session, isotp_result_t result, const uint8_t *data, size_t len, void *ctx)
+{
+    const isotp_config_t *config = isotp_getConfig(session);
+
+    // 2 (prefix) + 3 (txid) + 3 (rxid) + 3 (len) + data + CR
+    message_t msg = message_allocBudget(&((link_t *)ctx)->txBudget, 12 + len * 2);
+    if (msg.data == NULL)
+    {
+        ESP_LOGE(TAG, "no message buffer for ISO-TP PDU len:%d", len);
+        return;
+    }
+    char *pStr = (char *)msg.data;
+    *pStr++ = 'i';
+    *pStr++ = result == ISOTP_RESULT_OK ? 'p' : 'e';
+    *pStr++ = HEX2ASCII(config->txId >> 8 & 0xF);
+    *pStr++ = HEX2ASCII(config->txId >> 4 & 0xF);
+    *pStr++ = HEX2ASCII(config->txId & 0xF);
+    *pStr++ = HEX2ASCII(config->rxId >> 8 & 0xF);
+    *pStr++ = HEX2ASCII(config->rxId >> 4 & 0xF);
+    *pStr++ = HEX2ASCII(config->rxId & 0xF);
+    if (result == ISOTP_RESULT_OK)
+    {
+        *pStr++ = HEX2ASCII(len >> 8 & 0xF);
+        *pStr++ = HEX2ASCII(len >> 4 & 0xF);
+        *pStr++ = HEX2ASCII(len & 0xF);
+        pStr = formatHex(pStr, data, len);
+    }
+    else
+    {
+        *pStr++ = HEX2ASCII(result >> 4 & 0xF);
+        *pStr++ = HEX2ASCII(result & 0xF);
+    }
+    *pStr++ = '\r';
+    msg.length = pStr - (char *)msg.data;
+
+    sendMessage(ctx, &msg);
+}
+
+/// @brief Parse ISO-TP extension commands (non-standard)
+/// @details
+/// - io<txid><rxid>[<bs><stmin>]: open session (11bit identifiers, 3 hex digits each; bs and stmin 2 hex digits each)
+/// - ic<txid><rxid>: close session
+/// - is<txid><rxid><data>: send PDU (hex bytes)
+static void parseIsotpCommand(uint8_t *buf, size_t len)
+{
+    uint32_t txId, rxId;
+
+    if (len < strlen("iX1231FF\r") || parseHex(buf + 2, 3, &txId) != ESP_OK || parseHex(buf + 5, 3, &rxId) != ESP_OK)
     {
+        ESP_LOGE(TAG, "\"%.*s\": invalid identifiers", len - 1, buf);
         sendErrorResponse();
         return;
     }
 
-    switch (buf[0])
+    switch (buf[1])
     {
-    case 'S': // Set CAN standard bitrate
-        if (can_isOpen())
+    case 'o': // Open session
+    {
+        uint32_t bs = APP_ISOTP_DEFAULT_BS, stMin = APP_ISOTP_DEFAULT_STMIN;
+        if (len == strlen("io1231FF0000\r") && (parseHex(buf + 8, 2, &bs) != ESP_OK || parseHex(buf + 10, 2, &stMin) != ESP_OK))
         {
-            ESP_LOGE(TAG, "\"%.*s\": cannot set bitrate while connection is open", len - 1, buf);
+            ESP_LOGE(TAG, "\"%.*s\": invalid flow control parameters", len - 1, buf);
             sendErrorResponse();
+            break;
         }
+
+        isotp_config_t config = {
+            .txId = txId,
+            .rxId = rxId,
+            .blockSize = bs,
+            .stMin = stMin,
+            .callback = isotpCallback,
+            .ctx = cmdLink,
+        };
+        isotp_session_t *session;
+        esp_err_t res = isotp_open(&config, &session);
+        if (res == ESP_OK)
+            sendOkResponse(NULL);
         else
         {
-            switch (buf[1])
-            {
-            case '2':
-                timingConfig = (twai_timing_config_t)TWAI_TIMING_CONFIG_50KBITS();
-                timingConfigSet = true;
-                sendOkResponse(NULL);
-                break;
-            case '3':
-                timingConfig = (twai_timing_config_t)TWAI_TIMING_CONFIG_100KBITS();
-                timingConfigSet = true;
-                sendOkResponse(NULL);
-                break;
-            case '4':
-                timingConfig = (twai_timing_config_t)TWAI_TIMING_CONFIG_125KBITS();
-                timingConfigSet = true;
-                sendOkResponse(NULL);
-                break;
-            case '5':
-                timingConfig = (twai_timing_config_t)TWAI_TIMING_CONFIG_250KBITS();
-                timingConfigSet = true;
-                sendOkResponse(NULL);
-                break;
-            case '6':
-                timingConfig = (twai_timing_config_t)TWAI_TIMING_CONFIG_500KBITS();
-                timingConfigSet = true;
-                sendOkResponse(NULL);
-                break;
-            case '7':
-                timingConfig = (twai_timing_config_t)TWAI_TIMING_CONFIG_800KBITS();
-                timingConfigSet = true;
-                sendOkResponse(NULL);
-                break;
-            case '8':
-                timingConfig = (twai_timing_config_t)TWAI_TIMING_CONFIG_1MBITS();
-                timingConfigSet = true;
-                sendOkResponse(NULL);
-                break;
-            default:
-                ESP_LOGE(TAG, "\"%.*s\": unsupported bitrate", len - 1, buf);
-                sendErrorResponse();
-            }
+            ESP_LOGE(TAG, "\"%.*s\": isotp_open returned %s", len - 1, buf, esp_err_to_name(res));
+            sendErrorResponse();
         }
         break;
-    case 'O': // Open CAN channel
-    case 'L': // Open CAN channel in listen-only mode
-        if (can_isOpen())
+    }
+    case 'c': // Close session
+        if (isotp_close(isotp_find(txId, rxId)) == ESP_OK)
+            sendOkResponse(NULL);
+        else
         {
-            ESP_LOGE(TAG, "\"%.*s\": connection is already open", len - 1, buf);
+            ESP_LOGE(TAG, "\"%.*s\": session not found", len - 1, buf);
             sendErrorResponse();
         }
-        else if (!timingConfigSet)
+        break;
+    case 's': // Send PDU
+    {
+        isotp_session_t *session = isotp_find(txId, rxId);
+        size_t dataLen = (len - strlen("is1231FF\r")) / 2;
+        uint8_t data[APP_ISOTP_TX_BUF_SIZE];
+
+        if (session == NULL)
         {
-            ESP_LOGE(TAG, "\"%.*s\": bitrate has not been set", len - 1, buf);
+            ESP_LOGE(TAG, "\"%.*s\": session not found", len - 1, buf);
             sendErrorResponse();
+            break;
         }
-        else
+        if ((len - strlen("is1231FF\r")) % 2 != 0 || dataLen > sizeof(data))
         {
-            twai_mode_t mode = buf[0] == 'L' ? TWAI_MODE_LISTEN_ONLY : TWAI_MODE_NORMAL;
-            esp_err_t res = can_open(mode, &timingConfig);
-            if (res == ESP_OK)
-            {
-                if (_canRxTask != NULL)
-                {
-                    ESP_LOGW(TAG, "_canRxTask is not NULL");
-                    vTaskDelete(_canRxTask);
-                }
-
-                xTaskCreate(canRxTask, "slcan canRx", 3072, NULL, APP_SLCAN_CAN_RX_TASK_PRIO, &_canRxTask);
-                sendOkResponse(NULL);
-            }
-            else
+            ESP_LOGE(TAG, "\"%.*s\": invalid data length", len - 1, buf);
+            sendErrorResponse();
+            break;
+        }
+        for (size_t i = 0; i < dataLen; i++)
+        {
+            uint32_t byte;
+            if (parseHex(buf + 8 + i * 2, 2, &byte) != ESP_OK)
             {
-                ESP_LOGE(TAG, "\"%.*s\": can_open returned %s", len - 1, buf, esp_err_to_name(res));
-                sendErrorResponse();
+                dataLen = 0;
+                break;
             }
+            data[i] = byte;
         }
-        break;
-    case 'C': // Close CAN channel
-        if (!can_isOpen())
+
+        esp_err_t res = dataLen > 0 ? isotp_send(session, data, dataLen) : ESP_ERR_INVALID_ARG;
+        if (res == ESP_OK)
+            sendOkResponse(NULL);
+        else
         {
-            ESP_LOGE(TAG, "\"%.*s\": connection is not open", len - 1, buf);
+            ESP_LOGE(TAG, "\"%.*s\": isotp_send returned %s", len - 1, buf, esp_err_to_name(res));
             sendErrorResponse();
         }
-        else
+        break;
+    }
+    default:
+        ESP_LOGE(TAG, "\"%.*s\": unknown ISO-TP command", len - 1, buf);
+        sendErrorResponse();
+    }
+}
+
+/// @brief Send a cached OBD-II value as "pv<ecu><pid><age>,<value>", age is in ms (FFFF if no value yet or older)
+static void sendObdValue(const obd_value_t *value)
+{
+    int64_t ageMs = (esp_timer_get_time() - value->timestamp) / 1000;
+    if (value->rawLen == 0 || ageMs > 0xFFFF)
+        ageMs = 0xFFFF;
+
+    char buf[32];
+    snprintf(buf, sizeof(buf), "pv%X%.2X%.4X,%.2f", value->ecu, value->pid, (unsigned int)ageMs, value->value);
+    sendOkResponse(buf);
+}
+
+/// @brief Parse OBD-II poller extension commands (non-standard)
+/// @details
+/// - pa<ecu><pid><period>: poll mode 01 PID (ecu 1 hex digit, pid 2 hex digits, period in ms 4 hex digits)
+/// - pd<ecu><pid>: stop polling PID
+/// - pc: stop polling all PIDs
+/// - pq[<ecu><pid>]: query cached value of one or all PIDs
+/// - ps: query statistics, "ps<samples/s>,<requests/s>,<timeouts>"
+static void parseObdCommand(uint8_t *buf, size_t len)
+{
+    uint32_t ecu = 0, pid = 0, period = 0;
+    bool hasPid = len >= strlen("pX000\r") && parseHex(buf + 2, 1, &ecu) == ESP_OK && parseHex(buf + 3, 2, &pid) == ESP_OK;
+
+    switch (buf[1])
+    {
+    case 'a': // Add PID
+        if (!hasPid || len != strlen("pa00C0064\r") || parseHex(buf + 5, 4, &period) != ESP_OK)
         {
-            if (can_close() == ESP_OK)
-            {
-                if (_canRxTask != NULL)
-                {
-                    vTaskDelete(_canRxTask);
-                    _canRxTask = NULL;
-                }
-                sendOkResponse(NULL);
-            }
-            else
-                sendErrorResponse();
+            ESP_LOGE(TAG, "\"%.*s\": invalid arguments", len - 1, buf);
+            sendErrorResponse();
         }
-        break;
-    case 't': // Send standard frame
-    case 'r': // Send standard remote frame
-    case 'T': // Send extended frame
-    case 'R': // Send extended remote frame
-        if (!can_isOpen())
+        else if (obd_addPid(ecu, pid, period) != ESP_OK)
         {
-            ESP_LOGE(TAG, "\"%.*s\": connection is not open", len - 1, buf);
+            ESP_LOGE(TAG, "\"%.*s\": obd_addPid failed", len - 1, buf);
             sendErrorResponse();
         }
-        else if (can_getMode() != TWAI_MODE_NORMAL)
+        else
+            sendOkResponse(NULL);
+        break;
+    case 'd': // Remove PID
+        if (!hasPid || obd_removePid(ecu, pid) != ESP_OK)
         {
-            ESP_LOGW(TAG, "mode:%d", can_getMode());
-            ESP_LOGE(TAG, "\"%.*s\": mode does not allow sending frames", len - 1, buf);
+            ESP_LOGE(TAG, "\"%.*s\": PID not found", len - 1, buf);
             sendErrorResponse();
         }
         else
+            sendOkResponse(NULL);
+        break;
+    case 'c': // Remove all PIDs
+        obd_clear();
+        sendOkResponse(NULL);
+        break;
+    case 'q': // Query cached values
+        if (hasPid)
         {
-            twai_message_t frame;
-            if (parseFrame(buf, len, &frame) == ESP_OK)
-            {
-                if (can_transmit(&frame, pdMS_TO_TICKS(100)) == ESP_OK)
-                    sendOkResponse(frame.extd == 0 ? "z" : "Z");
-                else
-                {
-                    ESP_LOGE(TAG, "\"%.*s\": can_transmit failed", len - 1, buf);
-                    sendErrorResponse();
-                }
-            }
+            obd_value_t value;
+            if (obd_getValue(ecu, pid, &value) == ESP_OK)
+                sendObdValue(&value);
             else
             {
-                ESP_LOGE(TAG, "\"%.*s\": parseFrame failed", len - 1, buf);
+                ESP_LOGE(TAG, "\"%.*s\": PID not found", len - 1, buf);
                 sendErrorResponse();
             }
         }
+        else
+        {
+            obd_value_t values[APP_OBD_MAX_PIDS];
+            size_t count = obd_getValues(values, APP_OBD_MAX_PIDS);
+            for (size_t i = 0; i < count; i++)
+                sendObdValue(&values[i]);
+            sendOkResponse(NULL);
+        }
         break;
-    case 'F': // TODO Read and clear status flags
-        sendErrorResponse();
-        break;
-    case 'V': // Query adapter version
-        sendOkResponse("V0000");
-        break;
-    case 'N': // Query adapter serial number (uses last 2 bytes of base MAC address)
+    case 's': // Query statistics
     {
-        uint8_t mac[6];
-        esp_efuse_mac_get_default(mac);
-        char sn[6];
-        snprintf(sn, sizeof(sn), "N%.2X%.2X", mac[4], mac[5]);
+        obd_stats_t stats;
+        obd_getStats(&stats);
+        float elapsed = stats.elapsedUs / 1e6f;
 
-        sendOkResponse(sn);
+        char out[32];
+        snprintf(out, sizeof(out), "ps%.1f,%.1f,%lu", stats.samples / elapsed, stats.requests / elapsed, stats.timeouts);
+        sendOkResponse(out);
         break;
     }
     default:
-        ESP_LOGE(TAG, "\"%.*s\": unknown command", len - 1, buf);
+        ESP_LOGE(TAG, "\"%.*s\": unknown OBD command", len - 1, buf);
         sendErrorResponse();
     }
 }
 
-/// @brief Handle received SLCAN commands
-static void serialRxTask(void *arg)
+/// @brief Stream UDS job events to the host
+/// @details "ur<job><did><data>" DID record, "ut<job><data>" DTC records, "un<job><did><nrc>" negative response,
+/// "uf<job><status>" job finished
+static void udsCallback(uint8_t job, uds_eventType_t type, uint16_t id, const uint8_t *data, size_t len, void *ctx)
 {
-    message_t msg;
-    uint8_t bufRemainder[SLCAN_MAX_CMD_LEN];
-    size_t bufRemainderLen = 0;
-
-    while (1)
+    // 2 (prefix) + 1 (job) + 4 (did) + data + CR
+    message_t msg = message_allocBudget(&((link_t *)ctx)->txBudget, 8 + len * 2);
+    if (msg.data == NULL)
     {
-        xQueueReceive(*_rxQueue, &msg, portMAX_DELAY);
-        // ESP_LOG_BUFFER_HEXDUMP(TAG, msg.data, msg.length, ESP_LOG_INFO);
-        // ESP_LOGI(TAG, "serial received bytes:%d", msg.length);
-
-        uint8_t *pCmdStart = msg.data;                          // Command start position
-        uint8_t *pCmdEnd = memchr(pCmdStart, '\r', msg.length); // Command end position (CR character)
-        size_t cmdLen = 0;                                      // Command length
+        ESP_LOGE(TAG, "no message buffer for UDS event len:%d", len);
+        return;
+    }
+    char *pStr = (char *)msg.data;
+    *pStr++ = 'u';
+    switch (type)
+    {
+    case UDS_EVENT_DID:
+        *pStr++ = 'r';
+        break;
+    case UDS_EVENT_DTC:
+        *pStr++ = 't';
+        break;
+    case UDS_EVENT_NEGATIVE:
+        *pStr++ = 'n';
+        break;
+    case UDS_EVENT_DONE:
+        *pStr++ = 'f';
+        break;
+    }
+    *pStr++ = HEX2ASCII(job & 0xF);
+    if (type == UDS_EVENT_DID || type == UDS_EVENT_NEGATIVE)
+    {
+        *pStr++ = HEX2ASCII(id >> 12 & 0xF);
+        *pStr++ = HEX2ASCII(id >> 8 & 0xF);
+        *pStr++ = HEX2ASCII(id >> 4 & 0xF);
+        *pStr++ = HEX2ASCII(id & 0xF);
+    }
+    else if (type == UDS_EVENT_DONE)
+    {
+        *pStr++ = HEX2ASCII(id >> 4 & 0xF);
+        *pStr++ = HEX2ASCII(id & 0xF);
+    }
+    pStr = formatHex(pStr, data, len);
+    *pStr++ = '\r';
+    msg.length = pStr - (char *)msg.data;
 
-        // TODO
-        // if (bufLen == sizeof(buf) && pCmdEnd == NULL)
-        // { // TODO error: command longer than max command length, not permitted
-        //     ESP_LOGE(TAG, "RX command buffer overrun");
-        //     sendErrorResponse();
-        //     continue;
-        // }
+    sendMessage(ctx, &msg);
+}
 
-        while (pCmdEnd != NULL)
+/// @brief Parse UDS batch job extension commands (non-standard)
+/// @details
+/// - uv<txid><rxid><start><end>[<session>]: ReadDataByIdentifier sweep over DIDs start-end (4 hex digits each)
+/// - ud<txid><rxid>[<mask>[<session>]]: read DTCs by status mask (default FF)
+/// - us<txid><rxid><session>: enter diagnostic session and keep it alive with TesterPresent
+/// - ux<job>: cancel job
+/// Started jobs are answered with "uj<job>", results are streamed as they arrive
+static void parseUdsCommand(uint8_t *buf, size_t len)
+{
+    if (buf[1] == 'x')
+    {
+        uint32_t job;
+        if (len != strlen("ux0\r") || parseHex(buf + 2, 1, &job) != ESP_OK || uds_cancel(job) != ESP_OK)
         {
-            cmdLen = pCmdEnd - pCmdStart + 1;
-
-            if (bufRemainderLen > 0)
+            ESP_LOGE(TAG, "\"%.*s\": job not found", len - 1, buf);
+            sendErrorResponse();
+        }
+        else
+            sendOkResponse(NULL);
+        return;
+    }
+
+    uint32_t txId, rxId, didStart = 0, didEnd = 0, mask = 0xFF, session = 0;
+    bool valid = len >= strlen("uX1231FF\r") && parseHex(buf + 2, 3, &txId) == ESP_OK && parseHex(buf + 5, 3, &rxId) == ESP_OK;
+    uds_jobConfig_t config = {0};
+
+    switch (buf[1])
+    {
+    case 'v': // DID sweep
+        config.type = UDS_JOB_DID_SWEEP;
+        valid = valid && (len == strlen("uv7E07E8F180F19F\r") || len == strlen("uv7E07E8F180F19F03\r")) &&
+                parseHex(buf + 8, 4, &didStart) == ESP_OK && parseHex(buf + 12, 4, &didEnd) == ESP_OK &&
+                (len == strlen("uv7E07E8F180F19F\r") || parseHex(buf + 16, 2, &session) == ESP_OK);
+        break;
+    case 'd': // DTC read
+        config.type = UDS_JOB_DTC_READ;
+        valid = valid && len <= strlen("ud7E07E8FF03\r") &&
+                (len < strlen("ud7E07E8FF\r") || parseHex(buf + 8, 2, &mask) == ESP_OK) &&
+                (len < strlen("ud7E07E8FF03\r") || parseHex(buf + 10, 2, &session) == ESP_OK);
+        break;
+    case 's': // Session keep-alive
+        config.type = UDS_JOB_SESSION;
+        valid = valid && len == strlen("us7E07E803\r") && parseHex(buf + 8, 2, &session) == ESP_OK;
+        break;
+    default:
+        ESP_LOGE(TAG, "\"%.*s\": unknown UDS command", len - 1, buf);
+        sendErrorResponse();
+        return;
+    }
+
+    if (!valid)
+    {
+        ESP_LOGE(TAG, "\"%.*s\": invalid arguments", len - 1, buf);
+        sendErrorResponse();
+        return;
+    }
+
+    config.txId = txId;
+    config.rxId = rxId;
+    config.session = session;
+    config.didStart = didStart;
+    config.didEnd = didEnd;
+    config.dtcMask = mask;
+    config.callback = udsCallback;
+    config.ctx = cmdLink;
+
+    uint8_t job;
+    esp_err_t res = uds_start(&config, &job);
+    if (res == ESP_OK)
+    {
+        char out[4] = {'u', 'j', HEX2ASCII(job & 0xF), '\0'};
+        sendOkResponse(out);
+    }
+    else
+    {
+        ESP_LOGE(TAG, "\"%.*s\": uds_start returned %s", len - 1, buf, esp_err_to_name(res));
+        sendErrorResponse();
+    }
+}
+
+/// @brief Parse DBC signal decoder extension commands (non-standard)
+/// @details
+/// - dl: list signals, "dl<signal>,<name>,<unit>" for each signal
+/// - de<signal>: enable signal (4 hex digits)
+/// - dd[<signal>]: disable one or all signals
+/// - df<format><onchange>[<signals only>]: output format (0 text, 1 raw hex), only report changed values (0 or 1),
+///   send decoded signals instead of the frames of DBC messages (0 or 1, default 0)
+/// Decoded signals are sent to the link that last enabled a signal or set the format
+static void parseDbcCommand(uint8_t *buf, size_t len)
+{
+    uint32_t signal;
+    bool hasSignal = len == strlen("de0000\r") && parseHex(buf + 2, 4, &signal) == ESP_OK;
+
+    switch (buf[1])
+    {
+    case 'l': // List signals
+        for (size_t i = 0; i < dbc_getSignalCount(); i++)
+        {
+            char out[96];
+            int outLen = snprintf(out, sizeof(out), "dl%.4X,%s,%s\r", i, DBC_SIGNALS[i].name, DBC_SIGNALS[i].unit);
+            sendSerialMessage(cmdLink, out, outLen < sizeof(out) ? outLen : sizeof(out) - 1);
+        }
+        sendOkResponse(NULL);
+        break;
+    case 'e': // Enable signal
+    case 'd': // Disable signal(s)
+        if (buf[1] == 'd' && len == strlen("dd\r"))
+        {
+            dbc_disableAll();
+            sendOkResponse(NULL);
+        }
+        else if (!hasSignal || dbc_setEnabled(signal, buf[1] == 'e') != ESP_OK)
+        {
+            ESP_LOGE(TAG, "\"%.*s\": invalid signal", len - 1, buf);
+            sendErrorResponse();
+        }
+        else
+        {
+            if (buf[1] == 'e')
+                dbcLink = cmdLink;
+            sendOkResponse(NULL);
+        }
+        break;
+    case 'f': // Output format
+        if ((len != strlen("df00\r") && len != strlen("df000\r")) || (buf[2] != '0' && buf[2] != '1') ||
+            (buf[3] != '0' && buf[3] != '1') || (len == strlen("df000\r") && buf[4] != '0' && buf[4] != '1'))
+        {
+            ESP_LOGE(TAG, "\"%.*s\": invalid format", len - 1, buf);
+            sendErrorResponse();
+        }
+        else
+        {
+            dbcRawFormat = buf[2] == '1';
+            dbc_setOnChange(buf[3] == '1');
+            dbcSignalsOnly = len == strlen("df000\r") && buf[4] == '1';
+            dbcLink = cmdLink;
+            sendOkResponse(NULL);
+        }
+        break;
+    default:
+        ESP_LOGE(TAG, "\"%.*s\": unknown DBC command", len - 1, buf);
+        sendErrorResponse();
+    }
+}
+
+/// @brief Store the current bitrate, timestamps, link filters and forwarding with settings.autoStart (Q, Z)
+static esp_err_t saveSettings(void)
+{
+    settings.bitrate = capture_getBitrate();
+    settings.timestamps = timestamps;
+    settings.sinks = 0;
+    for (size_t i = 0; i < linkCount; i++)
+    {
+        if (links[i].forwarding)
+            settings.sinks |= 1 << i;
+        settings.filters[i].id = links[i].sink.filterId;
+        settings.filters[i].mask = links[i].sink.filterMask;
+    }
+    return settings_save(&settings);
+}
+
+/// @brief Parse link extension commands (non-standard)
+/// @details
+/// - fs<id><mask>: only forward frames whose identifier matches id under mask (8 hex digits each) on this link
+/// - fc: forward all frames on this link
+/// - fq: query link statistics, "fq<ring drops>,<transmit drops>" (frames lost by this link only)
+/// - fu: query UART transport statistics, "fu<rx bytes>,<tx bytes>,<fifo overflows>,<buffer full>,<frame errors>,<parity errors>,<breaks>,<rx queue full>"
+/// - fz[0|1]: disable/enable Bluetooth stream compression (Bluetooth link only), without argument query
+///   compression statistics, "fz<enabled>,<raw bytes>,<compressed bytes>,<microseconds per KB>"
+/// - fb[0|1]: disable/enable automatic bus-off recovery, without argument query bus statistics,
+///   "fb<state>,<load permille>,<peak load>,<tec>,<rec>,<peak tec>,<peak rec>,<bus errors>,<arbitration lost>,<tx failed>,
+///   <rx overruns>,<warnings>,<error passives>,<bus-offs>,<last outage ms>,<total outage ms>,<auto recovery>"
+/// - fm: query memory usage, one "fmt<task>,<stack bytes>,<stack never used>" line per task, one
+///   "fmp<block size>,<blocks>,<used>,<peak used>,<failures>" line per message pool, then
+///   "fmh<free>,<min free>,<largest block>,<internal free>,<internal min free>" heap bytes
+/// - fe[0|1]: stop/resume forwarding received frames on this link (stored by Q)
+/// - fa: query boot capture, "fa<auto start>,<boot frames>,<boot overflows>,<buffering>,<bus open us>,<first frame us>"
+///   (times since boot, -1 if not yet)
+/// - fr[0|1|2]: detect the bus bitrate in listen-only mode (bus closed), "fr<bitrate>,<candidates tried>,<ms>", then
+///   leave the bus closed (0, default) or open it in normal (1) or listen-only (2) mode
+static void parseLinkCommand(uint8_t *buf, size_t len)
+{
+    uint32_t id, mask;
+
+    switch (buf[1])
+    {
+    case 's': // Set filter
+        if (len != strlen("fs0000000000000000\r") || parseHex(buf + 2, 8, &id) != ESP_OK || parseHex(buf + 10, 8, &mask) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "\"%.*s\": invalid filter", len - 1, buf);
+            sendErrorResponse();
+        }
+        else
+        {
+            capture_setFilter(&cmdLink->sink, id, mask);
+            sendOkResponse(NULL);
+        }
+        break;
+    case 'c': // Clear filter
+        capture_setFilter(&cmdLink->sink, 0, 0);
+        sendOkResponse(NULL);
+        break;
+    case 'q': // Query statistics
+    {
+        char out[32];
+        snprintf(out, sizeof(out), "fq%lu,%lu", cmdLink->sink.drops, cmdLink->txDrops);
+        sendOkResponse(out);
+        break;
+    }
+    case 'u': // Query UART statistics
+    {
+        uart_stats_t stats;
+        uart_getStats(&stats);
+
+        char out[96];
+        int outLen = snprintf(out, sizeof(out), "fu%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu\r", stats.rxBytes, stats.txBytes, stats.fifoOverflows,
+                              stats.bufferFull, stats.frameErrors, stats.parityErrors, stats.breaks, stats.rxQueueFull);
+        sendSerialMessage(cmdLink, out, outLen);
+        break;
+    }
+    case 'z': // Bluetooth compression
+        if (cmdLink->txQueue != &btTxQueue)
+        {
+            ESP_LOGE(TAG, "\"%.*s\": compression is only available on Bluetooth", len - 1, buf);
+            sendErrorResponse();
+        }
+        else if (len == strlen("fz\r"))
+        {
+            bt_compression_stats_t stats;
+            bt_getCompressionStats(&stats);
+
+            char out[80];
+            int outLen = snprintf(out, sizeof(out), "fz%d,%llu,%llu,%llu\r", stats.enabled, stats.inBytes, stats.outBytes,
+                                  stats.inBytes > 0 ? stats.compressUs * 1024 / stats.inBytes : 0);
+            sendSerialMessage(cmdLink, out, outLen);
+        }
+        else if (len == strlen("fz0\r") && (buf[2] == '0' || buf[2] == '1'))
+        {
+            // Response may already be compressed, the host decompressor accepts both until the first block
+            bt_setCompression(buf[2] == '1');
+            sendOkResponse(NULL);
+        }
+        else
+        {
+            ESP_LOGE(TAG, "\"%.*s\": invalid compression command", len - 1, buf);
+            sendErrorResponse();
+        }
+        break;
+    case 'b': // Bus monitor
+        if (len == strlen("fb\r"))
+        {
+            monitor_stats_t stats;
+            monitor_getStats(&stats);
+
+            char out[192];
+            int outLen = snprintf(out, sizeof(out), "fb%d,%u,%u,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%d\r", stats.state,
+                                  stats.loadPermille, stats.peakLoadPermille, stats.tec, stats.rec, stats.peakTec, stats.peakRec,
+                                  stats.busErrors, stats.arbLost, stats.txFailed, stats.rxOverruns, stats.warnings, stats.errorPassives,
+                                  stats.busOffs, stats.lastOutageMs, stats.totalOutageMs, stats.autoRecovery);
+            sendSerialMessage(cmdLink, out, outLen);
+        }
+        else if (len == strlen("fb0\r") && (buf[2] == '0' || buf[2] == '1'))
+        {
+            monitor_setAutoRecovery(buf[2] == '1');
+            sendOkResponse(NULL);
+        }
+        else
+        {
+            ESP_LOGE(TAG, "\"%.*s\": invalid bus monitor command", len - 1, buf);
+            sendErrorResponse();
+        }
+        break;
+    case 'm': // Memory usage
+    {
+        // Lines are batched in messages of up to APP_SLCAN_TX_BATCH_SIZE bytes
+        char out[APP_SLCAN_TX_BATCH_SIZE];
+        size_t outLen = 0;
+        const size_t lineLen = 80; // Longest line is fmp with six 10 digit values, 69 characters and NUL
+
+        size_t pos = 0;
+        rtos_taskStats_t task;
+        while (rtos_nextTask(&pos, &task))
+        {
+            if (outLen + lineLen > sizeof(out))
+            {
+                sendSerialMessage(cmdLink, out, outLen);
+                outLen = 0;
+            }
+            outLen += snprintf(out + outLen, lineLen, "fmt%s,%lu,%lu\r", task.name, task.stackSize, task.stackFree);
+        }
+
+        message_poolStats_t pool;
+        for (size_t i = 0; message_getPoolStats(i, &pool); i++)
+        {
+            if (outLen + lineLen > sizeof(out))
+            {
+                sendSerialMessage(cmdLink, out, outLen);
+                outLen = 0;
+            }
+            outLen += snprintf(out + outLen, lineLen, "fmp%lu,%lu,%lu,%lu,%lu,%lu\r", pool.blockSize, pool.blocks, pool.used,
+                               pool.peakUsed, pool.failures, pool.limited);
+        }
+
+        rtos_heapStats_t heap;
+        rtos_getHeapStats(&heap);
+        if (outLen + lineLen > sizeof(out))
+        {
+            sendSerialMessage(cmdLink, out, outLen);
+            outLen = 0;
+        }
+        outLen += snprintf(out + outLen, lineLen, "fmh%lu,%lu,%lu,%lu,%lu\r", heap.freeBytes, heap.minFreeBytes, heap.largestBlock,
+                           heap.internalFreeBytes, heap.internalMinFreeBytes);
+
+        sendSerialMessage(cmdLink, out, outLen);
+        sendOkResponse(NULL);
+        break;
+    }
+    case 'e': // Frame forwarding
+        if (len != strlen("fe0\r") || (buf[2] != '0' && buf[2] != '1'))
+        {
+            ESP_LOGE(TAG, "\"%.*s\": invalid forwarding command", len - 1, buf);
+            sendErrorResponse();
+        }
+        else
+        {
+            cmdLink->forwarding = buf[2] == '1';
+            sendOkResponse(NULL);
+        }
+        break;
+    case 'r': // Bitrate detection
+        if (can_isOpen())
+        {
+            ESP_LOGE(TAG, "\"%.*s\": cannot detect bitrate while connection is open", len - 1, buf);
+            sendErrorResponse();
+        }
+        else if (len > strlen("fr0\r") || (len == strlen("fr0\r") && (buf[2] < '0' || buf[2] > '2')))
+        {
+            ESP_LOGE(TAG, "\"%.*s\": invalid bitrate detection command", len - 1, buf);
+            sendErrorResponse();
+        }
+        else
+        {
+            capture_detection_t detection;
+            esp_err_t res = capture_detectBitrate(&detection);
+            char mode = len == strlen("fr0\r") ? buf[2] : '0';
+            if (res == ESP_OK && mode != '0')
+                res = capture_open(mode == '2' ? TWAI_MODE_LISTEN_ONLY : TWAI_MODE_NORMAL);
+            if (res != ESP_OK)
+            {
+                ESP_LOGE(TAG, "\"%.*s\": bitrate detection returned %s", len - 1, buf, esp_err_to_name(res));
+                sendErrorResponse();
+                break;
+            }
+            if (can_isOpen())
+                attachLink(cmdLink);
+
+            char out[32];
+            snprintf(out, sizeof(out), "fr%lu,%lu,%lu", detection.bitrate, detection.candidates, detection.elapsedMs);
+            sendOkResponse(out);
+        }
+        break;
+    case 'a': // Boot capture
+    {
+        capture_bootStatus_t status;
+        capture_getBootStatus(&status);
+
+        char out[80];
+        int outLen = snprintf(out, sizeof(out), "fa%d,%lu,%lu,%d,%lld,%lld\r", settings.autoStart, status.frames, status.overflows,
+                              status.buffering, status.openUs, status.firstFrameUs);
+        sendSerialMessage(cmdLink, out, outLen);
+        break;
+    }
+    default:
+        ESP_LOGE(TAG, "\"%.*s\": unknown link command", len - 1, buf);
+        sendErrorResponse();
+    }
+}
+
+/// @brief Parse trace extension commands (non-standard)
+/// @details
+/// - ld: dump the trace records recorded since the last dump, one "ll<core>,<us>,<module>: <text>" line each
+///   (us from the CPU cycle counter of the core, wraps), records overwritten before the dump are counted by lq
+/// - lc: discard the records not dumped yet
+/// - ls: list modules, one "ls<module>,<name>,<compile-time level>,<runtime level>" line each
+/// - ls<module><level>: set the runtime level of a module (1 hex digit, level 0 none to 5 verbose, at most the
+///   compile-time level)
+/// - lq: query status, "lq<records core 0>,<records core 1>,<records kept per core>,<records lost by dumps>"
+static void parseTraceCommand(uint8_t *buf, size_t len)
+{
+    switch (buf[1])
+    {
+    case 'd': // Dump
+    {
+        // Lines are batched in messages of up to APP_SLCAN_TX_BATCH_SIZE bytes, records added meanwhile wait
+        char out[APP_SLCAN_TX_BATCH_SIZE];
+        size_t outLen = 0;
+        const size_t lineLen = 112;
+        uint32_t cyclesPerUs = esp_rom_get_cpu_ticks_per_us();
+        trace_entry_t entry;
+        for (size_t i = 0; i < portNUM_PROCESSORS * APP_TRACE_RING_LEN && trace_read(&traceReader, &entry); i++)
+        {
+            if (outLen + lineLen > sizeof(out))
+            {
+                sendSerialMessage(cmdLink, out, outLen);
+                outLen = 0;
+            }
+
+            int n = snprintf(out + outLen, lineLen - 1, "ll%d,%lu,", entry.core, entry.cycles / cyclesPerUs);
+            n += trace_format(&entry, out + outLen + n, lineLen - 1 - n);
+            outLen += n < (int)lineLen - 1 ? n : (int)lineLen - 2; // Truncated lines still end with CR
+            out[outLen++] = '\r';
+        }
+        if (outLen > 0)
+            sendSerialMessage(cmdLink, out, outLen);
+        sendOkResponse(NULL);
+        break;
+    }
+    case 'c': // Clear
+        trace_skipReader(&traceReader);
+        sendOkResponse(NULL);
+        break;
+    case 's': // List modules or set level
+    {
+        uint32_t module;
+        if (len == strlen("ls\r"))
+        {
+            char out[APP_SLCAN_TX_BATCH_SIZE];
+            size_t outLen = 0;
+            for (int module = 0; module < TRACE_MODULE_COUNT; module++)
+                outLen += snprintf(out + outLen, sizeof(out) - outLen, "ls%X,%s,%d,%d\r", module, trace_getModuleName(module),
+                                   trace_getCompiledLevel(module), trace_levels[module]);
+            sendSerialMessage(cmdLink, out, outLen);
+            sendOkResponse(NULL);
+        }
+        else if (len == strlen("ls03\r") && parseHex(buf + 2, 1, &module) == ESP_OK && buf[3] >= '0' && buf[3] <= '9' &&
+                 trace_setLevel(module, buf[3] - '0') == ESP_OK)
+            sendOkResponse(NULL);
+        else
+        {
+            ESP_LOGE(TAG, "\"%.*s\": invalid trace level", len - 1, buf);
+            sendErrorResponse();
+        }
+        break;
+    }
+    case 'q': // Query status
+    {
+        trace_status_t status;
+        trace_getStatus(&status);
+
+        char out[48];
+        snprintf(out, sizeof(out), "lq%lu,%lu,%lu,%lu", status.records[0], portNUM_PROCESSORS > 1 ? status.records[1] : 0,
+                 status.capacity, traceReader.lost);
+        sendOkResponse(out);
+        break;
+    }
+    default:
+        ESP_LOGE(TAG, "\"%.*s\": unknown trace command", len - 1, buf);
+        sendErrorResponse();
+    }
+}
+
+/// @brief Parse traffic census extension commands (non-standard)
+/// @details
+/// - nd[0|1]: dump the census, all identifiers or only those received since the last "nd1", one line each:
+///   "nl<id><count><period><jitter><min><max><dlcs><changed>", 8 hex digits each except dlcs (3, bit n for DLC n)
+///   and changed (payload bits that changed, 16 hex digits in frame byte order); times in us, id bit 31 for extended
+/// - nc: clear the census
+/// - nq: query status, "nq<identifiers>,<capacity>,<overflow frames>"
+static void parseCensusCommand(uint8_t *buf, size_t len)
+{
+    switch (buf[1])
+    {
+    case 'd': // Dump
+    {
+        if (len != strlen("nd\r") && !(len == strlen("nd0\r") && (buf[2] == '0' || buf[2] == '1')))
+        {
+            sendErrorResponse();
+            break;
+        }
+
+        // Entries are batched in messages of up to APP_SLCAN_TX_BATCH_SIZE bytes
+        bool onlyUpdated = len == strlen("nd0\r") && buf[2] == '1';
+        char out[APP_SLCAN_TX_BATCH_SIZE];
+        size_t outLen = 0;
+        size_t pos = 0;
+        census_entry_t entry;
+        while (census_next(&pos, onlyUpdated, &entry))
+        {
+            const size_t lineLen = 2 + 8 * 6 + 3 + 16 + 1;
+            if (outLen + lineLen > sizeof(out))
+            {
+                sendSerialMessage(cmdLink, out, outLen);
+                outLen = 0;
+            }
+
+            char *pStr = out + outLen;
+            pStr += sprintf(pStr, "nl%08lX%08lX%08lX%08lX%08lX%08lX%03X", entry.id, entry.count, entry.periodUs, entry.jitterUs,
+                            entry.minUs, entry.maxUs, entry.dlcMask);
+            pStr = formatHexPayload(pStr, entry.changedBits);
+            *pStr++ = '\r';
+            outLen = pStr - out;
+        }
+        if (outLen > 0)
+            sendSerialMessage(cmdLink, out, outLen);
+        sendOkResponse(NULL);
+        break;
+    }
+    case 'c': // Clear
+        census_clear();
+        sendOkResponse(NULL);
+        break;
+    case 'q': // Query status
+    {
+        census_status_t status;
+        census_getStatus(&status);
+
+        char out[32];
+        snprintf(out, sizeof(out), "nq%lu,%lu,%lu", status.ids, status.capacity, status.overflow);
+        sendOkResponse(out);
+        break;
+    }
+    default:
+        ESP_LOGE(TAG, "\"%.*s\": unknown census command", len - 1, buf);
+        sendErrorResponse();
+    }
+}
+
+/// @brief Handle rule actions, called from the CAN RX task
+/// @details Markers are sent on the link that set the rule as "xm<rule><frame>", frame in SLCAN format
+static void onRuleMatch(void *ctx, size_t index, rules_action_t action, const twai_message_t *msg, int64_t timestampUs)
+{
+    switch (action)
+    {
+    case RULES_ACTION_MARKER:
+    {
+        link_t *link = ruleLinks[index];
+        if (link == NULL || link->gvretMode)
+            break;
+
+        char out[4 + SLCAN_MAX_CMD_LEN + 1];
+        out[0] = 'x';
+        out[1] = 'm';
+        out[2] = HEX2ASCII(index >> 4 & 0xF);
+        out[3] = HEX2ASCII(index & 0xF);
+        size_t frameLen;
+        formatFrame((twai_message_t *)msg, out + 4, &frameLen, -1);
+        message_t marker = newLinkMessage(link, out, 4 + frameLen, 0);
+        if (!queueMessage(link, &marker, 0))
+            link->txDrops++;
+        break;
+    }
+    case RULES_ACTION_TRIGGER:
+        recorder_trigger(RECORDER_TRIGGER_RULE);
+        break;
+    case RULES_ACTION_ARM:
+        recorder_arm();
+        break;
+    case RULES_ACTION_DISARM:
+        recorder_disarm();
+        break;
+    default:
+        break;
+    }
+}
+
+/// @brief Parse frame match rule extension commands (non-standard)
+/// @details
+/// - xa<rule><id><dlc><action><value><mask>: set rule (2 hex digits, 00 to APP_RULES_MAX_RULES-1), matching frames with
+///   identifier id (8 hex digits, bit 31 set for extended identifiers), DLC dlc (F: any) and (data & mask) == value
+///   (16 hex digits each, frame byte order); action 0 count, 1 marker, 2 recorder trigger, 3 recorder arm, 4 recorder disarm
+/// - xd<rule>: delete rule
+/// - xc: delete all rules
+/// - xl: list rules, one "xl<rule><id><dlc><action><value><mask>,<hits>" line each
+/// - xr: reset hit counters
+static void parseRuleCommand(uint8_t *buf, size_t len)
+{
+    uint32_t index, id, dlc, action;
+
+    switch (buf[1])
+    {
+    case 'a': // Set rule
+    {
+        rules_rule_t rule;
+        if (len != 2 + 2 + 8 + 1 + 1 + 16 + 16 + 1 || parseHex(buf + 2, 2, &index) != ESP_OK || parseHex(buf + 4, 8, &id) != ESP_OK ||
+            parseHex(buf + 12, 1, &dlc) != ESP_OK || parseHex(buf + 13, 1, &action) != ESP_OK ||
+            parseHexPayload(buf + 14, &rule.value) != ESP_OK || parseHexPayload(buf + 30, &rule.mask) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "\"%.*s\": invalid rule", len - 1, buf);
+            sendErrorResponse();
+            break;
+        }
+
+        rule.id = id;
+        rule.dlc = dlc == 0xF ? RULES_DLC_ANY : dlc;
+        rule.action = action;
+        esp_err_t res = rules_set(index, &rule);
+        if (res == ESP_OK)
+        {
+            ruleLinks[index] = cmdLink;
+            sendOkResponse(NULL);
+        }
+        else
+        {
+            ESP_LOGE(TAG, "\"%.*s\": rules_set returned %s", len - 1, buf, esp_err_to_name(res));
+            sendErrorResponse();
+        }
+        break;
+    }
+    case 'd': // Delete rule
+        if (len == strlen("xd00\r") && parseHex(buf + 2, 2, &index) == ESP_OK && rules_delete(index) == ESP_OK)
+            sendOkResponse(NULL);
+        else
+            sendErrorResponse();
+        break;
+    case 'c': // Delete all rules
+        rules_clear();
+        sendOkResponse(NULL);
+        break;
+    case 'l': // List rules
+        for (size_t i = 0; i < APP_RULES_MAX_RULES; i++)
+        {
+            rules_rule_t rule;
+            uint32_t hits;
+            if (!rules_get(i, &rule, &hits))
+                continue;
+
+            char out[64];
+            int outLen = snprintf(out, sizeof(out), "xl%02X%08lX%X%X", i, rule.id, rule.dlc == RULES_DLC_ANY ? 0xF : rule.dlc, rule.action);
+            outLen = formatHexPayload(formatHexPayload(out + outLen, rule.value), rule.mask) - out;
+            outLen += snprintf(out + outLen, sizeof(out) - outLen, ",%lu\r", hits);
+            sendSerialMessage(cmdLink, out, outLen);
+        }
+        sendOkResponse(NULL);
+        break;
+    case 'r': // Reset hit counters
+        rules_resetHits();
+        sendOkResponse(NULL);
+        break;
+    default:
+        ESP_LOGE(TAG, "\"%.*s\": unknown rule command", len - 1, buf);
+        sendErrorResponse();
+    }
+}
+
+/// @brief Send a flight recorder window line on the link that selected streaming, as "wl<candump line>"
+static void sendRecorderLine(void *ctx, const char *line, size_t len)
+{
+    link_t *link = ctx;
+
+    char out[96];
+    int outLen = snprintf(out, sizeof(out), "wl%.*s\r", (int)len, line);
+    message_t msg = newLinkMessage(link, out, outLen, pdMS_TO_TICKS(APP_SLCAN_TX_WAIT_MS));
+    if (!queueMessage(link, &msg, pdMS_TO_TICKS(APP_SLCAN_TX_WAIT_MS)))
+        link->txDrops++;
+}
+
+/// @brief Parse flight recorder extension commands (non-standard)
+/// @details
+/// - wa: arm (start recording)
+/// - wx: disarm
+/// - wt: trigger now
+/// - wp<id><idmask><data><datamask>: trigger on frame pattern, id/idmask 8 hex digits (bit 31 set for extended
+///   identifiers), data/datamask 16 hex digits in frame byte order; without arguments disable
+/// - we<rate>: trigger on bus errors per second (4 hex digits), 0 disables
+/// - wb[0|1]: disable/enable bus-off trigger
+/// - ww<pre><post>: window before and after the trigger in ms (8 hex digits each)
+/// - wo[0|1]: write windows to the SD card, or stream them on this link as "wl<candump line>" ending with "wl# end"
+/// - wq: query status, "wq<state>,<capacity>,<psram>,<triggers>,<dumps>,<last records>,<last pre ms>,<last post ms>"
+static void parseRecorderCommand(uint8_t *buf, size_t len)
+{
+    uint32_t value, value2;
+
+    switch (buf[1])
+    {
+    case 'a': // Arm
+        if (recorder_arm() == ESP_OK)
+            sendOkResponse(NULL);
+        else
+            sendErrorResponse();
+        break;
+    case 'x': // Disarm
+        recorder_disarm();
+        sendOkResponse(NULL);
+        break;
+    case 't': // Trigger
+        if (recorder_trigger(RECORDER_TRIGGER_COMMAND) == ESP_OK)
+            sendOkResponse(NULL);
+        else
+        {
+            ESP_LOGE(TAG, "\"%.*s\": recorder not armed", len - 1, buf);
+            sendErrorResponse();
+        }
+        break;
+    case 'p': // Pattern trigger
+        if (len == strlen("wp\r"))
+        {
+            recorder_setPattern(NULL);
+            sendOkResponse(NULL);
+        }
+        else if (len == 2 + 8 + 8 + 16 + 16 + 1 && parseHex(buf + 2, 8, &value) == ESP_OK && parseHex(buf + 10, 8, &value2) == ESP_OK)
+        {
+            recorder_pattern_t pattern = {.enabled = true, .id = value, .idMask = value2};
+            if (parseHexPayload(buf + 18, &pattern.data) == ESP_OK && parseHexPayload(buf + 34, &pattern.dataMask) == ESP_OK)
             {
-                size_t tmpLen = bufRemainderLen + cmdLen;
+                recorder_setPattern(&pattern);
+                sendOkResponse(NULL);
+            }
+            else
+                sendErrorResponse();
+        }
+        else
+        {
+            ESP_LOGE(TAG, "\"%.*s\": invalid pattern", len - 1, buf);
+            sendErrorResponse();
+        }
+        break;
+    case 'e': // Error burst trigger
+        if (len == strlen("we0000\r") && parseHex(buf + 2, 4, &value) == ESP_OK)
+        {
+            recorder_setErrorBurst(value);
+            sendOkResponse(NULL);
+        }
+        else
+            sendErrorResponse();
+        break;
+    case 'b': // Bus-off trigger
+        if (len == strlen("wb0\r") && (buf[2] == '0' || buf[2] == '1'))
+        {
+            recorder_setBusOffTrigger(buf[2] == '1');
+            sendOkResponse(NULL);
+        }
+        else
+            sendErrorResponse();
+        break;
+    case 'w': // Window
+        if (len == strlen("ww0000000000000000\r") && parseHex(buf + 2, 8, &value) == ESP_OK && parseHex(buf + 10, 8, &value2) == ESP_OK &&
+            recorder_setWindow(value, value2) == ESP_OK)
+            sendOkResponse(NULL);
+        else
+        {
+            ESP_LOGE(TAG, "\"%.*s\": invalid window", len - 1, buf);
+            sendErrorResponse();
+        }
+        break;
+    case 'o': // Output
+        if (len == strlen("wo0\r") && (buf[2] == '0' || buf[2] == '1'))
+        {
+            if (buf[2] == '1')
+                recorder_setOutput(sendRecorderLine, cmdLink);
+            else
+                recorder_setOutput(NULL, NULL);
+            sendOkResponse(NULL);
+        }
+        else
+            sendErrorResponse();
+        break;
+    case 'q': // Query status
+    {
+        recorder_status_t status;
+        recorder_getStatus(&status);
+
+        char out[96];
+        int outLen = snprintf(out, sizeof(out), "wq%d,%lu,%d,%lu,%lu,%lu,%lu,%lu\r", status.state, status.capacity, status.psram,
+                              status.triggers, status.dumps, status.lastRecords, status.lastPreTriggerMs, status.lastPostTriggerMs);
+        sendSerialMessage(cmdLink, out, outLen);
+        break;
+    }
+    default:
+        ESP_LOGE(TAG, "\"%.*s\": unknown recorder command", len - 1, buf);
+        sendErrorResponse();
+    }
+}
+
+/// @brief Parse log replay commands (non-standard)
+/// @details
+/// - ys<name>: start replaying file name from the SD card root with the current options
+/// - yx: stop the replay, frames already in the CAN TX queue are still sent
+/// - yo<speed><loop>: options, speed in percent (4 hex digits, 0064 keeps the log timing), loop 0 or 1
+/// - yf[<id><mask>]: only send frames whose identifier matches id under mask (8 hex digits each), without arguments
+///   send all frames
+/// - yq: query status, "yq<state>,<frames>,<filtered>,<invalid lines>,<tx errors>,<late>,<underruns>,<loops>,
+///   <mean error us>,<max error us>" (decimal)
+static void parseReplayCommand(uint8_t *buf, size_t len)
+{
+    uint32_t value, value2;
+
+    switch (buf[1])
+    {
+    case 's': // Start
+    {
+        char name[32];
+        size_t nameLen = len - strlen("ys\r");
+        if (len < strlen("ysx\r") || nameLen >= sizeof(name))
+        {
+            sendErrorResponse();
+            break;
+        }
+        memcpy(name, buf + 2, nameLen);
+        name[nameLen] = '\0';
+
+        esp_err_t res = replay_start(name, &replayOptions);
+        if (res == ESP_OK)
+            sendOkResponse(NULL);
+        else
+        {
+            ESP_LOGE(TAG, "\"%.*s\": cannot replay: %s", len - 1, buf, esp_err_to_name(res));
+            sendErrorResponse();
+        }
+        break;
+    }
+    case 'x': // Stop
+        replay_stop();
+        sendOkResponse(NULL);
+        break;
+    case 'o': // Options
+        if (len == strlen("yo00000\r") && parseHex(buf + 2, 4, &value) == ESP_OK && value > 0 && value <= APP_REPLAY_MAX_SPEED_PERCENT &&
+            (buf[6] == '0' || buf[6] == '1'))
+        {
+            replayOptions.speedPercent = value;
+            replayOptions.loop = buf[6] == '1';
+            sendOkResponse(NULL);
+        }
+        else
+        {
+            ESP_LOGE(TAG, "\"%.*s\": invalid replay options", len - 1, buf);
+            sendErrorResponse();
+        }
+        break;
+    case 'f': // Identifier filter
+        if (len == strlen("yf\r"))
+        {
+            replayOptions.filterId = 0;
+            replayOptions.filterMask = 0;
+            sendOkResponse(NULL);
+        }
+        else if (len == strlen("yf0000000000000000\r") && parseHex(buf + 2, 8, &value) == ESP_OK && parseHex(buf + 10, 8, &value2) == ESP_OK)
+        {
+            replayOptions.filterId = value & value2;
+            replayOptions.filterMask = value2;
+            sendOkResponse(NULL);
+        }
+        else
+            sendErrorResponse();
+        break;
+    case 'q': // Query status
+    {
+        replay_status_t status;
+        replay_getStatus(&status);
+
+        char out[128];
+        int outLen = snprintf(out, sizeof(out), "yq%d,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu\r", status.state, status.frames, status.filtered,
+                              status.invalid, status.txErrors, status.late, status.underruns, status.loops, status.meanErrorUs,
+                              status.maxErrorUs);
+        sendSerialMessage(cmdLink, out, outLen);
+        break;
+    }
+    default:
+        ESP_LOGE(TAG, "\"%.*s\": unknown replay command", len - 1, buf);
+        sendErrorResponse();
+    }
+}
 
-                // Concatenate remainder with current command and parse it
-                uint8_t *tmpBuf = malloc(tmpLen);
-                memcpy(tmpBuf, bufRemainder, bufRemainderLen);
-                memcpy(tmpBuf + bufRemainderLen, pCmdStart, cmdLen);
+/// @brief Parse received command and perform requested action
+static void parseCommand(uint8_t *buf, size_t len)
+{
+    TRACE_TEXT(SLCAN_COMMAND, len, buf, len);
 
-                parseCommand(tmpBuf, tmpLen);
+    if (len == 0)
+    {
+        sendErrorResponse();
+        return;
+    }
 
-                free(tmpBuf);
-                bufRemainderLen = 0;
+    switch (buf[0])
+    {
+    case 'S': // Set CAN standard bitrate
+        if (can_isOpen())
+        {
+            ESP_LOGE(TAG, "\"%.*s\": cannot set bitrate while connection is open", len - 1, buf);
+            sendErrorResponse();
+        }
+        else if (len < 2 || buf[1] < '0' || buf[1] > '8' || capture_setBitrate(SLCAN_BITRATES[buf[1] - '0']) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "\"%.*s\": unsupported bitrate", len - 1, buf);
+            sendErrorResponse();
+        }
+        else
+            sendOkResponse(NULL);
+        break;
+    case 'O': // Open CAN channel
+    case 'L': // Open CAN channel in listen-only mode
+        if (can_isOpen())
+        {
+            ESP_LOGE(TAG, "\"%.*s\": connection is already open", len - 1, buf);
+            sendErrorResponse();
+        }
+        else if (capture_getBitrate() == 0)
+        {
+            ESP_LOGE(TAG, "\"%.*s\": bitrate has not been set", len - 1, buf);
+            sendErrorResponse();
+        }
+        else
+        {
+            esp_err_t res = capture_open(buf[0] == 'L' ? TWAI_MODE_LISTEN_ONLY : TWAI_MODE_NORMAL);
+            if (res == ESP_OK)
+                sendOkResponse(NULL);
+            else
+            {
+                ESP_LOGE(TAG, "\"%.*s\": can_open returned %s", len - 1, buf, esp_err_to_name(res));
+                sendErrorResponse();
+            }
+        }
+        // The host is ready for frames, also when the bus was already open (auto start)
+        if (can_isOpen())
+            attachLink(cmdLink);
+        break;
+    case 'C': // Close CAN channel
+        if (!can_isOpen())
+        {
+            ESP_LOGE(TAG, "\"%.*s\": connection is not open", len - 1, buf);
+            sendErrorResponse();
+        }
+        else
+        {
+            if (capture_close() == ESP_OK)
+                sendOkResponse(NULL);
+            else
+                sendErrorResponse();
+        }
+        break;
+    case 't': // Send standard frame
+    case 'r': // Send standard remote frame
+    case 'T': // Send extended frame
+    case 'R': // Send extended remote frame
+        if (!can_isOpen())
+        {
+            ESP_LOGE(TAG, "\"%.*s\": connection is not open", len - 1, buf);
+            sendErrorResponse();
+        }
+        else if (can_getMode() != TWAI_MODE_NORMAL)
+        {
+            ESP_LOGW(TAG, "mode:%d", can_getMode());
+            ESP_LOGE(TAG, "\"%.*s\": mode does not allow sending frames", len - 1, buf);
+            sendErrorResponse();
+        }
+        else
+        {
+            twai_message_t frame;
+            if (parseFrame(buf, len, &frame) == ESP_OK)
+            {
+                if (can_transmit(&frame, pdMS_TO_TICKS(100)) == ESP_OK)
+                    sendOkResponse(frame.extd == 0 ? "z" : "Z");
+                else
+                {
+                    ESP_LOGE(TAG, "\"%.*s\": can_transmit failed", len - 1, buf);
+                    sendErrorResponse();
+                }
             }
             else
             {
-                parseCommand(pCmdStart, cmdLen);
+                ESP_LOGE(TAG, "\"%.*s\": parseFrame failed", len - 1, buf);
+                sendErrorResponse();
             }
+        }
+        break;
+    case 'Q': // Auto start at power on with the current settings
+        if (len != strlen("Q0\r") || buf[1] < '0' || buf[1] > '2')
+        {
+            ESP_LOGE(TAG, "\"%.*s\": invalid auto start mode", len - 1, buf);
+            sendErrorResponse();
+        }
+        else if (buf[1] != '0' && !can_isOpen())
+        {
+            ESP_LOGE(TAG, "\"%.*s\": connection is not open", len - 1, buf);
+            sendErrorResponse();
+        }
+        else
+        {
+            settings.autoStart = buf[1] - '0';
+            if (saveSettings() == ESP_OK)
+                sendOkResponse(NULL);
+            else
+                sendErrorResponse();
+        }
+        break;
+    case 'Z': // Timestamps on/off
+        if (can_isOpen())
+        {
+            ESP_LOGE(TAG, "\"%.*s\": cannot set timestamps while connection is open", len - 1, buf);
+            sendErrorResponse();
+        }
+        else if (len != strlen("Z0\r") || (buf[1] != '0' && buf[1] != '1'))
+        {
+            ESP_LOGE(TAG, "\"%.*s\": invalid timestamps setting", len - 1, buf);
+            sendErrorResponse();
+        }
+        else
+        {
+            timestamps = buf[1] == '1';
+            if (saveSettings() == ESP_OK)
+                sendOkResponse(NULL);
+            else
+                sendErrorResponse();
+        }
+        break;
+    case 'F': // Read and clear status flags
+        if (!can_isOpen())
+            sendErrorResponse();
+        else
+        {
+            char out[4];
+            snprintf(out, sizeof(out), "F%02X", monitor_takeFlags());
+            sendOkResponse(out);
+        }
+        break;
+    case 'i': // ISO-TP extension commands
+        parseIsotpCommand(buf, len);
+        break;
+    case 'p': // OBD-II poller extension commands
+        parseObdCommand(buf, len);
+        break;
+    case 'u': // UDS batch job extension commands
+        parseUdsCommand(buf, len);
+        break;
+    case 'd': // DBC signal decoder extension commands
+        parseDbcCommand(buf, len);
+        break;
+    case 'f': // Link extension commands
+        parseLinkCommand(buf, len);
+        break;
+    case 'w': // Flight recorder extension commands
+        parseRecorderCommand(buf, len);
+        break;
+    case 'x': // Frame match rule extension commands
+        parseRuleCommand(buf, len);
+        break;
+    case 'n': // Traffic census extension commands
+        parseCensusCommand(buf, len);
+        break;
+    case 'l': // Trace extension commands
+        parseTraceCommand(buf, len);
+        break;
+    case 'y': // Log replay extension commands
+        parseReplayCommand(buf, len);
+        break;
+    case 'V': // Query adapter version
+        sendOkResponse("V0000");
+        break;
+    case 'N': // Query adapter serial number (uses last 2 bytes of base MAC address)
+    {
+        uint8_t mac[6];
+        esp_efuse_mac_get_default(mac);
+        char sn[6];
+        snprintf(sn, sizeof(sn), "N%.2X%.2X", mac[4], mac[5]);
+
+        sendOkResponse(sn);
+        break;
+    }
+    default:
+        ESP_LOGE(TAG, "\"%.*s\": unknown command", len - 1, buf);
+        sendErrorResponse();
+    }
+}
+
+/// @brief Handle data received on a link, SLCAN commands or GVRET
+static void processInput(link_t *link, message_t msg)
+{
+    // ESP_LOG_BUFFER_HEXDUMP(TAG, msg.data, msg.length, ESP_LOG_INFO);
+    // ESP_LOGI(TAG, "serial received bytes:%d", msg.length);
+    uint8_t *bufRemainder = link->bufRemainder;
+    size_t bufRemainderLen = link->bufRemainderLen;
+
+    // SavvyCAN starts GVRET sessions with a binary mode request, from then on the link speaks GVRET
+    if (!link->gvretMode && bufRemainderLen == 0 && gvret_isHandshake(msg.data, msg.length))
+    {
+        ESP_LOGI(TAG, "%s switching to GVRET protocol", link->name);
+        link->gvretMode = true;
+        attachLink(link);
+        xTaskNotifyGive(link->sink.task);
+    }
+    if (link->gvretMode)
+    {
+        gvret_processInput(&link->gvret, msg.data, msg.length);
+        message_free(&msg);
+        return;
+    }
+
+    uint8_t *pCmdStart = msg.data;                          // Command start position
+    uint8_t *pCmdEnd = memchr(pCmdStart, '\r', msg.length); // Command end position (CR character)
+    size_t cmdLen = 0;                                      // Command length
 
-            pCmdStart = pCmdEnd + 1;
+    while (pCmdEnd != NULL)
+    {
+        cmdLen = pCmdEnd - pCmdStart + 1;
 
-            // Discard LF after CR
-            if (*pCmdStart == '\n')
+        if (bufRemainderLen > 0)
+        {
+            // Complete the remainder with the current command and parse it
+            if (bufRemainderLen + cmdLen > sizeof(link->bufRemainder))
             {
-                pCmdStart++;
-                cmdLen++;
+                ESP_LOGE(TAG, "%s RX command buffer overrun", link->name);
+                sendErrorResponse();
             }
-
-            msg.length -= cmdLen;
-            pCmdEnd = memchr(pCmdStart, '\r', msg.length);
+            else
+            {
+                memcpy(bufRemainder + bufRemainderLen, pCmdStart, cmdLen);
+                parseCommand(bufRemainder, bufRemainderLen + cmdLen);
+            }
+            bufRemainderLen = 0;
+        }
+        else
+        {
+            parseCommand(pCmdStart, cmdLen);
         }
 
-        // If buffer does not end with CR, save remaining characters for next iteration
-        if (msg.length > 0)
+        pCmdStart = pCmdEnd + 1;
+
+        // Discard LF after CR
+        if (*pCmdStart == '\n')
         {
-            memcpy(bufRemainder + bufRemainderLen, pCmdStart, msg.length);
-            bufRemainderLen += msg.length;
+            pCmdStart++;
+            cmdLen++;
         }
 
-        message_free(&msg);
+        msg.length -= cmdLen;
+        pCmdEnd = memchr(pCmdStart, '\r', msg.length);
+    }
+
+    // If buffer does not end with CR, save remaining characters for next iteration
+    if (bufRemainderLen + msg.length > sizeof(link->bufRemainder))
+    {
+        ESP_LOGE(TAG, "%s RX command buffer overrun", link->name);
+        sendErrorResponse();
+        bufRemainderLen = 0;
+    }
+    else if (msg.length > 0)
+    {
+        memcpy(bufRemainder + bufRemainderLen, pCmdStart, msg.length);
+        bufRemainderLen += msg.length;
+    }
+
+    link->bufRemainderLen = bufRemainderLen;
+    message_free(&msg);
+}
+
+/// @brief Handle data received on all links, commands are executed one at a time
+static void dispatcherTask(void *arg)
+{
+    while (1)
+    {
+        QueueSetMemberHandle_t member = xQueueSelectFromSet(rxQueueSet, portMAX_DELAY);
+
+        for (size_t i = 0; i < linkCount; i++)
+        {
+            message_t msg;
+            if (*links[i].rxQueue == member && xQueueReceive(member, &msg, 0) == pdTRUE)
+            {
+                cmdLink = &links[i];
+                processInput(cmdLink, msg);
+                break;
+            }
+        }
     }
 }
 
-void slcan_init(QueueHandle_t *rxQueue, QueueHandle_t *txQueue)
+void slcan_init(void)
 {
-    _rxQueue = rxQueue;
-    _txQueue = txQueue;
+    settings_load(&settings);
+    timestamps = settings.timestamps;
+
+    // No static queue set API in the ESP-IDF 5.1 kernel, allocated once here
+    rxQueueSet = xQueueCreateSet(APP_SLCAN_RX_QUEUE_SET_LEN);
+
+    static const rules_callbacks_t rulesCallbacks = {.onMatch = onRuleMatch};
+    rules_init(&rulesCallbacks, NULL);
+    trace_initReader(&traceReader);
+
+    rtos_createTask(RTOS_TASK_SLCAN_DISPATCH, NULL, dispatcherTask, NULL);
 
-    xTaskCreate(serialRxTask, "slcan serialRx", 3072, NULL, APP_SLCAN_SERIAL_RX_TASK_PRIO, NULL);
+    // Received frames are kept in the boot buffer until a host attaches, links are added later
+    if (settings.autoStart != SETTINGS_AUTO_START_OFF)
+    {
+        esp_err_t res = capture_setBitrate(settings.bitrate);
+        if (res == ESP_OK)
+        {
+            capture_startBootBuffer();
+            res = capture_open(settings.autoStart == SETTINGS_AUTO_START_LISTEN_ONLY ? TWAI_MODE_LISTEN_ONLY : TWAI_MODE_NORMAL);
+        }
+        if (res != ESP_OK)
+            ESP_LOGE(TAG, "auto start failed bitrate:%lu res:%s", settings.bitrate, esp_err_to_name(res));
+        else
+            ESP_LOGI(TAG, "auto started bitrate:%lu mode:%d at %lld us", settings.bitrate, settings.autoStart, esp_timer_get_time());
+    }
 
     ESP_LOGI(TAG, "initialized");
 }
+
+esp_err_t slcan_addLink(const char *name, QueueHandle_t *rxQueue, QueueHandle_t *txQueue)
+{
+    if (linkCount >= APP_SLCAN_MAX_LINKS)
+        return ESP_ERR_NO_MEM;
+
+    link_t *link = &links[linkCount];
+    memset(link, 0, sizeof(*link));
+    link->name = name;
+    link->rxQueue = rxQueue;
+    link->txQueue = txQueue;
+    gvret_init(&link->gvret, &gvretCallbacks, link);
+    link->sink.name = name;
+    link->forwarding = settings.sinks & (1 << linkCount);
+    capture_setFilter(&link->sink, settings.filters[linkCount].id, settings.filters[linkCount].mask);
+
+    // The sink is not notified until its task exists
+    esp_err_t res = capture_addSink(&link->sink);
+    if (res != ESP_OK)
+        return res;
+    link->sink.task = rtos_createTask(RTOS_TASK_SLCAN_LINK_TX, name, linkTxTask, link);
+    linkCount++;
+
+    // The queue must be empty, data received before this point would not be notified to the set
+    if (xQueueAddToSet(*rxQueue, rxQueueSet) != pdPASS)
+    {
+        ESP_LOGE(TAG, "%s cannot add rxQueue to set", name);
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "link added name:%s", name);
+    return ESP_OK;
+}
@@ -2,8 +2,14 @@
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
+#include "esp_err.h"
 
-/// @brief Initialize SLCAN component
-/// @param rxQueue @ref message_t queue of received serial messages
+/// @brief Initialize SLCAN component, commands received on all links are handled by a single dispatcher
+void slcan_init(void);
+
+/// @brief Serve SLCAN (or GVRET) on a transport, received CAN frames are forwarded at the transport pace
+/// @param name Link name, used as task name and in logs
+/// @param rxQueue @ref message_t queue of received serial messages, must exist and be empty
 /// @param txQueue @ref message_t queue for sending serial messages
-void slcan_init(QueueHandle_t *rxQueue, QueueHandle_t *txQueue);
+/// @return ESP_ERR_NO_MEM if APP_SLCAN_MAX_LINKS links or APP_CAPTURE_MAX_SINKS sinks already exist
+esp_err_t slcan_addLink(const char *name, QueueHandle_t *rxQueue, QueueHandle_t *txQueue);
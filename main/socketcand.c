@@ -0,0 +1,471 @@
+/*
+Implementation of the socketcand ASCII protocol (https://github.com/linux-can/socketcand/blob/master/doc/protocol.md)
+Supports rawmode, bcmmode (backed by bcm.c) and controlmode on the single CAN bus of the device
+*/
+
+#include "socketcand.h"
+
+#include "message.h"
+#include "can.h"
+#include "tcp.h"
+#include "trace.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#define TAG "SOCKETCAND"
+
+#define SOCKETCAND_MAX_TOKENS 16 // "add sec usec id dlc" and 8 data bytes
+#define SOCKETCAND_MAX_FRAME_LEN (sizeof("< frame 1FFFFFFF 4294967295.999999 1122334455667788 >") - 1)
+
+static void reply(socketcand_t *s, const char *str)
+{
+    s->callbacks->send(str, strlen(str));
+}
+
+static void replyError(socketcand_t *s, const char *reason)
+{
+    char out[64];
+    int len = snprintf(out, sizeof(out), "< error %s >", reason);
+    s->callbacks->send(out, len);
+}
+
+static void sendFrame(socketcand_t *s, const twai_message_t *msg, int64_t timestampUs)
+{
+    char out[SOCKETCAND_MAX_FRAME_LEN + 1];
+    int len = snprintf(out, sizeof(out), msg->extd ? "< frame %08lX %" PRId64 ".%06ld "
+                                                   : "< frame %03lX %" PRId64 ".%06ld ",
+                       (unsigned long)msg->identifier, timestampUs / 1000000, (long)(timestampUs % 1000000));
+    for (int i = 0; i < msg->data_length_code && i < 8; i++)
+        len += snprintf(out + len, sizeof(out) - len, "%02X", msg->data[i]);
+    len += snprintf(out + len, sizeof(out) - len, " >");
+    s->callbacks->send(out, len);
+}
+
+static esp_err_t transmit(socketcand_t *s, twai_message_t *msg)
+{
+    esp_err_t res = s->callbacks->transmit(msg);
+    if (res == ESP_OK)
+    {
+        s->txFrames++;
+        s->txBytes += msg->data_length_code;
+    }
+    return res;
+}
+
+static esp_err_t bcmTransmit(void *ctx, twai_message_t *msg)
+{
+    return transmit(ctx, msg);
+}
+
+static void bcmReport(void *ctx, const twai_message_t *msg, int64_t timestampUs)
+{
+    sendFrame(ctx, msg, timestampUs);
+}
+
+static const bcm_callbacks_t bcmCallbacks = {
+    .transmit = bcmTransmit,
+    .report = bcmReport,
+};
+
+static bool parseNumber(const char *token, int base, uint32_t max, uint32_t *out)
+{
+    char *end;
+    unsigned long value = strtoul(token, &end, base);
+    if (*token == '\0' || *end != '\0' || value > max)
+        return false;
+    *out = value;
+    return true;
+}
+
+/// @brief Parse a CAN identifier, extended when written with more than 3 digits or above 0x7FF
+static bool parseId(const char *token, uint32_t *id, bool *extd)
+{
+    if (!parseNumber(token, 16, TWAI_EXTD_ID_MASK, id))
+        return false;
+    *extd = strlen(token) > 3 || *id > TWAI_STD_ID_MASK;
+    return true;
+}
+
+/// @brief Parse "sec usec" arguments
+static bool parseInterval(char **tokens, int64_t *intervalUs)
+{
+    uint32_t sec, usec;
+    if (!parseNumber(tokens[0], 10, UINT32_MAX, &sec) || !parseNumber(tokens[1], 10, 999999, &usec))
+        return false;
+    *intervalUs = (int64_t)sec * 1000000 + usec;
+    return true;
+}
+
+/// @brief Parse "can_id can_dlc [data]*" arguments
+static bool parseFrame(char **tokens, int count, twai_message_t *msg)
+{
+    uint32_t id, dlc, byte;
+    bool extd;
+    if (count < 2 || !parseId(tokens[0], &id, &extd) || !parseNumber(tokens[1], 10, 8, &dlc) || count != 2 + (int)dlc)
+        return false;
+
+    memset(msg, 0, sizeof(*msg));
+    msg->identifier = id;
+    msg->extd = extd;
+    msg->data_length_code = dlc;
+    for (uint32_t i = 0; i < dlc; i++)
+    {
+        if (!parseNumber(tokens[2 + i], 16, 0xFF, &byte))
+            return false;
+        msg->data[i] = byte;
+    }
+    return true;
+}
+
+/// @brief Handle BCM mode commands
+/// @param args Arguments after the command name
+static void handleBcmCommand(socketcand_t *s, const char *cmd, char **args, int count, int64_t nowUs)
+{
+    twai_message_t msg;
+    int64_t intervalUs;
+    uint32_t id;
+    bool extd;
+
+    if (strcmp(cmd, "add") == 0)
+    {
+        if (count < 4 || !parseInterval(args, &intervalUs) || !parseFrame(args + 2, count - 2, &msg))
+            replyError(s, "invalid add");
+        else if (bcm_addTx(&s->bcm, &msg, intervalUs, nowUs) != ESP_OK)
+            replyError(s, "cannot add");
+    }
+    else if (strcmp(cmd, "update") == 0)
+    {
+        if (!parseFrame(args, count, &msg))
+            replyError(s, "invalid update");
+        else if (bcm_updateTx(&s->bcm, &msg) != ESP_OK)
+            replyError(s, "not found");
+    }
+    else if (strcmp(cmd, "delete") == 0)
+    {
+        if (count != 1 || !parseId(args[0], &id, &extd))
+            replyError(s, "invalid delete");
+        else if (bcm_deleteTx(&s->bcm, id, extd) != ESP_OK)
+            replyError(s, "not found");
+    }
+    else if (strcmp(cmd, "filter") == 0)
+    {
+        // Data bytes are the mask of the bits whose changes are reported
+        if (count < 4 || !parseInterval(args, &intervalUs) || !parseFrame(args + 2, count - 2, &msg))
+            replyError(s, "invalid filter");
+        else if (bcm_addRx(&s->bcm, msg.identifier, msg.extd, msg.data_length_code > 0 ? msg.data : NULL, msg.data_length_code, intervalUs) != ESP_OK)
+            replyError(s, "cannot add filter");
+    }
+    else if (strcmp(cmd, "subscribe") == 0)
+    {
+        if (count != 3 || !parseInterval(args, &intervalUs) || !parseId(args[2], &id, &extd))
+            replyError(s, "invalid subscribe");
+        else if (bcm_addRx(&s->bcm, id, extd, NULL, 0, intervalUs) != ESP_OK)
+            replyError(s, "cannot subscribe");
+    }
+    else if (strcmp(cmd, "unsubscribe") == 0)
+    {
+        if (count != 1 || !parseId(args[0], &id, &extd))
+            replyError(s, "invalid unsubscribe");
+        else if (bcm_deleteRx(&s->bcm, id, extd) != ESP_OK)
+            replyError(s, "not found");
+    }
+    else if (strcmp(cmd, "muxfilter") == 0)
+        replyError(s, "muxfilter not supported");
+    else
+        replyError(s, "unknown command");
+}
+
+static void handleCommand(socketcand_t *s, char *line, int64_t nowUs)
+{
+    char *tokens[SOCKETCAND_MAX_TOKENS];
+    int count = 0;
+    char *save;
+    for (char *t = strtok_r(line, " ", &save); t != NULL; t = strtok_r(NULL, " ", &save))
+    {
+        if (count == SOCKETCAND_MAX_TOKENS)
+        {
+            replyError(s, "too many arguments");
+            return;
+        }
+        tokens[count++] = t;
+    }
+    if (count == 0)
+        return;
+
+    const char *cmd = tokens[0];
+    char **args = tokens + 1;
+    int argCount = count - 1;
+
+    if (strcmp(cmd, "echo") == 0)
+    {
+        reply(s, "< echo >");
+        return;
+    }
+
+    if (s->mode == SOCKETCAND_MODE_NO_BUS)
+    {
+        if (strcmp(cmd, "open") != 0 || argCount != 1)
+            replyError(s, "bus not open");
+        else if (!s->callbacks->isBusOpen())
+            replyError(s, "could not open bus"); // The bus is configured and opened by SLCAN/GVRET or at boot
+        else
+        {
+            s->mode = SOCKETCAND_MODE_BCM;
+            reply(s, "< ok >");
+        }
+        return;
+    }
+
+    if (strcmp(cmd, "rawmode") == 0 || strcmp(cmd, "bcmmode") == 0 || strcmp(cmd, "controlmode") == 0)
+    {
+        s->mode = cmd[0] == 'r' ? SOCKETCAND_MODE_RAW : (cmd[0] == 'b' ? SOCKETCAND_MODE_BCM : SOCKETCAND_MODE_CONTROL);
+        reply(s, "< ok >");
+        return;
+    }
+    if (strcmp(cmd, "isotpmode") == 0)
+    {
+        replyError(s, "isotpmode not supported");
+        return;
+    }
+
+    if (strcmp(cmd, "send") == 0 && s->mode != SOCKETCAND_MODE_CONTROL)
+    {
+        twai_message_t msg;
+        if (!parseFrame(args, argCount, &msg))
+            replyError(s, "invalid send");
+        else if (transmit(s, &msg) != ESP_OK)
+            replyError(s, "send failed");
+        return;
+    }
+
+    switch (s->mode)
+    {
+    case SOCKETCAND_MODE_BCM:
+        handleBcmCommand(s, cmd, args, argCount, nowUs);
+        break;
+    case SOCKETCAND_MODE_CONTROL:
+    {
+        uint32_t ms;
+        if (strcmp(cmd, "statistics") == 0 && argCount == 1 && parseNumber(args[0], 10, UINT32_MAX / 1000, &ms))
+        {
+            s->statsIntervalUs = (int64_t)ms * 1000;
+            s->statsNextUs = nowUs + s->statsIntervalUs;
+        }
+        else
+            replyError(s, "unknown command");
+        break;
+    }
+    default:
+        replyError(s, "unknown command");
+    }
+}
+
+void socketcand_sessionInit(socketcand_t *s, const socketcand_callbacks_t *callbacks)
+{
+    memset(s, 0, sizeof(*s));
+    s->callbacks = callbacks;
+    s->mode = SOCKETCAND_MODE_NO_BUS;
+    bcm_init(&s->bcm, &bcmCallbacks, s);
+
+    reply(s, "< hi >");
+}
+
+void socketcand_sessionClose(socketcand_t *s)
+{
+    bcm_clear(&s->bcm);
+    s->mode = SOCKETCAND_MODE_NO_BUS;
+    s->statsIntervalUs = 0;
+}
+
+void socketcand_sessionInput(socketcand_t *s, const char *data, size_t len, int64_t nowUs)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        char c = data[i];
+        if (c == '<')
+        {
+            s->inCmd = true;
+            s->cmdOverflow = false;
+            s->cmdLen = 0;
+        }
+        else if (!s->inCmd)
+            continue; // Whitespace between commands
+        else if (c == '>')
+        {
+            s->inCmd = false;
+            if (s->cmdOverflow)
+            {
+                replyError(s, "command too long");
+                continue;
+            }
+            s->cmd[s->cmdLen] = '\0';
+            handleCommand(s, s->cmd, nowUs);
+        }
+        else if (s->cmdLen < sizeof(s->cmd) - 1)
+            s->cmd[s->cmdLen++] = (c == '\t' || c == '\r' || c == '\n') ? ' ' : c;
+        else
+            s->cmdOverflow = true;
+    }
+}
+
+void socketcand_sessionFrame(socketcand_t *s, const twai_message_t *msg, int64_t timestampUs)
+{
+    s->rxFrames++;
+    s->rxBytes += msg->data_length_code;
+
+    if (s->mode == SOCKETCAND_MODE_RAW)
+        sendFrame(s, msg, timestampUs);
+    else if (s->mode == SOCKETCAND_MODE_BCM)
+        bcm_processFrame(&s->bcm, msg, timestampUs);
+}
+
+int64_t socketcand_sessionPoll(socketcand_t *s, int64_t nowUs)
+{
+    // Cyclic transmissions keep running when switching mode, as with socketcand
+    int64_t next = bcm_poll(&s->bcm, nowUs);
+
+    if (s->mode == SOCKETCAND_MODE_CONTROL && s->statsIntervalUs > 0)
+    {
+        if (s->statsNextUs <= nowUs)
+        {
+            char out[64];
+            int len = snprintf(out, sizeof(out), "< stat %lu %lu %lu %lu >",
+                               (unsigned long)s->rxBytes, (unsigned long)s->rxFrames, (unsigned long)s->txBytes, (unsigned long)s->txFrames);
+            s->callbacks->send(out, len);
+            s->statsNextUs = nowUs + s->statsIntervalUs;
+        }
+        if (s->statsNextUs < next)
+            next = s->statsNextUs;
+    }
+
+    return next;
+}
+
+// Server, one client at a time
+
+static socketcand_t session;
+static StaticSemaphore_t sessionLockBuffer;
+static SemaphoreHandle_t sessionLock;
+static bool connected = false;
+static message_budget_t txBudget; // Message blocks held by the client transmit queue
+
+static void serverConnect(void);
+static void serverDisconnect(void);
+
+static tcp_server_t server = {
+    .name = "socketcand",
+    .port = APP_SOCKETCAND_PORT,
+    .rxQueueId = RTOS_QUEUE_SOCKETCAND_RX,
+    .txQueueId = RTOS_QUEUE_SOCKETCAND_TX,
+    .serverTaskId = RTOS_TASK_SOCKETCAND_SERVER,
+    .txTaskId = RTOS_TASK_SOCKETCAND_TX,
+    .onConnect = serverConnect,
+    .onDisconnect = serverDisconnect,
+};
+
+static void serverSend(const char *data, size_t len)
+{
+    message_t msg = message_newBudget(&txBudget, (uint8_t *)data, len);
+    if (msg.data == NULL || xQueueSend(server.txQueue, &msg, 0) == errQUEUE_FULL)
+    {
+        // Reports of a busy bus can overrun a slow client, logging each dropped line would stall the receive path
+        TRACE(TCP_TX_QUEUE_FULL, server.port, len, 0);
+        message_free(&msg);
+    }
+}
+
+static bool serverIsBusOpen(void)
+{
+    return can_isOpen();
+}
+
+static esp_err_t serverTransmit(twai_message_t *msg)
+{
+    if (!can_isOpen() || can_getMode() != TWAI_MODE_NORMAL)
+        return ESP_ERR_INVALID_STATE;
+
+    return can_transmit(msg, pdMS_TO_TICKS(APP_SOCKETCAND_CAN_TX_TIMEOUT_MS));
+}
+
+static const socketcand_callbacks_t serverCallbacks = {
+    .send = serverSend,
+    .isBusOpen = serverIsBusOpen,
+    .transmit = serverTransmit,
+};
+
+static void serverConnect(void)
+{
+    xSemaphoreTake(sessionLock, portMAX_DELAY);
+    socketcand_sessionInit(&session, &serverCallbacks);
+    connected = true;
+    xSemaphoreGive(sessionLock);
+}
+
+static void serverDisconnect(void)
+{
+    xSemaphoreTake(sessionLock, portMAX_DELAY);
+    connected = false;
+    socketcand_sessionClose(&session);
+    xSemaphoreGive(sessionLock);
+}
+
+/// @brief Handle client commands and session deadlines
+static void sessionTask(void *arg)
+{
+    (void)arg;
+
+    int64_t nextUs = INT64_MAX;
+
+    while (1)
+    {
+        // Throttled reports are scheduled by received frames, so the wait is capped while connected
+        TickType_t ticksToWait = portMAX_DELAY;
+        if (connected)
+        {
+            int64_t waitUs = nextUs - esp_timer_get_time();
+            if (waitUs > APP_SOCKETCAND_POLL_INTERVAL_MS * 1000)
+                waitUs = APP_SOCKETCAND_POLL_INTERVAL_MS * 1000;
+            ticksToWait = waitUs > 0 ? pdMS_TO_TICKS(waitUs / 1000) : 0;
+        }
+
+        message_t msg;
+        bool received = xQueueReceive(server.rxQueue, &msg, ticksToWait) == pdTRUE;
+
+        xSemaphoreTake(sessionLock, portMAX_DELAY);
+        if (received && connected)
+            socketcand_sessionInput(&session, (const char *)msg.data, msg.length, esp_timer_get_time());
+        nextUs = connected ? socketcand_sessionPoll(&session, esp_timer_get_time()) : INT64_MAX;
+        xSemaphoreGive(sessionLock);
+
+        if (received)
+            message_free(&msg);
+    }
+}
+
+void socketcand_init(void)
+{
+    sessionLock = xSemaphoreCreateMutexStatic(&sessionLockBuffer);
+    tcp_start(&server);
+    rtos_createTask(RTOS_TASK_SOCKETCAND, NULL, sessionTask, NULL);
+
+    ESP_LOGI(TAG, "initialized");
+}
+
+void socketcand_processFrame(const twai_message_t *msg, int64_t timestampUs)
+{
+    if (!connected)
+        return;
+
+    xSemaphoreTake(sessionLock, portMAX_DELAY);
+    if (connected)
+        socketcand_sessionFrame(&session, msg, timestampUs);
+    xSemaphoreGive(sessionLock);
+}
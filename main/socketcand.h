@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "hal/twai_types.h"
+#include "bcm.h"
+#include "config.h"
+
+/// @brief Actions requested by the client, implemented by the protocol owner
+typedef struct
+{
+    void (*send)(const char *data, size_t len); // Send text to the client
+    bool (*isBusOpen)(void);                    // Check if the CAN bus is open
+    esp_err_t (*transmit)(twai_message_t *msg); // Send a frame on the CAN bus
+} socketcand_callbacks_t;
+
+typedef enum
+{
+    SOCKETCAND_MODE_NO_BUS, // Waiting for "open"
+    SOCKETCAND_MODE_BCM,    // Frames are reported through receive filters (default after "open")
+    SOCKETCAND_MODE_RAW,    // Every frame is reported
+    SOCKETCAND_MODE_CONTROL,
+} socketcand_mode_t;
+
+/// @brief socketcand protocol state of a client connection
+typedef struct
+{
+    const socketcand_callbacks_t *callbacks;
+    socketcand_mode_t mode;
+    bcm_t bcm;
+    char cmd[APP_SOCKETCAND_MAX_CMD_LEN]; // Command being received, between '<' and '>'
+    size_t cmdLen;
+    bool inCmd;
+    bool cmdOverflow;
+    int64_t statsIntervalUs; // Control mode statistics period, 0 when disabled
+    int64_t statsNextUs;
+    uint32_t rxFrames;
+    uint32_t rxBytes;
+    uint32_t txFrames;
+    uint32_t txBytes;
+} socketcand_t;
+
+/// @brief Initialize protocol state of a new client connection and greet the client
+void socketcand_sessionInit(socketcand_t *s, const socketcand_callbacks_t *callbacks);
+
+/// @brief Release the CAN resources of a closed client connection (cyclic transmissions are stopped)
+void socketcand_sessionClose(socketcand_t *s);
+
+/// @brief Parse data received from the client, commands may span multiple calls
+/// @param nowUs Current time, used to schedule cyclic transmissions
+void socketcand_sessionInput(socketcand_t *s, const char *data, size_t len, int64_t nowUs);
+
+/// @brief Handle a received CAN frame, reported to the client according to mode and filters
+void socketcand_sessionFrame(socketcand_t *s, const twai_message_t *msg, int64_t timestampUs);
+
+/// @brief Run cyclic transmissions, throttled reports and statistics
+/// @return Time of the next deadline, INT64_MAX if there is none
+int64_t socketcand_sessionPoll(socketcand_t *s, int64_t nowUs);
+
+/// @brief Start socketcand server on APP_SOCKETCAND_PORT (requires network interface, see wifi.c)
+void socketcand_init(void);
+
+/// @brief Forward a received CAN frame to the connected client, if any
+void socketcand_processFrame(const twai_message_t *msg, int64_t timestampUs);
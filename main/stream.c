@@ -0,0 +1,393 @@
+/*
+Live streaming of frames and decoded signals to dashboard clients (WebSocket server, see ws.c), transport independent.
+
+Subscriptions of all clients share an item table: a received frame only updates the latest value of its items
+(a copy), decoding and encoding happen at most once per batch for every item updated since, and client batches are
+assembled from the encoded records. A client that falls behind (slow rate, or transport not ready) only gets the latest
+value of each subscription, earlier ones are coalesced: per-client memory is fixed, nothing is queued.
+*/
+
+#include "stream.h"
+
+#include "dbc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TAG "STREAM"
+
+_Static_assert(APP_STREAM_MAX_ITEMS <= 255, "item indexes are 8 bit");
+_Static_assert(STREAM_SIGNAL_RECORD_LEN <= STREAM_FRAME_RECORD_LEN, "records must fit in an item record");
+
+/// @brief Latest value of a subscribed identifier or signal, shared by its subscribers
+typedef struct
+{
+    uint8_t kind;       // STREAM_RECORD_FRAME or STREAM_RECORD_SIGNAL, 0 when unused
+    uint16_t signal;    // Signal index (STREAM_RECORD_SIGNAL)
+    uint32_t key;       // Identifier | STREAM_ID_EXTD of the frame, or of the message of the signal
+    uint16_t refs;      // Subscriptions
+    uint32_t updateSeq; // Incremented by every received value, 0 until the first one
+    uint32_t encodedSeq;
+    twai_message_t msg; // Latest frame
+    int64_t timeUs;
+    uint8_t record[STREAM_FRAME_RECORD_LEN]; // Encoded at encodedSeq
+    uint8_t recordLen;
+} item_t;
+
+static stream_callbacks_t callbacks;
+static stream_client_t clients[APP_STREAM_MAX_CLIENTS];
+static item_t items[APP_STREAM_MAX_ITEMS];
+static uint32_t stdIds[2048 / 32]; // Standard identifiers with items, bit per identifier
+static size_t extItems = 0;        // Items of extended identifiers
+static stream_stats_t stats;
+static uint8_t batch[STREAM_MAX_BATCH_LEN]; // Assembled for one client at a time
+
+static inline void put16(uint8_t *p, uint16_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+}
+
+static inline void put32(uint8_t *p, uint32_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+/// @brief Rebuild the identifier lookups after subscriptions changed
+static void updateLookup(void)
+{
+    memset(stdIds, 0, sizeof(stdIds));
+    extItems = 0;
+    stats.items = 0;
+    for (size_t i = 0; i < APP_STREAM_MAX_ITEMS; i++)
+    {
+        if (items[i].kind == 0)
+            continue;
+        stats.items++;
+        if (items[i].key & STREAM_ID_EXTD)
+            extItems++;
+        else
+            stdIds[items[i].key / 32] |= 1UL << (items[i].key % 32);
+    }
+}
+
+static void encodeItem(item_t *item)
+{
+    if (item->encodedSeq == item->updateSeq)
+        return;
+
+    uint8_t *r = item->record;
+    memset(r, 0, sizeof(item->record));
+    r[0] = item->kind;
+    if (item->kind == STREAM_RECORD_FRAME)
+    {
+        const twai_message_t *msg = &item->msg;
+        uint8_t dlc = msg->data_length_code <= 8 ? msg->data_length_code : 8;
+        r[1] = (msg->extd ? 0x01 : 0) | (msg->rtr ? 0x02 : 0);
+        r[2] = dlc;
+        put32(r + 4, msg->identifier);
+        put32(r + 8, item->timeUs);
+        if (!msg->rtr)
+            memcpy(r + 12, msg->data, dlc);
+        item->recordLen = STREAM_FRAME_RECORD_LEN;
+    }
+    else
+    {
+        dbc_value_t value = {0};
+        dbc_decodeSignal(&item->msg, item->signal, &value);
+        uint32_t bits;
+        memcpy(&bits, &value.value, sizeof(bits));
+        put16(r + 2, item->signal);
+        put32(r + 4, item->timeUs);
+        put32(r + 8, bits);
+        item->recordLen = STREAM_SIGNAL_RECORD_LEN;
+    }
+    item->encodedSeq = item->updateSeq;
+    stats.encodes++;
+}
+
+/// @brief Subscribe a client to an item, shared with the other subscribers of the same identifier or signal
+static esp_err_t subscribe(stream_client_t *client, uint8_t kind, uint32_t key, uint16_t signal)
+{
+    int found = -1, free = -1;
+    for (int i = 0; i < APP_STREAM_MAX_ITEMS && found < 0; i++)
+    {
+        if (items[i].kind == kind && items[i].key == key && items[i].signal == signal)
+            found = i;
+        else if (items[i].kind == 0 && free < 0)
+            free = i;
+    }
+
+    if (found >= 0)
+    {
+        for (size_t i = 0; i < client->subCount; i++)
+            if (client->subs[i].item == found)
+                return ESP_OK;
+    }
+    if (client->subCount >= APP_STREAM_MAX_SUBS)
+        return ESP_ERR_NO_MEM;
+    if (found < 0)
+    {
+        if (free < 0)
+            return ESP_ERR_NO_MEM;
+        found = free;
+        memset(&items[found], 0, sizeof(items[found]));
+        items[found].kind = kind;
+        items[found].key = key;
+        items[found].signal = signal;
+        updateLookup();
+    }
+
+    items[found].refs++;
+    // The latest value, if any, goes out with the next batch
+    client->subs[client->subCount++] = (stream_sub_t){.item = found, .sentSeq = 0};
+    return ESP_OK;
+}
+
+static void unsubscribeAll(stream_client_t *client)
+{
+    for (size_t i = 0; i < client->subCount; i++)
+    {
+        item_t *item = &items[client->subs[i].item];
+        if (--item->refs == 0)
+            item->kind = 0;
+    }
+    client->subCount = 0;
+    updateLookup();
+}
+
+void stream_init(const stream_callbacks_t *value)
+{
+    callbacks = *value;
+    memset(clients, 0, sizeof(clients));
+    memset(items, 0, sizeof(items));
+    memset(&stats, 0, sizeof(stats));
+    updateLookup();
+}
+
+stream_client_t *stream_openClient(void *ctx)
+{
+    for (size_t i = 0; i < APP_STREAM_MAX_CLIENTS; i++)
+    {
+        stream_client_t *client = &clients[i];
+        if (client->used)
+            continue;
+
+        memset(client, 0, sizeof(*client));
+        client->used = true;
+        client->ctx = ctx;
+        client->intervalUs = APP_STREAM_DEFAULT_INTERVAL_MS * 1000LL;
+        stats.clients++;
+        return client;
+    }
+    return NULL;
+}
+
+stream_client_t *stream_findClient(void *ctx)
+{
+    for (size_t i = 0; i < APP_STREAM_MAX_CLIENTS; i++)
+        if (clients[i].used && clients[i].ctx == ctx)
+            return &clients[i];
+    return NULL;
+}
+
+void stream_closeClient(stream_client_t *client)
+{
+    unsubscribeAll(client);
+    client->used = false;
+    stats.clients--;
+}
+
+static void reply(stream_client_t *client, const char *text)
+{
+    callbacks.sendText(client->ctx, text, strlen(text));
+}
+
+void stream_clientInput(stream_client_t *client, const char *text, size_t len, int64_t nowUs)
+{
+    char cmd[APP_STREAM_MAX_CMD_LEN];
+    char out[16 + APP_STREAM_MAX_SUBS * 6]; // "ok <n>" and the signal index of every subscribed name
+    if (len >= sizeof(cmd))
+    {
+        reply(client, "error too long");
+        return;
+    }
+    memcpy(cmd, text, len);
+    cmd[len] = 0;
+
+    char *save;
+    char *verb = strtok_r(cmd, " \r\n", &save);
+    if (verb == NULL)
+        return;
+
+    if (strcmp(verb, "rate") == 0)
+    {
+        char *arg = strtok_r(NULL, " \r\n", &save);
+        char *end;
+        long ms = arg != NULL ? strtol(arg, &end, 10) : 0;
+        if (arg == NULL || *end != 0 || ms < APP_STREAM_MIN_INTERVAL_MS || ms > 60000)
+        {
+            reply(client, "error rate");
+            return;
+        }
+        client->intervalUs = ms * 1000LL;
+        client->nextUs = nowUs;
+        reply(client, "ok");
+    }
+    else if (strcmp(verb, "id") == 0 || strcmp(verb, "sig") == 0)
+    {
+        bool isSignal = verb[0] == 's';
+        char indexes[APP_STREAM_MAX_SUBS * 6 + 1] = "";
+        size_t indexesLen = 0;
+        char *arg;
+        while ((arg = strtok_r(NULL, " \r\n", &save)) != NULL)
+        {
+            esp_err_t res;
+            if (isSignal)
+            {
+                int signal = dbc_findSignal(arg);
+                const dbc_message_t *m = signal >= 0 ? dbc_getSignalMessage(signal) : NULL;
+                if (m == NULL)
+                {
+                    snprintf(out, sizeof(out), "error unknown %.48s", arg);
+                    reply(client, out);
+                    return;
+                }
+                res = subscribe(client, STREAM_RECORD_SIGNAL, m->identifier | (m->extd ? STREAM_ID_EXTD : 0), signal);
+                if (res == ESP_OK && indexesLen < sizeof(indexes) - 6)
+                    indexesLen += snprintf(indexes + indexesLen, sizeof(indexes) - indexesLen, " %d", signal);
+            }
+            else
+            {
+                // Identifiers with more than 3 hex digits are extended, like socketcand
+                char *end;
+                unsigned long id = strtoul(arg, &end, 16);
+                bool extd = strlen(arg) > 3;
+                if (*end != 0 || id > (extd ? 0x1FFFFFFFUL : 0x7FFUL))
+                {
+                    snprintf(out, sizeof(out), "error id %.48s", arg);
+                    reply(client, out);
+                    return;
+                }
+                res = subscribe(client, STREAM_RECORD_FRAME, id | (extd ? STREAM_ID_EXTD : 0), 0);
+            }
+            if (res != ESP_OK)
+            {
+                reply(client, "error full");
+                return;
+            }
+        }
+        client->nextUs = nowUs;
+        snprintf(out, sizeof(out), "ok %u%s", (unsigned)client->subCount, indexes);
+        reply(client, out);
+    }
+    else if (strcmp(verb, "clear") == 0)
+    {
+        unsubscribeAll(client);
+        reply(client, "ok 0");
+    }
+    else if (strcmp(verb, "stats") == 0)
+    {
+        snprintf(out, sizeof(out), "stats %lu %lu %lu %u", (unsigned long)client->batches, (unsigned long)client->coalesced,
+                 (unsigned long)client->busy, (unsigned)client->subCount);
+        reply(client, out);
+    }
+    else
+        reply(client, "error command");
+}
+
+void stream_processFrame(const twai_message_t *msg, int64_t timestampUs)
+{
+    if (msg->extd ? extItems == 0 : !(stdIds[(msg->identifier & 0x7FF) / 32] & 1UL << (msg->identifier % 32)))
+        return;
+
+    uint32_t key = msg->identifier | (msg->extd ? STREAM_ID_EXTD : 0);
+    for (size_t i = 0; i < APP_STREAM_MAX_ITEMS; i++)
+    {
+        item_t *item = &items[i];
+        if (item->kind == 0 || item->key != key || (item->kind == STREAM_RECORD_SIGNAL && msg->rtr))
+            continue;
+
+        item->msg = *msg;
+        item->timeUs = timestampUs;
+        if (++item->updateSeq == 0)
+            item->updateSeq = 1;
+        stats.frames++;
+    }
+}
+
+/// @brief Assemble and send the records updated since the last batch of a client
+/// @return false if there was nothing to send, or the client was not ready
+static bool sendBatch(stream_client_t *client, int64_t nowUs)
+{
+    size_t len = STREAM_HEADER_LEN;
+    uint16_t records = 0;
+    for (size_t i = 0; i < client->subCount; i++)
+    {
+        item_t *item = &items[client->subs[i].item];
+        if (item->updateSeq == client->subs[i].sentSeq)
+            continue;
+
+        encodeItem(item);
+        memcpy(batch + len, item->record, item->recordLen);
+        len += item->recordLen;
+        records++;
+    }
+    if (records == 0)
+        return false;
+
+    batch[0] = STREAM_MSG_BATCH;
+    batch[1] = 0;
+    put16(batch + 2, records);
+    put32(batch + 4, nowUs / 1000);
+    if (!callbacks.sendBatch(client->ctx, batch, len))
+    {
+        client->busy++;
+        return false;
+    }
+
+    for (size_t i = 0; i < client->subCount; i++)
+    {
+        stream_sub_t *sub = &client->subs[i];
+        uint32_t sentSeq = items[sub->item].encodedSeq;
+        if (sub->sentSeq != 0 && sentSeq - sub->sentSeq > 1)
+            client->coalesced += sentSeq - sub->sentSeq - 1;
+        sub->sentSeq = sentSeq;
+    }
+    client->batches++;
+    return true;
+}
+
+int64_t stream_poll(int64_t nowUs)
+{
+    int64_t nextUs = INT64_MAX;
+    for (size_t i = 0; i < APP_STREAM_MAX_CLIENTS; i++)
+    {
+        stream_client_t *client = &clients[i];
+        if (!client->used || client->subCount == 0)
+            continue;
+
+        if (nowUs >= client->nextUs)
+        {
+            uint32_t busy = client->busy;
+            if (sendBatch(client, nowUs))
+                client->nextUs = nowUs + client->intervalUs;
+            else if (client->busy != busy)
+                client->nextUs = nowUs + APP_STREAM_RETRY_MS * 1000LL;
+            else
+                continue; // Nothing new, sent as soon as a subscribed frame is received
+        }
+        if (client->nextUs < nextUs)
+            nextUs = client->nextUs;
+    }
+    return nextUs;
+}
+
+void stream_getStats(stream_stats_t *out)
+{
+    *out = stats;
+}
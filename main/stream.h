@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "hal/twai_types.h"
+#include "config.h"
+
+#define STREAM_ID_EXTD 0x80000000 // Item key flag of extended identifiers
+
+// Binary batch message: header, then records (little endian)
+#define STREAM_MSG_BATCH 0x01     // Header: type:8, reserved:8, records:16, time ms:32 (esp_timer, wraps)
+#define STREAM_RECORD_FRAME 0x01  // Record: kind:8, flags:8 (bit 0 extended, bit 1 RTR), dlc:8, reserved:8, id:32, time us:32, data:64
+#define STREAM_RECORD_SIGNAL 0x02 // Record: kind:8, reserved:8, signal:16, time us:32, value:float32
+#define STREAM_HEADER_LEN 8
+#define STREAM_FRAME_RECORD_LEN 20
+#define STREAM_SIGNAL_RECORD_LEN 12
+#define STREAM_MAX_BATCH_LEN (STREAM_HEADER_LEN + APP_STREAM_MAX_SUBS * STREAM_FRAME_RECORD_LEN)
+
+/// @brief Actions requested by the streaming core, implemented by the transport (WebSocket server)
+typedef struct
+{
+    void (*sendText)(void *ctx, const char *text, size_t len); // Send a command reply to the client
+    /// @brief Send a batch to the client without blocking
+    /// @return false if the client cannot take it now, its subscriptions are then coalesced until the next batch
+    bool (*sendBatch)(void *ctx, const uint8_t *data, size_t len);
+} stream_callbacks_t;
+
+/// @brief Subscription of a client to a shared item
+typedef struct
+{
+    uint8_t item;     // Index in the item table
+    uint32_t sentSeq; // Item update sequence number last sent to the client
+} stream_sub_t;
+
+/// @brief Client connection, all of its memory is in this fixed-size structure
+typedef struct
+{
+    bool used;
+    void *ctx;          // Transport handle, passed to callbacks
+    int64_t intervalUs; // Minimum time between batches, chosen by the client
+    int64_t nextUs;     // Earliest time of the next batch
+    size_t subCount;
+    stream_sub_t subs[APP_STREAM_MAX_SUBS];
+    uint32_t batches;   // Batches sent
+    uint32_t coalesced; // Values replaced by a newer one before they were sent
+    uint32_t busy;      // Batches postponed because the client was not ready
+} stream_client_t;
+
+typedef struct
+{
+    uint32_t clients;
+    uint32_t items;   // Items subscribed by at least one client
+    uint32_t frames;  // Received frames matching an item
+    uint32_t encodes; // Item records encoded (once per batch, whatever the number of subscribers)
+} stream_stats_t;
+
+/// @brief Initialize streaming state, without clients
+void stream_init(const stream_callbacks_t *callbacks);
+
+/// @brief Register a new client, with the default rate (APP_STREAM_DEFAULT_INTERVAL_MS) and no subscription
+/// @param ctx Transport handle passed to callbacks
+/// @return NULL if APP_STREAM_MAX_CLIENTS are connected
+stream_client_t *stream_openClient(void *ctx);
+
+/// @brief Find the client of a transport handle
+/// @return NULL if the handle has no client
+stream_client_t *stream_findClient(void *ctx);
+
+/// @brief Release a client and its subscriptions
+void stream_closeClient(stream_client_t *client);
+
+/// @brief Handle a text command of a client, answered through sendText
+/// @details "rate <ms>", "id <id>...", "sig <message.signal>..." (answered with the signal indexes of the records),
+/// "clear", "stats"
+void stream_clientInput(stream_client_t *client, const char *text, size_t len, int64_t nowUs);
+
+/// @brief Record the latest value of the items of a received frame
+/// @details Constant cost per frame (copy), decoding and encoding are deferred to the next batch
+void stream_processFrame(const twai_message_t *msg, int64_t timestampUs);
+
+/// @brief Encode the items updated since the last batch once, then send a batch to every due client
+/// @return Time of the next batch, INT64_MAX if no client has subscriptions
+int64_t stream_poll(int64_t nowUs);
+
+void stream_getStats(stream_stats_t *stats);
@@ -0,0 +1,159 @@
+#include "tcp.h"
+
+#include "config.h"
+#include "message.h"
+#include "trace.h"
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "lwip/sockets.h"
+
+#define TAG "TCP"
+
+QueueHandle_t tcpRxQueue;
+QueueHandle_t tcpTxQueue;
+
+static tcp_server_t slcanServer = {
+    .name = "tcp",
+    .port = APP_TCP_PORT,
+    .rxQueueId = RTOS_QUEUE_TCP_RX,
+    .txQueueId = RTOS_QUEUE_TCP_TX,
+    .serverTaskId = RTOS_TASK_TCP_SERVER,
+    .txTaskId = RTOS_TASK_TCP_TX,
+};
+
+/// @brief Accept clients and forward received data to the server rxQueue
+static void serverTask(void *arg)
+{
+    tcp_server_t *server = arg;
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+        .sin_port = htons(server->port),
+    };
+
+    int listenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    int reuse = 1;
+    setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(listenSocket, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listenSocket, 1) != 0)
+    {
+        ESP_LOGE(TAG, "cannot listen on port %d errno:%d", server->port, errno);
+        close(listenSocket);
+        vTaskSuspend(NULL); // Static task, kept for stack usage reports
+        return;
+    }
+
+    while (1)
+    {
+        int sock = accept(listenSocket, NULL, NULL);
+        if (sock < 0)
+        {
+            ESP_LOGE(TAG, "accept errno:%d", errno);
+            continue;
+        }
+
+        int noDelay = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+        server->clientSocket = sock;
+        ESP_LOGI(TAG, "%s client connected", server->name);
+        if (server->onConnect != NULL)
+            server->onConnect();
+
+        uint8_t buf[256];
+        int len;
+        while ((len = recv(sock, buf, sizeof(buf), 0)) > 0)
+        {
+            message_t msg = message_new(buf, len);
+            if (msg.data == NULL || xQueueSend(server->rxQueue, &msg, 0) == errQUEUE_FULL)
+            {
+                TRACE(TCP_RX_QUEUE_FULL, server->port, len, 0);
+                message_free(&msg);
+            }
+        }
+
+        ESP_LOGI(TAG, "%s client disconnected", server->name);
+        server->clientSocket = -1;
+        if (server->onDisconnect != NULL)
+            server->onDisconnect();
+        shutdown(sock, SHUT_RDWR);
+        close(sock);
+    }
+}
+
+static void sendToClient(tcp_server_t *server, const uint8_t *data, size_t len)
+{
+    int sock = server->clientSocket;
+    if (sock < 0 || len == 0)
+        return; // Not connected, data is discarded
+
+    // Blocks while the TCP send window is full, backpressure goes to the server txQueue
+    if (send(sock, data, len, 0) < 0)
+        TRACE(TCP_SEND_ERROR, server->port, errno, 0);
+}
+
+static void txTask(void *arg)
+{
+    tcp_server_t *server = arg;
+    message_t msgRemainder = {0}; // Message received during previous cycle that did not fit in the buffer
+
+    while (1)
+    {
+        // Read multiple messages from queue and send them at once
+        uint8_t buf[1460]; // One TCP segment
+        uint8_t *pBuf = buf;
+        message_t msg;
+
+        if (msgRemainder.data != NULL)
+        {
+            msg = msgRemainder;
+            msgRemainder.data = NULL;
+        }
+        else
+            xQueueReceive(server->txQueue, &msg, portMAX_DELAY);
+
+        do
+        {
+            size_t free = buf + sizeof(buf) - pBuf;
+            if (msg.length <= free)
+            {
+                memcpy(pBuf, msg.data, msg.length);
+                pBuf += msg.length;
+                message_free(&msg);
+            }
+            else if (pBuf == buf)
+            {
+                // Larger than the buffer, send as is
+                sendToClient(server, msg.data, msg.length);
+                message_free(&msg);
+            }
+            else
+            {
+                msgRemainder = msg;
+                break;
+            }
+        } while (xQueueReceive(server->txQueue, &msg, 0) == pdTRUE);
+
+        sendToClient(server, buf, pBuf - buf);
+    }
+}
+
+void tcp_start(tcp_server_t *server)
+{
+    server->clientSocket = -1;
+    server->rxQueue = rtos_createQueue(server->rxQueueId);
+    server->txQueue = rtos_createQueue(server->txQueueId);
+
+    rtos_createTask(server->serverTaskId, NULL, serverTask, server);
+    rtos_createTask(server->txTaskId, NULL, txTask, server);
+
+    ESP_LOGI(TAG, "%s listening port:%d", server->name, server->port);
+}
+
+void tcp_init(void)
+{
+    tcp_start(&slcanServer);
+    tcpRxQueue = slcanServer.rxQueue;
+    tcpTxQueue = slcanServer.txQueue;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+#include "rtos.h"
+
+/// @brief Single-client TCP server, received and sent data goes through @ref message_t queues
+typedef struct
+{
+    const char *name;           // Log name
+    uint16_t port;
+    rtos_queue_t rxQueueId;     // Static queue layout entries (rtos.h)
+    rtos_queue_t txQueueId;
+    rtos_task_t serverTaskId;   // Static task layout entries (rtos.h)
+    rtos_task_t txTaskId;
+    void (*onConnect)(void);    // Optional, called when a client connects
+    void (*onDisconnect)(void); // Optional, called when the client disconnects
+    QueueHandle_t rxQueue;      // Created by @ref tcp_start
+    QueueHandle_t txQueue;      // Created by @ref tcp_start
+    int clientSocket;
+} tcp_server_t;
+
+extern QueueHandle_t tcpRxQueue;
+extern QueueHandle_t tcpTxQueue;
+
+/**
+ * @brief Start a TCP server (requires network interface, see wifi.c)
+ * @param server Server description (name, port, queues and tasks, callbacks), must stay valid
+ */
+void tcp_start(tcp_server_t *server);
+
+/**
+ * @brief Initialize TCP server component (requires network interface, see wifi.c)
+ */
+void tcp_init(void);
@@ -0,0 +1,234 @@
+/*
+Deferred trace: hot paths record compact binary events (event id, three arguments, CPU cycle counter) in a ring per
+core, formatting happens only when the rings are read, by the SLCAN "ld" dump or by a low priority drain task that
+prints them on the console. Records are written with interrupts masked on the writing core (no lock shared between
+cores), readers detect records overwritten while they copy them.
+*/
+
+#include "trace.h"
+
+#include "rtos.h"
+
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_cpu.h"
+#include "esp_log.h"
+#include "esp_rom_sys.h"
+
+#define TAG "TRACE"
+
+_Static_assert((APP_TRACE_RING_LEN & (APP_TRACE_RING_LEN - 1)) == 0, "APP_TRACE_RING_LEN must be a power of 2");
+
+typedef struct
+{
+    uint32_t cycles;
+    uint16_t event;
+    uint16_t arg0;
+    uint32_t arg1;
+    uint32_t arg2;
+} record_t;
+
+typedef struct
+{
+    const char *format;
+    uint8_t module;
+    uint8_t level;
+    bool text;
+} eventInfo_t;
+
+static const eventInfo_t events[TRACE_EVENT_COUNT] = {
+#define TRACE_EVENT_INFO(id, module, level, text, format) {format, TRACE_MODULE_##module, TRACE_LEVEL_##level, text},
+    TRACE_EVENTS(TRACE_EVENT_INFO)
+#undef TRACE_EVENT_INFO
+};
+
+static const char *moduleNames[TRACE_MODULE_COUNT] = {
+#define TRACE_MODULE_NAME(id, name) name,
+    TRACE_MODULES(TRACE_MODULE_NAME)
+#undef TRACE_MODULE_NAME
+};
+
+static const uint8_t compiledLevels[TRACE_MODULE_COUNT] = {
+#define TRACE_MODULE_LEVEL(id, name) APP_TRACE_LEVEL_##id,
+    TRACE_MODULES(TRACE_MODULE_LEVEL)
+#undef TRACE_MODULE_LEVEL
+};
+
+volatile uint8_t trace_levels[TRACE_MODULE_COUNT] = {
+#define TRACE_MODULE_LEVEL(id, name) APP_TRACE_LEVEL_##id,
+    TRACE_MODULES(TRACE_MODULE_LEVEL)
+#undef TRACE_MODULE_LEVEL
+};
+
+static record_t rings[portNUM_PROCESSORS][APP_TRACE_RING_LEN];
+static uint32_t heads[portNUM_PROCESSORS]; // Sequence number of the next record, per core
+
+static inline void append(uint16_t event, uint32_t arg0, uint32_t arg1, uint32_t arg2)
+{
+    // Masking interrupts also keeps the task on this core until the record is complete
+    UBaseType_t state = portSET_INTERRUPT_MASK_FROM_ISR();
+    int core = xPortGetCoreID();
+    uint32_t head = heads[core];
+    record_t *record = &rings[core][head & (APP_TRACE_RING_LEN - 1)];
+    record->cycles = esp_cpu_get_cycle_count();
+    record->event = event;
+    record->arg0 = arg0;
+    record->arg1 = arg1;
+    record->arg2 = arg2;
+    __atomic_store_n(&heads[core], head + 1, __ATOMIC_RELEASE);
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(state);
+}
+
+void trace_record(trace_event_t event, uint32_t arg0, uint32_t arg1, uint32_t arg2)
+{
+    append(event, arg0, arg1, arg2);
+}
+
+void trace_recordText(trace_event_t event, uint32_t arg0, const char *text, size_t len)
+{
+    uint32_t words[TRACE_TEXT_LEN / sizeof(uint32_t)] = {0};
+    memcpy(words, text, len < TRACE_TEXT_LEN ? len : TRACE_TEXT_LEN);
+    append(event, arg0, words[0], words[1]);
+}
+
+void trace_initReader(trace_reader_t *reader)
+{
+    for (int core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        uint32_t head = __atomic_load_n(&heads[core], __ATOMIC_ACQUIRE);
+        reader->cursor[core] = head > APP_TRACE_RING_LEN ? head - APP_TRACE_RING_LEN : 0;
+    }
+    reader->lost = 0;
+}
+
+void trace_skipReader(trace_reader_t *reader)
+{
+    for (int core = 0; core < portNUM_PROCESSORS; core++)
+        reader->cursor[core] = __atomic_load_n(&heads[core], __ATOMIC_ACQUIRE);
+}
+
+bool trace_read(trace_reader_t *reader, trace_entry_t *entry)
+{
+    for (int core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        while (1)
+        {
+            uint32_t cursor = reader->cursor[core];
+            uint32_t head = __atomic_load_n(&heads[core], __ATOMIC_ACQUIRE);
+            if (head == cursor)
+                break;
+            if (head - cursor >= APP_TRACE_RING_LEN)
+            {
+                // Overwritten, or being overwritten: skip to the oldest record that is not
+                reader->lost += head - cursor - (APP_TRACE_RING_LEN - 1);
+                reader->cursor[core] = head - (APP_TRACE_RING_LEN - 1);
+                continue;
+            }
+
+            record_t record = rings[core][cursor & (APP_TRACE_RING_LEN - 1)];
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&heads[core], __ATOMIC_ACQUIRE) - cursor >= APP_TRACE_RING_LEN)
+                continue; // The writer reached the record while it was copied
+
+            reader->cursor[core] = cursor + 1;
+            if (record.event >= TRACE_EVENT_COUNT)
+                continue;
+
+            entry->core = core;
+            entry->cycles = record.cycles;
+            entry->event = record.event;
+            entry->arg0 = record.arg0;
+            entry->arg1 = record.arg1;
+            entry->arg2 = record.arg2;
+            return true;
+        }
+    }
+    return false;
+}
+
+int trace_format(const trace_entry_t *entry, char *out, size_t size)
+{
+    const eventInfo_t *info = &events[entry->event];
+    int len = snprintf(out, size, "%s: ", moduleNames[info->module]);
+    if (len < 0 || (size_t)len >= size)
+        return len;
+
+    if (info->text)
+    {
+        char text[TRACE_TEXT_LEN + 1] = {0};
+        memcpy(text, &entry->arg1, sizeof(entry->arg1));
+        memcpy(text + sizeof(entry->arg1), &entry->arg2, sizeof(entry->arg2));
+        for (size_t i = 0; i < TRACE_TEXT_LEN; i++)
+            if (text[i] == '\r')
+                text[i] = 0;
+        return len + snprintf(out + len, size - len, info->format, text, (unsigned long)entry->arg0);
+    }
+    return len + snprintf(out + len, size - len, info->format, (unsigned long)entry->arg0, (unsigned long)entry->arg1,
+                          (unsigned long)entry->arg2);
+}
+
+/// @brief Print records on the console, only runs when no other task is ready
+static void drainTask(void *arg)
+{
+    static trace_reader_t reader;
+    trace_initReader(&reader);
+    uint32_t cyclesPerUs = esp_rom_get_cpu_ticks_per_us();
+
+    while (1)
+    {
+        trace_entry_t entry;
+        char text[96];
+        while (trace_read(&reader, &entry))
+        {
+            trace_format(&entry, text, sizeof(text));
+            ESP_LOG_LEVEL(trace_getEventLevel(entry.event), TAG, "%d@%lu %s", entry.core, entry.cycles / cyclesPerUs, text);
+        }
+        if (reader.lost > 0)
+        {
+            ESP_LOGW(TAG, "drain lost:%lu", reader.lost);
+            reader.lost = 0;
+        }
+        vTaskDelay(pdMS_TO_TICKS(APP_TRACE_DRAIN_MS));
+    }
+}
+
+void trace_init(void)
+{
+    if (APP_TRACE_DRAIN_MS > 0)
+        rtos_createTask(RTOS_TASK_TRACE_DRAIN, NULL, drainTask, NULL);
+
+    ESP_LOGI(TAG, "initialized records:%d per core", APP_TRACE_RING_LEN);
+}
+
+esp_err_t trace_setLevel(trace_module_t module, uint8_t level)
+{
+    if (module >= TRACE_MODULE_COUNT || level > compiledLevels[module])
+        return ESP_ERR_INVALID_ARG;
+
+    trace_levels[module] = level;
+    return ESP_OK;
+}
+
+const char *trace_getModuleName(trace_module_t module)
+{
+    return moduleNames[module];
+}
+
+uint8_t trace_getCompiledLevel(trace_module_t module)
+{
+    return compiledLevels[module];
+}
+
+uint8_t trace_getEventLevel(trace_event_t event)
+{
+    return events[event].level;
+}
+
+void trace_getStatus(trace_status_t *status)
+{
+    for (int core = 0; core < portNUM_PROCESSORS; core++)
+        status->records[core] = __atomic_load_n(&heads[core], __ATOMIC_ACQUIRE);
+    status->capacity = APP_TRACE_RING_LEN;
+}
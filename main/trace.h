@@ -0,0 +1,147 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+
+#include "config.h"
+
+// Levels, same values as esp_log_level_t
+#define TRACE_LEVEL_NONE 0
+#define TRACE_LEVEL_ERROR 1
+#define TRACE_LEVEL_WARN 2
+#define TRACE_LEVEL_INFO 3
+#define TRACE_LEVEL_DEBUG 4
+#define TRACE_LEVEL_VERBOSE 5
+
+#define TRACE_TEXT_LEN 8 // Characters kept by text events (arg1 and arg2)
+
+/// @brief Traced modules: X(id, name), events above APP_TRACE_LEVEL_<id> are compiled out
+#define TRACE_MODULES(X) \
+    X(SLCAN, "SLCAN")    \
+    X(BT, "BT")          \
+    X(TCP, "TCP")
+
+/// @brief Trace events: X(id, module, level, text, format)
+/// @details Formatted at dump time with (arg0, arg1, arg2), or (text, arg0) when text is true
+#define TRACE_EVENTS(X)                                                           \
+    X(SLCAN_COMMAND, SLCAN, INFO, true, "command \"%.8s\" len:%lu")               \
+    X(SLCAN_OK, SLCAN, INFO, false, "respond ok len:%lu")                         \
+    X(SLCAN_ERROR, SLCAN, INFO, false, "respond error")                           \
+    X(SLCAN_TX_QUEUE_FULL, SLCAN, ERROR, false, "link:%lu transmit queue full")   \
+    X(BT_DATA_IND, BT, INFO, false, "ESP_SPP_DATA_IND_EVT length:%lu")            \
+    X(BT_RX_QUEUE_FULL, BT, ERROR, false, "btRxQueue FULL length:%lu")            \
+    X(BT_CONG, BT, WARN, false, "ESP_SPP_CONG_EVT status:%lu cong:%lu")           \
+    X(BT_WRITE, BT, WARN, false, "ESP_SPP_WRITE_EVT status:%lu cong:%lu len:%lu") \
+    X(TCP_RX_QUEUE_FULL, TCP, ERROR, false, "port:%lu rxQueue FULL length:%lu")   \
+    X(TCP_TX_QUEUE_FULL, TCP, ERROR, false, "port:%lu txQueue FULL length:%lu")   \
+    X(TCP_SEND_ERROR, TCP, WARN, false, "port:%lu send errno:%lu")
+
+typedef enum
+{
+#define TRACE_MODULE_ID(id, name) TRACE_MODULE_##id,
+    TRACE_MODULES(TRACE_MODULE_ID)
+#undef TRACE_MODULE_ID
+    TRACE_MODULE_COUNT
+} trace_module_t;
+
+typedef enum
+{
+#define TRACE_EVENT_ID(id, module, level, text, format) TRACE_EVENT_##id,
+    TRACE_EVENTS(TRACE_EVENT_ID)
+#undef TRACE_EVENT_ID
+    TRACE_EVENT_COUNT
+} trace_event_t;
+
+// Module, level and compile-time level of every event, for TRACE()
+enum
+{
+#define TRACE_EVENT_CONSTANTS(id, module, level, text, format) \
+    TRACE_MODULE_OF_##id = TRACE_MODULE_##module,              \
+    TRACE_LEVEL_OF_##id = TRACE_LEVEL_##level,                 \
+    TRACE_COMPILED_##id = TRACE_LEVEL_##level <= APP_TRACE_LEVEL_##module,
+    TRACE_EVENTS(TRACE_EVENT_CONSTANTS)
+#undef TRACE_EVENT_CONSTANTS
+};
+
+/// @brief Trace record, as read back from the rings
+typedef struct
+{
+    uint8_t core;
+    uint32_t cycles; // CPU cycle counter of the core (not synchronized between cores, wraps)
+    trace_event_t event;
+    uint32_t arg0;
+    uint32_t arg1;
+    uint32_t arg2;
+} trace_entry_t;
+
+/// @brief Independent reader of the rings, starting from the oldest record still kept
+typedef struct
+{
+    uint32_t cursor[portNUM_PROCESSORS];
+    uint32_t lost; // Records overwritten before this reader got to them
+} trace_reader_t;
+
+typedef struct
+{
+    uint32_t records[portNUM_PROCESSORS]; // Records written per core since boot
+    uint32_t capacity;                    // Records per core (APP_TRACE_RING_LEN)
+} trace_status_t;
+
+extern volatile uint8_t trace_levels[TRACE_MODULE_COUNT];
+
+/// @brief Record an event with three arguments, without formatting
+/// @details Compiled out above APP_TRACE_LEVEL_<module>, skipped above the runtime level of the module; arg0 is kept
+/// on 16 bits
+#define TRACE(id, arg0, arg1, arg2)                                                               \
+    do                                                                                            \
+    {                                                                                             \
+        if (TRACE_COMPILED_##id && TRACE_LEVEL_OF_##id <= trace_levels[TRACE_MODULE_OF_##id])     \
+            trace_record(TRACE_EVENT_##id, (uint32_t)(arg0), (uint32_t)(arg1), (uint32_t)(arg2)); \
+    } while (0)
+
+/// @brief Record an event with one argument and the first TRACE_TEXT_LEN characters of text
+#define TRACE_TEXT(id, arg0, text, len)                                                        \
+    do                                                                                         \
+    {                                                                                          \
+        if (TRACE_COMPILED_##id && TRACE_LEVEL_OF_##id <= trace_levels[TRACE_MODULE_OF_##id])  \
+            trace_recordText(TRACE_EVENT_##id, (uint32_t)(arg0), (const char *)(text), (len)); \
+    } while (0)
+
+/// @brief Initialize tracing, runtime levels start at the compile-time levels
+/// @details Starts the console drain task when APP_TRACE_DRAIN_MS is not 0
+void trace_init(void);
+
+/// @brief Append a record to the ring of the current core, use TRACE()
+void trace_record(trace_event_t event, uint32_t arg0, uint32_t arg1, uint32_t arg2);
+
+/// @brief Append a text record to the ring of the current core, use TRACE_TEXT()
+void trace_recordText(trace_event_t event, uint32_t arg0, const char *text, size_t len);
+
+/// @brief Start a reader at the oldest records still in the rings
+void trace_initReader(trace_reader_t *reader);
+
+/// @brief Skip the records already in the rings
+void trace_skipReader(trace_reader_t *reader);
+
+/// @brief Read the next record, core 0 first
+/// @return false when the reader has read every record written so far
+bool trace_read(trace_reader_t *reader, trace_entry_t *entry);
+
+/// @brief Format a record as "<module>: <text>"
+/// @return Formatted length, as snprintf
+int trace_format(const trace_entry_t *entry, char *out, size_t size);
+
+/// @brief Set the runtime level of a module, at most its compile-time level
+esp_err_t trace_setLevel(trace_module_t module, uint8_t level);
+
+const char *trace_getModuleName(trace_module_t module);
+
+/// @brief Get the compile-time level of a module
+uint8_t trace_getCompiledLevel(trace_module_t module);
+
+uint8_t trace_getEventLevel(trace_event_t event);
+
+void trace_getStatus(trace_status_t *status);
@@ -2,20 +2,57 @@
 
 #include "config.h"
 #include "message.h"
+#include "rtos.h"
 
 #include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "driver/gpio.h"
 #include "driver/uart.h"
 
 static const char *TAG = "UART";
 
+QueueHandle_t uartRxQueue;
+QueueHandle_t uartTxQueue;
+
 static QueueHandle_t uartEventQueue;
+static uart_stats_t stats = {0};
+static uint8_t rxBuf[1024]; // Data read from the driver RX ring, copied in messages
+
+/// @brief Forward all buffered data to uartRxQueue, in as few messages as possible
+/// @details Pattern detection wakes the event task as soon as a command terminator (CR) is received, instead of
+/// waiting for the RX timeout. Everything buffered is forwarded (partial commands are reassembled by the receiver),
+/// so binary protocols without terminators work as well.
+static void forwardReceived(void)
+{
+    // Positions are only used for wakeups, everything up to them is read below
+    while (uart_pattern_pop_pos(UART_PORT_NUM) >= 0)
+        ;
+
+    size_t buffered = 0;
+    uart_get_buffered_data_len(UART_PORT_NUM, &buffered);
+    while (buffered > 0)
+    {
+        int len = uart_read_bytes(UART_PORT_NUM, rxBuf, buffered < sizeof(rxBuf) ? buffered : sizeof(rxBuf), 0);
+        if (len <= 0)
+            break;
+        buffered -= len;
+        stats.rxBytes += len;
+
+        message_t msg = message_new(rxBuf, len);
+        if (msg.data == NULL || xQueueSend(uartRxQueue, &msg, 0) == errQUEUE_FULL)
+        {
+            stats.rxQueueFull++;
+            message_free(&msg);
+        }
+    }
+}
 
 static void uartEventTask(void *arg)
 {
     uart_event_t event;
-    uint8_t buf[UART_BUF_SIZE];
 
     while (1)
     {
@@ -24,37 +61,31 @@ static void uartEventTask(void *arg)
             switch (event.type)
             {
             case UART_DATA:
-                ESP_LOGI(TAG, "UART_DATA size:%d", event.size);
-                uart_read_bytes(UART_PORT_NUM, buf, event.size, portMAX_DELAY);
-                // ESP_LOG_BUFFER_HEXDUMP(TAG, buf, sizeof(buf), ESP_LOG_INFO);
-
-                message_t msg = message_new(buf, event.size);
-                if (xQueueSend(uartRxQueue, &msg, 0) == errQUEUE_FULL)
-                    ESP_LOGE(TAG, "uartRxQueue FULL");
-                break;
-            case UART_BREAK:
-                ESP_LOGI(TAG, "UART_BREAK");
-                break;
-            case UART_BUFFER_FULL:
-                ESP_LOGW(TAG, "UART_BUFFER_FULL");
+            case UART_PATTERN_DET:
+                forwardReceived();
                 break;
             case UART_FIFO_OVF:
-                ESP_LOGW(TAG, "UART_FIFO_OVF");
+            case UART_BUFFER_FULL:
+                // Data is lost, restart from a clean state as the received stream is not usable anymore
+                if (event.type == UART_FIFO_OVF)
+                    stats.fifoOverflows++;
+                else
+                    stats.bufferFull++;
+                uart_flush_input(UART_PORT_NUM);
+                uart_pattern_queue_reset(UART_PORT_NUM, UART_PATTERN_QUEUE_LEN);
+                xQueueReset(uartEventQueue);
                 break;
             case UART_FRAME_ERR:
-                ESP_LOGW(TAG, "UART_FRAME_ERR");
+                stats.frameErrors++;
                 break;
             case UART_PARITY_ERR:
-                ESP_LOGW(TAG, "UART_PARITY_ERR");
+                stats.parityErrors++;
                 break;
+            case UART_BREAK:
             case UART_DATA_BREAK:
-                ESP_LOGI(TAG, "UART_DATA_BREAK");
+                stats.breaks++;
                 break;
-            case UART_PATTERN_DET:
-                ESP_LOGI(TAG, "UART_PATTERN_DET");
-                break;
-            case UART_EVENT_MAX:
-                ESP_LOGW(TAG, "UART_EVENT_MAX");
+            default:
                 break;
             }
         }
@@ -68,11 +99,62 @@ static void uartTxTask(void *arg)
     while (1)
     {
         xQueueReceive(uartTxQueue, &msg, portMAX_DELAY);
-        uart_write_bytes(UART_PORT_NUM, (const char *)msg.data, msg.length);
+        // Copied in the driver TX ring, only blocks when the ring is full (or CTS is deasserted long enough)
+        int len = uart_write_bytes(UART_PORT_NUM, (const char *)msg.data, msg.length);
+        if (len > 0)
+            stats.txBytes += len;
         message_free(&msg);
     }
 }
 
+#if UART_LOOPBACK_BENCHMARK
+/// @brief Measure throughput with the UART internal loopback, sending SLCAN frames as a loaded bus would
+static void runLoopbackBenchmark(void)
+{
+    static uint8_t chunk[1024];
+    static uint8_t readBuf[1024];
+    const char *line = "T18DAF11080211223344556677\r"; // Extended frame with 8 data bytes
+
+    size_t lineLen = strlen(line);
+    for (size_t i = 0; i < sizeof(chunk); i++)
+        chunk[i] = line[i % lineLen];
+
+    uart_set_loop_back(UART_PORT_NUM, true);
+    uart_flush_input(UART_PORT_NUM);
+
+    // One chunk ahead in the TX ring, so the line never idles while reading
+    size_t sent = 0, received = 0;
+    int64_t start = esp_timer_get_time();
+    uart_write_bytes(UART_PORT_NUM, (const char *)chunk, sizeof(chunk));
+    sent += sizeof(chunk);
+    while (received < UART_BENCHMARK_SIZE)
+    {
+        if (sent < UART_BENCHMARK_SIZE)
+        {
+            uart_write_bytes(UART_PORT_NUM, (const char *)chunk, sizeof(chunk));
+            sent += sizeof(chunk);
+        }
+        int len = uart_read_bytes(UART_PORT_NUM, readBuf, sizeof(readBuf), pdMS_TO_TICKS(100));
+        if (len <= 0)
+            break; // Data lost
+        received += len;
+    }
+    int64_t elapsedUs = esp_timer_get_time() - start;
+
+    uart_set_loop_back(UART_PORT_NUM, false);
+    uart_flush_input(UART_PORT_NUM);
+    xQueueReset(uartEventQueue);
+
+    ESP_LOGW(TAG, "loopback benchmark baudrate:%d sent:%d received:%d elapsed:%lldus throughput:%lldB/s (line rate %dB/s)",
+             UART_BAUDRATE, sent, received, elapsedUs, received * 1000000LL / elapsedUs, UART_BAUDRATE / 10);
+}
+#endif
+
+void uart_getStats(uart_stats_t *out)
+{
+    *out = stats;
+}
+
 void uartInit(void)
 {
     uart_config_t uart_config = {
@@ -80,18 +162,29 @@ void uartInit(void)
         .data_bits = UART_DATA_8_BITS,
         .parity = UART_PARITY_DISABLE,
         .stop_bits = UART_STOP_BITS_1,
-        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+        .flow_ctrl = UART_FLOW_CONTROL ? UART_HW_FLOWCTRL_CTS_RTS : UART_HW_FLOWCTRL_DISABLE,
+        .rx_flow_ctrl_thresh = UART_RX_FLOW_THRESHOLD,
+        .source_clk = UART_SCLK_APB, // 80MHz, required for baudrates above 1Mbaud
     };
 
-    ESP_ERROR_CHECK(uart_driver_install(UART_PORT_NUM, UART_BUF_SIZE * 2, UART_BUF_SIZE * 2, 16, &uartEventQueue, 0));
+    ESP_ERROR_CHECK(uart_driver_install(UART_PORT_NUM, UART_RX_BUF_SIZE, UART_TX_BUF_SIZE, UART_EVENT_QUEUE_LEN, &uartEventQueue, 0));
     ESP_ERROR_CHECK(uart_param_config(UART_PORT_NUM, &uart_config));
-    ESP_ERROR_CHECK(uart_set_pin(UART_PORT_NUM, UART_TXD_GPIO_NUM, UART_RXD_GPIO_NUM, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
+    ESP_ERROR_CHECK(uart_set_pin(UART_PORT_NUM, UART_TXD_GPIO_NUM, UART_RXD_GPIO_NUM,
+                                 UART_FLOW_CONTROL ? UART_RTS_GPIO_NUM : UART_PIN_NO_CHANGE,
+                                 UART_FLOW_CONTROL ? UART_CTS_GPIO_NUM : UART_PIN_NO_CHANGE));
+
+#if UART_LOOPBACK_BENCHMARK
+    runLoopbackBenchmark();
+#endif
+
+    ESP_ERROR_CHECK(uart_enable_pattern_det_baud_intr(UART_PORT_NUM, '\r', 1, 1, 0, 0));
+    ESP_ERROR_CHECK(uart_pattern_queue_reset(UART_PORT_NUM, UART_PATTERN_QUEUE_LEN));
 
-    uartRxQueue = xQueueCreate(UART_QUEUES_LEN, sizeof(message_t));
-    uartTxQueue = xQueueCreate(UART_QUEUES_LEN, sizeof(message_t));
+    uartRxQueue = rtos_createQueue(RTOS_QUEUE_UART_RX);
+    uartTxQueue = rtos_createQueue(RTOS_QUEUE_UART_TX);
 
-    xTaskCreate(uartEventTask, "uartEvent", 2048, NULL, UART_EVENT_TASK_PRIO, NULL);
-    xTaskCreate(uartTxTask, "uartTx", 2048, NULL, UART_TX_TASK_PRIO, NULL);
+    rtos_createTask(RTOS_TASK_UART_EVENT, NULL, uartEventTask, NULL);
+    rtos_createTask(RTOS_TASK_UART_TX, NULL, uartTxTask, NULL);
 
-    ESP_LOGI(TAG, "initialized");
+    ESP_LOGI(TAG, "initialized baudrate:%d flowControl:%d", UART_BAUDRATE, UART_FLOW_CONTROL);
 }
@@ -1,9 +1,26 @@
 #pragma once
 
+#include <stdint.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
 
-QueueHandle_t uartRxQueue;
-QueueHandle_t uartTxQueue;
+/// @brief UART transport counters, since boot
+typedef struct
+{
+    uint32_t rxBytes;
+    uint32_t txBytes;
+    uint32_t fifoOverflows; // Hardware RX FIFO overflows (data lost)
+    uint32_t bufferFull;    // Driver RX ring full (data lost)
+    uint32_t frameErrors;
+    uint32_t parityErrors;
+    uint32_t breaks;
+    uint32_t rxQueueFull; // Received messages dropped because uartRxQueue was full
+} uart_stats_t;
+
+extern QueueHandle_t uartRxQueue;
+extern QueueHandle_t uartTxQueue;
 
 void uartInit(void);
+
+/// @brief Get UART transport counters
+void uart_getStats(uart_stats_t *stats);
@@ -0,0 +1,410 @@
+/*
+UDS (ISO 14229) diagnostic client running batch jobs on-device
+Every job owns an ISO-TP session, so jobs towards different ECUs run concurrently and the next request
+is sent as soon as the previous response arrives, without any host round trip
+*/
+
+#include "uds.h"
+
+#include "config.h"
+#include "can.h"
+#include "isotp.h"
+#include "rtos.h"
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#define TAG "UDS"
+
+#define UDS_SID_SESSION_CONTROL 0x10
+#define UDS_SID_READ_DTC 0x19
+#define UDS_SID_READ_DID 0x22
+#define UDS_SID_TESTER_PRESENT 0x3E
+#define UDS_SID_NEGATIVE 0x7F
+#define UDS_POSITIVE_OFFSET 0x40
+#define UDS_SUPPRESS_POSITIVE 0x80
+#define UDS_DTC_BY_STATUS_MASK 0x02
+#define UDS_NRC_OUT_OF_RANGE 0x31
+#define UDS_NRC_RESPONSE_PENDING 0x78
+
+typedef enum
+{
+    JOB_FREE,
+    JOB_PENDING, // Waiting for an ISO-TP session
+    JOB_READY,   // Next request can be sent
+    JOB_WAIT,    // Request in flight
+    JOB_IDLE,    // Session job, only TesterPresent is sent
+    JOB_DONE,    // Done event must be emitted
+} jobState_t;
+
+typedef struct
+{
+    jobState_t state;
+    uds_jobConfig_t config;
+    isotp_session_t *isotp;
+    bool sessionActive;
+    uint8_t sid;        // SID of the request in flight
+    uint32_t did;       // Next DID (UDS_JOB_DID_SWEEP)
+    uint8_t timeouts;   // Consecutive timeouts
+    int64_t deadline;   // Response deadline (us)
+    int64_t lastTx;     // Time of last request (us)
+    uds_status_t status;
+} job_t;
+
+/// @brief Job event, emitted once the jobs lock is released
+typedef struct
+{
+    uint8_t job;
+    uds_callback_t callback;
+    void *ctx;
+    uds_eventType_t type;
+    uint16_t id;
+    const uint8_t *data;
+    size_t len;
+} event_t;
+
+/// @brief Request built with jobsLock held and sent once it is released: isotp_send waits for CAN TX queue space, and
+/// isotpCallback (CAN RX path) takes jobsLock
+typedef struct
+{
+    job_t *job;
+    uint8_t data[3];
+    uint8_t len;
+    bool failed; // isotp_send failed, retried on next iteration
+} request_t;
+
+static job_t jobs[APP_UDS_MAX_JOBS];
+static StaticSemaphore_t jobsLockBuffer;
+static SemaphoreHandle_t jobsLock = NULL;
+static TaskHandle_t _udsTask = NULL;
+
+static void setEvent(event_t *event, job_t *j, uds_eventType_t type, uint16_t id, const uint8_t *data, size_t len)
+{
+    event->job = j - jobs;
+    event->callback = j->config.callback;
+    event->ctx = j->config.ctx;
+    event->type = type;
+    event->id = id;
+    event->data = data;
+    event->len = len;
+}
+
+static void fireEvent(event_t *event)
+{
+    if (event->callback != NULL)
+        event->callback(event->job, event->type, event->id, event->data, event->len, event->ctx);
+}
+
+/// @brief Finish a job, must be called with jobsLock held
+/// @details Its ISO-TP session is closed by udsTask, the only task sending on it
+static void finishJob(job_t *j, uds_status_t status)
+{
+    j->status = status;
+    j->state = JOB_DONE;
+}
+
+/// @brief Advance a job after a response (or timeout) to its request, must be called with jobsLock held
+static void advanceJob(job_t *j)
+{
+    if (j->sid == UDS_SID_SESSION_CONTROL)
+    {
+        j->sessionActive = true;
+        j->state = j->config.type == UDS_JOB_SESSION ? JOB_IDLE : JOB_READY;
+        return;
+    }
+
+    switch (j->config.type)
+    {
+    case UDS_JOB_DID_SWEEP:
+        if (++j->did > j->config.didEnd)
+            finishJob(j, UDS_STATUS_OK);
+        else
+            j->state = JOB_READY;
+        break;
+    case UDS_JOB_DTC_READ:
+        finishJob(j, UDS_STATUS_OK);
+        break;
+    case UDS_JOB_SESSION:
+        j->state = JOB_IDLE;
+        break;
+    }
+}
+
+static void isotpCallback(isotp_session_t *session, isotp_result_t result, const uint8_t *data, size_t len, void *ctx)
+{
+    (void)session;
+    job_t *j = (job_t *)ctx;
+    event_t event;
+    bool hasEvent = false;
+
+    xSemaphoreTake(jobsLock, portMAX_DELAY);
+
+    if (j->state != JOB_WAIT || result != ISOTP_RESULT_OK || len < 1)
+    {
+        // ISO-TP errors are handled as response timeouts
+        xSemaphoreGive(jobsLock);
+        return;
+    }
+
+    j->timeouts = 0;
+
+    if (data[0] == UDS_SID_NEGATIVE && len >= 3 && data[1] == j->sid)
+    {
+        uint8_t nrc = data[2];
+        if (nrc == UDS_NRC_RESPONSE_PENDING)
+            j->deadline = esp_timer_get_time() + APP_UDS_P2_EXT_MS * 1000;
+        else if (j->sid == UDS_SID_SESSION_CONTROL)
+            finishJob(j, UDS_STATUS_SESSION_REJECTED);
+        else
+        {
+            // requestOutOfRange is the expected answer for unsupported DIDs, not worth streaming
+            if (nrc != UDS_NRC_OUT_OF_RANGE)
+            {
+                setEvent(&event, j, UDS_EVENT_NEGATIVE, j->sid == UDS_SID_READ_DID ? j->did : 0, &data[2], 1);
+                hasEvent = true;
+            }
+            advanceJob(j);
+        }
+    }
+    else if (data[0] == j->sid + UDS_POSITIVE_OFFSET)
+    {
+        if (j->sid == UDS_SID_READ_DID && len >= 3 && (uint32_t)(data[1] << 8 | data[2]) == j->did)
+        {
+            setEvent(&event, j, UDS_EVENT_DID, j->did, data + 3, len - 3);
+            hasEvent = true;
+        }
+        else if (j->sid == UDS_SID_READ_DTC && len >= 2)
+        {
+            setEvent(&event, j, UDS_EVENT_DTC, 0, data + 2, len - 2);
+            hasEvent = true;
+        }
+        advanceJob(j);
+    }
+    else
+    {
+        // Unrelated response, keep waiting
+        xSemaphoreGive(jobsLock);
+        return;
+    }
+
+    xSemaphoreGive(jobsLock);
+
+    // Response data is only valid during this callback
+    if (hasEvent)
+        fireEvent(&event);
+    xTaskNotifyGive(_udsTask);
+}
+
+/// @brief Prepare a request, must be called with jobsLock held
+/// @details The job waits for the response before the request is sent, so that a fast response is not missed
+static void prepareRequest(job_t *j, const uint8_t *data, size_t len, int64_t now, request_t *request)
+{
+    request->job = j;
+    memcpy(request->data, data, len);
+    request->len = len;
+
+    j->sid = data[0];
+    j->lastTx = now;
+    j->deadline = now + APP_UDS_P2_MS * 1000;
+    j->state = JOB_WAIT;
+}
+
+/// @brief Run a job state machine step, must be called with jobsLock held
+/// @return true if a request was prepared, to be sent once jobsLock is released
+static bool runJob(job_t *j, int64_t now, request_t *request)
+{
+    if (j->state == JOB_PENDING)
+    {
+        isotp_config_t config = {
+            .txId = j->config.txId,
+            .rxId = j->config.rxId,
+            .blockSize = APP_ISOTP_DEFAULT_BS,
+            .stMin = APP_ISOTP_DEFAULT_STMIN,
+            .callback = isotpCallback,
+            .ctx = j,
+        };
+        esp_err_t ret = isotp_open(&config, &j->isotp);
+        if (ret == ESP_ERR_INVALID_STATE)
+            finishJob(j, UDS_STATUS_NO_SESSION);
+        else if (ret == ESP_OK)
+            j->state = JOB_READY;
+        else
+            j->isotp = NULL; // No free session, retry later
+        return false;
+    }
+
+    if (j->state == JOB_WAIT && now >= j->deadline)
+    {
+        if (++j->timeouts >= APP_UDS_MAX_TIMEOUTS || j->sid == UDS_SID_SESSION_CONTROL)
+            finishJob(j, UDS_STATUS_TIMEOUT);
+        else
+            advanceJob(j); // Skip this DID
+    }
+
+    if (j->state == JOB_READY)
+    {
+        if (j->config.session != 0 && !j->sessionActive)
+        {
+            uint8_t data[] = {UDS_SID_SESSION_CONTROL, j->config.session};
+            prepareRequest(j, data, sizeof(data), now, request);
+            return true;
+        }
+        else if (j->config.type == UDS_JOB_DID_SWEEP)
+        {
+            uint8_t data[] = {UDS_SID_READ_DID, j->did >> 8, j->did & 0xFF};
+            prepareRequest(j, data, sizeof(data), now, request);
+            return true;
+        }
+        else if (j->config.type == UDS_JOB_DTC_READ)
+        {
+            uint8_t data[] = {UDS_SID_READ_DTC, UDS_DTC_BY_STATUS_MASK, j->config.dtcMask};
+            prepareRequest(j, data, sizeof(data), now, request);
+            return true;
+        }
+    }
+
+    // Keep non-default sessions alive when no request has been sent recently (S3 server timer), no response expected
+    if (j->sessionActive && j->state == JOB_IDLE && now - j->lastTx >= APP_UDS_TESTER_PRESENT_MS * 1000)
+    {
+        *request = (request_t){.job = j, .data = {UDS_SID_TESTER_PRESENT, UDS_SUPPRESS_POSITIVE}, .len = 2};
+        j->lastTx = now;
+        return true;
+    }
+    return false;
+}
+
+static void udsTask(void *arg)
+{
+    (void)arg;
+
+    event_t events[APP_UDS_MAX_JOBS];
+    request_t requests[APP_UDS_MAX_JOBS];
+
+    while (1)
+    {
+        size_t eventCnt = 0;
+        size_t requestCnt = 0;
+        int64_t now = esp_timer_get_time();
+
+        xSemaphoreTake(jobsLock, portMAX_DELAY);
+        for (size_t i = 0; i < APP_UDS_MAX_JOBS; i++)
+        {
+            job_t *j = &jobs[i];
+            if (j->state == JOB_FREE)
+                continue;
+
+            if (j->state != JOB_DONE && can_isOpen() && can_getMode() == TWAI_MODE_NORMAL &&
+                runJob(j, now, &requests[requestCnt]))
+                requestCnt++;
+
+            if (j->state == JOB_DONE)
+            {
+                if (j->isotp != NULL)
+                {
+                    isotp_close(j->isotp);
+                    j->isotp = NULL;
+                }
+                setEvent(&events[eventCnt++], j, UDS_EVENT_DONE, j->status, NULL, 0);
+                j->state = JOB_FREE;
+            }
+        }
+        xSemaphoreGive(jobsLock);
+
+        // Sessions are only closed by this task, they stay open while requests are sent
+        bool anyFailed = false;
+        for (size_t i = 0; i < requestCnt; i++)
+        {
+            request_t *r = &requests[i];
+            r->failed = isotp_send(r->job->isotp, r->data, r->len) != ESP_OK;
+            anyFailed |= r->failed;
+        }
+
+        // Failed requests are retried on next iteration, unless the job finished meanwhile
+        if (anyFailed)
+        {
+            xSemaphoreTake(jobsLock, portMAX_DELAY);
+            for (size_t i = 0; i < requestCnt; i++)
+            {
+                job_t *j = requests[i].job;
+                if (!requests[i].failed)
+                    continue;
+                if (j->state == JOB_WAIT)
+                    j->state = JOB_READY;
+                else if (j->state == JOB_IDLE)
+                    j->lastTx = 0;
+            }
+            xSemaphoreGive(jobsLock);
+        }
+
+        for (size_t i = 0; i < eventCnt; i++)
+            fireEvent(&events[i]);
+
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(APP_UDS_POLL_INTERVAL_MS));
+    }
+}
+
+esp_err_t uds_start(const uds_jobConfig_t *config, uint8_t *job)
+{
+    if (config->type == UDS_JOB_DID_SWEEP && config->didStart > config->didEnd)
+        return ESP_ERR_INVALID_ARG;
+    if (config->type == UDS_JOB_SESSION && config->session == 0)
+        return ESP_ERR_INVALID_ARG;
+
+    esp_err_t ret = ESP_ERR_NO_MEM;
+
+    xSemaphoreTake(jobsLock, portMAX_DELAY);
+    for (size_t i = 0; i < APP_UDS_MAX_JOBS; i++)
+    {
+        job_t *j = &jobs[i];
+        if (j->state == JOB_FREE)
+        {
+            memset(j, 0, sizeof(*j));
+            j->config = *config;
+            j->did = config->didStart;
+            j->state = JOB_PENDING;
+            *job = i;
+            ret = ESP_OK;
+            break;
+        }
+    }
+    xSemaphoreGive(jobsLock);
+
+    if (ret == ESP_OK)
+    {
+        ESP_LOGI(TAG, "job:%d type:%d tx:%03lX rx:%03lX", *job, config->type, config->txId, config->rxId);
+        xTaskNotifyGive(_udsTask);
+    }
+    return ret;
+}
+
+esp_err_t uds_cancel(uint8_t job)
+{
+    if (job >= APP_UDS_MAX_JOBS)
+        return ESP_ERR_INVALID_ARG;
+
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+
+    xSemaphoreTake(jobsLock, portMAX_DELAY);
+    if (jobs[job].state != JOB_FREE && jobs[job].state != JOB_DONE)
+    {
+        finishJob(&jobs[job], UDS_STATUS_CANCELLED);
+        ret = ESP_OK;
+    }
+    xSemaphoreGive(jobsLock);
+
+    xTaskNotifyGive(_udsTask);
+    return ret;
+}
+
+void uds_init(void)
+{
+    jobsLock = xSemaphoreCreateMutexStatic(&jobsLockBuffer);
+
+    _udsTask = rtos_createTask(RTOS_TASK_UDS, NULL, udsTask, NULL);
+
+    ESP_LOGI(TAG, "initialized");
+}
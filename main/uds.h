@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/// @brief Batch job types
+typedef enum
+{
+    UDS_JOB_DID_SWEEP, // ReadDataByIdentifier (0x22) over a DID range
+    UDS_JOB_DTC_READ,  // ReadDTCInformation (0x19) reportDTCByStatusMask
+    UDS_JOB_SESSION,   // DiagnosticSessionControl (0x10), kept alive with TesterPresent (0x3E) until cancelled
+} uds_jobType_t;
+
+/// @brief Job result event types
+typedef enum
+{
+    UDS_EVENT_DID,      // Positive ReadDataByIdentifier response: id = DID, data = record
+    UDS_EVENT_DTC,      // Positive ReadDTCInformation response: data = status availability mask followed by DTC records
+    UDS_EVENT_NEGATIVE, // Negative response: id = DID (or 0), data[0] = NRC
+    UDS_EVENT_DONE,     // Job finished: id = @ref uds_status_t
+} uds_eventType_t;
+
+/// @brief Final job status
+typedef enum
+{
+    UDS_STATUS_OK = 0,
+    UDS_STATUS_SESSION_REJECTED, // DiagnosticSessionControl was refused
+    UDS_STATUS_CANCELLED,        // Cancelled by @ref uds_cancel
+    UDS_STATUS_NO_SESSION,       // ISO-TP session could not be opened (identifiers already in use)
+    UDS_STATUS_TIMEOUT,          // ECU stopped responding
+} uds_status_t;
+
+/// @brief Job event callback
+/// @param job Job index
+/// @param type Event type
+/// @param id DID, or status for @ref UDS_EVENT_DONE
+/// @param data Event data (only valid during the call)
+/// @param len Event data length
+/// @param ctx User context given in @ref uds_jobConfig_t
+typedef void (*uds_callback_t)(uint8_t job, uds_eventType_t type, uint16_t id, const uint8_t *data, size_t len, void *ctx);
+
+/// @brief Job configuration
+typedef struct
+{
+    uds_jobType_t type;
+    uint32_t txId;       // Physical request identifier (11bit)
+    uint32_t rxId;       // Response identifier (11bit)
+    uint8_t session;     // Diagnostic session to enter before running the job, 0 to stay in the current session
+    uint16_t didStart;   // First DID (UDS_JOB_DID_SWEEP)
+    uint16_t didEnd;     // Last DID, inclusive (UDS_JOB_DID_SWEEP)
+    uint8_t dtcMask;     // DTC status mask (UDS_JOB_DTC_READ)
+    uds_callback_t callback;
+    void *ctx;
+} uds_jobConfig_t;
+
+/// @brief Initialize UDS client component
+void uds_init(void);
+
+/// @brief Queue a batch job, jobs run concurrently as long as ISO-TP sessions are available
+/// @param config Job configuration
+/// @param job Output job index
+/// @return ESP_ERR_NO_MEM if all job slots are in use
+esp_err_t uds_start(const uds_jobConfig_t *config, uint8_t *job);
+
+/// @brief Cancel a job, a @ref UDS_EVENT_DONE event is emitted
+esp_err_t uds_cancel(uint8_t job);
@@ -0,0 +1,188 @@
+/*
+WebSocket transport of live streaming (stream.c), on the ESP-IDF HTTP server: endpoint /ws on APP_WS_PORT.
+The HTTP server task handles handshakes and client commands, the stream task feeds received frames to the streaming
+core and sends batches when they are due. Batches are only sent to sockets that are writable right away, so a slow
+client never stalls the others: its values are coalesced until it catches up.
+*/
+
+#include "ws.h"
+
+#include "config.h"
+#include "capture.h"
+#include "rtos.h"
+#include "stream.h"
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "lwip/sockets.h"
+
+#define TAG "WS"
+
+static httpd_handle_t server = NULL;
+static capture_sink_t streamSink = {.name = "ws"};
+static SemaphoreHandle_t streamLock; // Streaming core state, shared by the HTTP server task and the stream task
+static StaticSemaphore_t streamLockBuffer;
+
+static void sendText(void *ctx, const char *text, size_t len)
+{
+    httpd_ws_frame_t frame = {
+        .type = HTTPD_WS_TYPE_TEXT,
+        .payload = (uint8_t *)text,
+        .len = len,
+        .final = true,
+    };
+    httpd_ws_send_frame_async(server, (int)(intptr_t)ctx, &frame);
+}
+
+static bool sendBatch(void *ctx, const uint8_t *data, size_t len)
+{
+    int fd = (int)(intptr_t)ctx;
+
+    // Socket send buffer must have room now, the send below would otherwise wait for the client
+    fd_set writeFds;
+    FD_ZERO(&writeFds);
+    FD_SET(fd, &writeFds);
+    struct timeval timeout = {0};
+    if (select(fd + 1, NULL, &writeFds, NULL, &timeout) <= 0)
+        return false;
+
+    httpd_ws_frame_t frame = {
+        .type = HTTPD_WS_TYPE_BINARY,
+        .payload = (uint8_t *)data,
+        .len = len,
+        .final = true,
+    };
+    return httpd_ws_send_frame_async(server, fd, &frame) == ESP_OK;
+}
+
+static const stream_callbacks_t streamCallbacks = {
+    .sendText = sendText,
+    .sendBatch = sendBatch,
+};
+
+static esp_err_t wsHandler(httpd_req_t *req)
+{
+    int fd = httpd_req_to_sockfd(req);
+    if (req->method == HTTP_GET)
+    {
+        // Handshake done, an error closes the socket
+        xSemaphoreTake(streamLock, portMAX_DELAY);
+        stream_client_t *client = stream_openClient((void *)(intptr_t)fd);
+        xSemaphoreGive(streamLock);
+        if (client == NULL)
+        {
+            ESP_LOGW(TAG, "client rejected fd:%d, too many clients", fd);
+            return ESP_FAIL;
+        }
+        ESP_LOGI(TAG, "client connected fd:%d", fd);
+        return ESP_OK;
+    }
+
+    uint8_t buf[APP_STREAM_MAX_CMD_LEN];
+    httpd_ws_frame_t frame = {.payload = buf};
+    esp_err_t res = httpd_ws_recv_frame(req, &frame, 0);
+    if (res != ESP_OK)
+        return res;
+    if (frame.type != HTTPD_WS_TYPE_TEXT || frame.len > sizeof(buf))
+    {
+        // Unread payload cannot be skipped, the connection is closed
+        ESP_LOGW(TAG, "fd:%d unexpected frame type:%d len:%u", fd, frame.type, frame.len);
+        return ESP_FAIL;
+    }
+    res = httpd_ws_recv_frame(req, &frame, frame.len);
+    if (res != ESP_OK)
+        return res;
+
+    xSemaphoreTake(streamLock, portMAX_DELAY);
+    stream_client_t *client = stream_findClient((void *)(intptr_t)fd);
+    if (client != NULL)
+        stream_clientInput(client, (const char *)frame.payload, frame.len, esp_timer_get_time());
+    xSemaphoreGive(streamLock);
+
+    xTaskNotifyGive(streamSink.task); // Subscriptions or rate changed, reschedule
+    return ESP_OK;
+}
+
+static void closeHandler(httpd_handle_t hd, int fd)
+{
+    xSemaphoreTake(streamLock, portMAX_DELAY);
+    stream_client_t *client = stream_findClient((void *)(intptr_t)fd);
+    if (client != NULL)
+    {
+        stream_closeClient(client);
+        ESP_LOGI(TAG, "client disconnected fd:%d", fd);
+    }
+    xSemaphoreGive(streamLock);
+    close(fd);
+}
+
+/// @brief Feed received frames to the streaming core and send batches when due
+static void streamTask(void *arg)
+{
+    uint32_t lastDrops = 0;
+    int64_t nextUs = INT64_MAX;
+
+    while (1)
+    {
+        TickType_t ticksToWait = portMAX_DELAY;
+        if (nextUs != INT64_MAX)
+        {
+            int64_t waitUs = nextUs - esp_timer_get_time();
+            ticksToWait = waitUs > 0 ? pdMS_TO_TICKS((waitUs + 999) / 1000) : 0;
+            if (waitUs > 0 && ticksToWait == 0)
+                ticksToWait = 1;
+        }
+        ulTaskNotifyTake(pdTRUE, ticksToWait);
+
+        xSemaphoreTake(streamLock, portMAX_DELAY);
+        capture_frame_t frame;
+        while (capture_read(&streamSink, &frame))
+            stream_processFrame(&frame.msg, frame.timestampUs);
+        nextUs = stream_poll(esp_timer_get_time());
+        xSemaphoreGive(streamLock);
+
+        if (streamSink.drops != lastDrops)
+        {
+            ESP_LOGW(TAG, "stream dropped frames:%lu", streamSink.drops - lastDrops);
+            lastDrops = streamSink.drops;
+        }
+    }
+}
+
+void ws_init(void)
+{
+    streamLock = xSemaphoreCreateMutexStatic(&streamLockBuffer);
+    stream_init(&streamCallbacks);
+
+    streamSink.task = rtos_createTask(RTOS_TASK_STREAM, NULL, streamTask, NULL);
+    if (capture_addSink(&streamSink) != ESP_OK)
+        ESP_LOGE(TAG, "cannot add stream sink");
+
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = APP_WS_PORT;
+    config.max_open_sockets = APP_STREAM_MAX_CLIENTS + 1; // One more to reject clients above the limit cleanly
+    config.close_fn = closeHandler;
+    config.task_priority = APP_WS_TASK_PRIO;
+
+    esp_err_t res = httpd_start(&server, &config);
+    if (res != ESP_OK)
+    {
+        ESP_LOGE(TAG, "httpd_start: %s", esp_err_to_name(res));
+        return;
+    }
+
+    static const httpd_uri_t wsUri = {
+        .uri = "/ws",
+        .method = HTTP_GET,
+        .handler = wsHandler,
+        .is_websocket = true,
+    };
+    httpd_register_uri_handler(server, &wsUri);
+
+    ESP_LOGI(TAG, "listening on port %d", APP_WS_PORT);
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+/// @brief Start the WebSocket streaming server on APP_WS_PORT, endpoint /ws (requires network interface, see wifi.c)
+/// @details Clients subscribe with text commands and receive binary batches of the latest values, see stream.h
+void ws_init(void);
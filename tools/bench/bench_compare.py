@@ -0,0 +1,65 @@
+#!/usr/bin/env python3
+"""
+Compare two pipeline_bench --json results (single run or --sweep), report regressions beyond a tolerance
+
+    bench_compare.py baseline.json current.json [--tolerance 5]
+
+Runs are matched by bitrate, load and burst. Regressions: lower frame rates, more drops, higher p99 latency or
+peak message heap. Exit status 1 when a regression is found.
+"""
+
+import argparse
+import json
+import sys
+
+
+def runs(path):
+    with open(path) as f:
+        data = json.load(f)
+    data = data if isinstance(data, list) else [data]
+    return {(r["bitrate"], r["load"], r["burst"]): r for r in data}
+
+
+def metrics(run):
+    # name -> (value, higher is better)
+    out = {"rx.fps": (run["rx"]["fps"], True), "rx.driverDrops": (run["rx"]["driverDrops"], False),
+           "heap.peakMessageBytes": (run["heap"]["peakMessageBytes"], False)}
+    for name, link in run["links"].items():
+        out[name + ".fps"] = (link["fps"], True)
+        out[name + ".ringDrops"] = (link["ringDrops"], False)
+        out[name + ".txDrops"] = (link["txDrops"], False)
+        out[name + ".p99Us"] = (link["latencyUs"]["p99"], False)
+    return out
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compare pipeline_bench JSON results")
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--tolerance", type=float, default=5, help="allowed relative change in percent")
+    args = parser.parse_args()
+
+    baseline = runs(args.baseline)
+    current = runs(args.current)
+    regressions = 0
+    for key in sorted(baseline.keys() & current.keys()):
+        before = metrics(baseline[key])
+        after = metrics(current[key])
+        for name in sorted(before.keys() & after.keys()):
+            old, higherIsBetter = before[name]
+            new = after[name][0]
+            change = (new - old) / old * 100 if old != 0 else (0 if new == 0 else float("inf"))
+            worse = -change if higherIsBetter else change
+            if worse > args.tolerance:
+                regressions += 1
+                print("%d bit/s %.0f%% burst %d: %s %g -> %g (%+.1f%%)" % (key + (name, old, new, change)))
+
+    missing = baseline.keys() - current.keys()
+    if missing:
+        print("runs missing from %s: %s" % (args.current, sorted(missing)))
+    print("%d regression(s)" % regressions)
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
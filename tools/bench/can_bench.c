@@ -0,0 +1,68 @@
+/*
+Host receive throughput of the CAN layer (main/can.c) with the SocketCAN backend
+
+Feed the interface from another terminal, e.g. at full speed with cangen or with a recorded trace:
+    cangen vcan0 -g 0 -I i -L 8 -D i
+    canplayer -I candump.log vcan0=slcan0
+Prints one line per second: frames, equivalent bus occupancy (bits of real CAN frames) and average receive batch.
+*/
+
+#include "can.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BATCH_LEN 16 // Same as APP_CAPTURE_RX_BATCH
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    const char *ifname = argc > 1 ? argv[1] : "vcan0";
+    int seconds = argc > 2 ? atoi(argv[2]) : 10;
+
+    can_socketcanSetInterface(ifname);
+    can_setBackend(&can_socketcanBackend);
+    twai_timing_config_t timing = {0};
+    if (can_open(TWAI_MODE_LISTEN_ONLY, &timing) != ESP_OK)
+        return 1;
+
+    printf("%-6s %-10s %-12s %s\n", "second", "frames/s", "kbit/s (bus)", "batch");
+
+    twai_message_t batch[BATCH_LEN];
+    can_counters_t last;
+    can_getCounters(&last);
+    uint32_t calls = 0;
+    double start = now();
+    double next = start + 1;
+
+    for (int second = 1; second <= seconds;)
+    {
+        size_t count;
+        if (can_receive(batch, BATCH_LEN, &count, pdMS_TO_TICKS(100)) == ESP_OK)
+            calls++;
+
+        double t = now();
+        if (t < next)
+            continue;
+
+        can_counters_t counters;
+        can_getCounters(&counters);
+        uint32_t frames = counters.frames - last.frames;
+        printf("%-6d %-10u %-12.1f %.1f\n", second, frames, (counters.busBits - last.busBits) / 1000.0,
+               calls > 0 ? (double)frames / calls : 0);
+        last = counters;
+        calls = 0;
+        next += 1;
+        second++;
+    }
+
+    can_close();
+    return 0;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+// Host build of on-device modules: MAC address, provided by the tests
+
+#include <stdint.h>
+#include "esp_err.h"
+
+esp_err_t esp_efuse_mac_get_default(uint8_t *mac);
@@ -0,0 +1,7 @@
+#pragma once
+
+// Host build of on-device modules: ROM functions, provided by the tests
+
+#include <stdint.h>
+
+uint32_t esp_rom_get_cpu_ticks_per_us(void);
@@ -0,0 +1,7 @@
+#pragma once
+
+// Host build of on-device modules: the clock is provided by the benchmark (simulated time)
+
+#include <stdint.h>
+
+int64_t esp_timer_get_time(void);
@@ -0,0 +1,19 @@
+#pragma once
+
+// Host build of on-device modules: queues are not available, tests of modules using them provide the functions
+
+#include "freertos/FreeRTOS.h"
+
+typedef void *QueueHandle_t;
+
+#define errQUEUE_FULL 0
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticksToWait);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticksToWait);
+
+typedef void *QueueSetHandle_t;
+typedef void *QueueSetMemberHandle_t;
+
+QueueSetHandle_t xQueueCreateSet(uint32_t length);
+BaseType_t xQueueAddToSet(QueueSetMemberHandle_t queue, QueueSetHandle_t set);
+QueueSetMemberHandle_t xQueueSelectFromSet(QueueSetHandle_t set, TickType_t ticksToWait);
@@ -0,0 +1,16 @@
+#pragma once
+
+// Host build of on-device modules: tasks are not created, the benchmark calls the task bodies itself
+
+#include "freertos/FreeRTOS.h"
+
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define pdPASS 1
+
+// Provided by the benchmark (and rtos_createTask)
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticksToWait);
+TickType_t xTaskGetTickCount(void);
+void vTaskDelay(TickType_t ticks);
@@ -0,0 +1,124 @@
+/*
+Host benchmark of the DBC signal decoder (main/dbc.c), signals decoded per second on a synthetic bus
+
+Tables are generated from tools/bench/bench.dbc (32 messages, 8 with extended identifiers, Intel and Motorola, signed
+signals), or from -DBENCH_DBC_FILE=<file.dbc>. A quarter of the frames have identifiers that are not in the DBC. Cases:
+no signal enabled (lookup only), the first signal of every message, every signal, and every signal in on-change mode
+with half of the frames repeating the previous payload of their identifier.
+*/
+
+#include "dbc.h"
+#include "dbc_tables.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define FRAME_COUNT 1000000
+#define FRAMES_LEN 4096
+
+static twai_message_t frames[FRAMES_LEN];
+static const size_t messageCount = DBC_MESSAGE_COUNT;
+
+static void generateFrames(void)
+{
+    srand(1);
+    for (size_t i = 0; i < FRAMES_LEN; i++)
+    {
+        twai_message_t *msg = &frames[i];
+        msg->data_length_code = 8;
+        if (messageCount > 0 && rand() % 4 != 0)
+        {
+            const dbc_message_t *m = &DBC_MESSAGES[rand() % messageCount];
+            msg->identifier = m->identifier;
+            msg->extd = m->extd;
+        }
+        else
+            msg->identifier = 0x700 + rand() % 0x80; // Not in the DBC
+
+        // Half of the frames repeat the previous payload of their identifier (on-change case)
+        const twai_message_t *previous = NULL;
+        for (size_t j = i; j-- > 0 && previous == NULL;)
+            if (frames[j].identifier == msg->identifier && frames[j].extd == msg->extd)
+                previous = &frames[j];
+        if (previous != NULL && rand() % 2 == 0)
+            memcpy(msg->data, previous->data, 8);
+        else
+            for (int b = 0; b < 8; b++)
+                msg->data[b] = rand();
+    }
+}
+
+/// @brief Compare every decoded value with the single signal decoder, decoding in small chunks to cover resuming
+static bool validate(void)
+{
+    dbc_value_t values[3];
+    for (size_t i = 0; i < FRAMES_LEN; i++)
+    {
+        uint16_t next = 0, last = 0;
+        size_t count;
+        while ((count = dbc_decodeFrame(&frames[i], values, sizeof(values) / sizeof(values[0]), &next)) > 0)
+        {
+            for (size_t v = 0; v < count; v++)
+            {
+                dbc_value_t expected;
+                if (values[v].signal < last ||
+                    dbc_decodeSignal(&frames[i], values[v].signal, &expected) != ESP_OK ||
+                    expected.raw != values[v].raw || expected.value != values[v].value)
+                    return false;
+                last = values[v].signal + 1;
+            }
+        }
+    }
+    return true;
+}
+
+static void run(const char *name)
+{
+    dbc_value_t values[64];
+    uint64_t signals = 0;
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < FRAME_COUNT; i++)
+    {
+        uint16_t next = 0;
+        size_t count;
+        while ((count = dbc_decodeFrame(&frames[i & (FRAMES_LEN - 1)], values, sizeof(values) / sizeof(values[0]),
+                                        &next)) > 0)
+            signals += count;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    printf("%-14s %-9.1f %-12.2f %-12.2f %.2f\n", name, ns / FRAME_COUNT, FRAME_COUNT / ns * 1e3, signals / ns * 1e3,
+           (double)signals / FRAME_COUNT);
+}
+
+int main(void)
+{
+    generateFrames();
+    printf("%zu messages, %zu signals\n", messageCount, dbc_getSignalCount());
+    printf("%-14s %-9s %-12s %-12s %s\n", "enabled", "ns/frame", "Mframes/s", "Msignals/s", "signals/frame");
+
+    dbc_disableAll();
+    run("none");
+
+    for (size_t i = 0; i < messageCount; i++)
+        dbc_setEnabled(DBC_MESSAGES[i].firstSignal, true);
+    run("first/message");
+
+    for (size_t i = 0; i < dbc_getSignalCount(); i++)
+        dbc_setEnabled(i, true);
+    if (!validate())
+    {
+        fprintf(stderr, "frame decoder result differs from single signal decoder\n");
+        return 1;
+    }
+    run("all");
+
+    dbc_setOnChange(true);
+    run("all on-change");
+    return 0;
+}
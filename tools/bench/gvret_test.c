@@ -0,0 +1,251 @@
+/*
+Host conformance test of the GVRET protocol (main/gvret.c): replays a SavvyCAN session transcript and compares
+everything the adapter sends with the transcript byte for byte, and the bus and transmit callbacks with the expected
+ones. The session is replayed twice, with host data handed over line by line and byte by byte (commands split
+across reads). Batching limits are checked separately.
+
+    gvret_test [session transcript, default tools/bench/gvret_session.txt]
+*/
+
+#include "host_test.h"
+
+#include "candump.h"
+#include "config.h"
+#include "gvret.h"
+
+#include <stdlib.h>
+
+#define MAX_OUTPUT 8192
+#define MAX_EVENTS 32
+#define EVENT_LEN 48
+
+typedef struct
+{
+    uint8_t bytes[MAX_OUTPUT];
+    size_t len;
+    size_t sends; // send callback invocations
+    char events[MAX_EVENTS][EVENT_LEN];
+    size_t eventCount;
+} capture_t;
+
+static bool busEnabled = false, busListenOnly = false;
+static uint32_t busBitrate = 0;
+
+static void appendBytes(capture_t *c, const uint8_t *data, size_t len)
+{
+    if (c->len + len <= MAX_OUTPUT)
+    {
+        memcpy(c->bytes + c->len, data, len);
+        c->len += len;
+    }
+}
+
+static void addEvent(capture_t *c, const char *event)
+{
+    if (c->eventCount < MAX_EVENTS)
+        snprintf(c->events[c->eventCount++], EVENT_LEN, "%s", event);
+}
+
+static void formatFrame(const twai_message_t *msg, char *out, size_t size)
+{
+    int n = snprintf(out, size, msg->extd ? "%08lX#" : "%03lX#", (unsigned long)msg->identifier);
+    for (int i = 0; i < msg->data_length_code && n + 2 < (int)size; i++)
+        n += snprintf(out + n, size - n, "%02X", msg->data[i]);
+}
+
+static void send(void *ctx, const uint8_t *data, size_t len)
+{
+    capture_t *c = ctx;
+    appendBytes(c, data, len);
+    c->sends++;
+}
+
+static esp_err_t setBus(void *ctx, bool enabled, bool listenOnly, uint32_t bitrate)
+{
+    char event[EVENT_LEN];
+    snprintf(event, sizeof(event), "bus %d %d %lu", enabled, listenOnly, (unsigned long)bitrate);
+    addEvent(ctx, event);
+    busEnabled = enabled;
+    busListenOnly = listenOnly;
+    busBitrate = bitrate;
+    return ESP_OK;
+}
+
+static void getBus(void *ctx, bool *enabled, bool *listenOnly, uint32_t *bitrate)
+{
+    *enabled = busEnabled;
+    *listenOnly = busListenOnly;
+    *bitrate = busBitrate;
+}
+
+static esp_err_t transmit(void *ctx, twai_message_t *msg)
+{
+    char event[EVENT_LEN] = "tx ";
+    formatFrame(msg, event + 3, sizeof(event) - 3);
+    addEvent(ctx, event);
+    return ESP_OK;
+}
+
+static const gvret_callbacks_t callbacks = {
+    .send = send,
+    .setBus = setBus,
+    .getBus = getBus,
+    .transmit = transmit,
+};
+
+static size_t parseHexBytes(const char *text, uint8_t *out, size_t max)
+{
+    size_t n = 0;
+    char *end;
+    for (unsigned long b = strtoul(text, &end, 16); end != text && n < max; b = strtoul(text, &end, 16))
+    {
+        out[n++] = b;
+        text = end;
+    }
+    return n;
+}
+
+/// @brief Replay the transcript, host data handed over per line or byte by byte
+static bool replay(const char *path, bool byteByByte)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        fprintf(stderr, "cannot open %s\n", path);
+        return false;
+    }
+
+    static gvret_t g;
+    static capture_t actual, expected;
+    memset(&actual, 0, sizeof(actual));
+    memset(&expected, 0, sizeof(expected));
+    busEnabled = busListenOnly = false;
+    busBitrate = 0;
+    testNowUs = 0;
+    gvret_init(&g, &callbacks, &actual);
+
+    char line[256];
+    int lineNo = 0;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        lineNo++;
+        line[strcspn(line, "\r\n")] = '\0';
+        const char *arg = line + 2;
+        uint8_t bytes[64];
+        size_t len;
+
+        switch (line[0])
+        {
+        case 't':
+            testNowUs = strtoll(arg, NULL, 10);
+            gvret_flush(&g, testNowUs);
+            break;
+        case '>':
+            len = parseHexBytes(arg, bytes, sizeof(bytes));
+            if (byteByByte)
+                for (size_t i = 0; i < len; i++)
+                    gvret_processInput(&g, bytes + i, 1);
+            else
+                gvret_processInput(&g, bytes, len);
+            break;
+        case '<':
+            len = parseHexBytes(arg, bytes, sizeof(bytes));
+            appendBytes(&expected, bytes, len);
+            break;
+        case 'r':
+        {
+            candump_frame_t frame;
+            if (candump_parseLine(arg, &frame) != ESP_OK)
+            {
+                fprintf(stderr, "%s:%d: invalid frame\n", path, lineNo);
+                testFailures++;
+                break;
+            }
+            gvret_queueFrame(&g, &frame.msg, frame.timeUs);
+            break;
+        }
+        case 'e':
+            addEvent(&expected, arg);
+            break;
+        }
+
+        // Output must match the transcript as soon as it is expected, not only at the end
+        if (line[0] == '<' || line[0] == 't' || line[0] == '>')
+        {
+            size_t n = actual.len < expected.len ? actual.len : expected.len;
+            if (line[0] == '<' && actual.len < expected.len)
+            {
+                fprintf(stderr, "%s:%d: adapter sent %zu bytes, %zu expected\n", path, lineNo, actual.len, expected.len);
+                fclose(file);
+                return false;
+            }
+            for (size_t i = 0; i < n; i++)
+            {
+                if (actual.bytes[i] != expected.bytes[i])
+                {
+                    fprintf(stderr, "%s:%d: byte %zu is %02X, %02X expected\n", path, lineNo, i, actual.bytes[i],
+                            expected.bytes[i]);
+                    fclose(file);
+                    return false;
+                }
+            }
+        }
+    }
+    fclose(file);
+
+    CHECK(actual.len == expected.len);
+    CHECK(!gvret_hasPending(&g));
+    CHECK(actual.eventCount == expected.eventCount);
+    for (size_t i = 0; i < actual.eventCount && i < expected.eventCount; i++)
+    {
+        if (strcmp(actual.events[i], expected.events[i]) != 0)
+        {
+            fprintf(stderr, "event %zu: \"%s\", \"%s\" expected\n", i, actual.events[i], expected.events[i]);
+            testFailures++;
+        }
+    }
+    return true;
+}
+
+/// @brief Batches are sent when the next frame does not fit, or when the first frame is APP_GVRET_BATCH_MS old
+static void testBatching(void)
+{
+    static gvret_t g;
+    static capture_t c;
+    memset(&c, 0, sizeof(c));
+    gvret_init(&g, &callbacks, &c);
+
+    twai_message_t msg = {.identifier = 0x100, .data_length_code = 8};
+    size_t perBatch = APP_GVRET_BATCH_SIZE / GVRET_MAX_FRAME_LEN;
+    for (size_t i = 0; i < perBatch; i++)
+        gvret_queueFrame(&g, &msg, 1000 + i);
+    CHECK(c.sends == 0 && gvret_hasPending(&g));
+    gvret_queueFrame(&g, &msg, 1000 + perBatch);
+    CHECK(c.sends == 1 && c.len == perBatch * GVRET_MAX_FRAME_LEN);
+
+    // The new batch starts with the frame that did not fit
+    gvret_flush(&g, 1000 + perBatch + APP_GVRET_BATCH_MS * 1000 - 1);
+    CHECK(c.sends == 1);
+    gvret_flush(&g, 1000 + perBatch + APP_GVRET_BATCH_MS * 1000);
+    CHECK(c.sends == 2 && c.len == (perBatch + 1) * GVRET_MAX_FRAME_LEN);
+    CHECK(!gvret_hasPending(&g));
+
+    // A frame older than the batch time is sent at once
+    gvret_queueFrame(&g, &msg, 100000);
+    gvret_queueFrame(&g, &msg, 100000 + APP_GVRET_BATCH_MS * 1000);
+    CHECK(c.sends == 3 && !gvret_hasPending(&g));
+
+    CHECK(gvret_isHandshake((const uint8_t[]){0xE7, 0xE7}, 2));
+    CHECK(!gvret_isHandshake((const uint8_t[]){'V', '\r'}, 2));
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = argc > 1 ? argv[1] : GVRET_SESSION_FILE;
+
+    CHECK(replay(path, false));
+    CHECK(replay(path, true));
+    testBatching();
+
+    return testResult("gvret_test");
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+/*
+Helpers of the host tests of on-device modules (built with the compat headers, run by ctest):
+checks, simulated clock, and single steps of task bodies
+
+A task body is an endless loop that blocks in ulTaskNotifyTake: runTask calls it and returns when it blocks (longjmp
+out of ulTaskNotifyTake), which is one iteration of the loop since task bodies keep no state across iterations.
+Bodies that wait at the top of their loop are run with wakeTask, which lets that first wait return.
+*/
+
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "rtos.h"
+
+static int testChecks = 0;
+static int testFailures = 0;
+
+#define CHECK(cond)                                                                  \
+    do                                                                               \
+    {                                                                                \
+        testChecks++;                                                                \
+        if (!(cond))                                                                 \
+        {                                                                            \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            testFailures++;                                                          \
+        }                                                                            \
+    } while (0)
+
+#define CHECK_MEM(actual, expected, len) CHECK(memcmp((actual), (expected), (len)) == 0)
+
+/// @brief Print the result of a test program, return value of main
+static inline int testResult(const char *name)
+{
+    printf("%s: %d checks, %d failed\n", name, testChecks, testFailures);
+    return testFailures > 0 ? 1 : 0;
+}
+
+// Simulated clock (esp_timer_get_time)
+static int64_t testNowUs = 0;
+
+int64_t esp_timer_get_time(void)
+{
+    return testNowUs;
+}
+
+// Task stepping, bodies are captured when modules create their tasks
+static TaskFunction_t testTasks[RTOS_TASK_COUNT];
+static void *testTaskArgs[RTOS_TASK_COUNT];
+static jmp_buf testTaskExit;
+static bool testTaskRunning = false;
+static bool testTaskWoken = false; // Next ulTaskNotifyTake returns instead of blocking
+static TickType_t testTaskWait = 0; // ticksToWait of the ulTaskNotifyTake the task blocked in
+static uint32_t testNotifications = 0;
+
+TaskHandle_t rtos_createTask(rtos_task_t task, const char *name, TaskFunction_t function, void *arg)
+{
+    testTasks[task] = function;
+    testTaskArgs[task] = arg;
+    return (TaskHandle_t)&testTasks[task];
+}
+
+/// @brief Run a task body created with rtos_createTask until it blocks in ulTaskNotifyTake
+static inline void runTask(rtos_task_t task)
+{
+    testTaskRunning = true;
+    if (setjmp(testTaskExit) == 0)
+        testTasks[task](testTaskArgs[task]);
+    testTaskRunning = false;
+    testTaskWoken = false;
+}
+
+/// @brief Run a task body waiting at the top of its loop for one iteration, as woken by a notification or timeout
+static inline void wakeTask(rtos_task_t task)
+{
+    testTaskWoken = true;
+    runTask(task);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticksToWait)
+{
+    uint32_t notifications = testNotifications;
+    if (clearOnExit)
+        testNotifications = 0;
+    if (testTaskRunning && testTaskWoken)
+        testTaskWoken = false;
+    else if (testTaskRunning)
+    {
+        testTaskWait = ticksToWait;
+        longjmp(testTaskExit, 1);
+    }
+    return notifications;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    testNotifications++;
+    return pdPASS;
+}
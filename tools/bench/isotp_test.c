@@ -0,0 +1,403 @@
+/*
+Host test of the ISO-TP engine (main/isotp.c), in simulated time: segmentation, reassembly, flow control
+(CTS with block size and STmin, WAIT, OVFLW) and N_Bs/N_Cr timeouts against a scripted peer
+
+    isotp_test
+*/
+
+#include "host_test.h"
+
+#include "can.h"
+#include "config.h"
+#include "isotp.h"
+
+#define TX_ID 0x7E0
+#define RX_ID 0x7E8
+#define MAX_FRAMES 64
+
+// Frames transmitted by the engine, with their simulated time
+static twai_message_t sent[MAX_FRAMES];
+static int64_t sentUs[MAX_FRAMES];
+static size_t sentCount = 0;
+static bool txQueueFull = false;
+
+// Last callback invocation
+static isotp_result_t lastResult;
+static uint8_t lastData[APP_ISOTP_RX_BUF_SIZE];
+static size_t lastLen;
+static int events = 0;
+
+bool can_isOpen(void)
+{
+    return true;
+}
+
+esp_err_t can_transmit(const twai_message_t *msg, TickType_t ticksToWait)
+{
+    if (txQueueFull)
+        return ESP_ERR_TIMEOUT;
+    if (sentCount < MAX_FRAMES)
+    {
+        sentUs[sentCount] = testNowUs;
+        sent[sentCount++] = *msg;
+    }
+    return ESP_OK;
+}
+
+static void callback(isotp_session_t *session, isotp_result_t result, const uint8_t *data, size_t len, void *ctx)
+{
+    lastResult = result;
+    lastLen = len;
+    if (data != NULL)
+        memcpy(lastData, data, len);
+    events++;
+}
+
+static void reset(void)
+{
+    sentCount = 0;
+    events = 0;
+    lastLen = 0;
+    txQueueFull = false;
+}
+
+static isotp_session_t *openSession(uint8_t blockSize, uint8_t stMin)
+{
+    isotp_config_t config = {
+        .txId = TX_ID,
+        .rxId = RX_ID,
+        .blockSize = blockSize,
+        .stMin = stMin,
+        .callback = callback,
+    };
+    isotp_session_t *session = NULL;
+    CHECK(isotp_open(&config, &session) == ESP_OK);
+    return session;
+}
+
+/// @brief Frame from the peer, padded to 8 bytes
+static void receive(const uint8_t *data, size_t len)
+{
+    twai_message_t msg = {.identifier = RX_ID, .data_length_code = 8};
+    memset(msg.data, APP_ISOTP_PADDING, sizeof(msg.data));
+    memcpy(msg.data, data, len);
+    isotp_processFrame(&msg);
+}
+
+static void flowControl(uint8_t flowStatus, uint8_t blockSize, uint8_t stMin)
+{
+    uint8_t fc[] = {0x30 | flowStatus, blockSize, stMin};
+    receive(fc, sizeof(fc));
+}
+
+/// @brief Advance the clock and run the ISO-TP task, as its timer would
+static void advance(int64_t us)
+{
+    testNowUs += us;
+    runTask(RTOS_TASK_ISOTP);
+}
+
+static void testSingleFrame(void)
+{
+    reset();
+    isotp_session_t *session = openSession(0, 0);
+
+    uint8_t request[] = {0x22, 0xF1, 0x90};
+    CHECK(isotp_send(session, request, sizeof(request)) == ESP_OK);
+    uint8_t expected[8] = {0x03, 0x22, 0xF1, 0x90, 0xCC, 0xCC, 0xCC, 0xCC};
+    CHECK(sentCount == 1);
+    CHECK(sent[0].identifier == TX_ID && sent[0].data_length_code == 8);
+    CHECK_MEM(sent[0].data, expected, 8);
+
+    uint8_t response[] = {0x04, 0x62, 0xF1, 0x90, 0x01};
+    receive(response, sizeof(response));
+    CHECK(events == 1 && lastResult == ISOTP_RESULT_OK && lastLen == 4);
+    CHECK_MEM(lastData, response + 1, 4);
+
+    // Other identifiers and remote frames are ignored
+    twai_message_t other = {.identifier = 0x7E9, .data_length_code = 8, .data = {0x02, 0x50, 0x03}};
+    isotp_processFrame(&other);
+    twai_message_t rtr = {.identifier = RX_ID, .rtr = 1};
+    isotp_processFrame(&rtr);
+    CHECK(events == 1);
+
+    CHECK(isotp_close(session) == ESP_OK);
+}
+
+static void testSegmentedSend(void)
+{
+    reset();
+    isotp_session_t *session = openSession(0, 0);
+
+    uint8_t pdu[40];
+    for (size_t i = 0; i < sizeof(pdu); i++)
+        pdu[i] = i;
+    CHECK(isotp_send(session, pdu, sizeof(pdu)) == ESP_OK);
+    CHECK(sentCount == 1);
+    uint8_t ff[8] = {0x10, sizeof(pdu), 0, 1, 2, 3, 4, 5};
+    CHECK_MEM(sent[0].data, ff, 8);
+    CHECK(isotp_send(session, pdu, sizeof(pdu)) == ESP_ERR_INVALID_STATE); // Transfer in progress
+
+    // Nothing is sent before Flow Control
+    advance(1000);
+    CHECK(sentCount == 1);
+
+    // CTS, block size 2, STmin 5ms: two CFs 5ms apart, then wait for the next FC
+    flowControl(0x0, 2, 5);
+    advance(0);
+    CHECK(sentCount == 2);
+    advance(4000);
+    CHECK(sentCount == 2);
+    advance(1000);
+    CHECK(sentCount == 3);
+    CHECK(sentUs[2] - sentUs[1] == 5000);
+    advance(10000);
+    CHECK(sentCount == 3);
+    CHECK(sent[1].data[0] == 0x21 && sent[2].data[0] == 0x22);
+    CHECK(sent[1].data[1] == 6 && sent[2].data[1] == 13);
+
+    // CTS, no further FC, STmin 0xF5 (500us): remaining 20 bytes in three CFs
+    flowControl(0x0, 0, 0xF5);
+    advance(0);
+    for (int i = 0; i < 3; i++)
+        advance(500);
+    CHECK(sentCount == 6);
+    CHECK(sentUs[4] - sentUs[3] == 500 && sentUs[5] - sentUs[4] == 500);
+    uint8_t last[8] = {0x25, 34, 35, 36, 37, 38, 39, 0xCC};
+    CHECK_MEM(sent[5].data, last, 8);
+    CHECK(events == 0);
+
+    // Idle again
+    CHECK(isotp_send(session, pdu, 3) == ESP_OK);
+    CHECK(isotp_close(session) == ESP_OK);
+}
+
+static void testSequenceNumberWraps(void)
+{
+    reset();
+    isotp_session_t *session = openSession(0, 0);
+
+    uint8_t pdu[6 + 7 * 17];
+    memset(pdu, 0x55, sizeof(pdu));
+    CHECK(isotp_send(session, pdu, sizeof(pdu)) == ESP_OK);
+    flowControl(0x0, 0, 0);
+    advance(0);
+    CHECK(sentCount == 18);
+    CHECK(sent[15].data[0] == 0x2F && sent[16].data[0] == 0x20 && sent[17].data[0] == 0x21);
+
+    CHECK(isotp_close(session) == ESP_OK);
+}
+
+static void testFlowControlWait(void)
+{
+    reset();
+    isotp_session_t *session = openSession(0, 0);
+
+    uint8_t pdu[20] = {0};
+    CHECK(isotp_send(session, pdu, sizeof(pdu)) == ESP_OK);
+
+    // Each WAIT restarts N_Bs
+    for (int i = 0; i < APP_ISOTP_MAX_WFT; i++)
+    {
+        advance(APP_ISOTP_TIMEOUT_MS * 1000 - 1000);
+        flowControl(0x1, 0, 0);
+    }
+    advance(APP_ISOTP_TIMEOUT_MS * 1000 - 1000);
+    CHECK(events == 0 && sentCount == 1);
+
+    // One WAIT too many aborts the transfer
+    flowControl(0x1, 0, 0);
+    CHECK(events == 1 && lastResult == ISOTP_RESULT_WFT_OVERRUN);
+    advance(APP_ISOTP_TIMEOUT_MS * 1000);
+    CHECK(events == 1 && sentCount == 1);
+
+    // WAIT then CTS resumes
+    reset();
+    CHECK(isotp_send(session, pdu, sizeof(pdu)) == ESP_OK);
+    flowControl(0x1, 0, 0);
+    flowControl(0x0, 0, 0);
+    advance(0);
+    CHECK(events == 0 && sentCount == 3);
+
+    CHECK(isotp_close(session) == ESP_OK);
+}
+
+static void testFlowControlOverflow(void)
+{
+    reset();
+    isotp_session_t *session = openSession(0, 0);
+
+    uint8_t pdu[20] = {0};
+    CHECK(isotp_send(session, pdu, sizeof(pdu)) == ESP_OK);
+    flowControl(0x2, 0, 0);
+    CHECK(events == 1 && lastResult == ISOTP_RESULT_OVERFLOW);
+    advance(0);
+    CHECK(sentCount == 1);
+    CHECK(isotp_send(session, pdu, sizeof(pdu)) == ESP_OK);
+
+    CHECK(isotp_close(session) == ESP_OK);
+}
+
+static void testTimeoutBs(void)
+{
+    reset();
+    isotp_session_t *session = openSession(0, 0);
+
+    uint8_t pdu[20] = {0};
+    CHECK(isotp_send(session, pdu, sizeof(pdu)) == ESP_OK);
+    advance(APP_ISOTP_TIMEOUT_MS * 1000 - 1);
+    CHECK(events == 0);
+    advance(1);
+    CHECK(events == 1 && lastResult == ISOTP_RESULT_TIMEOUT_BS);
+
+    // Also while waiting for the FC of the next block
+    reset();
+    CHECK(isotp_send(session, pdu, sizeof(pdu)) == ESP_OK);
+    flowControl(0x0, 1, 0);
+    advance(0);
+    CHECK(sentCount == 2);
+    advance(APP_ISOTP_TIMEOUT_MS * 1000);
+    CHECK(events == 1 && lastResult == ISOTP_RESULT_TIMEOUT_BS);
+
+    CHECK(isotp_close(session) == ESP_OK);
+}
+
+static void testReassembly(void)
+{
+    reset();
+    isotp_session_t *session = openSession(2, 0x0A);
+
+    // FF of 25 bytes: the Flow Control is sent by the ISO-TP task, never from the CAN RX path
+    uint8_t ff[] = {0x10, 25, 0x62, 0xF1, 0x90, 'W', 'V', 'W'};
+    receive(ff, sizeof(ff));
+    CHECK(sentCount == 0);
+    advance(0);
+    uint8_t cts[8] = {0x30, 2, 0x0A, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC};
+    CHECK(sentCount == 1);
+    CHECK_MEM(sent[0].data, cts, 8);
+
+    uint8_t cf1[] = {0x21, 'Z', 'Z', 'Z', '1', 'K', '1', 'Z'};
+    uint8_t cf2[] = {0x22, '9', '7', '0', '0', '0', '0', '0'};
+    uint8_t cf3[] = {0x23, '1', '2', '3', '4', '5'};
+    receive(cf1, sizeof(cf1));
+    receive(cf2, sizeof(cf2));
+    CHECK(sentCount == 1);
+    advance(0);
+    CHECK(sentCount == 2); // Block size reached, next FC
+    CHECK_MEM(sent[1].data, cts, 8);
+    receive(cf3, sizeof(cf3));
+    CHECK(events == 1 && lastResult == ISOTP_RESULT_OK && lastLen == 25);
+    CHECK_MEM(lastData, "\x62\xF1\x90WVWZZZ1K1Z970000012345", 25);
+
+    // Wrong sequence number
+    reset();
+    receive(ff, sizeof(ff));
+    advance(0);
+    receive(cf2, sizeof(cf2));
+    CHECK(events == 1 && lastResult == ISOTP_RESULT_WRONG_SN);
+
+    // A CF without FF is ignored
+    reset();
+    receive(cf1, sizeof(cf1));
+    CHECK(events == 0);
+
+    CHECK(isotp_close(session) == ESP_OK);
+}
+
+static void testReceiveOverflow(void)
+{
+    reset();
+    isotp_session_t *session = openSession(0, 0);
+
+    uint8_t ff[] = {0x10 | (APP_ISOTP_RX_BUF_SIZE + 1) >> 8, (APP_ISOTP_RX_BUF_SIZE + 1) & 0xFF, 1, 2, 3, 4, 5, 6};
+    receive(ff, sizeof(ff));
+    CHECK(events == 1 && lastResult == ISOTP_RESULT_OVERFLOW);
+    CHECK(sentCount == 0);
+    advance(0);
+    CHECK(sentCount == 1 && sent[0].data[0] == 0x32);
+
+    CHECK(isotp_close(session) == ESP_OK);
+}
+
+static void testTimeoutCr(void)
+{
+    reset();
+    isotp_session_t *session = openSession(0, 0);
+
+    uint8_t ff[] = {0x10, 20, 1, 2, 3, 4, 5, 6};
+    uint8_t cf1[] = {0x21, 7, 8, 9, 10, 11, 12, 13};
+    receive(ff, sizeof(ff));
+    advance(0);
+    advance(APP_ISOTP_TIMEOUT_MS * 1000 - 1000);
+    receive(cf1, sizeof(cf1)); // Restarts N_Cr
+    advance(APP_ISOTP_TIMEOUT_MS * 1000 - 1000);
+    CHECK(events == 0);
+    advance(1000);
+    CHECK(events == 1 && lastResult == ISOTP_RESULT_TIMEOUT_CR);
+
+    CHECK(isotp_close(session) == ESP_OK);
+}
+
+static void testTxQueueFull(void)
+{
+    reset();
+    isotp_session_t *session = openSession(0, 0);
+
+    // A Single Frame or First Frame refused by the driver is reported at once and leaves the session idle
+    txQueueFull = true;
+    uint8_t sf[3] = {0x22, 0xF1, 0x90};
+    CHECK(isotp_send(session, sf, sizeof(sf)) == ESP_ERR_TIMEOUT);
+    uint8_t pdu[20] = {0};
+    CHECK(isotp_send(session, pdu, sizeof(pdu)) == ESP_ERR_TIMEOUT);
+    CHECK(sentCount == 0);
+    advance(APP_ISOTP_TIMEOUT_MS * 1000);
+    CHECK(events == 0);
+
+    txQueueFull = false;
+    CHECK(isotp_send(session, pdu, sizeof(pdu)) == ESP_OK);
+    CHECK(sentCount == 1 && sent[0].data[0] == 0x10);
+
+    // Consecutive Frames refused by the driver are lost without blocking the engine, the peer times out
+    txQueueFull = true;
+    flowControl(0, 0, 0);
+    advance(APP_ISOTP_TIMEOUT_MS * 1000);
+    CHECK(sentCount == 1);
+
+    CHECK(isotp_close(session) == ESP_OK);
+}
+
+static void testSessions(void)
+{
+    reset();
+    isotp_session_t *session = openSession(0, 0);
+    isotp_config_t config = {.txId = 0x7E1, .rxId = RX_ID};
+    isotp_session_t *other;
+    CHECK(isotp_open(&config, &other) == ESP_ERR_INVALID_STATE); // Same RX identifier
+    CHECK(isotp_find(TX_ID, RX_ID) == session);
+
+    uint8_t tooLong[APP_ISOTP_TX_BUF_SIZE + 1] = {0};
+    CHECK(isotp_send(session, tooLong, sizeof(tooLong)) == ESP_ERR_INVALID_SIZE);
+    CHECK(isotp_send(session, tooLong, 0) == ESP_ERR_INVALID_SIZE);
+
+    CHECK(isotp_close(session) == ESP_OK);
+    CHECK(isotp_find(TX_ID, RX_ID) == NULL);
+}
+
+int main(void)
+{
+    isotp_init();
+
+    testSingleFrame();
+    testSegmentedSend();
+    testSequenceNumberWraps();
+    testFlowControlWait();
+    testFlowControlOverflow();
+    testTimeoutBs();
+    testReassembly();
+    testReceiveOverflow();
+    testTimeoutCr();
+    testTxQueueFull();
+    testSessions();
+
+    return testResult("isotp_test");
+}
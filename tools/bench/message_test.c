@@ -0,0 +1,104 @@
+/*
+Host test of the message pools (main/message.c): messages take blocks of the smallest class that fits and never fall
+back to a larger class, so the large blocks stay free for UART and SPP reads. Link budgets cap the blocks held per class
+and are given back when messages are freed.
+*/
+
+#include "host_test.h"
+
+#include "config.h"
+#include "message.h"
+
+static message_poolStats_t poolStats(size_t index)
+{
+    message_poolStats_t stats;
+    message_getPoolStats(index, &stats);
+    return stats;
+}
+
+/// @brief An exhausted class fails without taking blocks of a larger one
+static void testNoFallback(void)
+{
+    static message_t small[APP_MESSAGE_SMALL_COUNT];
+    for (size_t i = 0; i < APP_MESSAGE_SMALL_COUNT; i++)
+        small[i] = message_alloc(APP_MESSAGE_SMALL_SIZE);
+    CHECK(small[APP_MESSAGE_SMALL_COUNT - 1].data != NULL && poolStats(0).used == APP_MESSAGE_SMALL_COUNT);
+
+    message_t msg = message_alloc(1);
+    CHECK(msg.data == NULL && msg.length == 0);
+    CHECK(poolStats(0).failures == 1 && poolStats(1).used == 0 && poolStats(2).used == 0);
+
+    // A length between two block sizes takes the larger class
+    msg = message_alloc(APP_MESSAGE_SMALL_SIZE + 1);
+    CHECK(msg.data != NULL && msg.length == APP_MESSAGE_SMALL_SIZE + 1 && poolStats(1).used == 1);
+    message_free(&msg);
+    CHECK(msg.data == NULL && poolStats(1).used == 0);
+
+    // Longer than every block
+    msg = message_alloc(APP_MESSAGE_LARGE_SIZE + 1);
+    CHECK(msg.data == NULL && poolStats(2).failures == 1 && poolStats(2).used == 0);
+
+    uint8_t *lastFreed = small[APP_MESSAGE_SMALL_COUNT - 1].data;
+    for (size_t i = 0; i < APP_MESSAGE_SMALL_COUNT; i++)
+        message_free(&small[i]);
+    CHECK(poolStats(0).used == 0 && poolStats(0).peakUsed == APP_MESSAGE_SMALL_COUNT);
+
+    // Released blocks are taken again
+    msg = message_new((uint8_t *)"abc", 3);
+    CHECK(msg.data == lastFreed && memcmp(msg.data, "abc", 3) == 0);
+    message_free(&msg);
+}
+
+/// @brief A link holds at most its budget of every class, other links and unlimited messages are not affected
+static void testBudget(void)
+{
+    static message_budget_t link, other;
+    static message_t held[APP_MESSAGE_LINK_SMALL_BLOCKS];
+    for (size_t i = 0; i < APP_MESSAGE_LINK_SMALL_BLOCKS; i++)
+        held[i] = message_allocBudget(&link, 1);
+    CHECK(link.used[0] == APP_MESSAGE_LINK_SMALL_BLOCKS && held[0].budget == &link);
+
+    message_t msg = message_allocBudget(&link, 1);
+    CHECK(msg.data == NULL && poolStats(0).limited == 1 && poolStats(0).failures == 1);
+
+    // Budgets are per class and per link
+    static uint8_t data[APP_MESSAGE_SMALL_SIZE + 1];
+    memset(data, 'x', sizeof(data));
+    msg = message_newBudget(&link, data, sizeof(data));
+    CHECK(msg.data != NULL && link.used[1] == 1 && memcmp(msg.data, data, sizeof(data)) == 0);
+    message_free(&msg);
+    CHECK(link.used[1] == 0 && msg.budget == NULL);
+    msg = message_allocBudget(&other, 1);
+    CHECK(msg.data != NULL && other.used[0] == 1);
+    message_free(&msg);
+    msg = message_alloc(1);
+    CHECK(msg.data != NULL && msg.budget == NULL);
+    message_free(&msg);
+
+    message_t large = message_allocBudget(&link, APP_MESSAGE_LARGE_SIZE);
+    msg = message_allocBudget(&link, APP_MESSAGE_MEDIUM_SIZE + 1);
+    CHECK(large.data != NULL && msg.data == NULL && poolStats(2).limited == APP_MESSAGE_LINK_LARGE_BLOCKS);
+    message_free(&large);
+
+    // Freed blocks go back to the budget
+    message_free(&held[0]);
+    CHECK(link.used[0] == APP_MESSAGE_LINK_SMALL_BLOCKS - 1);
+    held[0] = message_allocBudget(&link, 1);
+    CHECK(held[0].data != NULL && poolStats(0).limited == 1);
+
+    for (size_t i = 0; i < APP_MESSAGE_LINK_SMALL_BLOCKS; i++)
+        message_free(&held[i]);
+    CHECK(link.used[0] == 0 && link.used[2] == 0 && poolStats(0).used == 0 && poolStats(2).used == 0);
+
+    message_poolStats_t stats;
+    CHECK(message_getPoolStats(0, &stats) && stats.blockSize == APP_MESSAGE_SMALL_SIZE);
+    CHECK(!message_getPoolStats(MESSAGE_POOL_COUNT, &stats));
+}
+
+int main(void)
+{
+    testNoFallback();
+    testBudget();
+
+    return testResult("message_test");
+}
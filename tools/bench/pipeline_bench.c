@@ -0,0 +1,754 @@
+/*
+Host load benchmark of the receive pipeline, in simulated time:
+CAN bus -> TWAI driver RX queue -> capture RX stage (main/capture.c with census and rules, main/can.c)
+-> capture ring -> SLCAN link sinks -> link transmit queues -> transports
+
+The capture, census, rules and CAN layer code is the device code. The device CPU cost of each stage is a model
+parameter (--cost): the RX stage runs on its own core, link sinks share the other one and block up to
+APP_SLCAN_TX_WAIT_MS when their transmit queue is full, like linkTxTask. Transports drain their queue at a fixed rate.
+ISO-TP, socketcand and the flight recorder are not linked, their RX cost is part of the RX cost parameter.
+
+Reports sustained frame rate, drops of each stage (driver RX queue, capture ring and transmit queue of each link),
+latency percentiles from the end of frame on the bus to the last byte sent on each link, and peak heap used by
+queued messages (message_new). Results are deterministic for a given set of options.
+
+    pipeline_bench [options]
+    --bitrate <bit/s>       bus bitrate, 125000, 500000 or 1000000 (default 500000)
+    --load <percent>        offered bus load, 1-100 (default 50)
+    --ids <n>               identifiers (default 64)
+    --ext <percent>         extended identifiers (default 0)
+    --dlc <n|mix>           fixed DLC, or mix: 60% DLC 8, others uniform 0-7 (default 8)
+    --burst <n>             frames sent back to back per burst, the average load is kept (default 1)
+    --seconds <n>           simulated traffic duration (default 10)
+    --replay <file>         candump -l log instead of synthetic traffic, timestamps are kept unless the bus is busy
+    --rules <n>             frame match rules (count action) spread over the identifiers (default 0)
+    --rx-queue <n>          TWAI driver RX queue length (default 5, TWAI_GENERAL_CONFIG_DEFAULT)
+    --link <name:B/s:len>   transport: name, rate in bytes/s, transmit queue length; repeatable
+                            (default uart, bt and tcp from config.h)
+    --cost <rx,batch,sink,msg>
+                            device CPU time in us: per received frame, per RX batch (task wake-up), per formatted
+                            frame, per sent message (allocation and queue) (default 12,20,4,25)
+    --sweep                 run loads 10% to 100% in steps of 10%
+    --json                  JSON output (dlc -1 for mix), for regression comparison with bench_compare.py
+*/
+
+#include "capture.h"
+#include "can.h"
+#include "census.h"
+#include "rules.h"
+#include "rtos.h"
+#include "config.h"
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define MAX_LINKS 4
+#define SLCAN_MAX_CMD_LEN 30     // Same as slcan.c, longest frame line with timestamp
+#define MAX_MESSAGE_FRAMES 64    // Frames in one message, shortest line is 6 bytes
+#define ARRIVALS_LEN (1 << 16)   // Bus arrival times by capture sequence number, covers frames in flight
+#define HISTOGRAM_US 10          // Latency histogram resolution
+#define HISTOGRAM_LEN 100000     // Up to 1s, longer latencies go to the last bucket
+#define NEVER INFINITY
+
+typedef struct
+{
+    char name[16];
+    double bytesPerSec;
+    int queueLen;
+} link_config_t;
+
+typedef struct
+{
+    uint32_t bitrate;
+    double load;
+    int ids;
+    double extPercent;
+    int dlc; // -1: mix
+    int burst;
+    double seconds;
+    const char *replay;
+    int rules;
+    int rxQueueLen;
+    link_config_t links[MAX_LINKS];
+    int linkCount;
+    double rxFrameUs, rxBatchUs, sinkFrameUs, sinkMessageUs;
+    bool json;
+} options_t;
+
+typedef struct
+{
+    size_t len;
+    size_t frames;
+    uint32_t seqs[MAX_MESSAGE_FRAMES];
+} message_t;
+
+typedef struct
+{
+    link_config_t config;
+    capture_sink_t sink;
+
+    message_t queue[256]; // Transmit queue, config.queueLen used
+    int queueHead, queueCount;
+    double wireDoneUs; // Transport busy sending queue[queueHead] until then
+
+    bool blocked; // Sink task waiting for room in the transmit queue
+    message_t pending;
+    double blockedUntilUs;
+
+    uint64_t sentFrames, sentBytes, txDrops;
+    uint32_t *histogram;
+    uint64_t latencySamples;
+    double maxLatencyUs;
+} link_t;
+
+static options_t opt;
+static double nowUs = 0;
+static link_t links[MAX_LINKS];
+
+// Simulated bus and TWAI driver RX queue
+static twai_message_t driverQueue[64];
+static double driverArrival[64];
+static int driverHead = 0, driverCount = 0;
+static uint64_t offeredFrames = 0, offeredBits = 0, driverDrops = 0;
+static double lastArrivalUs = 0;
+static double arrivals[ARRIVALS_LEN];
+static uint32_t publishedSeq = 0;
+
+// Heap used by queued messages
+static size_t heapBytes = 0, peakHeapBytes = 0;
+
+// Host time spent in the RX stage (device code)
+static double hostRxNs = 0;
+static uint64_t processedFrames = 0;
+
+int64_t esp_timer_get_time(void)
+{
+    return (int64_t)nowUs;
+}
+
+TaskHandle_t rtos_createTask(rtos_task_t task, const char *name, TaskFunction_t function, void *arg)
+{
+    return NULL;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticksToWait)
+{
+    return 0;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    return pdPASS; // Sinks are scheduled when their ring cursor is behind
+}
+
+// Consumers not linked in the benchmark
+void isotp_processFrame(const twai_message_t *msg) {}
+void socketcand_processFrame(const twai_message_t *msg, int64_t timestampUs) {}
+void recorder_append(const twai_message_t *msg, int64_t timestampUs) {}
+
+static esp_err_t simOpen(twai_mode_t mode, const twai_timing_config_t *timingConfig, uint32_t alerts)
+{
+    return ESP_OK;
+}
+
+static esp_err_t simClose(void)
+{
+    return ESP_OK;
+}
+
+static esp_err_t simReceive(twai_message_t *msgs, size_t maxCount, size_t *count, TickType_t ticksToWait)
+{
+    size_t n = 0;
+    while (n < maxCount && driverCount > 0)
+    {
+        arrivals[(publishedSeq + n) & (ARRIVALS_LEN - 1)] = driverArrival[driverHead];
+        msgs[n++] = driverQueue[driverHead];
+        driverHead = (driverHead + 1) % opt.rxQueueLen;
+        driverCount--;
+    }
+    *count = n;
+    return n > 0 ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+static esp_err_t simTransmit(const twai_message_t *msg, TickType_t ticksToWait)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+static esp_err_t simGetStatus(twai_status_info_t *status)
+{
+    memset(status, 0, sizeof(*status));
+    status->state = TWAI_STATE_RUNNING;
+    status->msgs_to_rx = driverCount;
+    return ESP_OK;
+}
+
+static esp_err_t simReadAlerts(uint32_t *alerts, TickType_t ticksToWait)
+{
+    return ESP_ERR_TIMEOUT;
+}
+
+static esp_err_t simNoop(void)
+{
+    return ESP_OK;
+}
+
+static const can_backend_t simBackend = {
+    .name = "sim",
+    .open = simOpen,
+    .close = simClose,
+    .receive = simReceive,
+    .transmit = simTransmit,
+    .getStatus = simGetStatus,
+    .readAlerts = simReadAlerts,
+    .initiateRecovery = simNoop,
+    .start = simNoop,
+};
+
+/* Traffic sources */
+
+static uint32_t rngState = 1;
+
+static uint32_t rng(void)
+{
+    rngState = rngState * 1664525 + 1013904223;
+    return rngState >> 8;
+}
+
+static uint32_t identifierOf(int n, bool *extd)
+{
+    *extd = n < opt.ids * opt.extPercent / 100;
+    return *extd ? 0x18DA0000 + n * 0x101 : (0x100 + n * 13) & 0x7FF;
+}
+
+static FILE *replayFile = NULL;
+static double replayStartS = -1;
+static double busFreeUs = 0;
+static int burstLeft = 0;
+static uint64_t burstBits = 0;
+
+/// @brief Next frame on the bus and the time its transmission ends, false when the source is exhausted
+static bool nextFrame(twai_message_t *msg, double *endUs)
+{
+    memset(msg, 0, sizeof(*msg));
+
+    if (replayFile != NULL)
+    {
+        char line[256];
+        while (fgets(line, sizeof(line), replayFile) != NULL)
+        {
+            double ts;
+            char ifname[32], frame[128];
+            if (sscanf(line, "(%lf) %31s %127s", &ts, ifname, frame) != 3)
+                continue;
+            char *hash = strchr(frame, '#');
+            if (hash == NULL || hash[1] == '#')
+                continue; // CAN FD frames are not supported
+            msg->identifier = strtoul(frame, NULL, 16);
+            msg->extd = hash - frame > 3;
+            if (hash[1] == 'R')
+            {
+                msg->rtr = 1;
+                msg->data_length_code = hash[2] != '\0' ? hash[2] - '0' : 0;
+            }
+            else
+            {
+                size_t len = strlen(hash + 1) / 2;
+                msg->data_length_code = len <= 8 ? len : 8;
+                for (int i = 0; i < msg->data_length_code; i++)
+                {
+                    char byte[3] = {hash[1 + i * 2], hash[2 + i * 2], '\0'};
+                    msg->data[i] = strtoul(byte, NULL, 16);
+                }
+            }
+
+            if (replayStartS < 0)
+                replayStartS = ts;
+            double frameUs = can_frameBits(msg) * 1e6 / opt.bitrate;
+            double logUs = (ts - replayStartS) * 1e6;
+            if (logUs >= opt.seconds * 1e6)
+                return false;
+            // The log time is the reception time, the frame cannot end before the previous one plus its duration
+            *endUs = fmax(logUs, busFreeUs + frameUs);
+            busFreeUs = *endUs;
+            return true;
+        }
+        return false;
+    }
+
+    int n = rng() % opt.ids;
+    bool extd;
+    msg->identifier = identifierOf(n, &extd);
+    msg->extd = extd;
+    msg->data_length_code = opt.dlc >= 0 ? (uint32_t)opt.dlc : (rng() % 10 < 6 ? 8 : rng() % 8);
+    for (int i = 0; i < 8; i++)
+        msg->data[i] = rng();
+
+    uint32_t bits = can_frameBits(msg);
+    double endBusUs = busFreeUs + bits * 1e6 / opt.bitrate;
+    if (endBusUs >= opt.seconds * 1e6)
+        return false;
+
+    // Bursts are sent at wire speed, the idle time after each burst keeps the average load
+    *endUs = endBusUs;
+    busFreeUs = endBusUs;
+    burstBits += bits;
+    if (++burstLeft >= opt.burst)
+    {
+        busFreeUs += burstBits * (100.0 / opt.load - 1) * 1e6 / opt.bitrate;
+        burstLeft = 0;
+        burstBits = 0;
+    }
+    return true;
+}
+
+/* Simulation */
+
+static size_t slcanLineLen(const twai_message_t *msg)
+{
+    return 1 + (msg->extd ? 8 : 3) + 1 + (msg->rtr ? 0 : msg->data_length_code * 2) + 1;
+}
+
+static void recordLatency(link_t *link, const message_t *message)
+{
+    for (size_t i = 0; i < message->frames; i++)
+    {
+        double latency = nowUs - arrivals[message->seqs[i] & (ARRIVALS_LEN - 1)];
+        size_t bucket = latency / HISTOGRAM_US;
+        link->histogram[bucket < HISTOGRAM_LEN ? bucket : HISTOGRAM_LEN - 1]++;
+        link->latencySamples++;
+        if (latency > link->maxLatencyUs)
+            link->maxLatencyUs = latency;
+    }
+}
+
+static void startWire(link_t *link)
+{
+    if (link->queueCount > 0 && link->wireDoneUs == NEVER)
+        link->wireDoneUs = nowUs + link->queue[link->queueHead].len * 1e6 / link->config.bytesPerSec;
+}
+
+static void enqueue(link_t *link, const message_t *message)
+{
+    link->queue[(link->queueHead + link->queueCount) % link->config.queueLen] = *message;
+    link->queueCount++;
+    startWire(link);
+}
+
+static void freeMessage(const message_t *message)
+{
+    heapBytes -= message->len;
+}
+
+/// @brief Transport finished sending its oldest message
+static void wireDone(link_t *link)
+{
+    message_t *message = &link->queue[link->queueHead];
+    recordLatency(link, message);
+    link->sentFrames += message->frames;
+    link->sentBytes += message->len;
+    freeMessage(message);
+    link->queueHead = (link->queueHead + 1) % link->config.queueLen;
+    link->queueCount--;
+    link->wireDoneUs = NEVER;
+
+    if (link->blocked)
+    {
+        enqueue(link, &link->pending);
+        link->blocked = false;
+    }
+    startWire(link);
+}
+
+/// @brief One pass of a link sink: read frames from the ring into one message, as linkTxTask does
+/// @return device CPU time of the pass
+static double buildMessage(link_t *link, message_t *message)
+{
+    message->len = 0;
+    message->frames = 0;
+
+    capture_frame_t frame;
+    while (message->frames < MAX_MESSAGE_FRAMES && message->len + SLCAN_MAX_CMD_LEN + 1 <= APP_SLCAN_TX_BATCH_SIZE &&
+           capture_read(&link->sink, &frame))
+    {
+        message->seqs[message->frames++] = link->sink.cursor - 1;
+        message->len += slcanLineLen(&frame.msg);
+    }
+
+    heapBytes += message->len;
+    if (heapBytes > peakHeapBytes)
+        peakHeapBytes = heapBytes;
+    return opt.sinkMessageUs + message->frames * opt.sinkFrameUs;
+}
+
+static void resetState(void)
+{
+    nowUs = 0;
+    driverHead = driverCount = 0;
+    offeredFrames = offeredBits = driverDrops = 0;
+    lastArrivalUs = 0;
+    heapBytes = peakHeapBytes = 0;
+    hostRxNs = 0;
+    processedFrames = 0;
+    busFreeUs = 0;
+    burstLeft = 0;
+    burstBits = 0;
+    rngState = 1;
+    replayStartS = -1;
+}
+
+static void run(void)
+{
+    resetState();
+    if (opt.replay != NULL && (replayFile = fopen(opt.replay, "r")) == NULL)
+    {
+        fprintf(stderr, "cannot open %s\n", opt.replay);
+        exit(1);
+    }
+
+    static const rules_callbacks_t ruleCallbacks = {0};
+    rules_init(&ruleCallbacks, NULL);
+    for (int i = 0; i < opt.rules; i++)
+    {
+        bool extd;
+        uint32_t id = identifierOf(i % opt.ids, &extd);
+        rules_rule_t rule = {.id = id | (extd ? RULES_ID_EXTD : 0), .dlc = RULES_DLC_ANY, .action = RULES_ACTION_COUNT,
+                             .mask = 0xF0ULL << 16, .value = (uint64_t)(i & 0xF) << 20};
+        rules_set(i, &rule);
+    }
+    census_init();
+
+    can_setBackend(&simBackend);
+    capture_init();
+    capture_setBitrate(opt.bitrate);
+    capture_open(TWAI_MODE_LISTEN_ONLY);
+
+    for (int i = 0; i < opt.linkCount; i++)
+    {
+        link_t *link = &links[i];
+        memset(link, 0, sizeof(*link));
+        link->config = opt.links[i];
+        link->sink.name = link->config.name;
+        link->wireDoneUs = NEVER;
+        link->histogram = calloc(HISTOGRAM_LEN, sizeof(uint32_t));
+        capture_addSink(&link->sink);
+    }
+
+    twai_message_t next;
+    double nextArrivalUs;
+    if (!nextFrame(&next, &nextArrivalUs))
+        nextArrivalUs = NEVER;
+
+    twai_message_t rxBatch[APP_CAPTURE_RX_BATCH];
+    size_t rxCount = 0;
+    double rxDoneUs = NEVER;
+
+    int sinkLink = -1; // Link whose sink pass is running on the sinks core
+    message_t sinkMessage;
+    double sinkDoneUs = NEVER;
+    int nextLink = 0;
+
+    while (1)
+    {
+        // Next event
+        double t = fmin(nextArrivalUs, fmin(rxDoneUs, sinkDoneUs));
+        for (int i = 0; i < opt.linkCount; i++)
+        {
+            t = fmin(t, links[i].wireDoneUs);
+            if (links[i].blocked)
+                t = fmin(t, links[i].blockedUntilUs);
+        }
+        if (t == NEVER)
+            break;
+        nowUs = t;
+
+        if (nextArrivalUs == t)
+        {
+            offeredFrames++;
+            offeredBits += can_frameBits(&next);
+            lastArrivalUs = t;
+            if (driverCount < opt.rxQueueLen)
+            {
+                int tail = (driverHead + driverCount) % opt.rxQueueLen;
+                driverQueue[tail] = next;
+                driverArrival[tail] = t;
+                driverCount++;
+            }
+            else
+                driverDrops++;
+            if (!nextFrame(&next, &nextArrivalUs))
+                nextArrivalUs = NEVER;
+        }
+
+        for (int i = 0; i < opt.linkCount; i++)
+        {
+            link_t *link = &links[i];
+            if (link->wireDoneUs == t)
+                wireDone(link);
+            if (link->blocked && link->blockedUntilUs == t)
+            {
+                // Same as sendFrames after APP_SLCAN_TX_WAIT_MS
+                link->txDrops += link->pending.frames;
+                freeMessage(&link->pending);
+                link->blocked = false;
+            }
+        }
+
+        if (rxDoneUs == t)
+        {
+            struct timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            capture_processFrames(rxBatch, rxCount);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            hostRxNs += (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+            processedFrames += rxCount;
+            publishedSeq += rxCount;
+            rxDoneUs = NEVER;
+        }
+
+        if (sinkDoneUs == t)
+        {
+            link_t *link = &links[sinkLink];
+            if (sinkMessage.frames == 0)
+                freeMessage(&sinkMessage);
+            else if (link->queueCount < link->config.queueLen)
+                enqueue(link, &sinkMessage);
+            else
+            {
+                link->blocked = true;
+                link->pending = sinkMessage;
+                link->blockedUntilUs = t + APP_SLCAN_TX_WAIT_MS * 1000.0;
+            }
+            sinkLink = -1;
+            sinkDoneUs = NEVER;
+        }
+
+        // RX task takes a batch from the driver queue when idle
+        if (rxDoneUs == NEVER && driverCount > 0)
+        {
+            can_receive(rxBatch, APP_CAPTURE_RX_BATCH, &rxCount, 0);
+            rxDoneUs = t + opt.rxBatchUs + rxCount * opt.rxFrameUs;
+        }
+
+        // Sinks core runs the next link with unread frames, round robin, blocked links wait
+        if (sinkLink < 0)
+        {
+            for (int n = 0; n < opt.linkCount; n++)
+            {
+                int i = (nextLink + n) % opt.linkCount;
+                link_t *link = &links[i];
+                if (!link->blocked && link->sink.cursor != publishedSeq)
+                {
+                    sinkLink = i;
+                    sinkDoneUs = t + buildMessage(link, &sinkMessage);
+                    nextLink = (i + 1) % opt.linkCount;
+                    break;
+                }
+            }
+        }
+    }
+
+    if (replayFile != NULL)
+    {
+        fclose(replayFile);
+        replayFile = NULL;
+    }
+}
+
+/* Report */
+
+static double percentile(const link_t *link, double p)
+{
+    if (link->latencySamples == 0)
+        return 0;
+    uint64_t rank = ceil(link->latencySamples * p);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HISTOGRAM_LEN; i++)
+    {
+        if (seen + link->histogram[i] >= rank)
+        {
+            // Samples spread evenly within the bucket, never above the largest one
+            double latency = (i + (double)(rank - seen) / link->histogram[i]) * HISTOGRAM_US;
+            return latency < link->maxLatencyUs ? latency : link->maxLatencyUs;
+        }
+        seen += link->histogram[i];
+    }
+    return link->maxLatencyUs;
+}
+
+static void report(void)
+{
+    // A replay can end before --seconds
+    double seconds = opt.replay != NULL ? fmin(opt.seconds, lastArrivalUs / 1e6) : opt.seconds;
+    if (seconds <= 0)
+        seconds = opt.seconds;
+    double offeredLoad = offeredBits * 100.0 / (opt.bitrate * seconds);
+    size_t staticBytes = APP_CAPTURE_RING_LEN * sizeof(capture_frame_t) + APP_CENSUS_MAX_IDS * sizeof(census_entry_t) +
+                         APP_RULES_MAX_RULES * sizeof(rules_rule_t);
+    bool lossless = driverDrops == 0;
+    for (int i = 0; i < opt.linkCount; i++)
+        lossless = lossless && links[i].sink.drops == 0 && links[i].txDrops == 0;
+
+    if (opt.json)
+    {
+        printf("{\"bitrate\":%" PRIu32 ",\"load\":%.1f,\"burst\":%d,\"ids\":%d,\"dlc\":%d,\"seconds\":%.1f,", opt.bitrate,
+               opt.replay != NULL ? offeredLoad : opt.load, opt.burst, opt.ids, opt.dlc, seconds);
+        printf("\"offered\":{\"frames\":%" PRIu64 ",\"fps\":%.1f,\"busLoad\":%.2f},", offeredFrames, offeredFrames / seconds,
+               offeredLoad);
+        printf("\"rx\":{\"frames\":%" PRIu64 ",\"fps\":%.1f,\"driverDrops\":%" PRIu64 ",\"hostNsPerFrame\":%.1f},",
+               processedFrames, processedFrames / seconds, driverDrops, processedFrames > 0 ? hostRxNs / processedFrames : 0);
+        printf("\"links\":{");
+        for (int i = 0; i < opt.linkCount; i++)
+        {
+            const link_t *link = &links[i];
+            printf("%s\"%s\":{\"fps\":%.1f,\"bytesPerSec\":%.1f,\"ringDrops\":%" PRIu32 ",\"txDrops\":%" PRIu64
+                   ",\"latencyUs\":{\"p50\":%.0f,\"p90\":%.0f,\"p99\":%.0f,\"p999\":%.0f,\"max\":%.0f}}",
+                   i > 0 ? "," : "", link->config.name, link->sentFrames / seconds, link->sentBytes / seconds, link->sink.drops,
+                   link->txDrops, percentile(link, 0.5), percentile(link, 0.9), percentile(link, 0.99), percentile(link, 0.999),
+                   link->maxLatencyUs);
+        }
+        printf("},\"heap\":{\"staticBytes\":%zu,\"peakMessageBytes\":%zu},\"lossless\":%s}", staticBytes, peakHeapBytes,
+               lossless ? "true" : "false");
+        return;
+    }
+
+    printf("bitrate %" PRIu32 " load %.1f%% burst %d: offered %.0f fps, rx %.0f fps, driver drops %" PRIu64 ", host %.0f ns/frame\n",
+           opt.bitrate, offeredLoad, opt.burst, offeredFrames / seconds, processedFrames / seconds, driverDrops,
+           processedFrames > 0 ? hostRxNs / processedFrames : 0);
+    printf("  %-6s %-9s %-10s %-10s %-9s %-7s %-7s %-7s %s\n", "link", "fps", "B/s", "ring drop", "tx drop", "p50 us", "p99 us",
+           "p999 us", "max us");
+    for (int i = 0; i < opt.linkCount; i++)
+    {
+        const link_t *link = &links[i];
+        printf("  %-6s %-9.0f %-10.0f %-10" PRIu32 " %-9" PRIu64 " %-7.0f %-7.0f %-7.0f %.0f\n", link->config.name,
+               link->sentFrames / seconds, link->sentBytes / seconds, link->sink.drops, link->txDrops, percentile(link, 0.5),
+               percentile(link, 0.99), percentile(link, 0.999), link->maxLatencyUs);
+    }
+    printf("  heap: %zu bytes static, %zu bytes peak in messages%s\n", staticBytes, peakHeapBytes, lossless ? ", lossless" : "");
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: pipeline_bench [--bitrate n] [--load %%] [--ids n] [--ext %%] [--dlc n|mix] [--burst n] [--seconds n]\n"
+                    "                      [--replay file] [--rules n] [--rx-queue n] [--link name:B/s:len]...\n"
+                    "                      [--cost rx,batch,sink,msg] [--sweep] [--json]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    opt = (options_t){
+        .bitrate = 500000,
+        .load = 50,
+        .ids = 64,
+        .dlc = 8,
+        .burst = 1,
+        .seconds = 10,
+        .rxQueueLen = 5,
+        .rxFrameUs = 12,
+        .rxBatchUs = 20,
+        .sinkFrameUs = 4,
+        .sinkMessageUs = 25,
+    };
+    bool sweep = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(arg, "--sweep") == 0)
+            sweep = true;
+        else if (strcmp(arg, "--json") == 0)
+            opt.json = true;
+        else if (value == NULL)
+            usage();
+        else
+        {
+            i++;
+            if (strcmp(arg, "--bitrate") == 0)
+                opt.bitrate = atoi(value);
+            else if (strcmp(arg, "--load") == 0)
+                opt.load = atof(value);
+            else if (strcmp(arg, "--ids") == 0)
+                opt.ids = atoi(value);
+            else if (strcmp(arg, "--ext") == 0)
+                opt.extPercent = atof(value);
+            else if (strcmp(arg, "--dlc") == 0)
+                opt.dlc = strcmp(value, "mix") == 0 ? -1 : atoi(value);
+            else if (strcmp(arg, "--burst") == 0)
+                opt.burst = atoi(value);
+            else if (strcmp(arg, "--seconds") == 0)
+                opt.seconds = atof(value);
+            else if (strcmp(arg, "--replay") == 0)
+                opt.replay = value;
+            else if (strcmp(arg, "--rules") == 0)
+                opt.rules = atoi(value);
+            else if (strcmp(arg, "--rx-queue") == 0)
+                opt.rxQueueLen = atoi(value);
+            else if (strcmp(arg, "--link") == 0 && opt.linkCount < MAX_LINKS)
+            {
+                link_config_t *link = &opt.links[opt.linkCount++];
+                if (sscanf(value, "%15[^:]:%lf:%d", link->name, &link->bytesPerSec, &link->queueLen) != 3)
+                    usage();
+            }
+            else if (strcmp(arg, "--cost") == 0)
+            {
+                if (sscanf(value, "%lf,%lf,%lf,%lf", &opt.rxFrameUs, &opt.rxBatchUs, &opt.sinkFrameUs, &opt.sinkMessageUs) != 4)
+                    usage();
+            }
+            else
+                usage();
+        }
+    }
+
+    if (opt.linkCount == 0)
+    {
+        opt.links[opt.linkCount++] = (link_config_t){"uart", UART_BAUDRATE / 10.0, UART_QUEUES_LEN};
+        opt.links[opt.linkCount++] = (link_config_t){"bt", 60000, APP_BT_TX_QUEUE_LEN};
+        opt.links[opt.linkCount++] = (link_config_t){"tcp", 1000000, APP_TCP_TX_QUEUE_LEN};
+    }
+    bool valid = opt.bitrate > 0 && opt.load > 0 && opt.load <= 100 && opt.ids > 0 && opt.ids <= 2048 && opt.dlc <= 8 &&
+                 opt.burst > 0 && opt.seconds > 0 && opt.rxQueueLen > 0 && opt.rxQueueLen <= 64 && opt.rules <= APP_RULES_MAX_RULES;
+    for (int i = 0; i < opt.linkCount; i++)
+        valid = valid && opt.links[i].bytesPerSec > 0 && opt.links[i].queueLen > 0 && opt.links[i].queueLen <= 256;
+    if (!valid || capture_setBitrate(opt.bitrate) != ESP_OK)
+        usage();
+
+    if (!sweep)
+    {
+        run();
+        report();
+        if (opt.json)
+            printf("\n");
+        return 0;
+    }
+
+    // Every point runs in a child process, the capture ring and its sinks cannot be reset
+    if (opt.json)
+        printf("[");
+    for (int load = 10; load <= 100; load += 10)
+    {
+        opt.load = load;
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            run();
+            report();
+            fflush(stdout);
+            _exit(0);
+        }
+        waitpid(pid, NULL, 0);
+        if (opt.json && load < 100)
+            printf(",\n");
+    }
+    if (opt.json)
+        printf("]\n");
+    return 0;
+}
@@ -0,0 +1,327 @@
+/*
+Host test of the flight recorder (main/recorder.c): frames are appended on a simulated clock, triggers fire from
+commands, patterns, bus errors and bus-off, and the windows written by the recorder task are compared with the frames
+expected before and after each trigger. The ring is the internal RAM one (no PSRAM).
+*/
+
+#include "host_test.h"
+
+#include "can.h"
+#include "capture.h"
+#include "config.h"
+#include "recorder.h"
+#include "sd.h"
+
+#include <stdlib.h>
+#include "esp_heap_caps.h"
+
+#define MAX_LINES (APP_RECORDER_RING_LEN + 8)
+#define LINE_LEN 64
+
+static char lines[MAX_LINES][LINE_LEN]; // Lines written by the last dump
+static size_t lineCount = 0;
+static char *sdBuffer = NULL;
+static size_t sdSize = 0;
+static bool sdAvailable = false;
+static twai_status_info_t busStatus = {0};
+
+void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+    return caps & MALLOC_CAP_SPIRAM ? NULL : malloc(size);
+}
+
+FILE *sd_createFile(const char *prefix)
+{
+    free(sdBuffer);
+    sdBuffer = NULL;
+    return sdAvailable ? open_memstream(&sdBuffer, &sdSize) : NULL;
+}
+
+bool capture_isDetecting(void)
+{
+    return false;
+}
+
+esp_err_t can_getStatusInfo(twai_status_info_t *status)
+{
+    *status = busStatus;
+    return ESP_OK;
+}
+
+static void output(void *ctx, const char *line, size_t len)
+{
+    if (lineCount < MAX_LINES && len < LINE_LEN)
+    {
+        memcpy(lines[lineCount], line, len);
+        lines[lineCount++][len] = '\0';
+    }
+}
+
+static void append(uint32_t id, bool extd, uint8_t dlc, uint8_t byte)
+{
+    twai_message_t msg = {.identifier = id, .extd = extd, .data_length_code = dlc};
+    memset(msg.data, byte, sizeof(msg.data));
+    recorder_append(&msg, testNowUs);
+}
+
+/// @brief Append a frame every periodUs until endUs (excluded)
+static void appendUntil(int64_t endUs, int64_t periodUs)
+{
+    for (; testNowUs < endUs; testNowUs += periodUs)
+        append(0x100, false, 1, testNowUs / periodUs);
+}
+
+static recorder_status_t getStatus(void)
+{
+    recorder_status_t status;
+    recorder_getStatus(&status);
+    return status;
+}
+
+/// @brief Run the recorder task once and keep the lines of the window it writes
+static void runRecorder(void)
+{
+    lineCount = 0;
+    wakeTask(RTOS_TASK_RECORDER);
+}
+
+/// @brief Check a dump header, window bounds and end marker
+static bool checkWindow(const char *header, const char *first, const char *last)
+{
+    bool ok = lineCount >= 3 && strcmp(lines[0], header) == 0 && strcmp(lines[1], first) == 0 &&
+              strcmp(lines[lineCount - 2], last) == 0 && strcmp(lines[lineCount - 1], "# end") == 0;
+    if (!ok && lineCount >= 3)
+        fprintf(stderr, "window \"%s\" \"%s\" .. \"%s\"\n", lines[0], lines[1], lines[lineCount - 2]);
+    return ok;
+}
+
+static void testPreTriggerWindow(void)
+{
+    recorder_status_t status = getStatus();
+    CHECK(status.state == RECORDER_ARMED && status.capacity == APP_RECORDER_RING_LEN && !status.psram);
+    CHECK(recorder_arm() == ESP_OK);
+    CHECK(recorder_setWindow(RECORDER_MAX_WINDOW_MS + 1, 0) == ESP_ERR_INVALID_ARG);
+
+    // Frames every 10 ms, the window keeps 1 s before and 0.5 s after the trigger
+    CHECK(recorder_setWindow(1000, 500) == ESP_OK);
+    testNowUs = 0;
+    appendUntil(3000000, 10000);
+    testNotifications = 0;
+    CHECK(recorder_trigger(RECORDER_TRIGGER_COMMAND) == ESP_OK);
+    CHECK(testNotifications == 1 && getStatus().state == RECORDER_TRIGGERED);
+    CHECK(recorder_trigger(RECORDER_TRIGGER_COMMAND) == ESP_ERR_INVALID_STATE);
+    CHECK(recorder_arm() == ESP_ERR_INVALID_STATE);
+
+    // The window start is found while post-trigger frames are recorded
+    runRecorder();
+    CHECK(lineCount == 0 && getStatus().state == RECORDER_TRIGGERED);
+
+    testNowUs += 10000;
+    appendUntil(3500000, 10000);
+    CHECK(getStatus().state == RECORDER_TRIGGERED && testNotifications == 0);
+    append(0x100, false, 1, 0x5E); // Frame at the end of the post-trigger window
+    CHECK(getStatus().state == RECORDER_DUMPING && testNotifications == 1);
+
+    runRecorder();
+    CHECK(lineCount == 1 + 150 + 1);
+    CHECK(checkWindow("# trigger:command time:3.000000 records:150", "(2.000000) can0 100#C8", "(3.500000) can0 100#5E"));
+    CHECK(strcmp(lines[100], "(2.990000) can0 100#2B") == 0 && strcmp(lines[101], "(3.010000) can0 100#2D") == 0);
+
+    status = getStatus();
+    CHECK(status.state == RECORDER_ARMED && status.triggers == 1 && status.dumps == 1);
+    CHECK(status.lastRecords == 150 && status.lastPreTriggerMs == 1000 && status.lastPostTriggerMs == 500);
+
+    // Frames of the previous window are not part of the next one
+    testNowUs = 3600000;
+    CHECK(recorder_trigger(RECORDER_TRIGGER_RULE) == ESP_OK);
+    testNowUs = 4200000;
+    runRecorder();
+    CHECK(lineCount == 2 && strcmp(lines[0], "# trigger:rule time:3.600000 records:0") == 0);
+    CHECK(getStatus().lastRecords == 0);
+}
+
+static void testPatternTrigger(void)
+{
+    // Byte 0 is 0xAA on identifier 0x456, any other bits
+    recorder_pattern_t pattern = {.enabled = true, .id = 0x456, .idMask = 0x7FF | RECORDER_ID_EXTD, .data = 0xAA, .dataMask = 0xFF};
+    recorder_setPattern(&pattern);
+    CHECK(recorder_setWindow(100, 50) == ESP_OK);
+
+    testNowUs = 10000000;
+    testNotifications = 0;
+    append(0x456, true, 8, 0xAA);  // Extended identifier
+    append(0x456, false, 0, 0xAA); // Bytes past DLC do not match
+    append(0x456, false, 8, 0xAB);
+    testNowUs += 1000;
+    twai_message_t rtr = {.identifier = 0x1ABCDEF0, .extd = true, .rtr = true};
+    recorder_append(&rtr, testNowUs);
+    CHECK(getStatus().state == RECORDER_ARMED && testNotifications == 0);
+
+    testNowUs += 1000;
+    append(0x456, false, 2, 0xAA);
+    CHECK(getStatus().state == RECORDER_TRIGGERED && testNotifications == 1);
+    runRecorder();
+
+    // The window also ends without traffic
+    testNowUs += 49999;
+    runRecorder();
+    CHECK(lineCount == 0);
+    testNowUs += 1;
+    runRecorder();
+    CHECK(lineCount == 1 + 5 + 1);
+    CHECK(checkWindow("# trigger:pattern time:10.002000 records:5", "(10.000000) can0 00000456#AAAAAAAAAAAAAAAA",
+                      "(10.002000) can0 456#AAAA"));
+    CHECK(strcmp(lines[2], "(10.000000) can0 456#") == 0);
+    CHECK(strcmp(lines[4], "(10.001000) can0 1ABCDEF0#R") == 0);
+    CHECK(getStatus().lastPreTriggerMs == 2 && getStatus().lastPostTriggerMs == 0);
+
+    recorder_setPattern(NULL);
+    append(0x456, false, 2, 0xAA);
+    CHECK(getStatus().state == RECORDER_ARMED);
+}
+
+/// @brief The ring is shared between pre and post-trigger frames when it is shorter than the window
+static void testRingShorterThanWindow(void)
+{
+    CHECK(recorder_setWindow(3000, 1000) == ESP_OK);
+    testNowUs = 20000000;
+    appendUntil(25000000, 1000);
+    CHECK(recorder_trigger(RECORDER_TRIGGER_COMMAND) == ESP_OK);
+    runRecorder();
+
+    uint32_t pre = APP_RECORDER_RING_LEN * 3 / 4;
+    int64_t firstUs = 25000000 - pre * 1000;
+    appendUntil(25000000 + (APP_RECORDER_RING_LEN - pre) * 1000 - 1000, 1000);
+    CHECK(getStatus().state == RECORDER_TRIGGERED);
+    appendUntil(25000000 + (APP_RECORDER_RING_LEN - pre) * 1000, 1000);
+    CHECK(getStatus().state == RECORDER_DUMPING);
+
+    runRecorder();
+    char first[LINE_LEN];
+    snprintf(first, sizeof(first), "(%lld.%06lld) can0 100#%02X", (long long)(firstUs / 1000000),
+             (long long)(firstUs % 1000000), (uint8_t)(firstUs / 1000));
+    CHECK(lineCount == APP_RECORDER_RING_LEN + 2 && strcmp(lines[1], first) == 0);
+    CHECK(getStatus().lastRecords == APP_RECORDER_RING_LEN);
+}
+
+/// @brief Record times keep 28 bits, windows across the wrap are written with increasing times
+static void testTimeWrap(void)
+{
+    CHECK(recorder_setWindow(1000, 1000) == ESP_OK);
+    int64_t wrapUs = 1LL << RECORDER_TIME_BITS;
+    testNowUs = wrapUs - 500000;
+    appendUntil(wrapUs + 200000, 100000);
+    CHECK(recorder_trigger(RECORDER_TRIGGER_COMMAND) == ESP_OK);
+    runRecorder();
+    testNowUs = wrapUs + 200000 + 1000000;
+    runRecorder();
+
+    CHECK(lineCount == 1 + 7 + 1);
+    CHECK(checkWindow("# trigger:command time:268.635456 records:7", "(267.935456) can0 100#77",
+                      "(268.535456) can0 100#7D"));
+    CHECK(getStatus().lastPreTriggerMs == 700);
+}
+
+static void testBusTriggers(void)
+{
+    CHECK(recorder_setWindow(0, 0) == ESP_OK);
+    recorder_setErrorBurst(100);
+    testNowUs = 300000000;
+    busStatus.bus_error_count = 1000;
+    runRecorder();
+
+    // 9 errors in 100 ms is below 100 errors per second, 10 is not; without post-trigger window it is written at once
+    uint32_t triggers = getStatus().triggers;
+    testNowUs += 100000;
+    busStatus.bus_error_count += 9;
+    runRecorder();
+    CHECK(getStatus().triggers == triggers && lineCount == 0);
+    testNowUs += 100000;
+    busStatus.bus_error_count += 10;
+    runRecorder();
+    CHECK(getStatus().triggers == triggers + 1 && getStatus().state == RECORDER_ARMED);
+    CHECK(lineCount == 2 && strcmp(lines[0], "# trigger:error-burst time:300.200000 records:0") == 0);
+
+    recorder_setErrorBurst(0);
+    testNowUs += 100000;
+    busStatus.bus_error_count += 1000;
+    runRecorder();
+    CHECK(getStatus().triggers == triggers + 1);
+
+    recorder_setBusOffTrigger(false);
+    recorder_notifyBusOff();
+    CHECK(getStatus().state == RECORDER_ARMED);
+    recorder_setBusOffTrigger(true);
+    recorder_notifyBusOff();
+    CHECK(getStatus().state == RECORDER_TRIGGERED);
+    testNowUs += 1000;
+    runRecorder();
+    CHECK(lineCount == 2 && strcmp(lines[0], "# trigger:bus-off time:300.300000 records:0") == 0);
+}
+
+static void testDisarm(void)
+{
+    recorder_disarm();
+    CHECK(getStatus().state == RECORDER_DISARMED);
+    CHECK(recorder_trigger(RECORDER_TRIGGER_COMMAND) == ESP_ERR_INVALID_STATE);
+    testNowUs = 400000000;
+    append(0x100, false, 1, 0x01);
+
+    // Frames appended while disarmed are not recorded
+    CHECK(recorder_arm() == ESP_OK);
+    CHECK(recorder_setWindow(1000, 0) == ESP_OK);
+    testNowUs += 1000;
+    append(0x100, false, 1, 0x02);
+    CHECK(recorder_trigger(RECORDER_TRIGGER_COMMAND) == ESP_OK);
+    runRecorder();
+    CHECK(lineCount == 3 && strcmp(lines[1], "(400.001000) can0 100#02") == 0);
+
+    // A pending window is discarded
+    CHECK(recorder_trigger(RECORDER_TRIGGER_COMMAND) == ESP_OK);
+    recorder_disarm();
+    testNowUs += 1000;
+    runRecorder();
+    CHECK(lineCount == 0 && getStatus().state == RECORDER_DISARMED);
+    CHECK(recorder_arm() == ESP_OK);
+}
+
+static void testSdOutput(void)
+{
+    recorder_setOutput(NULL, NULL);
+    CHECK(recorder_setWindow(1000, 0) == ESP_OK);
+    testNowUs = 500000000;
+    append(0x7DF, false, 2, 0x01);
+    uint32_t dumps = getStatus().dumps;
+
+    // Without SD card the window is discarded
+    sdAvailable = false;
+    CHECK(recorder_trigger(RECORDER_TRIGGER_COMMAND) == ESP_OK);
+    runRecorder();
+    CHECK(getStatus().dumps == dumps && getStatus().state == RECORDER_ARMED);
+
+    sdAvailable = true;
+    testNowUs += 1000;
+    append(0x7DF, false, 2, 0x02);
+    CHECK(recorder_trigger(RECORDER_TRIGGER_COMMAND) == ESP_OK);
+    runRecorder();
+    const char *expected = "# trigger:command time:500.001000 records:1\n(500.001000) can0 7DF#0202\n";
+    CHECK(getStatus().dumps == dumps + 1 && sdBuffer != NULL && strcmp(sdBuffer, expected) == 0);
+    free(sdBuffer);
+    sdBuffer = NULL;
+}
+
+int main(void)
+{
+    recorder_init();
+    recorder_setOutput(output, NULL);
+
+    testPreTriggerWindow();
+    testPatternTrigger();
+    testRingShorterThanWindow();
+    testTimeWrap();
+    testBusTriggers();
+    testDisarm();
+    testSdOutput();
+
+    return testResult("recorder_test");
+}
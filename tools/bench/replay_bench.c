@@ -0,0 +1,361 @@
+/*
+Host simulation of the timing error of log replay (main/replay.c), in simulated time:
+SD card reader -> read-ahead ring -> transmit task woken by the replay timer -> can_transmit -> CAN bus
+
+Logs are parsed with the device parser (main/candump.c) and frame lengths come from main/can.c. The device timing is
+a model: interrupt entry and context switch latencies, a random jitter for the interrupts and critical sections of
+other tasks (WiFi, Bluetooth), the can_transmit call duration, and a reader throughput with periodic SD card stalls.
+The TWAI TX queue is not modelled, frames wait for the bus in order.
+
+Three transmit schedulers are compared on the same log:
+    tick        vTaskDelayUntil on the 1ms FreeRTOS tick
+    timer       hardware timer alarm at the frame time, the task sends as soon as it runs
+    timer+spin  alarm --lead us early, the task spins on the timer to the frame time (replay.c)
+The error of a frame is the difference between its end on the bus and its log time (scaled by --speed), relative to
+the first frame: constant latencies cancel out. The gap error compares the time between consecutive frames. Late
+frames are handed to the driver more than APP_REPLAY_LATE_US after their time, underruns are late frames that waited
+for the reader. Results are deterministic for a given set of options.
+
+    replay_bench [options]
+    --log <file>                candump log (default: synthetic periodic traffic)
+    --ids <n>                   synthetic log: identifiers, periods 10ms to 1s (default 48)
+    --seconds <n>               synthetic log: duration (default 60)
+    --speed <percent>           replay time scale (default 100)
+    --bitrate <bit/s>           bus bitrate (default 500000)
+    --wake <isr,switch,jitter>  device latencies in us: interrupt entry, context switch, max random jitter (default 2,8,30)
+    --tx-cost <us>              can_transmit call duration (default 15)
+    --lead <us>                 timer+spin alarm lead (default APP_REPLAY_WAKE_LEAD_US)
+    --reader <fps,ms,s>         reader throughput in frames/s, SD stall duration and period (default 20000,30,1)
+    --buf <frames>              read-ahead ring length (default APP_REPLAY_BUF_LEN)
+*/
+
+#include "can.h"
+#include "candump.h"
+#include "config.h"
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum
+{
+    SCHED_TICK,
+    SCHED_TIMER,
+    SCHED_SPIN,
+    SCHED_COUNT,
+} scheduler_t;
+
+static const char *SCHEDULER_NAMES[] = {"tick", "timer", "timer+spin"};
+
+typedef struct
+{
+    const char *log;
+    int ids;
+    double seconds;
+    int speedPercent;
+    uint32_t bitrate;
+    double isrUs, switchUs, jitterUs;
+    double txCostUs;
+    double leadUs;
+    double readerFps, stallMs, stallPeriodS;
+    int bufLen;
+} options_t;
+
+typedef struct
+{
+    twai_message_t msg;
+    int64_t logUs;
+} frame_t;
+
+static options_t opt;
+static frame_t *frames = NULL;
+static size_t frameCount = 0;
+static uint32_t rngState;
+
+static uint32_t rng(void)
+{
+    rngState = rngState * 1664525 + 1013904223;
+    return rngState >> 8;
+}
+
+static double jitter(double maxUs)
+{
+    return maxUs * (rng() & 0xFFFF) / 65536.0;
+}
+
+static void addFrame(const twai_message_t *msg, int64_t logUs)
+{
+    static size_t capacity = 0;
+    if (frameCount == capacity)
+    {
+        capacity = capacity > 0 ? capacity * 2 : 4096;
+        frames = realloc(frames, capacity * sizeof(frame_t));
+        if (frames == NULL)
+            exit(1);
+    }
+    frames[frameCount++] = (frame_t){.msg = *msg, .logUs = logUs};
+}
+
+static bool loadLog(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return false;
+
+    char line[APP_REPLAY_MAX_LINE_LEN];
+    candump_frame_t frame;
+    while (fgets(line, sizeof(line), file) != NULL)
+        if (candump_parseLine(line, &frame) == ESP_OK)
+            addFrame(&frame.msg, frame.timeUs);
+    fclose(file);
+    return frameCount > 0;
+}
+
+static int compareLogTime(const void *a, const void *b)
+{
+    const frame_t *fa = a, *fb = b;
+    return fa->logUs < fb->logUs ? -1 : fa->logUs > fb->logUs;
+}
+
+/// @brief Periodic traffic like a vehicle bus, log times are frame ends on a bus at --bitrate
+static void generateLog(void)
+{
+    static const int PERIODS_MS[] = {10, 10, 20, 20, 20, 50, 50, 100, 100, 100, 200, 500, 1000};
+    size_t periodCount = sizeof(PERIODS_MS) / sizeof(PERIODS_MS[0]);
+
+    for (int n = 0; n < opt.ids; n++)
+    {
+        int64_t periodUs = PERIODS_MS[n % periodCount] * 1000LL;
+        twai_message_t msg = {.identifier = (0x100 + n * 13) & 0x7FF, .data_length_code = 8};
+        for (int64_t t = rng() % periodUs; t < opt.seconds * 1e6; t += periodUs)
+        {
+            for (int i = 0; i < 8; i++)
+                msg.data[i] = rng();
+            addFrame(&msg, t);
+        }
+    }
+    qsort(frames, frameCount, sizeof(frame_t), compareLogTime);
+
+    // Frames due at the same time leave the bus one after the other
+    int64_t busFreeUs = 0;
+    for (size_t i = 0; i < frameCount; i++)
+    {
+        int64_t frameUs = ceil(can_frameBits(&frames[i].msg) * 1e6 / opt.bitrate);
+        if (frames[i].logUs < busFreeUs + frameUs)
+            frames[i].logUs = busFreeUs + frameUs;
+        busFreeUs = frames[i].logUs;
+    }
+}
+
+static int compareDouble(const void *a, const void *b)
+{
+    double da = *(const double *)a, db = *(const double *)b;
+    return da < db ? -1 : da > db;
+}
+
+static double percentile(const double *sorted, size_t n, double p)
+{
+    size_t rank = ceil(n * p);
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void simulate(scheduler_t scheduler, double *errors, double *gapErrors)
+{
+    rngState = 12345;
+    double *callDoneUs = malloc(frameCount * sizeof(double));
+    if (callDoneUs == NULL)
+        exit(1);
+
+    double readerUs = 0;
+    double nextStallUs = opt.stallPeriodS * 1e6;
+    double taskFreeUs = 0;
+    double busFreeUs = 0;
+    double firstEndUs = 0, lastEndUs = 0, lastTimeUs = 0;
+    uint64_t late = 0, underruns = 0;
+    double maxDispatchUs = 0;
+
+    for (size_t i = 0; i < frameCount; i++)
+    {
+        // Same integer scaling as replay.c
+        double timeUs = (frames[i].logUs - frames[0].logUs) * 100 / opt.speedPercent;
+
+        // Reader: the timer starts once the ring is full, a full ring waits until half of it is sent
+        double availableUs = 0;
+        if (i >= (size_t)opt.bufLen)
+        {
+            if (callDoneUs[i - opt.bufLen] > readerUs)
+                readerUs = fmax(readerUs, callDoneUs[i - opt.bufLen / 2 - 1]);
+            readerUs += 1e6 / opt.readerFps;
+            if (readerUs >= nextStallUs)
+            {
+                readerUs += opt.stallMs * 1000;
+                nextStallUs += opt.stallPeriodS * 1e6;
+            }
+            availableUs = readerUs;
+        }
+
+        // Transmit task: woken by the reader when the ring ran empty, otherwise ready after the previous frame
+        bool starved = availableUs > taskFreeUs;
+        double readyUs = starved ? availableUs + opt.switchUs + jitter(opt.jitterUs) : taskFreeUs;
+        double startUs = readyUs;
+        if (timeUs > readyUs)
+        {
+            switch (scheduler)
+            {
+            case SCHED_TICK:
+                startUs = ceil(timeUs / 1000) * 1000 + opt.isrUs + opt.switchUs + jitter(opt.jitterUs);
+                break;
+            case SCHED_TIMER:
+                startUs = timeUs + opt.isrUs + opt.switchUs + jitter(opt.jitterUs);
+                break;
+            default:
+                if (timeUs > readyUs + 2 * opt.leadUs)
+                    readyUs = timeUs - opt.leadUs + opt.isrUs + opt.switchUs + jitter(opt.jitterUs);
+                startUs = fmax(readyUs, timeUs) + jitter(1); // Timer read granularity
+                break;
+            }
+        }
+
+        double dispatchUs = startUs - timeUs;
+        if (dispatchUs > APP_REPLAY_LATE_US)
+        {
+            late++;
+            if (starved)
+                underruns++;
+        }
+        maxDispatchUs = fmax(maxDispatchUs, dispatchUs);
+
+        callDoneUs[i] = startUs + opt.txCostUs;
+        taskFreeUs = callDoneUs[i];
+        double endUs = fmax(callDoneUs[i], busFreeUs) + can_frameBits(&frames[i].msg) * 1e6 / opt.bitrate;
+        busFreeUs = endUs;
+
+        if (i == 0)
+            firstEndUs = endUs;
+        errors[i] = fabs((endUs - firstEndUs) - timeUs);
+        if (i > 0)
+            gapErrors[i - 1] = fabs((endUs - lastEndUs) - (timeUs - lastTimeUs));
+        lastEndUs = endUs;
+        lastTimeUs = timeUs;
+    }
+    free(callDoneUs);
+
+    double sum = 0;
+    for (size_t i = 0; i < frameCount; i++)
+        sum += errors[i];
+    qsort(errors, frameCount, sizeof(double), compareDouble);
+    size_t gaps = frameCount > 1 ? frameCount - 1 : 1;
+    qsort(gapErrors, gaps, sizeof(double), compareDouble);
+
+    printf("  %-11s %-8.1f %-7.1f %-7.1f %-8.1f %-8.1f %-10.1f %-9.1f %-7" PRIu64 " %" PRIu64 "\n", SCHEDULER_NAMES[scheduler],
+           sum / frameCount, percentile(errors, frameCount, 0.5), percentile(errors, frameCount, 0.99),
+           percentile(errors, frameCount, 0.999), errors[frameCount - 1], percentile(gapErrors, gaps, 0.99), maxDispatchUs, late,
+           underruns);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: replay_bench [--log file] [--ids n] [--seconds n] [--speed %%] [--bitrate n]\n"
+                    "                    [--wake isr,switch,jitter] [--tx-cost us] [--lead us] [--reader fps,ms,s] [--buf n]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    opt = (options_t){
+        .ids = 48,
+        .seconds = 60,
+        .speedPercent = 100,
+        .bitrate = 500000,
+        .isrUs = 2,
+        .switchUs = 8,
+        .jitterUs = 30,
+        .txCostUs = 15,
+        .leadUs = APP_REPLAY_WAKE_LEAD_US,
+        .readerFps = 20000,
+        .stallMs = 30,
+        .stallPeriodS = 1,
+        .bufLen = APP_REPLAY_BUF_LEN,
+    };
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (value == NULL)
+            usage();
+        i++;
+        if (strcmp(arg, "--log") == 0)
+            opt.log = value;
+        else if (strcmp(arg, "--ids") == 0)
+            opt.ids = atoi(value);
+        else if (strcmp(arg, "--seconds") == 0)
+            opt.seconds = atof(value);
+        else if (strcmp(arg, "--speed") == 0)
+            opt.speedPercent = atoi(value);
+        else if (strcmp(arg, "--bitrate") == 0)
+            opt.bitrate = atoi(value);
+        else if (strcmp(arg, "--wake") == 0)
+        {
+            if (sscanf(value, "%lf,%lf,%lf", &opt.isrUs, &opt.switchUs, &opt.jitterUs) != 3)
+                usage();
+        }
+        else if (strcmp(arg, "--tx-cost") == 0)
+            opt.txCostUs = atof(value);
+        else if (strcmp(arg, "--lead") == 0)
+            opt.leadUs = atof(value);
+        else if (strcmp(arg, "--reader") == 0)
+        {
+            if (sscanf(value, "%lf,%lf,%lf", &opt.readerFps, &opt.stallMs, &opt.stallPeriodS) != 3)
+                usage();
+        }
+        else if (strcmp(arg, "--buf") == 0)
+            opt.bufLen = atoi(value);
+        else
+            usage();
+    }
+    if (opt.ids <= 0 || opt.ids > 2048 || opt.seconds <= 0 || opt.speedPercent <= 0 ||
+        opt.speedPercent > APP_REPLAY_MAX_SPEED_PERCENT || opt.bitrate == 0 || opt.readerFps <= 0 || opt.stallPeriodS <= 0 ||
+        opt.bufLen < 2)
+        usage();
+
+    rngState = 1;
+    if (opt.log != NULL)
+    {
+        if (!loadLog(opt.log))
+        {
+            fprintf(stderr, "cannot read frames from %s\n", opt.log);
+            return 1;
+        }
+    }
+    else
+        generateLog();
+
+    double durationS = (frames[frameCount - 1].logUs - frames[0].logUs) / 1e6;
+    uint64_t bits = 0;
+    for (size_t i = 0; i < frameCount; i++)
+        bits += can_frameBits(&frames[i].msg);
+    printf("log %s: %zu frames over %.1f s (%.0f fps, bus load %.1f%% at %" PRIu32 " bit/s), speed %d%%\n",
+           opt.log != NULL ? opt.log : "synthetic", frameCount, durationS, frameCount / fmax(durationS, 1e-6),
+           bits * 100.0 / (opt.bitrate * fmax(durationS, 1e-6)) * opt.speedPercent / 100, opt.bitrate, opt.speedPercent);
+    printf("read-ahead %d frames, reader %.0f fps with %.0f ms stall every %.1f s; wake %.0f+%.0f+0..%.0f us, "
+           "tx %.0f us, lead %.0f us\n",
+           opt.bufLen, opt.readerFps, opt.stallMs, opt.stallPeriodS, opt.isrUs, opt.switchUs, opt.jitterUs, opt.txCostUs,
+           opt.leadUs);
+    printf("  %-11s %-8s %-7s %-7s %-8s %-8s %-10s %-9s %-7s %s\n", "scheduler", "mean us", "p50 us", "p99 us", "p999 us",
+           "max us", "gap p99 us", "late max", "late", "underruns");
+
+    double *errors = malloc(frameCount * sizeof(double));
+    double *gapErrors = malloc(frameCount * sizeof(double));
+    if (errors == NULL || gapErrors == NULL)
+        return 1;
+    for (int s = 0; s < SCHED_COUNT; s++)
+        simulate(s, errors, gapErrors);
+
+    free(errors);
+    free(gapErrors);
+    free(frames);
+    return 0;
+}
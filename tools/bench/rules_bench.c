@@ -0,0 +1,119 @@
+/*
+Host benchmark of frame match rule evaluation (main/rules.c), cost per received frame with 1, 32 and 256 rules
+
+Rules are spread over the identifiers of a synthetic bus (64 standard, 16 extended identifiers), plus a worst
+case where every rule targets the same identifier.
+*/
+
+#include "rules.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define FRAME_COUNT 1000000
+#define STD_IDS 64
+#define EXT_IDS 16
+
+static twai_message_t frames[4096];
+
+static uint32_t identifierOf(size_t n)
+{
+    return n < STD_IDS ? 0x100 + n * 7 : (0x18DA0000 + (n - STD_IDS) * 0x101) | RULES_ID_EXTD;
+}
+
+static void generateFrames(void)
+{
+    srand(1);
+    for (size_t i = 0; i < sizeof(frames) / sizeof(frames[0]); i++)
+    {
+        uint32_t id = identifierOf(rand() % (STD_IDS + EXT_IDS));
+        twai_message_t *msg = &frames[i];
+        msg->extd = (id & RULES_ID_EXTD) != 0;
+        msg->identifier = id & ~RULES_ID_EXTD;
+        msg->data_length_code = 8;
+        for (int b = 0; b < 8; b++)
+            msg->data[b] = rand();
+    }
+}
+
+static rules_rule_t added[256];
+static size_t addedCount = 0;
+
+static void addRules(size_t count, bool sameIdentifier)
+{
+    rules_clear();
+    addedCount = count;
+    for (size_t i = 0; i < count; i++)
+    {
+        rules_rule_t rule = {
+            .id = identifierOf(sameIdentifier ? 0 : i % (STD_IDS + EXT_IDS)),
+            .dlc = RULES_DLC_ANY,
+            .action = RULES_ACTION_COUNT,
+            .mask = 0xF0ULL << 16, // byte2 & 0xF0
+            .value = (uint64_t)(i & 0xF) << 20,
+        };
+        rules_set(i, &rule);
+        added[i] = rule;
+    }
+}
+
+/// @brief Compare the dispatch table result with a linear scan of every rule
+static bool validate(void)
+{
+    for (size_t i = 0; i < sizeof(frames) / sizeof(frames[0]); i++)
+    {
+        const twai_message_t *msg = &frames[i];
+        uint32_t id = msg->identifier | (msg->extd ? RULES_ID_EXTD : 0);
+        uint64_t data = 0;
+        for (int b = 0; b < 8; b++)
+            data |= (uint64_t)msg->data[b] << (b * 8);
+
+        size_t expected = 0;
+        for (size_t r = 0; r < addedCount; r++)
+            if (added[r].id == id && (data & added[r].mask) == added[r].value)
+                expected++;
+        if (rules_processFrame(msg, 0) != expected)
+            return false;
+    }
+    return true;
+}
+
+static double run(void)
+{
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < FRAME_COUNT; i++)
+        rules_processFrame(&frames[i & (sizeof(frames) / sizeof(frames[0]) - 1)], i);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    return ns / FRAME_COUNT;
+}
+
+int main(void)
+{
+    static const rules_callbacks_t callbacks = {0};
+    rules_init(&callbacks, NULL);
+    generateFrames();
+
+    printf("%-6s %-10s %s\n", "rules", "layout", "ns/frame");
+    printf("%-6d %-10s %.1f\n", 0, "-", run());
+
+    static const size_t COUNTS[] = {1, 32, 256};
+    for (size_t i = 0; i < sizeof(COUNTS) / sizeof(COUNTS[0]); i++)
+    {
+        for (int sameIdentifier = 0; sameIdentifier <= 1; sameIdentifier++)
+        {
+            addRules(COUNTS[i], sameIdentifier);
+            if (!validate())
+            {
+                fprintf(stderr, "%zu rules: dispatch table result differs from linear scan\n", COUNTS[i]);
+                return 1;
+            }
+            printf("%-6zu %-10s %.1f\n", COUNTS[i], sameIdentifier ? "same-id" : "spread", run());
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,493 @@
+/*
+Host test of the SLCAN links (main/slcan.c) with the capture ring and boot buffer (main/capture.c): the bus is auto
+started at boot, a host connects and opens the bus, and the frames forwarded to the link are compared with the frames
+received, each sent once and in order. The modules behind the other SLCAN commands are stubs.
+*/
+
+#include "host_test.h"
+
+#include "bt.h"
+#include "can.h"
+#include "capture.h"
+#include "census.h"
+#include "config.h"
+#include "isotp.h"
+#include "message.h"
+#include "monitor.h"
+#include "obd.h"
+#include "recorder.h"
+#include "replay.h"
+#include "rules.h"
+#include "settings.h"
+#include "slcan.h"
+#include "socketcand.h"
+#include "trace.h"
+#include "uart.h"
+#include "uds.h"
+
+#include "esp_mac.h"
+#include "esp_rom_sys.h"
+
+#define MAX_OUTPUT 1024
+
+static char output[MAX_OUTPUT]; // Text sent to the host since the last check
+static size_t outputLen = 0;
+static const char *hostInput = NULL; // Data received from the host, read by the dispatcher task
+static bool busOpen = false;
+static int rxStorage, txStorage;
+static QueueHandle_t rxQueue = &rxStorage, txQueue = &txStorage;
+
+/// @brief Compare the text sent to the host since the last check, then forget it
+static bool takeOutput(const char *expected)
+{
+    bool ok = strcmp(output, expected) == 0;
+    if (!ok)
+        fprintf(stderr, "sent \"%s\", \"%s\" expected\n", output, expected);
+    outputLen = 0;
+    output[0] = '\0';
+    return ok;
+}
+
+#define CHECK_OUTPUT(expected) CHECK(takeOutput(expected))
+
+static void receive(uint32_t id, uint8_t data)
+{
+    twai_message_t msg = {.identifier = id, .data_length_code = 1, .data = {data}};
+    testNowUs += 1000;
+    capture_processFrames(&msg, 1);
+}
+
+// Link queues and dispatcher queue set
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticksToWait)
+{
+    message_t msg = *(const message_t *)item;
+    if (queue == txQueue && outputLen + msg.length < MAX_OUTPUT)
+    {
+        memcpy(output + outputLen, msg.data, msg.length);
+        outputLen += msg.length;
+        output[outputLen] = '\0';
+    }
+    message_free(&msg);
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticksToWait)
+{
+    if (queue != rxQueue || hostInput == NULL)
+        return pdFALSE;
+    *(message_t *)item = message_new((uint8_t *)hostInput, strlen(hostInput));
+    hostInput = NULL;
+    return pdTRUE;
+}
+
+QueueSetHandle_t xQueueCreateSet(uint32_t length)
+{
+    return &rxQueue;
+}
+
+BaseType_t xQueueAddToSet(QueueSetMemberHandle_t queue, QueueSetHandle_t set)
+{
+    return pdPASS;
+}
+
+/// @brief The dispatcher task blocks here once the host input has been handled
+QueueSetMemberHandle_t xQueueSelectFromSet(QueueSetHandle_t set, TickType_t ticksToWait)
+{
+    if (hostInput == NULL && testTaskRunning)
+        longjmp(testTaskExit, 1);
+    return hostInput != NULL ? rxQueue : NULL;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return testNowUs / 1000;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    testNowUs += ticks * 1000;
+}
+
+// Adapter configuration: bus auto started at 500 kbit/s, link 0 forwarding every frame
+
+esp_err_t settings_load(settings_t *settings)
+{
+    *settings = (settings_t){.bitrate = 500000, .autoStart = SETTINGS_AUTO_START_NORMAL, .sinks = 1};
+    return ESP_OK;
+}
+
+esp_err_t settings_save(const settings_t *settings)
+{
+    return ESP_OK;
+}
+
+// CAN driver
+
+esp_err_t can_open(twai_mode_t mode, twai_timing_config_t *timingConfig)
+{
+    busOpen = true;
+    return ESP_OK;
+}
+
+esp_err_t can_close(void)
+{
+    busOpen = false;
+    return ESP_OK;
+}
+
+bool can_isOpen(void)
+{
+    return busOpen;
+}
+
+twai_mode_t can_getMode(void)
+{
+    return TWAI_MODE_NORMAL;
+}
+
+esp_err_t can_receive(twai_message_t *msgs, size_t maxCount, size_t *count, TickType_t ticksToWait)
+{
+    *count = 0;
+    return ESP_ERR_TIMEOUT;
+}
+
+esp_err_t can_transmit(const twai_message_t *msg, TickType_t ticksToWait)
+{
+    return ESP_OK;
+}
+
+esp_err_t can_getStatusInfo(twai_status_info_t *status)
+{
+    return ESP_ERR_INVALID_STATE;
+}
+
+// Modules behind the other commands and the other CAN RX consumers, not used by this test
+
+QueueHandle_t btTxQueue = NULL;
+volatile uint8_t trace_levels[TRACE_MODULE_COUNT];
+
+void trace_record(trace_event_t event, uint32_t arg0, uint32_t arg1, uint32_t arg2)
+{
+}
+
+void trace_recordText(trace_event_t event, uint32_t arg0, const char *text, size_t len)
+{
+}
+
+int trace_format(const trace_entry_t *entry, char *out, size_t size)
+{
+    return 0;
+}
+
+uint8_t trace_getCompiledLevel(trace_module_t module)
+{
+    return 0;
+}
+
+const char *trace_getModuleName(trace_module_t module)
+{
+    return "";
+}
+
+void trace_getStatus(trace_status_t *status)
+{
+    memset(status, 0, sizeof(*status));
+}
+
+void trace_initReader(trace_reader_t *reader)
+{
+    memset(reader, 0, sizeof(*reader));
+}
+
+bool trace_read(trace_reader_t *reader, trace_entry_t *entry)
+{
+    return false;
+}
+
+esp_err_t trace_setLevel(trace_module_t module, uint8_t level)
+{
+    return ESP_OK;
+}
+
+void trace_skipReader(trace_reader_t *reader)
+{
+}
+
+void bt_getCompressionStats(bt_compression_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+void bt_setCompression(bool enable)
+{
+}
+
+void uart_getStats(uart_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+void census_processFrame(const twai_message_t *msg, int64_t timestampUs)
+{
+}
+
+void census_clear(void)
+{
+}
+
+void census_getStatus(census_status_t *status)
+{
+    memset(status, 0, sizeof(*status));
+}
+
+bool census_next(size_t *pos, bool onlyUpdated, census_entry_t *entry)
+{
+    return false;
+}
+
+void monitor_getStats(monitor_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+void monitor_setAutoRecovery(bool enable)
+{
+}
+
+uint8_t monitor_takeFlags(void)
+{
+    return 0;
+}
+
+esp_err_t obd_addPid(uint8_t ecu, uint8_t pid, uint16_t periodMs)
+{
+    return ESP_OK;
+}
+
+void obd_clear(void)
+{
+}
+
+void obd_getStats(obd_stats_t *out)
+{
+    memset(out, 0, sizeof(*out));
+}
+
+esp_err_t obd_getValue(uint8_t ecu, uint8_t pid, obd_value_t *out)
+{
+    return ESP_ERR_NOT_FOUND;
+}
+
+size_t obd_getValues(obd_value_t *out, size_t max)
+{
+    return 0;
+}
+
+esp_err_t obd_removePid(uint8_t ecu, uint8_t pid)
+{
+    return ESP_OK;
+}
+
+void recorder_append(const twai_message_t *msg, int64_t timestampUs)
+{
+}
+
+esp_err_t recorder_arm(void)
+{
+    return ESP_OK;
+}
+
+void recorder_disarm(void)
+{
+}
+
+void recorder_getStatus(recorder_status_t *status)
+{
+    memset(status, 0, sizeof(*status));
+}
+
+void recorder_setBusOffTrigger(bool enable)
+{
+}
+
+void recorder_setErrorBurst(uint32_t errorsPerSecond)
+{
+}
+
+void recorder_setOutput(recorder_output_t output, void *ctx)
+{
+}
+
+void recorder_setPattern(const recorder_pattern_t *pattern)
+{
+}
+
+esp_err_t recorder_setWindow(uint32_t preTriggerMs, uint32_t postTriggerMs)
+{
+    return ESP_OK;
+}
+
+esp_err_t recorder_trigger(recorder_trigger_t source)
+{
+    return ESP_OK;
+}
+
+void replay_getStatus(replay_status_t *status)
+{
+    memset(status, 0, sizeof(*status));
+}
+
+esp_err_t replay_start(const char *name, const replay_options_t *options)
+{
+    return ESP_OK;
+}
+
+void replay_stop(void)
+{
+}
+
+void rtos_getHeapStats(rtos_heapStats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+bool rtos_nextTask(size_t *pos, rtos_taskStats_t *stats)
+{
+    return false;
+}
+
+void rules_init(const rules_callbacks_t *callbacks, void *ctx)
+{
+}
+
+size_t rules_processFrame(const twai_message_t *msg, int64_t timestampUs)
+{
+    return 0;
+}
+
+void rules_clear(void)
+{
+}
+
+esp_err_t rules_delete(size_t index)
+{
+    return ESP_OK;
+}
+
+bool rules_get(size_t index, rules_rule_t *rule, uint32_t *hits)
+{
+    return false;
+}
+
+void rules_resetHits(void)
+{
+}
+
+esp_err_t rules_set(size_t index, const rules_rule_t *rule)
+{
+    return ESP_OK;
+}
+
+void socketcand_processFrame(const twai_message_t *msg, int64_t timestampUs)
+{
+}
+
+void isotp_processFrame(const twai_message_t *msg)
+{
+}
+
+esp_err_t isotp_open(const isotp_config_t *config, isotp_session_t **session)
+{
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t isotp_close(isotp_session_t *session)
+{
+    return ESP_OK;
+}
+
+isotp_session_t *isotp_find(uint32_t txId, uint32_t rxId)
+{
+    return NULL;
+}
+
+const isotp_config_t *isotp_getConfig(isotp_session_t *session)
+{
+    return NULL;
+}
+
+esp_err_t isotp_send(isotp_session_t *session, const uint8_t *data, size_t len)
+{
+    return ESP_OK;
+}
+
+esp_err_t uds_start(const uds_jobConfig_t *config, uint8_t *job)
+{
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t uds_cancel(uint8_t job)
+{
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t esp_efuse_mac_get_default(uint8_t *mac)
+{
+    memset(mac, 0, 6);
+    return ESP_OK;
+}
+
+uint32_t esp_rom_get_cpu_ticks_per_us(void)
+{
+    return 240;
+}
+
+/// @brief A link connected to an auto started bus forwards nothing until the host opens the bus, then the frames
+/// received since boot followed by the live ones, each once and in order
+static void testAttach(void)
+{
+    slcan_init();
+    CHECK(busOpen && capture_getBitrate() == 500000);
+    CHECK(slcan_addLink("uart", &rxQueue, &txQueue) == ESP_OK);
+
+    // Connected, not attached yet: the frames stay in the boot buffer
+    receive(0x100, 0x00);
+    receive(0x101, 0x01);
+    wakeTask(RTOS_TASK_SLCAN_LINK_TX);
+    receive(0x102, 0x02);
+    wakeTask(RTOS_TASK_SLCAN_LINK_TX);
+    CHECK_OUTPUT("");
+
+    // O is answered with an error (bus already open) and attaches the link
+    hostInput = "O\r";
+    runTask(RTOS_TASK_SLCAN_DISPATCH);
+    CHECK(hostInput == NULL);
+    CHECK_OUTPUT("\a");
+
+    receive(0x103, 0x03);
+    wakeTask(RTOS_TASK_SLCAN_LINK_TX);
+    CHECK_OUTPUT("t100100\rt101101\rt102102\rt103103\r");
+
+    receive(0x104, 0x04);
+    wakeTask(RTOS_TASK_SLCAN_LINK_TX);
+    CHECK_OUTPUT("t104104\r");
+
+    // A second open does not send the boot buffer again
+    hostInput = "O\r";
+    runTask(RTOS_TASK_SLCAN_DISPATCH);
+    receive(0x105, 0x05);
+    wakeTask(RTOS_TASK_SLCAN_LINK_TX);
+    CHECK_OUTPUT("\at105105\r");
+
+    capture_bootStatus_t boot;
+    capture_getBootStatus(&boot);
+    CHECK(boot.frames == 3 && !boot.buffering && boot.overflows == 0);
+}
+
+int main(void)
+{
+    testAttach();
+
+    return testResult("slcan_test");
+}
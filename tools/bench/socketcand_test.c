@@ -0,0 +1,476 @@
+/*
+Host test of the socketcand protocol (main/socketcand.c) and of the broadcast manager behind bcmmode (main/bcm.c):
+sessions are driven with client commands, received frames and polls on a simulated clock, and everything sent to the
+client and on the bus is compared with the protocol. The server glue is checked for dropped lines on a full client
+queue or message budget (main/message.c).
+*/
+
+#include "host_test.h"
+
+#include "can.h"
+#include "config.h"
+#include "message.h"
+#include "socketcand.h"
+#include "tcp.h"
+#include "trace.h"
+
+#define MAX_OUTPUT 4096
+#define MAX_TX 32
+
+static char output[MAX_OUTPUT]; // Text sent to the client since the last check
+static size_t outputLen = 0;
+static bool busOpen = true;
+static twai_message_t txFrames[MAX_TX];
+static size_t txCount = 0;
+static esp_err_t txResult = ESP_OK;
+
+static void send(const char *data, size_t len)
+{
+    if (outputLen + len < MAX_OUTPUT)
+    {
+        memcpy(output + outputLen, data, len);
+        outputLen += len;
+        output[outputLen] = '\0';
+    }
+}
+
+static bool isBusOpen(void)
+{
+    return busOpen;
+}
+
+static esp_err_t transmit(twai_message_t *msg)
+{
+    if (txResult == ESP_OK && txCount < MAX_TX)
+        txFrames[txCount++] = *msg;
+    return txResult;
+}
+
+static const socketcand_callbacks_t callbacks = {
+    .send = send,
+    .isBusOpen = isBusOpen,
+    .transmit = transmit,
+};
+
+/// @brief Compare the text sent to the client since the last check, then forget it
+static bool takeOutput(const char *expected)
+{
+    bool ok = strcmp(output, expected) == 0;
+    if (!ok)
+        fprintf(stderr, "sent \"%s\", \"%s\" expected\n", output, expected);
+    outputLen = 0;
+    output[0] = '\0';
+    return ok;
+}
+
+#define CHECK_OUTPUT(expected) CHECK(takeOutput(expected))
+
+static void input(socketcand_t *s, const char *text)
+{
+    socketcand_sessionInput(s, text, strlen(text), testNowUs);
+}
+
+static void frame(socketcand_t *s, uint32_t id, bool extd, uint8_t dlc, const uint8_t *data)
+{
+    twai_message_t msg = {.identifier = id, .extd = extd, .data_length_code = dlc};
+    if (dlc > 0)
+        memcpy(msg.data, data, dlc);
+    socketcand_sessionFrame(s, &msg, testNowUs);
+}
+
+static void reset(socketcand_t *s)
+{
+    testNowUs = 0;
+    busOpen = true;
+    txCount = 0;
+    txResult = ESP_OK;
+    socketcand_sessionInit(s, &callbacks);
+    CHECK_OUTPUT("< hi >");
+}
+
+/// @brief Session opened in the default bcmmode
+static void open(socketcand_t *s)
+{
+    reset(s);
+    input(s, "< open can0 >");
+    CHECK_OUTPUT("< ok >");
+}
+
+static void testOpen(void)
+{
+    static socketcand_t s;
+    reset(&s);
+
+    input(&s, "< echo >");
+    CHECK_OUTPUT("< echo >");
+    input(&s, "< rawmode >");
+    CHECK_OUTPUT("< error bus not open >");
+    input(&s, "< open >");
+    CHECK_OUTPUT("< error bus not open >");
+
+    busOpen = false;
+    input(&s, "< open can0 >");
+    CHECK_OUTPUT("< error could not open bus >");
+    CHECK(s.mode == SOCKETCAND_MODE_NO_BUS);
+
+    busOpen = true;
+    input(&s, "< open can0 >");
+    CHECK_OUTPUT("< ok >");
+    CHECK(s.mode == SOCKETCAND_MODE_BCM);
+
+    // Commands are split across reads and separated by any whitespace
+    input(&s, "\r\n< raw");
+    input(&s, "mode >\n<\techo\t>");
+    CHECK_OUTPUT("< ok >< echo >");
+    CHECK(s.mode == SOCKETCAND_MODE_RAW);
+    input(&s, "< bcmmode >< isotpmode >");
+    CHECK_OUTPUT("< ok >< error isotpmode not supported >");
+    CHECK(s.mode == SOCKETCAND_MODE_BCM);
+
+    char longCmd[APP_SOCKETCAND_MAX_CMD_LEN + 8] = "<";
+    memset(longCmd + 1, 'x', APP_SOCKETCAND_MAX_CMD_LEN + 2);
+    longCmd[APP_SOCKETCAND_MAX_CMD_LEN + 3] = '>';
+    input(&s, longCmd);
+    CHECK_OUTPUT("< error command too long >");
+    input(&s, "< send 123 8 1 2 3 4 5 6 7 8 9 10 11 12 13 14 >");
+    CHECK_OUTPUT("< error too many arguments >");
+    input(&s, "< muxfilter 0 0 123 0 >< foo >");
+    CHECK_OUTPUT("< error muxfilter not supported >< error unknown command >");
+}
+
+static void testRawMode(void)
+{
+    static socketcand_t s;
+    open(&s);
+
+    // Frames are not reported in bcmmode without filter
+    frame(&s, 0x123, false, 2, (const uint8_t[]){0x11, 0x22});
+    CHECK_OUTPUT("");
+
+    input(&s, "< rawmode >");
+    CHECK_OUTPUT("< ok >");
+    testNowUs = 1000500;
+    frame(&s, 0x123, false, 2, (const uint8_t[]){0x11, 0x22});
+    frame(&s, 0x1ABCDEF0, true, 0, NULL);
+    CHECK_OUTPUT("< frame 123 1.000500 1122 >< frame 1ABCDEF0 1.000500  >");
+
+    input(&s, "< send 7DF 3 02 1 0C >");
+    CHECK_OUTPUT("");
+    CHECK(txCount == 1 && txFrames[0].identifier == 0x7DF && !txFrames[0].extd && txFrames[0].data_length_code == 3);
+    CHECK_MEM(txFrames[0].data, ((const uint8_t[]){0x02, 0x01, 0x0C}), 3);
+
+    // More than 3 digits or above 0x7FF is an extended identifier
+    input(&s, "< send 0123 0 >< send 800 0 >");
+    CHECK(txCount == 3 && txFrames[1].extd && txFrames[1].identifier == 0x123 && txFrames[2].extd);
+
+    input(&s, "< send 123 2 01 >< send 123 9 >< send 123 1 100 >< send 20000000 0 >");
+    CHECK_OUTPUT("< error invalid send >< error invalid send >< error invalid send >< error invalid send >");
+    txResult = ESP_ERR_TIMEOUT;
+    input(&s, "< send 123 0 >");
+    CHECK_OUTPUT("< error send failed >");
+
+    // BCM commands are only available in bcmmode
+    input(&s, "< add 0 1000 123 0 >");
+    CHECK_OUTPUT("< error unknown command >");
+}
+
+static void testCyclicTransmission(void)
+{
+    static socketcand_t s;
+    open(&s);
+
+    input(&s, "< add 0 100000 123 2 01 02 >");
+    CHECK_OUTPUT("");
+    CHECK(socketcand_sessionPoll(&s, 99999) == 100000 && txCount == 0);
+    CHECK(socketcand_sessionPoll(&s, 100000) == 200000 && txCount == 1);
+    CHECK_MEM(txFrames[0].data, ((const uint8_t[]){0x01, 0x02}), 2);
+
+    // Content changes, timing does not
+    input(&s, "< update 123 3 0A 0B 0C >");
+    CHECK_OUTPUT("");
+    CHECK(socketcand_sessionPoll(&s, 150000) == 200000 && txCount == 1);
+    CHECK(socketcand_sessionPoll(&s, 200000) == 300000 && txCount == 2);
+    CHECK(txFrames[1].data_length_code == 3 && txFrames[1].data[2] == 0x0C);
+
+    // Missed transmissions are skipped instead of sent in a burst
+    CHECK(socketcand_sessionPoll(&s, 550000) == 650000 && txCount == 3);
+
+    // Adding the same identifier again restarts its timing, other identifiers run independently
+    testNowUs = 600000;
+    input(&s, "< add 1 0 123 0 >< add 0 50000 0456 1 FF >");
+    CHECK(socketcand_sessionPoll(&s, 650000) == 700000 && txCount == 4);
+    CHECK(txFrames[3].identifier == 0x456 && txFrames[3].extd);
+
+    input(&s, "< delete 123 >");
+    CHECK_OUTPUT("");
+    CHECK(socketcand_sessionPoll(&s, 1600000) == 1650000 && txCount == 5 && txFrames[4].identifier == 0x456);
+    input(&s, "< delete 123 >< delete 456 >< update 123 0 >");
+    CHECK_OUTPUT("< error not found >< error not found >< error not found >");
+    input(&s, "< delete 0456 >");
+    CHECK(socketcand_sessionPoll(&s, 10000000) == INT64_MAX && txCount == 5);
+
+    input(&s, "< add 0 0 123 0 >< add 0 1000 123 >< update 123 >");
+    CHECK_OUTPUT("< error cannot add >< error invalid add >< error invalid update >");
+    for (int i = 0; i < APP_BCM_MAX_TX_JOBS; i++)
+    {
+        char cmd[48];
+        snprintf(cmd, sizeof(cmd), "< add 0 1000 %X 0 >", 0x100 + i);
+        input(&s, cmd);
+    }
+    input(&s, "< add 0 1000 7FF 0 >");
+    CHECK_OUTPUT("< error cannot add >");
+
+    // Cyclic transmissions keep running in rawmode and stop with the session
+    input(&s, "< rawmode >");
+    CHECK_OUTPUT("< ok >");
+    CHECK(socketcand_sessionPoll(&s, 10001000) == 10002000 && txCount == 5 + APP_BCM_MAX_TX_JOBS);
+    socketcand_sessionClose(&s);
+    CHECK(socketcand_sessionPoll(&s, 10002000) == INT64_MAX && txCount == 5 + APP_BCM_MAX_TX_JOBS);
+}
+
+static void testFilters(void)
+{
+    static socketcand_t s;
+    open(&s);
+
+    // Changes of the first byte and of the data length are reported
+    input(&s, "< filter 0 0 123 1 FF >");
+    CHECK_OUTPUT("");
+    frame(&s, 0x123, false, 2, (const uint8_t[]){0x01, 0x00});
+    CHECK_OUTPUT("< frame 123 0.000000 0100 >");
+    frame(&s, 0x123, false, 2, (const uint8_t[]){0x01, 0x55});
+    frame(&s, 0x124, false, 2, (const uint8_t[]){0x01, 0x55});
+    frame(&s, 0x0123, true, 2, (const uint8_t[]){0x02, 0x55});
+    CHECK_OUTPUT("");
+    frame(&s, 0x123, false, 2, (const uint8_t[]){0x02, 0x55});
+    frame(&s, 0x123, false, 3, (const uint8_t[]){0x02, 0x55, 0x00});
+    CHECK_OUTPUT("< frame 123 0.000000 0255 >< frame 123 0.000000 025500 >");
+
+    // Bit masks
+    input(&s, "< filter 0 0 00000200 2 00 80 >");
+    frame(&s, 0x200, true, 2, (const uint8_t[]){0x00, 0x00});
+    frame(&s, 0x200, true, 2, (const uint8_t[]){0xFF, 0x7F});
+    frame(&s, 0x200, true, 2, (const uint8_t[]){0xFF, 0xFF});
+    CHECK_OUTPUT("< frame 00000200 0.000000 0000 >< frame 00000200 0.000000 FFFF >");
+
+    // Subscriptions report every frame
+    input(&s, "< subscribe 0 0 300 >");
+    frame(&s, 0x300, false, 1, (const uint8_t[]){0x01});
+    frame(&s, 0x300, false, 1, (const uint8_t[]){0x01});
+    CHECK_OUTPUT("< frame 300 0.000000 01 >< frame 300 0.000000 01 >");
+    input(&s, "< unsubscribe 300 >< unsubscribe 300 >");
+    CHECK_OUTPUT("< error not found >");
+    frame(&s, 0x300, false, 1, (const uint8_t[]){0x02});
+    CHECK_OUTPUT("");
+
+    input(&s, "< filter 0 0 123 >< subscribe 0 123 >< unsubscribe >");
+    CHECK_OUTPUT("< error invalid filter >< error invalid subscribe >< error invalid unsubscribe >");
+    for (int i = 0; i < APP_BCM_MAX_RX_FILTERS; i++)
+    {
+        char cmd[48];
+        snprintf(cmd, sizeof(cmd), "< subscribe 0 0 %X >", 0x400 + i);
+        input(&s, cmd);
+    }
+    CHECK_OUTPUT("< error cannot subscribe >< error cannot subscribe >");
+    input(&s, "< filter 0 0 7FF 0 >");
+    CHECK_OUTPUT("< error cannot add filter >");
+}
+
+static void testThrottling(void)
+{
+    static socketcand_t s;
+    open(&s);
+
+    input(&s, "< filter 0 100000 123 1 FF >");
+    frame(&s, 0x123, false, 1, (const uint8_t[]){0x01});
+    CHECK_OUTPUT("< frame 123 0.000000 01 >");
+
+    // Changes within the interval are merged, the latest content is reported with its reception time
+    testNowUs = 10000;
+    frame(&s, 0x123, false, 1, (const uint8_t[]){0x02});
+    testNowUs = 20000;
+    frame(&s, 0x123, false, 1, (const uint8_t[]){0x03});
+    CHECK_OUTPUT("");
+    CHECK(socketcand_sessionPoll(&s, 99999) == 100000);
+    CHECK_OUTPUT("");
+    CHECK(socketcand_sessionPoll(&s, 100000) == INT64_MAX);
+    CHECK_OUTPUT("< frame 123 0.020000 03 >");
+
+    // The interval restarts at the throttled report
+    testNowUs = 150000;
+    frame(&s, 0x123, false, 1, (const uint8_t[]){0x04});
+    CHECK_OUTPUT("");
+    CHECK(socketcand_sessionPoll(&s, 150000) == 200000);
+    CHECK(socketcand_sessionPoll(&s, 200000) == INT64_MAX);
+    CHECK_OUTPUT("< frame 123 0.150000 04 >");
+
+    // Unchanged content is not reported, a change after the interval is reported at once
+    testNowUs = 250000;
+    frame(&s, 0x123, false, 1, (const uint8_t[]){0x04});
+    CHECK(socketcand_sessionPoll(&s, 300000) == INT64_MAX);
+    CHECK_OUTPUT("");
+    testNowUs = 350000;
+    frame(&s, 0x123, false, 1, (const uint8_t[]){0x05});
+    CHECK_OUTPUT("< frame 123 0.350000 05 >");
+
+    // Throttled reports are dropped with the filter
+    testNowUs = 360000;
+    frame(&s, 0x123, false, 1, (const uint8_t[]){0x06});
+    input(&s, "< unsubscribe 123 >");
+    CHECK(socketcand_sessionPoll(&s, 1000000) == INT64_MAX);
+    CHECK_OUTPUT("");
+}
+
+static void testControlMode(void)
+{
+    static socketcand_t s;
+    open(&s);
+
+    input(&s, "< send 123 2 01 02 >");
+    frame(&s, 0x123, false, 8, (const uint8_t[8]){0});
+    frame(&s, 0x124, false, 4, (const uint8_t[4]){0});
+    input(&s, "< controlmode >< send 123 0 >< statistics x >");
+    CHECK_OUTPUT("< ok >< error unknown command >< error unknown command >");
+    CHECK(txCount == 1);
+
+    testNowUs = 1000000;
+    input(&s, "< statistics 500 >");
+    CHECK(socketcand_sessionPoll(&s, 1499999) == 1500000);
+    CHECK_OUTPUT("");
+    CHECK(socketcand_sessionPoll(&s, 1500000) == 2000000);
+    CHECK_OUTPUT("< stat 12 2 2 1 >");
+
+    // Frames are counted but not reported
+    frame(&s, 0x125, false, 1, (const uint8_t[]){0});
+    CHECK(socketcand_sessionPoll(&s, 2000000) == 2000000 + 500000);
+    CHECK_OUTPUT("< stat 13 3 2 1 >");
+
+    input(&s, "< statistics 0 >");
+    CHECK(socketcand_sessionPoll(&s, 3000000) == INT64_MAX);
+    CHECK_OUTPUT("");
+}
+
+// Server glue against the message pools: client queues, CAN driver and trace stubs
+
+#define MAX_QUEUED 32
+
+static tcp_server_t *testServer = NULL;
+static message_t queued[MAX_QUEUED]; // Lines sent to the client
+static size_t queuedCount = 0;
+static size_t queueCapacity = MAX_QUEUED;
+static const char *clientInput = NULL; // Data received from the client, read by the session task
+static uint32_t traceTxQueueFull = 0;
+
+volatile uint8_t trace_levels[TRACE_MODULE_COUNT] = {[TRACE_MODULE_TCP] = TRACE_LEVEL_ERROR};
+
+void trace_record(trace_event_t event, uint32_t arg0, uint32_t arg1, uint32_t arg2)
+{
+    if (event == TRACE_EVENT_TCP_TX_QUEUE_FULL && arg0 == APP_SOCKETCAND_PORT)
+        traceTxQueueFull++;
+}
+
+void tcp_start(tcp_server_t *server)
+{
+    static int rxQueue, txQueue;
+    server->rxQueue = &rxQueue;
+    server->txQueue = &txQueue;
+    testServer = server;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticksToWait)
+{
+    if (queue != testServer->txQueue || queuedCount == queueCapacity)
+        return errQUEUE_FULL;
+    queued[queuedCount++] = *(const message_t *)item;
+    return pdTRUE;
+}
+
+/// @brief The session task blocks here once the client input has been read
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticksToWait)
+{
+    if (clientInput != NULL)
+    {
+        *(message_t *)item = message_new((uint8_t *)clientInput, strlen(clientInput));
+        clientInput = NULL;
+        return pdTRUE;
+    }
+    if (testTaskRunning)
+        longjmp(testTaskExit, 1);
+    return pdFALSE;
+}
+
+bool can_isOpen(void)
+{
+    return busOpen;
+}
+
+twai_mode_t can_getMode(void)
+{
+    return TWAI_MODE_NORMAL;
+}
+
+esp_err_t can_transmit(const twai_message_t *msg, TickType_t ticksToWait)
+{
+    return ESP_OK;
+}
+
+static void freeQueued(void)
+{
+    for (size_t i = 0; i < queuedCount; i++)
+        message_free(&queued[i]);
+    queuedCount = 0;
+}
+
+static message_poolStats_t smallPool(void)
+{
+    message_poolStats_t stats;
+    message_getPoolStats(0, &stats);
+    return stats;
+}
+
+/// @brief Lines that do not fit in the client queue or in its message budget are dropped and traced, not logged
+static void testServerQueueFull(void)
+{
+    busOpen = true;
+    socketcand_init();
+    CHECK(testServer != NULL && testServer->port == APP_SOCKETCAND_PORT && testServer->onConnect != NULL);
+
+    testServer->onConnect();
+    clientInput = "< open can0 >< rawmode >";
+    runTask(RTOS_TASK_SOCKETCAND);
+    CHECK(clientInput == NULL && queuedCount == 3);
+    CHECK(queued[2].length == 6 && memcmp(queued[2].data, "< ok >", 6) == 0);
+
+    // A client that does not read holds at most its budget of blocks
+    twai_message_t msg = {.identifier = 0x123, .data_length_code = 1};
+    for (int i = 0; i < APP_MESSAGE_LINK_SMALL_BLOCKS - 3 + 5; i++)
+        socketcand_processFrame(&msg, 0);
+    CHECK(queuedCount == APP_MESSAGE_LINK_SMALL_BLOCKS && traceTxQueueFull == 5);
+    CHECK(smallPool().used == APP_MESSAGE_LINK_SMALL_BLOCKS && smallPool().limited == 5 && smallPool().failures == 0);
+    CHECK(queued[3].length == 25 && memcmp(queued[3].data, "< frame 123 0.000000 00 >", 25) == 0);
+
+    // Blocks go back to the budget when the client reads, a full queue drops lines the same way
+    freeQueued();
+    queueCapacity = 2;
+    for (int i = 0; i < 5; i++)
+        socketcand_processFrame(&msg, 0);
+    CHECK(queuedCount == 2 && traceTxQueueFull == 8 && smallPool().used == 2 && smallPool().limited == 5);
+
+    freeQueued();
+    testServer->onDisconnect();
+    socketcand_processFrame(&msg, 0);
+    CHECK(queuedCount == 0 && smallPool().used == 0 && traceTxQueueFull == 8);
+}
+
+int main(void)
+{
+    testOpen();
+    testRawMode();
+    testCyclicTransmission();
+    testFilters();
+    testThrottling();
+    testControlMode();
+    testServerQueueFull();
+
+    return testResult("socketcand_test");
+}
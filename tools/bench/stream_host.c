@@ -0,0 +1,357 @@
+/*
+Host build of the WebSocket live streaming (main/stream.c) with the SocketCAN backend, to test dashboards and
+clients on Linux without a device. Minimal single-threaded WebSocket server (RFC 6455: handshake, masked client
+frames, ping, close), same endpoint and protocol as ws.c.
+
+    build-bench/stream_host vcan0 8080
+    tools/wsclient.py ws://localhost:8080/ws --rate 50 --id 123 7DF --sig Engine.Rpm
+    cangen vcan0 -g 1 -I 123 -L 8
+*/
+
+#include "can.h"
+#include "stream.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#define BATCH_LEN 16
+#define MAX_CONNECTIONS (APP_STREAM_MAX_CLIENTS + 1)
+#define RX_BUF_LEN (APP_STREAM_MAX_CMD_LEN + 16)
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+typedef struct
+{
+    int fd; // -1 when unused
+    bool upgraded;
+    uint8_t rx[RX_BUF_LEN];
+    size_t rxLen;
+    stream_client_t *client;
+} connection_t;
+
+static connection_t connections[MAX_CONNECTIONS];
+
+int64_t esp_timer_get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static uint32_t rol(uint32_t value, int bits)
+{
+    return value << bits | value >> (32 - bits);
+}
+
+static void sha1(const uint8_t *data, size_t len, uint8_t out[20])
+{
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    uint8_t block[64];
+    size_t total = (len + 9 + 63) / 64 * 64;
+
+    for (size_t offset = 0; offset < total; offset += 64)
+    {
+        for (size_t i = 0; i < 64; i++)
+        {
+            size_t pos = offset + i;
+            if (pos < len)
+                block[i] = data[pos];
+            else if (pos == len)
+                block[i] = 0x80;
+            else if (pos >= total - 8)
+                block[i] = (uint64_t)len * 8 >> (8 * (total - 1 - pos));
+            else
+                block[i] = 0;
+        }
+
+        uint32_t w[80];
+        for (int i = 0; i < 16; i++)
+            w[i] = (uint32_t)block[i * 4] << 24 | block[i * 4 + 1] << 16 | block[i * 4 + 2] << 8 | block[i * 4 + 3];
+        for (int i = 16; i < 80; i++)
+            w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; i++)
+        {
+            uint32_t f, k;
+            if (i < 20)
+                f = (b & c) | (~b & d), k = 0x5A827999;
+            else if (i < 40)
+                f = b ^ c ^ d, k = 0x6ED9EBA1;
+            else if (i < 60)
+                f = (b & c) | (b & d) | (c & d), k = 0x8F1BBCDC;
+            else
+                f = b ^ c ^ d, k = 0xCA62C1D6;
+            uint32_t t = rol(a, 5) + f + e + k + w[i];
+            e = d, d = c, c = rol(b, 30), b = a, a = t;
+        }
+        h[0] += a, h[1] += b, h[2] += c, h[3] += d, h[4] += e;
+    }
+
+    for (int i = 0; i < 20; i++)
+        out[i] = h[i / 4] >> (24 - 8 * (i % 4));
+}
+
+static void base64(const uint8_t *data, size_t len, char *out)
+{
+    static const char chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    for (size_t i = 0; i < len; i += 3)
+    {
+        uint32_t v = data[i] << 16 | (i + 1 < len ? data[i + 1] << 8 : 0) | (i + 2 < len ? data[i + 2] : 0);
+        *out++ = chars[v >> 18 & 63];
+        *out++ = chars[v >> 12 & 63];
+        *out++ = i + 1 < len ? chars[v >> 6 & 63] : '=';
+        *out++ = i + 2 < len ? chars[v & 63] : '=';
+    }
+    *out = 0;
+}
+
+static bool sendFrame(int fd, uint8_t opcode, const void *data, size_t len, int flags)
+{
+    uint8_t header[4] = {0x80 | opcode};
+    size_t headerLen = 2;
+    if (len < 126)
+        header[1] = len;
+    else
+    {
+        header[1] = 126;
+        header[2] = len >> 8;
+        header[3] = len;
+        headerLen = 4;
+    }
+    return send(fd, header, headerLen, flags | MSG_MORE | MSG_NOSIGNAL) == (ssize_t)headerLen &&
+           send(fd, data, len, flags | MSG_NOSIGNAL) == (ssize_t)len;
+}
+
+static void sendText(void *ctx, const char *text, size_t len)
+{
+    connection_t *c = ctx;
+    sendFrame(c->fd, 0x1, text, len, 0);
+}
+
+static bool sendBatch(void *ctx, const uint8_t *data, size_t len)
+{
+    connection_t *c = ctx;
+    struct pollfd pfd = {.fd = c->fd, .events = POLLOUT};
+    if (poll(&pfd, 1, 0) != 1 || !(pfd.revents & POLLOUT))
+        return false;
+    return sendFrame(c->fd, 0x2, data, len, 0);
+}
+
+static const stream_callbacks_t callbacks = {
+    .sendText = sendText,
+    .sendBatch = sendBatch,
+};
+
+static void closeConnection(connection_t *c)
+{
+    if (c->client != NULL)
+        stream_closeClient(c->client);
+    close(c->fd);
+    c->fd = -1;
+    c->client = NULL;
+    fprintf(stderr, "client disconnected\n");
+}
+
+/// @brief Answer the HTTP upgrade request once it is complete
+/// @return false if the connection must be closed
+static bool handshake(connection_t *c)
+{
+    c->rx[c->rxLen] = 0;
+    char *end = strstr((char *)c->rx, "\r\n\r\n");
+    if (end == NULL)
+        return c->rxLen < RX_BUF_LEN - 1;
+
+    const char *key = NULL;
+    for (char *line = strtok((char *)c->rx, "\r\n"); line != NULL; line = strtok(NULL, "\r\n"))
+        if (strncasecmp(line, "Sec-WebSocket-Key:", 18) == 0)
+            for (key = line + 18; *key == ' ';)
+                key++;
+    if (strncmp((char *)c->rx, "GET /ws ", 8) != 0 || key == NULL || strlen(key) > 64)
+    {
+        const char *reply = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+        send(c->fd, reply, strlen(reply), MSG_NOSIGNAL);
+        return false;
+    }
+
+    char text[192];
+    uint8_t digest[20];
+    char accept[32];
+    snprintf(text, sizeof(text), "%s" WS_GUID, key);
+    sha1((const uint8_t *)text, strlen(text), digest);
+    base64(digest, sizeof(digest), accept);
+
+    c->client = stream_openClient(c);
+    if (c->client == NULL)
+    {
+        const char *reply = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n";
+        send(c->fd, reply, strlen(reply), MSG_NOSIGNAL);
+        return false;
+    }
+
+    int len = snprintf(text, sizeof(text),
+                       "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                       "Sec-WebSocket-Accept: %s\r\n\r\n",
+                       accept);
+    send(c->fd, text, len, MSG_NOSIGNAL);
+    c->upgraded = true;
+    c->rxLen = 0; // Clients wait for the reply before sending frames
+    fprintf(stderr, "client connected\n");
+    return true;
+}
+
+/// @brief Handle the complete frames received from a client
+/// @return false if the connection must be closed
+static bool receiveFrames(connection_t *c)
+{
+    while (c->rxLen >= 2)
+    {
+        uint8_t opcode = c->rx[0] & 0x0F;
+        bool masked = c->rx[1] & 0x80;
+        size_t len = c->rx[1] & 0x7F;
+        size_t headerLen = 2;
+        if (len == 127 || !masked || !(c->rx[0] & 0x80))
+            return false; // Commands are short, unfragmented, and client frames are masked
+        if (len == 126)
+        {
+            if (c->rxLen < 4)
+                return true;
+            len = c->rx[2] << 8 | c->rx[3];
+            headerLen = 4;
+        }
+        if (headerLen + 4 + len > RX_BUF_LEN)
+            return false;
+        if (c->rxLen < headerLen + 4 + len)
+            return true;
+
+        const uint8_t *mask = c->rx + headerLen;
+        uint8_t *payload = c->rx + headerLen + 4;
+        for (size_t i = 0; i < len; i++)
+            payload[i] ^= mask[i % 4];
+
+        if (opcode == 0x1)
+            stream_clientInput(c->client, (const char *)payload, len, esp_timer_get_time());
+        else if (opcode == 0x8)
+        {
+            sendFrame(c->fd, 0x8, payload, len < 2 ? len : 2, 0);
+            return false;
+        }
+        else if (opcode == 0x9)
+            sendFrame(c->fd, 0xA, payload, len, 0);
+        else if (opcode != 0xA)
+            return false;
+
+        size_t frameLen = headerLen + 4 + len;
+        memmove(c->rx, c->rx + frameLen, c->rxLen - frameLen);
+        c->rxLen -= frameLen;
+    }
+    return true;
+}
+
+static int listenOn(int port)
+{
+    int fd = socket(AF_INET6, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in6 addr = {.sin6_family = AF_INET6, .sin6_port = htons(port), .sin6_addr = in6addr_any};
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 4) != 0)
+    {
+        perror("listen");
+        exit(1);
+    }
+    return fd;
+}
+
+int main(int argc, char **argv)
+{
+    const char *ifname = argc > 1 ? argv[1] : "vcan0";
+    int port = argc > 2 ? atoi(argv[2]) : 8080;
+
+    signal(SIGPIPE, SIG_IGN);
+    can_socketcanSetInterface(ifname);
+    can_setBackend(&can_socketcanBackend);
+    twai_timing_config_t timing = {0};
+    if (can_open(TWAI_MODE_LISTEN_ONLY, &timing) != ESP_OK)
+        return 1;
+
+    stream_init(&callbacks);
+    for (size_t i = 0; i < MAX_CONNECTIONS; i++)
+        connections[i].fd = -1;
+    int listenFd = listenOn(port);
+    fprintf(stderr, "streaming %s on ws://localhost:%d/ws\n", ifname, port);
+
+    int64_t nextUs = INT64_MAX;
+    int64_t statsUs = esp_timer_get_time() + 10000000;
+    while (1)
+    {
+        struct pollfd pfds[MAX_CONNECTIONS + 1] = {{.fd = listenFd, .events = POLLIN}};
+        for (size_t i = 0; i < MAX_CONNECTIONS; i++)
+            pfds[i + 1] = (struct pollfd){.fd = connections[i].fd, .events = POLLIN};
+        poll(pfds, MAX_CONNECTIONS + 1, 0);
+
+        if (pfds[0].revents & POLLIN)
+        {
+            int fd = accept(listenFd, NULL, NULL);
+            connection_t *c = NULL;
+            for (size_t i = 0; i < MAX_CONNECTIONS && c == NULL; i++)
+                if (connections[i].fd < 0)
+                    c = &connections[i];
+            if (c == NULL)
+                close(fd);
+            else if (fd >= 0)
+            {
+                int on = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                *c = (connection_t){.fd = fd};
+            }
+        }
+
+        for (size_t i = 0; i < MAX_CONNECTIONS; i++)
+        {
+            connection_t *c = &connections[i];
+            if (c->fd < 0 || !(pfds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+            ssize_t len = recv(c->fd, c->rx + c->rxLen, RX_BUF_LEN - 1 - c->rxLen, 0);
+            if (len <= 0)
+            {
+                closeConnection(c);
+                continue;
+            }
+            c->rxLen += len;
+            if (!(c->upgraded ? receiveFrames(c) : handshake(c)))
+                closeConnection(c);
+            nextUs = esp_timer_get_time(); // Subscriptions or rate may have changed
+        }
+
+        // Wait for frames until the next batch is due, at most 10 ms to keep serving sockets
+        int64_t waitUs = nextUs - esp_timer_get_time();
+        TickType_t wait = waitUs <= 0 ? 0 : waitUs >= 10000 ? 10 : (waitUs + 999) / 1000;
+        twai_message_t batch[BATCH_LEN];
+        size_t count;
+        if (can_receive(batch, BATCH_LEN, &count, wait) == ESP_OK)
+        {
+            int64_t nowUs = esp_timer_get_time();
+            for (size_t i = 0; i < count; i++)
+                stream_processFrame(&batch[i], nowUs);
+        }
+        nextUs = stream_poll(esp_timer_get_time());
+
+        if (esp_timer_get_time() >= statsUs)
+        {
+            stream_stats_t stats;
+            stream_getStats(&stats);
+            fprintf(stderr, "clients:%u items:%u frames:%u encodes:%u\n", stats.clients, stats.items, stats.frames,
+                    stats.encodes);
+            statsUs += 10000000;
+        }
+    }
+}
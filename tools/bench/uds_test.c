@@ -0,0 +1,398 @@
+/*
+Host test of the UDS batch client (main/uds.c over main/isotp.c), in simulated time against a scripted ECU:
+DID sweeps, DTC reads, diagnostic sessions, negative responses, responsePending (0x78) and timeouts
+
+    uds_test
+*/
+
+#include "host_test.h"
+
+#include "can.h"
+#include "config.h"
+#include "isotp.h"
+#include "uds.h"
+
+#define TESTER_ID 0x7E0
+#define ECU_ID 0x7E8
+#define STEP_US 1000
+#define MAX_PENDING 64
+#define MAX_EVENTS 32
+#define MAX_REQUESTS 64
+
+typedef struct
+{
+    uds_eventType_t type;
+    uint16_t id;
+    uint8_t data[64];
+    size_t len;
+    int64_t timeUs;
+} event_t;
+
+typedef struct
+{
+    int64_t timeUs;
+    twai_message_t msg;
+} pending_t;
+
+typedef struct
+{
+    uint8_t data[8];
+    size_t len;
+    int64_t timeUs;
+} request_t;
+
+/// @brief ECU behavior, answers a request with ecuReply
+typedef void (*ecuHandler_t)(const uint8_t *request, size_t len);
+
+static ecuHandler_t ecuHandler = NULL;
+
+// Frames from the ECU, delivered to the engine at their time
+static pending_t pending[MAX_PENDING];
+static size_t pendingCount = 0;
+
+// Multi-frame ECU response waiting for the tester Flow Control
+static uint8_t ecuTxBuf[256];
+static size_t ecuTxLen = 0;
+
+static request_t requests[MAX_REQUESTS];
+static size_t requestCount = 0;
+
+static event_t events[MAX_EVENTS];
+static size_t eventCount = 0;
+
+bool can_isOpen(void)
+{
+    return true;
+}
+
+twai_mode_t can_getMode(void)
+{
+    return TWAI_MODE_NORMAL;
+}
+
+static void queueFrame(int64_t timeUs, const uint8_t *data, size_t len)
+{
+    if (pendingCount == MAX_PENDING)
+        return;
+    pending_t *p = &pending[pendingCount++];
+    p->timeUs = timeUs;
+    p->msg = (twai_message_t){.identifier = ECU_ID, .data_length_code = 8};
+    memset(p->msg.data, 0xAA, 8);
+    memcpy(p->msg.data, data, len);
+}
+
+/// @brief Send a response after delayUs, segmented if needed (the CFs follow the tester Flow Control)
+static void ecuReply(int64_t delayUs, const uint8_t *data, size_t len)
+{
+    if (len <= 7)
+    {
+        uint8_t sf[8] = {len};
+        memcpy(sf + 1, data, len);
+        queueFrame(testNowUs + delayUs, sf, len + 1);
+        return;
+    }
+
+    uint8_t ff[8] = {0x10 | len >> 8, len & 0xFF};
+    memcpy(ff + 2, data, 6);
+    queueFrame(testNowUs + delayUs, ff, 8);
+    memcpy(ecuTxBuf, data, len);
+    ecuTxLen = len;
+}
+
+/// @brief Frames of the engine: requests (single frames) and Flow Control of multi-frame responses
+esp_err_t can_transmit(const twai_message_t *msg, TickType_t ticksToWait)
+{
+    CHECK(msg->identifier == TESTER_ID);
+    uint8_t pci = msg->data[0];
+
+    if (pci >> 4 == 0x3 && ecuTxLen > 0)
+    {
+        CHECK((pci & 0xF) == 0); // CTS, default block size: every CF at once
+        uint8_t sn = 1;
+        for (size_t pos = 6; pos < ecuTxLen; pos += 7, sn++)
+        {
+            uint8_t cf[8] = {0x20 | (sn & 0xF)};
+            size_t n = ecuTxLen - pos < 7 ? ecuTxLen - pos : 7;
+            memcpy(cf + 1, ecuTxBuf + pos, n);
+            queueFrame(testNowUs, cf, n + 1);
+        }
+        ecuTxLen = 0;
+    }
+    else if (pci >> 4 == 0x0)
+    {
+        size_t len = pci & 0xF;
+        CHECK(len >= 1 && len <= 7);
+        if (requestCount < MAX_REQUESTS)
+        {
+            memcpy(requests[requestCount].data, msg->data + 1, len);
+            requests[requestCount].len = len;
+            requests[requestCount++].timeUs = testNowUs;
+        }
+        if (ecuHandler != NULL)
+            ecuHandler(msg->data + 1, len);
+    }
+    else
+        CHECK(false); // UDS requests of the client always fit a single frame
+    return ESP_OK;
+}
+
+static void callback(uint8_t job, uds_eventType_t type, uint16_t id, const uint8_t *data, size_t len, void *ctx)
+{
+    if (eventCount == MAX_EVENTS)
+        return;
+    event_t *e = &events[eventCount++];
+    e->type = type;
+    e->id = id;
+    e->len = len < sizeof(e->data) ? len : sizeof(e->data);
+    if (e->len > 0)
+        memcpy(e->data, data, e->len);
+    e->timeUs = testNowUs;
+}
+
+/// @brief Run the engine for us: deliver due ECU frames, then the ISO-TP and UDS tasks, every STEP_US
+static void run(int64_t us)
+{
+    for (int64_t end = testNowUs + us; testNowUs < end; testNowUs += STEP_US)
+    {
+        for (size_t i = 0; i < pendingCount;)
+        {
+            if (pending[i].timeUs <= testNowUs)
+            {
+                twai_message_t msg = pending[i].msg;
+                memmove(&pending[i], &pending[i + 1], (--pendingCount - i) * sizeof(pending_t));
+                isotp_processFrame(&msg);
+            }
+            else
+                i++;
+        }
+        runTask(RTOS_TASK_ISOTP);
+        runTask(RTOS_TASK_UDS);
+    }
+}
+
+static void reset(ecuHandler_t handler)
+{
+    ecuHandler = handler;
+    pendingCount = 0;
+    ecuTxLen = 0;
+    requestCount = 0;
+    eventCount = 0;
+}
+
+static uint8_t startJob(uds_jobType_t type, uint8_t session, uint16_t didStart, uint16_t didEnd)
+{
+    uds_jobConfig_t config = {
+        .type = type,
+        .txId = TESTER_ID,
+        .rxId = ECU_ID,
+        .session = session,
+        .didStart = didStart,
+        .didEnd = didEnd,
+        .dtcMask = 0x08,
+        .callback = callback,
+    };
+    uint8_t job = 0xFF;
+    CHECK(uds_start(&config, &job) == ESP_OK);
+    return job;
+}
+
+static const event_t *lastEvent(void)
+{
+    static const event_t none = {.type = -1};
+    return eventCount > 0 ? &events[eventCount - 1] : &none;
+}
+
+/* ECU scripts */
+
+static const uint8_t VIN[] = "WVWZZZ1KZ9W000001";
+
+static void sweepEcu(const uint8_t *request, size_t len)
+{
+    if (request[0] != 0x22 || len != 3)
+        return;
+
+    uint16_t did = request[1] << 8 | request[2];
+    uint8_t response[32] = {0x62, request[1], request[2]};
+    switch (did)
+    {
+    case 0xF190: // VIN, multi-frame
+        memcpy(response + 3, VIN, 17);
+        ecuReply(2000, response, 20);
+        break;
+    case 0xF191: // Not supported
+        ecuReply(2000, (const uint8_t[]){0x7F, 0x22, 0x31}, 3);
+        break;
+    case 0xF192: // Response pending, answer after more than P2
+        ecuReply(2000, (const uint8_t[]){0x7F, 0x22, 0x78}, 3);
+        response[3] = 0x42;
+        ecuReply(2000 + 3 * APP_UDS_P2_MS * 1000, response, 4);
+        break;
+    case 0xF193: // conditionsNotCorrect
+        ecuReply(2000, (const uint8_t[]){0x7F, 0x22, 0x22}, 3);
+        break;
+    }
+}
+
+static void testDidSweep(void)
+{
+    reset(sweepEcu);
+    startJob(UDS_JOB_DID_SWEEP, 0, 0xF190, 0xF193);
+    run(5000 * 1000);
+
+    CHECK(requestCount == 4);
+    CHECK(eventCount == 4);
+    CHECK(events[0].type == UDS_EVENT_DID && events[0].id == 0xF190 && events[0].len == 17);
+    CHECK_MEM(events[0].data, VIN, 17);
+    // requestOutOfRange (0xF191) is not reported
+    CHECK(events[1].type == UDS_EVENT_DID && events[1].id == 0xF192 && events[1].len == 1 && events[1].data[0] == 0x42);
+    CHECK(events[2].type == UDS_EVENT_NEGATIVE && events[2].id == 0xF193 && events[2].len == 1 && events[2].data[0] == 0x22);
+    CHECK(events[3].type == UDS_EVENT_DONE && events[3].id == UDS_STATUS_OK);
+
+    // The next request follows each response without waiting for the poll interval
+    CHECK(requests[1].timeUs - requests[0].timeUs <= 2000 + 2 * STEP_US);
+    // responsePending extends the deadline to P2*: F192 is answered after P2 and is not skipped
+    CHECK(requests[3].timeUs - requests[2].timeUs >= 3 * APP_UDS_P2_MS * 1000);
+}
+
+static void dtcEcu(const uint8_t *request, size_t len)
+{
+    if (request[0] == 0x10)
+        ecuReply(1000, (const uint8_t[]){0x50, request[1], 0x00, 0x32, 0x01, 0xF4}, 6);
+    else if (request[0] == 0x19 && request[1] == 0x02)
+    {
+        CHECK(request[2] == 0x08);
+        const uint8_t response[] = {0x59, 0x02, 0xFF, 0x01, 0x23, 0x45, 0x08, 0xC1, 0x00, 0x73, 0x08, 0x12, 0x34, 0x56, 0x2F};
+        ecuReply(1000, response, sizeof(response));
+    }
+}
+
+static void testDtcReadInSession(void)
+{
+    reset(dtcEcu);
+    startJob(UDS_JOB_DTC_READ, 0x03, 0, 0);
+    run(1000 * 1000);
+
+    CHECK(requestCount == 2);
+    CHECK(requests[0].len == 2 && requests[0].data[0] == 0x10 && requests[0].data[1] == 0x03);
+    CHECK(requests[1].len == 3 && requests[1].data[0] == 0x19);
+    CHECK(eventCount == 2);
+    CHECK(events[0].type == UDS_EVENT_DTC && events[0].len == 13);
+    CHECK(events[0].data[0] == 0xFF && events[0].data[1] == 0x01 && events[0].data[12] == 0x2F);
+    CHECK(events[1].type == UDS_EVENT_DONE && events[1].id == UDS_STATUS_OK);
+}
+
+static void rejectingEcu(const uint8_t *request, size_t len)
+{
+    ecuReply(1000, (const uint8_t[]){0x7F, request[0], 0x12}, 3);
+}
+
+static void testSessionRejected(void)
+{
+    reset(rejectingEcu);
+    startJob(UDS_JOB_DTC_READ, 0x03, 0, 0);
+    run(1000 * 1000);
+
+    CHECK(requestCount == 1);
+    CHECK(eventCount == 1 && lastEvent()->type == UDS_EVENT_DONE && lastEvent()->id == UDS_STATUS_SESSION_REJECTED);
+}
+
+static void testTimeouts(void)
+{
+    // Silent ECU: every DID times out after P2, the job stops after APP_UDS_MAX_TIMEOUTS in a row
+    reset(NULL);
+    startJob(UDS_JOB_DID_SWEEP, 0, 0x0100, 0x01FF);
+    run(APP_UDS_MAX_TIMEOUTS * (APP_UDS_P2_MS + 20) * 1000);
+
+    CHECK(requestCount == APP_UDS_MAX_TIMEOUTS);
+    CHECK(requests[1].timeUs - requests[0].timeUs >= APP_UDS_P2_MS * 1000);
+    CHECK(requests[1].timeUs - requests[0].timeUs <= (APP_UDS_P2_MS + APP_UDS_POLL_INTERVAL_MS) * 1000 + STEP_US);
+    CHECK(eventCount == 1 && lastEvent()->type == UDS_EVENT_DONE && lastEvent()->id == UDS_STATUS_TIMEOUT);
+
+    // No answer to DiagnosticSessionControl aborts at once
+    reset(NULL);
+    startJob(UDS_JOB_DID_SWEEP, 0x03, 0x0100, 0x01FF);
+    run((APP_UDS_P2_MS + 20) * 1000);
+    CHECK(requestCount == 1);
+    CHECK(eventCount == 1 && lastEvent()->type == UDS_EVENT_DONE && lastEvent()->id == UDS_STATUS_TIMEOUT);
+}
+
+static void pendingForeverEcu(const uint8_t *request, size_t len)
+{
+    ecuReply(1000, (const uint8_t[]){0x7F, request[0], 0x78}, 3);
+}
+
+static void testResponsePendingTimeout(void)
+{
+    // responsePending without a final answer: the DID is skipped after P2*, not P2
+    reset(pendingForeverEcu);
+    startJob(UDS_JOB_DID_SWEEP, 0, 0x0100, 0x0101);
+    run((APP_UDS_P2_EXT_MS - 100) * 1000);
+    CHECK(requestCount == 1);
+    run(200 * 1000);
+    CHECK(requestCount == 2);
+    CHECK(eventCount == 0);
+    run(APP_UDS_P2_EXT_MS * 1000);
+    CHECK(eventCount == 1 && lastEvent()->type == UDS_EVENT_DONE && lastEvent()->id == UDS_STATUS_OK);
+}
+
+static void sessionEcu(const uint8_t *request, size_t len)
+{
+    if (request[0] == 0x10)
+        ecuReply(1000, (const uint8_t[]){0x50, request[1], 0x00, 0x32, 0x01, 0xF4}, 6);
+}
+
+static void testSessionKeepAlive(void)
+{
+    reset(sessionEcu);
+    uint8_t job = startJob(UDS_JOB_SESSION, 0x03, 0, 0);
+    run(3 * APP_UDS_TESTER_PRESENT_MS * 1000 + 100 * 1000);
+
+    // TesterPresent with suppressPosRspMsgIndicationBit, every APP_UDS_TESTER_PRESENT_MS
+    CHECK(requestCount == 4);
+    for (size_t i = 1; i < requestCount; i++)
+    {
+        CHECK(requests[i].len == 2 && requests[i].data[0] == 0x3E && requests[i].data[1] == 0x80);
+        CHECK(requests[i].timeUs - requests[i - 1].timeUs <= APP_UDS_TESTER_PRESENT_MS * 1000 + 2 * STEP_US);
+    }
+    CHECK(eventCount == 0);
+
+    CHECK(uds_cancel(job) == ESP_OK);
+    run(10 * 1000);
+    CHECK(eventCount == 1 && lastEvent()->type == UDS_EVENT_DONE && lastEvent()->id == UDS_STATUS_CANCELLED);
+    CHECK(uds_cancel(job) == ESP_ERR_NOT_FOUND);
+    CHECK(isotp_find(TESTER_ID, ECU_ID) == NULL);
+}
+
+static void testNoSession(void)
+{
+    reset(NULL);
+    isotp_config_t config = {.txId = TESTER_ID, .rxId = ECU_ID};
+    isotp_session_t *session;
+    CHECK(isotp_open(&config, &session) == ESP_OK);
+
+    startJob(UDS_JOB_DID_SWEEP, 0, 0xF190, 0xF190);
+    run(10 * 1000);
+    CHECK(requestCount == 0);
+    CHECK(eventCount == 1 && lastEvent()->type == UDS_EVENT_DONE && lastEvent()->id == UDS_STATUS_NO_SESSION);
+    CHECK(isotp_close(session) == ESP_OK);
+
+    uds_jobConfig_t invalid = {.type = UDS_JOB_DID_SWEEP, .didStart = 2, .didEnd = 1};
+    uint8_t job;
+    CHECK(uds_start(&invalid, &job) == ESP_ERR_INVALID_ARG);
+}
+
+int main(void)
+{
+    isotp_init();
+    uds_init();
+
+    testDidSweep();
+    testDtcReadInSession();
+    testSessionRejected();
+    testTimeouts();
+    testResponsePendingTimeout();
+    testSessionKeepAlive();
+    testNoSession();
+
+    return testResult("uds_test");
+}
@@ -0,0 +1,260 @@
+#!/usr/bin/env python3
+"""
+Host side of Bluetooth stream compression (fz1 link command)
+
+Usage:
+  btbridge.py <serial port>          Enable compression and expose the decompressed stream on a pseudo terminal
+  btbridge.py --benchmark <candump.log> [...]
+                                     Compress the SLCAN stream of recorded frames, report ratio and host time
+
+Bridge example:
+  btbridge.py /dev/rfcomm0           Prints the pseudo terminal path, e.g. /dev/pts/5
+  slcand -o -s6 /dev/pts/5 can0      Host commands are forwarded unchanged, device output is decompressed
+
+Stream format (see main/bt.h, main/lzss.h): raw bytes until the first block, then only blocks
+[0x1B][flags][compressed length:16][raw length:16][payload], lengths big endian. Payload is an LZSS
+bit stream, MSB first: "1" + 8 bit literal or "0" + (distance-1):10 + (length-3):5, padded to a byte.
+History (1024 bytes) carries across blocks and restarts on blocks with the RESET flag.
+"""
+
+import os
+import re
+import select
+import sys
+import termios
+import time
+import tty
+
+BLOCK_MARKER = 0x1B
+BLOCK_HEADER_LEN = 6
+FLAG_RESET = 0x01
+FLAG_STORED = 0x02
+
+WINDOW_BITS = 10
+LENGTH_BITS = 5
+MIN_MATCH = 3
+WINDOW_SIZE = 1 << WINDOW_BITS
+MAX_MATCH = MIN_MATCH + (1 << LENGTH_BITS) - 1
+MAX_BLOCK_SIZE = 1024
+MAX_CHAIN = 16  # Must match LZSS_MAX_CHAIN for the benchmark to reflect the device ratio
+
+
+class Decompressor:
+    """Incremental decoder, feed() accepts any chunking of the device stream"""
+
+    def __init__(self):
+        self.pending = bytearray()
+        self.history = bytearray()
+        self.synced = False  # First block seen, no raw bytes from then on
+
+    def feed(self, data):
+        self.pending += data
+        out = bytearray()
+        while self.pending:
+            if not self.synced and self.pending[0] != BLOCK_MARKER:
+                # Sent before compression was enabled (e.g. the fz1 response)
+                end = self.pending.find(BLOCK_MARKER)
+                end = len(self.pending) if end < 0 else end
+                out += self.pending[:end]
+                del self.pending[:end]
+                continue
+            if self.pending[0] != BLOCK_MARKER:
+                raise ValueError('lost block synchronization')
+            if len(self.pending) < BLOCK_HEADER_LEN:
+                break
+            flags = self.pending[1]
+            comp_len = self.pending[2] << 8 | self.pending[3]
+            raw_len = self.pending[4] << 8 | self.pending[5]
+            if len(self.pending) < BLOCK_HEADER_LEN + comp_len:
+                break
+            payload = bytes(self.pending[BLOCK_HEADER_LEN:BLOCK_HEADER_LEN + comp_len])
+            del self.pending[:BLOCK_HEADER_LEN + comp_len]
+
+            if flags & FLAG_RESET:
+                self.history = bytearray()
+                self.synced = True
+            block = payload if flags & FLAG_STORED else self._decode(payload, raw_len)
+            self.history = (self.history + block)[-WINDOW_SIZE:]
+            out += block
+        return bytes(out)
+
+    def _decode(self, payload, raw_len):
+        buf = bytearray(self.history)
+        start = len(buf)
+        bits = int.from_bytes(payload, 'big')
+        remaining = len(payload) * 8
+
+        def read(count):
+            nonlocal remaining
+            remaining -= count
+            return bits >> remaining & ((1 << count) - 1)
+
+        while len(buf) - start < raw_len:
+            if read(1):
+                buf.append(read(8))
+            else:
+                dist = read(WINDOW_BITS) + 1
+                length = read(LENGTH_BITS) + MIN_MATCH
+                for _ in range(length):
+                    buf.append(buf[-dist])
+        return bytes(buf[start:])
+
+
+class Compressor:
+    """Port of main/lzss.c, for offline ratio measurements"""
+
+    def __init__(self):
+        self.history = b''
+
+    def compress_block(self, data):
+        buf = self.history + data
+        head = {}
+        prev = [-1] * len(buf)
+
+        def insert(pos):
+            key = buf[pos:pos + MIN_MATCH]
+            prev[pos] = head.get(key, -1)
+            head[key] = pos
+
+        for i in range(len(self.history)):
+            if i + MIN_MATCH <= len(buf):
+                insert(i)
+
+        bits, bit_count = 0, 0
+        pos = len(self.history)
+        while pos < len(buf):
+            best_len, best_dist = 0, 0
+            max_len = min(len(buf) - pos, MAX_MATCH)
+            if max_len >= MIN_MATCH:
+                candidate = head.get(buf[pos:pos + MIN_MATCH], -1)
+                depth = 0
+                while candidate >= 0 and depth < MAX_CHAIN and pos - candidate <= WINDOW_SIZE:
+                    length = 0
+                    while length < max_len and buf[candidate + length] == buf[pos + length]:
+                        length += 1
+                    if length > best_len:
+                        best_len, best_dist = length, pos - candidate
+                        if length == max_len:
+                            break
+                    candidate = prev[candidate]
+                    depth += 1
+
+            if best_len >= MIN_MATCH:
+                bits = bits << (1 + WINDOW_BITS + LENGTH_BITS) | (best_dist - 1) << LENGTH_BITS | (best_len - MIN_MATCH)
+                bit_count += 1 + WINDOW_BITS + LENGTH_BITS
+            else:
+                best_len = 1
+                bits = bits << 9 | 0x100 | buf[pos]
+                bit_count += 9
+            for p in range(pos, pos + best_len):
+                if p + MIN_MATCH <= len(buf):
+                    insert(p)
+            pos += best_len
+
+        pad = -bit_count % 8
+        self.history = buf[-WINDOW_SIZE:]
+        return (bits << pad).to_bytes((bit_count + pad) // 8, 'big')
+
+    def block(self, data, reset):
+        """Frame data as sent by the device"""
+        payload = self.compress_block(data)
+        flags = FLAG_RESET if reset else 0
+        if len(payload) >= len(data):
+            flags |= FLAG_STORED
+            payload = data
+        return bytes([BLOCK_MARKER, flags, len(payload) >> 8, len(payload) & 0xFF, len(data) >> 8, len(data) & 0xFF]) + payload
+
+
+RE_CANDUMP = re.compile(r'^\(\d+\.\d+\)\s+\S+\s+([0-9A-Fa-f]+)#(R|[0-9A-Fa-f]*)')
+
+
+def candump_to_slcan(path):
+    """Convert candump -L lines to the SLCAN frames the device would forward"""
+    lines = []
+    with open(path) as f:
+        for line in f:
+            m = RE_CANDUMP.match(line)
+            if not m:
+                continue
+            ident, data = m.groups()
+            extd = len(ident) > 3
+            if data == 'R':
+                lines.append(f'{"R" if extd else "r"}{ident.upper()}0\r')
+            else:
+                lines.append(f'{"T" if extd else "t"}{ident.upper()}{len(data) // 2}{data.upper()}\r')
+    return lines
+
+
+def benchmark(paths):
+    for path in paths:
+        lines = candump_to_slcan(path)
+        if not lines:
+            print(f'{path}: no frames')
+            continue
+
+        # Blocks follow the device batching: frames are appended until the next one does not fit
+        blocks, current = [], ''
+        for line in lines:
+            if len(current) + len(line) > MAX_BLOCK_SIZE:
+                blocks.append(current.encode())
+                current = ''
+            current += line
+        blocks.append(current.encode())
+
+        compressor = Compressor()
+        start = time.perf_counter()
+        stream = b''.join(compressor.block(b, i == 0) for i, b in enumerate(blocks))
+        elapsed = time.perf_counter() - start
+
+        raw = b''.join(blocks)
+        if Decompressor().feed(stream) != raw:
+            raise AssertionError(f'{path}: round trip mismatch')
+
+        print(f'{path}: frames:{len(lines)} raw:{len(raw)} compressed:{len(stream)} '
+              f'ratio:{len(raw) / len(stream):.2f} host:{elapsed * 1e6 / (len(raw) / 1024):.0f}us/KB')
+    print('Device CPU cost: enable with fz1, replay the log on the bus, then query fz')
+
+
+def bridge(port):
+    device = os.open(port, os.O_RDWR | os.O_NOCTTY)
+    tty.setraw(device)
+    master, slave = os.openpty()
+    tty.setraw(master)
+    print(os.ttyname(slave), flush=True)
+
+    os.write(device, b'fz1\r')
+    decompressor = Decompressor()
+    try:
+        while True:
+            ready, _, _ = select.select([device, master], [], [])
+            if device in ready:
+                data = os.read(device, 4096)
+                if not data:
+                    break
+                os.write(master, decompressor.feed(data))
+            if master in ready:
+                try:
+                    data = os.read(master, 4096)
+                except OSError:  # No client attached to the pseudo terminal yet
+                    time.sleep(0.01)
+                    continue
+                os.write(device, data)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        try:
+            os.write(device, b'fz0\r')
+        except OSError:
+            pass
+        termios.tcflush(device, termios.TCIOFLUSH)
+        os.close(device)
+
+
+if __name__ == '__main__':
+    if len(sys.argv) >= 3 and sys.argv[1] == '--benchmark':
+        benchmark(sys.argv[2:])
+    elif len(sys.argv) == 2:
+        bridge(sys.argv[1])
+    else:
+        print(__doc__)
+        sys.exit(1)
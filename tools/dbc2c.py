@@ -0,0 +1,170 @@
+#!/usr/bin/env python3
+"""
+Generate on-device signal decoder tables (dbc_tables.h, dbc_tables.c) from a DBC file
+
+Usage: dbc2c.py <file.dbc | ""> <output directory>
+
+Signals are stored with a precomputed shift, so that the decoder extracts every signal from the
+frame payload loaded as a 64bit integer (little or big endian) with a single shift and mask.
+Standard identifiers are looked up through a direct 2048 entry index, extended identifiers through
+an open addressing hash table; both lookups are O(1).
+"""
+
+import os
+import re
+import sys
+
+RE_MESSAGE = re.compile(r'^BO_\s+(\d+)\s+(\w+)\s*:\s*(\d+)')
+RE_SIGNAL = re.compile(
+    r'^\s+SG_\s+(\w+)\s*(M|m\d+)?\s*:\s*(\d+)\|(\d+)@([01])([+-])\s*'
+    r'\(\s*([^,]+)\s*,\s*([^)]+)\s*\)\s*\[[^\]]*\]\s*"([^"]*)"')
+
+EXT_FLAG = 0x80000000
+HASH_MULTIPLIER = 0x9E3779B1  # Must match dbc.c
+
+
+def parse(path):
+    messages = []
+    current = None
+    with open(path, encoding='latin-1') as f:
+        for lineno, line in enumerate(f, 1):
+            m = RE_MESSAGE.match(line)
+            if m:
+                raw_id = int(m.group(1))
+                current = {
+                    'id': raw_id & 0x1FFFFFFF,
+                    'extd': bool(raw_id & EXT_FLAG),
+                    'name': m.group(2),
+                    'signals': [],
+                }
+                # VECTOR__INDEPENDENT_SIG_MSG holds unassigned signals, not a real frame
+                if current['name'] != 'VECTOR__INDEPENDENT_SIG_MSG':
+                    messages.append(current)
+                continue
+
+            m = RE_SIGNAL.match(line)
+            if m and current is not None:
+                name, mux, start, length, order, sign, scale, offset, unit = m.groups()
+                if mux is not None and mux.startswith('m'):
+                    print(f'{path}:{lineno}: skipping multiplexed signal {name}', file=sys.stderr)
+                    continue
+                start, length = int(start), int(length)
+                little_endian = order == '1'
+                if little_endian:
+                    shift = start
+                else:
+                    # Motorola start bit is the MSB in sawtooth numbering, convert to position from MSB of byte 0
+                    msb = (start // 8) * 8 + (7 - start % 8)
+                    shift = 64 - msb - length
+                if length == 0 or length > 64 or shift < 0 or shift + length > 64:
+                    print(f'{path}:{lineno}: skipping signal {name} with invalid layout', file=sys.stderr)
+                    continue
+                current['signals'].append({
+                    'name': f'{current["name"]}.{name}',
+                    'shift': shift,
+                    'length': length,
+                    'little_endian': little_endian,
+                    'signed': sign == '-',
+                    'scale': float(scale),
+                    'offset': float(offset),
+                    'unit': unit,
+                })
+            elif not line.startswith((' ', '\t')):
+                current = None
+
+    return [m for m in messages if m['signals']]
+
+
+def ext_hash(identifier, bits):
+    return ((identifier * HASH_MULTIPLIER) & 0xFFFFFFFF) >> (32 - bits) if bits > 0 else 0
+
+
+def c_string(s):
+    return '"' + s.replace('\\', '\\\\').replace('"', '\\"') + '"'
+
+
+def generate(messages, out_dir):
+    signals = [s for m in messages for s in m['signals']]
+    std_index = [0] * 2048
+    ext_messages = [(i, m) for i, m in enumerate(messages) if m['extd']]
+
+    for i, m in enumerate(messages):
+        if not m['extd']:
+            std_index[m['id'] & 0x7FF] = i + 1
+
+    ext_bits = 0
+    while (1 << ext_bits) < 2 * len(ext_messages):
+        ext_bits += 1
+    ext_table = [0] * (1 << ext_bits)
+    max_probe = 0
+    for i, m in ext_messages:
+        slot = ext_hash(m['id'], ext_bits)
+        probe = 1
+        while ext_table[slot] != 0:
+            slot = (slot + 1) % len(ext_table)
+            probe += 1
+        ext_table[slot] = i + 1
+        max_probe = max(max_probe, probe)
+
+    with open(os.path.join(out_dir, 'dbc_tables.h'), 'w') as f:
+        f.write('// Generated by tools/dbc2c.py, do not edit\n')
+        f.write('#pragma once\n\n')
+        f.write(f'#define DBC_MESSAGE_COUNT {len(messages)}\n')
+        f.write(f'#define DBC_SIGNAL_COUNT {len(signals)}\n')
+        f.write(f'#define DBC_EXT_HASH_BITS {ext_bits}\n')
+        f.write(f'#define DBC_EXT_MAX_PROBE {max_probe}\n')
+
+    with open(os.path.join(out_dir, 'dbc_tables.c'), 'w') as f:
+        f.write('// Generated by tools/dbc2c.py, do not edit\n')
+        f.write('#include "dbc.h"\n#include "dbc_tables.h"\n\n')
+
+        f.write('const dbc_signal_t DBC_SIGNALS[DBC_SIGNAL_COUNT > 0 ? DBC_SIGNAL_COUNT : 1] = {\n')
+        if not signals:
+            f.write('    {0},\n')
+        for s in signals:
+            f.write(f'    {{{c_string(s["name"])}, {c_string(s["unit"])}, {s["shift"]}, {s["length"]}, '
+                    f'{int(s["little_endian"])}, {int(s["signed"])}, {s["scale"]!r}f, {s["offset"]!r}f}},\n')
+        f.write('};\n\n')
+
+        f.write('const dbc_message_t DBC_MESSAGES[DBC_MESSAGE_COUNT > 0 ? DBC_MESSAGE_COUNT : 1] = {\n')
+        if not messages:
+            f.write('    {0},\n')
+        first = 0
+        for m in messages:
+            f.write(f'    {{0x{m["id"]:X}, {int(m["extd"])}, {first}, {len(m["signals"])}}}, // {m["name"]}\n')
+            first += len(m['signals'])
+        f.write('};\n\n')
+
+        f.write('// Index + 1 into DBC_MESSAGES by standard identifier, 0 if not present\n')
+        f.write('const uint16_t DBC_STD_INDEX[2048] = {\n')
+        if not any(std_index):
+            f.write('    0,\n')
+        for i, idx in enumerate(std_index):
+            if idx:
+                f.write(f'    [0x{i:03X}] = {idx},\n')
+        f.write('};\n\n')
+
+        f.write('// Index + 1 into DBC_MESSAGES by extended identifier hash (linear probing), 0 if empty\n')
+        f.write(f'const uint16_t DBC_EXT_INDEX[{len(ext_table)}] = {{\n')
+        if not any(ext_table):
+            f.write('    0,\n')
+        for i, idx in enumerate(ext_table):
+            if idx:
+                f.write(f'    [{i}] = {idx},\n')
+        f.write('};\n')
+
+
+def main():
+    if len(sys.argv) != 3:
+        print(__doc__, file=sys.stderr)
+        sys.exit(1)
+
+    dbc_file, out_dir = sys.argv[1], sys.argv[2]
+    messages = parse(dbc_file) if dbc_file else []
+    os.makedirs(out_dir, exist_ok=True)
+    generate(messages, out_dir)
+    print(f'dbc2c: {len(messages)} messages, {sum(len(m["signals"]) for m in messages)} signals', file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()
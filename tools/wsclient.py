@@ -0,0 +1,180 @@
+#!/usr/bin/env python3
+"""
+Live streaming client (WebSocket endpoint /ws, see main/stream.h), standard library only
+
+Usage: wsclient.py <ws://host[:port]/ws> [--rate <ms>] [--id <hex> ...] [--sig <message.signal> ...]
+                   [--seconds <n>] [--stats]
+
+Examples:
+  wsclient.py ws://192.168.4.1/ws --rate 50 --id 7E8 18DAF110
+  wsclient.py ws://localhost:8080/ws --sig Engine.Rpm Engine.Coolant --seconds 10 --stats
+
+Prints one line per received record. Commands are text frames ("rate", "id", "sig", "clear", "stats"),
+answered with "ok ..." or "error ..."; values arrive in binary batches (little endian):
+  header  type:8 (1), reserved:8, records:16, time ms:32
+  frame   kind:8 (1), flags:8 (bit 0 extended, bit 1 RTR), dlc:8, reserved:8, id:32, time us:32, data:64
+  signal  kind:8 (2), reserved:8, signal:16, time us:32, value:float32
+"""
+
+import argparse
+import base64
+import os
+import socket
+import struct
+import sys
+import time
+from urllib.parse import urlparse
+
+MSG_BATCH = 0x01
+RECORD_FRAME = 0x01
+RECORD_SIGNAL = 0x02
+FRAME_RECORD_LEN = 20
+SIGNAL_RECORD_LEN = 12
+
+
+class WebSocket:
+    def __init__(self, url):
+        u = urlparse(url)
+        if u.scheme != 'ws':
+            raise ValueError('only ws:// URLs are supported')
+        self.sock = socket.create_connection((u.hostname, u.port or 80))
+        key = base64.b64encode(os.urandom(16)).decode()
+        self.sock.sendall((f'GET {u.path or "/"} HTTP/1.1\r\nHost: {u.netloc}\r\nUpgrade: websocket\r\n'
+                           f'Connection: Upgrade\r\nSec-WebSocket-Key: {key}\r\n'
+                           'Sec-WebSocket-Version: 13\r\n\r\n').encode())
+        self.buf = b''
+        while b'\r\n\r\n' not in self.buf:
+            data = self.sock.recv(1024)
+            if not data:
+                raise ConnectionError('connection closed during handshake')
+            self.buf += data
+        head, self.buf = self.buf.split(b'\r\n\r\n', 1)
+        if not head.startswith(b'HTTP/1.1 101'):
+            raise ConnectionError(head.split(b'\r\n')[0].decode())
+
+    def send_text(self, text):
+        payload = text.encode()
+        mask = os.urandom(4)
+        header = bytes([0x81])
+        if len(payload) < 126:
+            header += bytes([0x80 | len(payload)])
+        else:
+            header += bytes([0x80 | 126]) + struct.pack('>H', len(payload))
+        self.sock.sendall(header + mask + bytes(b ^ mask[i % 4] for i, b in enumerate(payload)))
+
+    def _fill(self, n):
+        while len(self.buf) < n:
+            data = self.sock.recv(4096)
+            if not data:
+                raise ConnectionError('connection closed')
+            self.buf += data
+
+    def recv(self):
+        """Return (opcode, payload) of the next data frame, answering pings"""
+        while True:
+            # Frames are only consumed once complete, a timeout leaves the buffer intact
+            self._fill(2)
+            length = self.buf[1] & 0x7F
+            offset = 2
+            if length == 126:
+                self._fill(4)
+                length, = struct.unpack_from('>H', self.buf, 2)
+                offset = 4
+            elif length == 127:
+                self._fill(10)
+                length, = struct.unpack_from('>Q', self.buf, 2)
+                offset = 10
+            self._fill(offset + length)
+            opcode = self.buf[0] & 0x0F
+            payload, self.buf = self.buf[offset:offset + length], self.buf[offset + length:]
+            if opcode == 0x9:
+                self.sock.sendall(bytes([0x8A, 0x80 | len(payload)]) + bytes(4) + payload)
+            elif opcode == 0x8:
+                raise ConnectionError('closed by server')
+            elif opcode in (0x1, 0x2):
+                return opcode, payload
+
+
+def decode_batch(payload):
+    """Yield the records of a batch as tuples: ('frame', id, extd, rtr, data, us) or ('signal', index, value, us)"""
+    kind, _, count, _ = struct.unpack_from('<BBHI', payload)
+    if kind != MSG_BATCH:
+        return
+    offset = 8
+    for _ in range(count):
+        if payload[offset] == RECORD_FRAME:
+            _, flags, dlc, _, ident, us = struct.unpack_from('<BBBBII', payload, offset)
+            data = payload[offset + 12:offset + 12 + dlc]
+            yield ('frame', ident, bool(flags & 1), bool(flags & 2), data, us)
+            offset += FRAME_RECORD_LEN
+        elif payload[offset] == RECORD_SIGNAL:
+            _, _, index, us, value = struct.unpack_from('<BBHIf', payload, offset)
+            yield ('signal', index, value, us)
+            offset += SIGNAL_RECORD_LEN
+        else:
+            raise ValueError(f'unknown record kind {payload[offset]}')
+
+
+def command(ws, text):
+    ws.send_text(text)
+    while True:
+        opcode, payload = ws.recv()
+        if opcode == 0x1:
+            reply = payload.decode()
+            if reply.startswith('error'):
+                sys.exit(f'{text}: {reply}')
+            return reply
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Live streaming client')
+    parser.add_argument('url')
+    parser.add_argument('--rate', type=int, help='minimum time between batches in ms')
+    parser.add_argument('--id', nargs='+', default=[], help='identifiers (hex, more than 3 digits is extended)')
+    parser.add_argument('--sig', nargs='+', default=[], help='signals as message.signal')
+    parser.add_argument('--seconds', type=float, help='stop after this time')
+    parser.add_argument('--stats', action='store_true', help='print client statistics on exit')
+    args = parser.parse_args()
+
+    ws = WebSocket(args.url)
+    if args.rate:
+        command(ws, f'rate {args.rate}')
+    signals = {}
+    if args.id:
+        command(ws, 'id ' + ' '.join(args.id))
+    if args.sig:
+        # Answered with the signal index of every name, carried by signal records
+        indexes = command(ws, 'sig ' + ' '.join(args.sig)).split()[2:]
+        signals = {int(index): name for index, name in zip(indexes, args.sig)}
+    batches = records = 0
+    start = time.monotonic()
+    try:
+        while args.seconds is None or time.monotonic() - start < args.seconds:
+            if args.seconds is not None:
+                ws.sock.settimeout(max(0.01, args.seconds - (time.monotonic() - start)))
+            try:
+                opcode, payload = ws.recv()
+            except socket.timeout:
+                break
+            if opcode != 0x2:
+                continue
+            batches += 1
+            for record in decode_batch(payload):
+                records += 1
+                if record[0] == 'frame':
+                    _, ident, extd, rtr, data, us = record
+                    text = 'R' if rtr else data.hex().upper()
+                    print(f'{us / 1e6:12.6f} {ident:0{8 if extd else 3}X}#{text}')
+                else:
+                    _, index, value, us = record
+                    print(f'{us / 1e6:12.6f} {signals.get(index, index)} = {value:g}')
+    except KeyboardInterrupt:
+        pass
+    if args.stats:
+        ws.sock.settimeout(2)
+        print(f'received batches:{batches} records:{records}', file=sys.stderr)
+        print(command(ws, 'stats'), '(batches coalesced busy subscriptions)', file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()